@@ -0,0 +1,1037 @@
+#include "cmaf_demuxer.h"
+
+#include "hls_common.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mathematics.h"
+#include "libavutil/mem.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#define CMAF_MAX_TRACKS          8
+#define CMAF_MAX_BOX_SIZE        (16 * 1024 * 1024) /* moov/moof larger than this is rejected */
+#define CMAF_SKIP_SIZE           4096
+
+#define BOX_FTYP                 MKBETAG('f','t','y','p')
+#define BOX_STYP                 MKBETAG('s','t','y','p')
+#define BOX_MOOV                 MKBETAG('m','o','o','v')
+#define BOX_MOOF                 MKBETAG('m','o','o','f')
+#define BOX_MDAT                 MKBETAG('m','d','a','t')
+
+/* tfhd flags */
+#define TFHD_BASE_DATA_OFFSET    0x000001
+#define TFHD_SAMPLE_DESC_INDEX   0x000002
+#define TFHD_DEFAULT_DURATION    0x000008
+#define TFHD_DEFAULT_SIZE        0x000010
+#define TFHD_DEFAULT_FLAGS       0x000020
+#define TFHD_DEFAULT_BASE_IS_MOOF 0x020000
+
+/* trun flags */
+#define TRUN_DATA_OFFSET         0x000001
+#define TRUN_FIRST_SAMPLE_FLAGS  0x000004
+#define TRUN_SAMPLE_DURATION     0x000100
+#define TRUN_SAMPLE_SIZE         0x000200
+#define TRUN_SAMPLE_FLAGS        0x000400
+#define TRUN_SAMPLE_CTS          0x000800
+
+/* sample flags */
+#define SAMPLE_IS_NON_SYNC       0x00010000
+#define SAMPLE_DEPENDS_YES       0x01000000
+
+typedef struct Box_s {
+    uint32_t        mType;
+    const uint8_t*  mData;   /* payload */
+    int             mSize;
+} Box_t;
+
+typedef struct Track_s {
+    CMAFTrackInfo_t mInfo;
+    int             mMediaTimeScale;   /* timescale of current init section */
+
+    /* trex */
+    uint32_t        mDefaultDuration;
+    uint32_t        mDefaultSize;
+    uint32_t        mDefaultFlags;
+
+    int64_t         mNextDts;
+    bool            mExtraDataChanged;
+} Track_t;
+
+typedef struct Sample_s {
+    int             mTrack;
+    int64_t         mPos;
+    int             mSize;
+    int64_t         mDts;
+    int64_t         mPts;
+    int             mFlags;
+} Sample_t;
+
+typedef struct CMAFDemuxer_s {
+    CMAFDemuxerRead_fn mRead;
+    void*           mOpaque;
+
+    int64_t         mPos;          /* consumed bytes of stream */
+    uint8_t*        mBoxBuf;
+    int             mBoxBufSize;
+
+    /* last parsed moov, re-sent moov is skipped when unchanged */
+    uint8_t*        mInitData;
+    int             mInitSize;
+
+    Track_t         mTracks[CMAF_MAX_TRACKS];
+    int             mTrackCnt;
+    bool            mInitDone;
+
+    /* samples of the last moof, ordered by position */
+    Sample_t*       mSamples;
+    int             mSampleCnt;
+    int             mSampleCapacity;
+    int             mSampleIndex;
+
+    bool            mInMdat;
+    int64_t         mMdatEnd;
+
+    PacketPool      mPool;
+} CMAFDemuxer_t;
+
+static bool next_box(const uint8_t** p, const uint8_t* end, Box_t* box)
+{
+    uint64_t size;
+    int headerSize = 8;
+
+    if (end - *p < 8)
+        return false;
+
+    size = AV_RB32(*p);
+    box->mType = AV_RB32(*p + 4);
+
+    if (size == 1)
+    {
+        if (end - *p < 16)
+            return false;
+        size = AV_RB64(*p + 8);
+        headerSize = 16;
+    }
+    else if (size == 0)
+        size = end - *p;
+
+    if (size < headerSize || size > end - *p)
+        return false;
+
+    box->mData = *p + headerSize;
+    box->mSize = (int)size - headerSize;
+    *p += size;
+    return true;
+}
+
+static bool find_child(const Box_t* parent, int offset, uint32_t type, Box_t* child)
+{
+    const uint8_t* p = parent->mData + offset;
+    const uint8_t* end = parent->mData + parent->mSize;
+
+    if (offset > parent->mSize)
+        return false;
+
+    while (next_box(&p, end, child))
+    {
+        if (child->mType == type)
+            return true;
+    }
+
+    return false;
+}
+
+static bool find_path(const Box_t* parent, const char* path, Box_t* child)
+{
+    Box_t box = *parent;
+
+    for (; *path; path += 4)
+    {
+        if (!find_child(&box, 0, MKBETAG(path[0], path[1], path[2], path[3]), child))
+            return false;
+        box = *child;
+    }
+
+    return true;
+}
+
+static int set_extradata(Track_t* track, const uint8_t* data, int size)
+{
+    av_freep(&track->mInfo.mExtraData);
+    track->mInfo.mExtraDataSize = 0;
+
+    if (!(track->mInfo.mExtraData = (uint8_t*)av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE)))
+        return AVERROR(ENOMEM);
+
+    memcpy(track->mInfo.mExtraData, data, size);
+    track->mInfo.mExtraDataSize = size;
+    return 0;
+}
+
+static int read_descr_len(const uint8_t** p, const uint8_t* end)
+{
+    int len = 0;
+    int ii;
+
+    for (ii = 0; ii < 4 && *p < end; ii++)
+    {
+        int c = *(*p)++;
+        len = (len << 7) | (c & 0x7f);
+        if (!(c & 0x80))
+            break;
+    }
+
+    return len;
+}
+
+static void parse_esds(const Box_t* esds, Track_t* track)
+{
+    const uint8_t* p = esds->mData + 4;
+    const uint8_t* end = esds->mData + esds->mSize;
+
+    while (p + 2 <= end)
+    {
+        int tag = *p++;
+        int len = read_descr_len(&p, end);
+
+        if (tag == 0x03) /* ES_Descriptor, children follow */
+        {
+            int flags;
+
+            if (p + 3 > end)
+                return;
+            flags = p[2];
+            p += 3;
+            if (flags & 0x80)
+                p += 2;
+            if ((flags & 0x40) && p < end)
+                p += 1 + *p;
+            if (flags & 0x20)
+                p += 2;
+        }
+        else if (tag == 0x04) /* DecoderConfigDescriptor, children follow */
+        {
+            if (p + 13 > end)
+                return;
+            if (p[0] == 0x69 || p[0] == 0x6b)
+                track->mInfo.mCodecId = AV_CODEC_ID_MP3;
+            p += 13;
+        }
+        else if (tag == 0x05) /* DecoderSpecificInfo */
+        {
+            if (len <= end - p)
+                set_extradata(track, p, len);
+            return;
+        }
+        else
+            p += len;
+    }
+}
+
+static int parse_sample_entry(const Box_t* entry, Track_t* track)
+{
+    const uint8_t* d = entry->mData;
+    Box_t config;
+
+    switch (entry->mType)
+    {
+    case MKBETAG('a','v','c','1'):
+    case MKBETAG('a','v','c','3'):
+    case MKBETAG('h','v','c','1'):
+    case MKBETAG('h','e','v','1'):
+        if (track->mInfo.mCodecType != AVMEDIA_TYPE_VIDEO || entry->mSize < 78)
+            return -1;
+
+        track->mInfo.mWidth  = AV_RB16(d + 24);
+        track->mInfo.mHeight = AV_RB16(d + 26);
+
+        if (entry->mType == MKBETAG('a','v','c','1') || entry->mType == MKBETAG('a','v','c','3'))
+        {
+            track->mInfo.mCodecId = AV_CODEC_ID_H264;
+            if (find_child(entry, 78, MKBETAG('a','v','c','C'), &config))
+                set_extradata(track, config.mData, config.mSize);
+        }
+        else
+        {
+            track->mInfo.mCodecId = AV_CODEC_ID_HEVC;
+            if (find_child(entry, 78, MKBETAG('h','v','c','C'), &config))
+                set_extradata(track, config.mData, config.mSize);
+        }
+        return 0;
+
+    case MKBETAG('m','p','4','a'):
+    case MKBETAG('a','c','-','3'):
+    case MKBETAG('e','c','-','3'):
+    {
+        int version;
+        int offset = 28;
+
+        if (track->mInfo.mCodecType != AVMEDIA_TYPE_AUDIO || entry->mSize < 28)
+            return -1;
+
+        version = AV_RB16(d + 8);
+        offset += version == 1 ? 16 : version == 2 ? 36 : 0;
+
+        track->mInfo.mChannels   = AV_RB16(d + 16);
+        track->mInfo.mSampleRate = AV_RB32(d + 24) >> 16;
+
+        if (entry->mType == MKBETAG('a','c','-','3'))
+            track->mInfo.mCodecId = AV_CODEC_ID_AC3;
+        else if (entry->mType == MKBETAG('e','c','-','3'))
+            track->mInfo.mCodecId = AV_CODEC_ID_EAC3;
+        else
+        {
+            track->mInfo.mCodecId = AV_CODEC_ID_AAC;
+            if (find_child(entry, offset, MKBETAG('e','s','d','s'), &config))
+                parse_esds(&config, track);
+        }
+        return 0;
+    }
+
+    default:
+        /* encrypted or unsupported sample entry, generic demuxer handles it */
+        return -1;
+    }
+}
+
+static int parse_trak(const Box_t* trak, Track_t* track)
+{
+    Box_t box, entry;
+    const uint8_t* p;
+    int version;
+
+    if (!find_path(trak, "tkhd", &box) || box.mSize < 24)
+        return -1;
+    version = box.mData[0];
+    track->mInfo.mTrackId = AV_RB32(box.mData + (version == 1 ? 20 : 12));
+
+    if (!find_path(trak, "mdiamdhd", &box) || box.mSize < 24)
+        return -1;
+    version = box.mData[0];
+    track->mMediaTimeScale = AV_RB32(box.mData + (version == 1 ? 20 : 12));
+    if (track->mMediaTimeScale <= 0)
+        return -1;
+    track->mInfo.mTimeScale = track->mMediaTimeScale;
+
+    if (!find_path(trak, "mdiahdlr", &box) || box.mSize < 12)
+        return -1;
+    switch (AV_RB32(box.mData + 8))
+    {
+    case MKBETAG('v','i','d','e'):
+        track->mInfo.mCodecType = AVMEDIA_TYPE_VIDEO;
+        break;
+    case MKBETAG('s','o','u','n'):
+        track->mInfo.mCodecType = AVMEDIA_TYPE_AUDIO;
+        break;
+    default:
+        return -1;
+    }
+
+    if (!find_path(trak, "mdiaminfstblstsd", &box) || box.mSize < 8)
+        return -1;
+
+    /* first sample entry only */
+    p = box.mData + 8;
+    if (!next_box(&p, box.mData + box.mSize, &entry))
+        return -1;
+
+    return parse_sample_entry(&entry, track);
+}
+
+static Track_t* find_track(CMAFDemuxer_t* d, int trackId)
+{
+    int ii;
+
+    for (ii = 0; ii < d->mTrackCnt; ii++)
+    {
+        if (d->mTracks[ii].mInfo.mTrackId == trackId)
+            return &d->mTracks[ii];
+    }
+
+    return NULL;
+}
+
+static void release_track(Track_t* track)
+{
+    av_freep(&track->mInfo.mExtraData);
+    track->mInfo.mExtraDataSize = 0;
+}
+
+/* Tracks are fixed once init is parsed, later init sections only update them */
+static void apply_init_tracks(CMAFDemuxer_t* d, Track_t* tracks, int cnt)
+{
+    bool used[CMAF_MAX_TRACKS] = { false, };
+    int ii, jj;
+
+    if (!d->mInitDone)
+    {
+        for (ii = 0; ii < d->mTrackCnt; ii++)
+            release_track(&d->mTracks[ii]);
+
+        memcpy(d->mTracks, tracks, sizeof(Track_t) * cnt);
+        d->mTrackCnt = cnt;
+        return;
+    }
+
+    for (ii = 0; ii < cnt; ii++)
+    {
+        Track_t* track = NULL;
+        Track_t* newTrack = &tracks[ii];
+
+        for (jj = 0; jj < d->mTrackCnt && !track; jj++)
+            if (!used[jj] && d->mTracks[jj].mInfo.mCodecType == newTrack->mInfo.mCodecType)
+                track = &d->mTracks[jj];
+
+        if (!track)
+        {
+            LOG_WARN("new track in init section is ignored, track id : %d\n", newTrack->mInfo.mTrackId);
+            release_track(newTrack);
+            continue;
+        }
+        used[track - d->mTracks] = true;
+
+        if (track->mInfo.mCodecId != newTrack->mInfo.mCodecId)
+            LOG_WARN("codec of track %d is changed !\n", track->mInfo.mTrackId);
+
+        track->mInfo.mTrackId    = newTrack->mInfo.mTrackId;
+        track->mInfo.mCodecId    = newTrack->mInfo.mCodecId;
+        track->mInfo.mWidth      = newTrack->mInfo.mWidth;
+        track->mInfo.mHeight     = newTrack->mInfo.mHeight;
+        track->mInfo.mChannels   = newTrack->mInfo.mChannels;
+        track->mInfo.mSampleRate = newTrack->mInfo.mSampleRate;
+        track->mMediaTimeScale   = newTrack->mMediaTimeScale;
+        track->mDefaultDuration  = newTrack->mDefaultDuration;
+        track->mDefaultSize      = newTrack->mDefaultSize;
+        track->mDefaultFlags     = newTrack->mDefaultFlags;
+
+        if (newTrack->mInfo.mExtraDataSize != track->mInfo.mExtraDataSize ||
+            (track->mInfo.mExtraDataSize > 0 &&
+             memcmp(newTrack->mInfo.mExtraData, track->mInfo.mExtraData, track->mInfo.mExtraDataSize)))
+        {
+            release_track(track);
+            track->mInfo.mExtraData     = newTrack->mInfo.mExtraData;
+            track->mInfo.mExtraDataSize = newTrack->mInfo.mExtraDataSize;
+            track->mExtraDataChanged    = true;
+        }
+        else
+            release_track(newTrack);
+    }
+}
+
+static int parse_moov(CMAFDemuxer_t* d, const uint8_t* data, int size)
+{
+    Track_t tracks[CMAF_MAX_TRACKS];
+    const uint8_t* p = data;
+    Box_t box, trex;
+    Box_t mvex = { 0, NULL, 0 };
+    int cnt = 0;
+    int ii;
+
+    if (d->mInitData && d->mInitSize == size && !memcmp(d->mInitData, data, size))
+        return 0;
+
+    memset(tracks, 0, sizeof(tracks));
+    while (next_box(&p, data + size, &box))
+    {
+        if (box.mType == MKBETAG('t','r','a','k') && cnt < CMAF_MAX_TRACKS)
+        {
+            if (parse_trak(&box, &tracks[cnt]) == 0)
+                cnt++;
+            else
+                release_track(&tracks[cnt]);
+        }
+        else if (box.mType == MKBETAG('m','v','e','x'))
+            mvex = box;
+    }
+
+    if (cnt == 0)
+    {
+        LOG_ERROR("no supported track in init section !\n");
+        return AVERROR_INVALIDDATA;
+    }
+
+    p = mvex.mData;
+    while (mvex.mData && next_box(&p, mvex.mData + mvex.mSize, &trex))
+    {
+        if (trex.mType != MKBETAG('t','r','e','x') || trex.mSize < 24)
+            continue;
+
+        for (ii = 0; ii < cnt; ii++)
+        {
+            if (tracks[ii].mInfo.mTrackId == AV_RB32(trex.mData + 4))
+            {
+                tracks[ii].mDefaultDuration = AV_RB32(trex.mData + 12);
+                tracks[ii].mDefaultSize     = AV_RB32(trex.mData + 16);
+                tracks[ii].mDefaultFlags    = AV_RB32(trex.mData + 20);
+            }
+        }
+    }
+
+    apply_init_tracks(d, tracks, cnt);
+
+    av_freep(&d->mInitData);
+    d->mInitSize = 0;
+    if ((d->mInitData = (uint8_t*)av_malloc(size)))
+    {
+        memcpy(d->mInitData, data, size);
+        d->mInitSize = size;
+    }
+
+    return 0;
+}
+
+static int add_sample(CMAFDemuxer_t* d, const Sample_t* sample)
+{
+    if (d->mSampleCnt == d->mSampleCapacity)
+    {
+        int capacity = _MAX(d->mSampleCapacity * 2, 64);
+        Sample_t* samples = (Sample_t*)av_realloc(d->mSamples, capacity * sizeof(Sample_t));
+        if (!samples)
+            return AVERROR(ENOMEM);
+
+        d->mSamples = samples;
+        d->mSampleCapacity = capacity;
+    }
+
+    d->mSamples[d->mSampleCnt++] = *sample;
+    return 0;
+}
+
+static int parse_trun(CMAFDemuxer_t* d, Track_t* track, const Box_t* trun, int64_t base, int64_t* dataPos,
+                      uint32_t defDuration, uint32_t defSize, uint32_t defFlags)
+{
+    const uint8_t* p = trun->mData + 8;
+    const uint8_t* end = trun->mData + trun->mSize;
+    uint32_t flags, count, firstFlags = defFlags;
+    int entrySize, ii;
+
+    if (trun->mSize < 8)
+        return AVERROR_INVALIDDATA;
+
+    flags = AV_RB24(trun->mData + 1);
+    count = AV_RB32(trun->mData + 4);
+
+    if (flags & TRUN_DATA_OFFSET)
+    {
+        if (p + 4 > end)
+            return AVERROR_INVALIDDATA;
+        *dataPos = base + (int32_t)AV_RB32(p);
+        p += 4;
+    }
+
+    if (flags & TRUN_FIRST_SAMPLE_FLAGS)
+    {
+        if (p + 4 > end)
+            return AVERROR_INVALIDDATA;
+        firstFlags = AV_RB32(p);
+        p += 4;
+    }
+
+    entrySize = 4 * (!!(flags & TRUN_SAMPLE_DURATION) + !!(flags & TRUN_SAMPLE_SIZE) +
+                     !!(flags & TRUN_SAMPLE_FLAGS) + !!(flags & TRUN_SAMPLE_CTS));
+    if ((int64_t)count * entrySize > end - p)
+        return AVERROR_INVALIDDATA;
+
+    for (ii = 0; ii < count; ii++)
+    {
+        Sample_t sample;
+        uint32_t duration    = defDuration;
+        uint32_t sampleFlags = ii == 0 ? firstFlags : defFlags;
+        int32_t  cts         = 0;
+        int      ret;
+
+        sample.mSize = defSize;
+
+        if (flags & TRUN_SAMPLE_DURATION)
+        {
+            duration = AV_RB32(p);
+            p += 4;
+        }
+        if (flags & TRUN_SAMPLE_SIZE)
+        {
+            sample.mSize = AV_RB32(p);
+            p += 4;
+        }
+        if (flags & TRUN_SAMPLE_FLAGS)
+        {
+            sampleFlags = AV_RB32(p);
+            p += 4;
+        }
+        if (flags & TRUN_SAMPLE_CTS)
+        {
+            cts = (int32_t)AV_RB32(p);
+            p += 4;
+        }
+
+        sample.mTrack = track - d->mTracks;
+        sample.mPos   = *dataPos;
+        sample.mDts   = track->mNextDts;
+        sample.mPts   = track->mNextDts + cts;
+        sample.mFlags = (sampleFlags & (SAMPLE_IS_NON_SYNC | SAMPLE_DEPENDS_YES)) ? 0 : AV_PKT_FLAG_KEY;
+
+        if ((ret = add_sample(d, &sample)) < 0)
+            return ret;
+
+        *dataPos += sample.mSize;
+        track->mNextDts += duration;
+    }
+
+    return 0;
+}
+
+static int parse_traf(CMAFDemuxer_t* d, const Box_t* traf, int64_t moofStart, int64_t* prevDataEnd, bool isFirst)
+{
+    Box_t tfhd, box;
+    Track_t* track;
+    const uint8_t* p;
+    const uint8_t* end;
+    uint32_t flags;
+    uint32_t defDuration, defSize, defFlags;
+    int64_t base, dataPos;
+    int ret;
+
+    if (!find_path(traf, "tfhd", &tfhd) || tfhd.mSize < 8)
+        return AVERROR_INVALIDDATA;
+
+    flags = AV_RB24(tfhd.mData + 1);
+    if (!(track = find_track(d, AV_RB32(tfhd.mData + 4))))
+        return 0;
+
+    p   = tfhd.mData + 8;
+    end = tfhd.mData + tfhd.mSize;
+    if (p + 4 * (2 * !!(flags & TFHD_BASE_DATA_OFFSET) + !!(flags & TFHD_SAMPLE_DESC_INDEX) +
+                 !!(flags & TFHD_DEFAULT_DURATION) + !!(flags & TFHD_DEFAULT_SIZE) + !!(flags & TFHD_DEFAULT_FLAGS)) > end)
+        return AVERROR_INVALIDDATA;
+
+    /* absolute offsets do not survive segment concatenation, moof relative offset is assumed (CMAF) */
+    base = (flags & (TFHD_BASE_DATA_OFFSET | TFHD_DEFAULT_BASE_IS_MOOF)) || isFirst ? moofStart : *prevDataEnd;
+    if (flags & TFHD_BASE_DATA_OFFSET)
+        p += 8;
+    if (flags & TFHD_SAMPLE_DESC_INDEX)
+        p += 4;
+
+    defDuration = track->mDefaultDuration;
+    defSize     = track->mDefaultSize;
+    defFlags    = track->mDefaultFlags;
+    if (flags & TFHD_DEFAULT_DURATION)
+    {
+        defDuration = AV_RB32(p);
+        p += 4;
+    }
+    if (flags & TFHD_DEFAULT_SIZE)
+    {
+        defSize = AV_RB32(p);
+        p += 4;
+    }
+    if (flags & TFHD_DEFAULT_FLAGS)
+        defFlags = AV_RB32(p);
+
+    if (find_path(traf, "tfdt", &box) && box.mSize >= 8)
+        track->mNextDts = box.mData[0] == 1 && box.mSize >= 12 ? (int64_t)AV_RB64(box.mData + 4) : AV_RB32(box.mData + 4);
+
+    dataPos = base;
+    p   = traf->mData;
+    end = traf->mData + traf->mSize;
+    while (next_box(&p, end, &box))
+    {
+        if (box.mType != MKBETAG('t','r','u','n'))
+            continue;
+
+        if ((ret = parse_trun(d, track, &box, base, &dataPos, defDuration, defSize, defFlags)) < 0)
+            return ret;
+    }
+
+    *prevDataEnd = dataPos;
+    return 0;
+}
+
+static int compare_sample_pos(const void* a, const void* b)
+{
+    const Sample_t* sa = (const Sample_t*)a;
+    const Sample_t* sb = (const Sample_t*)b;
+
+    return sa->mPos < sb->mPos ? -1 : sa->mPos > sb->mPos;
+}
+
+static int parse_moof(CMAFDemuxer_t* d, const uint8_t* data, int size, int64_t moofStart)
+{
+    const uint8_t* p = data;
+    Box_t traf;
+    int64_t prevDataEnd = moofStart;
+    bool isFirst = true;
+    bool sorted = true;
+    int ii, ret;
+
+    d->mSampleCnt = 0;
+    d->mSampleIndex = 0;
+
+    while (next_box(&p, data + size, &traf))
+    {
+        if (traf.mType != MKBETAG('t','r','a','f'))
+            continue;
+
+        if ((ret = parse_traf(d, &traf, moofStart, &prevDataEnd, isFirst)) < 0)
+        {
+            d->mSampleCnt = 0;
+            return ret;
+        }
+        isFirst = false;
+    }
+
+    for (ii = 1; ii < d->mSampleCnt && sorted; ii++)
+        sorted = d->mSamples[ii - 1].mPos <= d->mSamples[ii].mPos;
+
+    if (!sorted)
+        qsort(d->mSamples, d->mSampleCnt, sizeof(Sample_t), compare_sample_pos);
+
+    return 0;
+}
+
+static int read_bytes(CMAFDemuxer_t* d, uint8_t* buf, int size)
+{
+    int done = 0;
+
+    while (done < size)
+    {
+        int ret = d->mRead(d->mOpaque, buf + done, size - done);
+        if (ret <= 0)
+            return ret < 0 ? ret : AVERROR_EOF;
+
+        done += ret;
+        d->mPos += ret;
+    }
+
+    return 0;
+}
+
+static int skip_bytes(CMAFDemuxer_t* d, int64_t size)
+{
+    uint8_t buf[CMAF_SKIP_SIZE];
+    int ret;
+
+    while (size > 0)
+    {
+        int n = _MIN(size, CMAF_SKIP_SIZE);
+
+        if ((ret = read_bytes(d, buf, n)) < 0)
+            return ret;
+        size -= n;
+    }
+
+    return 0;
+}
+
+/* Returns payload size, or -1 if the box is extended to the end of data */
+static int read_box_header(CMAFDemuxer_t* d, uint32_t* type, int64_t* size)
+{
+    uint8_t header[16];
+    uint64_t boxSize;
+    int ret;
+
+    if ((ret = read_bytes(d, header, 8)) < 0)
+        return ret;
+
+    boxSize = AV_RB32(header);
+    *type   = AV_RB32(header + 4);
+
+    if (boxSize == 1)
+    {
+        if ((ret = read_bytes(d, header + 8, 8)) < 0)
+            return ret;
+        boxSize = AV_RB64(header + 8);
+        if (boxSize < 16)
+            return AVERROR_INVALIDDATA;
+        *size = boxSize - 16;
+    }
+    else if (boxSize == 0)
+        *size = -1;
+    else if (boxSize < 8)
+        return AVERROR_INVALIDDATA;
+    else
+        *size = boxSize - 8;
+
+    return 0;
+}
+
+static int read_box_payload(CMAFDemuxer_t* d, int size)
+{
+    if (size > d->mBoxBufSize)
+    {
+        uint8_t* buf = (uint8_t*)av_realloc(d->mBoxBuf, size);
+        if (!buf)
+            return AVERROR(ENOMEM);
+
+        d->mBoxBuf = buf;
+        d->mBoxBufSize = size;
+    }
+
+    return read_bytes(d, d->mBoxBuf, size);
+}
+
+/* Returns 1 if pkt is filled, 0 at the end of mdat */
+static int read_sample(CMAFDemuxer_t* d, AVPacket* pkt)
+{
+    int ret;
+
+    while (d->mSampleIndex < d->mSampleCnt)
+    {
+        Sample_t* sample = &d->mSamples[d->mSampleIndex++];
+        Track_t*  track  = &d->mTracks[sample->mTrack];
+
+        if (sample->mPos < d->mPos || sample->mPos + sample->mSize > d->mMdatEnd)
+        {
+            LOG_WARN("sample is out of mdat, track : %d\n", track->mInfo.mTrackId);
+            continue;
+        }
+
+        if ((ret = skip_bytes(d, sample->mPos - d->mPos)) < 0)
+            return ret;
+
+        if ((ret = PacketPool_NewPacket(d->mPool, pkt, sample->mSize)) < 0)
+            return ret;
+
+        if ((ret = read_bytes(d, pkt->data, sample->mSize)) < 0)
+        {
+            av_packet_unref(pkt);
+            return ret;
+        }
+
+        pkt->stream_index = sample->mTrack;
+        pkt->dts          = sample->mDts;
+        pkt->pts          = sample->mPts;
+        pkt->flags        = sample->mFlags;
+        pkt->pos          = sample->mPos;
+
+        if (track->mMediaTimeScale != track->mInfo.mTimeScale)
+        {
+            pkt->dts = av_rescale(pkt->dts, track->mInfo.mTimeScale, track->mMediaTimeScale);
+            pkt->pts = av_rescale(pkt->pts, track->mInfo.mTimeScale, track->mMediaTimeScale);
+        }
+
+        if (track->mExtraDataChanged)
+        {
+            uint8_t* side = av_packet_new_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA, track->mInfo.mExtraDataSize);
+            if (side)
+            {
+                memcpy(side, track->mInfo.mExtraData, track->mInfo.mExtraDataSize);
+                track->mExtraDataChanged = false;
+            }
+        }
+
+        return 1;
+    }
+
+    d->mInMdat = false;
+    d->mSampleCnt = 0;
+
+    if (d->mMdatEnd != INT64_MAX && (ret = skip_bytes(d, d->mMdatEnd - d->mPos)) < 0)
+        return ret;
+
+    return 0;
+}
+
+CMAFDemuxer CMAFDemuxer_Create(CMAFDemuxerRead_fn read, void* opaque)
+{
+    CMAFDemuxer_t* d = (CMAFDemuxer_t*)av_mallocz(sizeof(CMAFDemuxer_t));
+    if (!d)
+    {
+        LOG_ERROR("failed to alloc cmaf demuxer !\n");
+        return NULL;
+    }
+
+    d->mRead   = read;
+    d->mOpaque = opaque;
+
+    return d;
+}
+
+void CMAFDemuxer_Delete(CMAFDemuxer demuxer)
+{
+    int ii;
+
+    if (!demuxer)
+        return;
+
+    for (ii = 0; ii < demuxer->mTrackCnt; ii++)
+        release_track(&demuxer->mTracks[ii]);
+
+    av_free(demuxer->mBoxBuf);
+    av_free(demuxer->mInitData);
+    av_free(demuxer->mSamples);
+    av_free(demuxer);
+}
+
+int CMAFDemuxer_FindInitEnd(const uint8_t* buf, int size)
+{
+    const uint8_t* p = buf;
+    const uint8_t* end = buf + size;
+
+    while (end - p >= 8)
+    {
+        uint64_t boxSize = AV_RB32(p);
+        uint32_t type = AV_RB32(p + 4);
+
+        switch (type)
+        {
+        case BOX_FTYP:
+        case BOX_STYP:
+        case BOX_MOOV:
+        case MKBETAG('s','i','d','x'):
+        case MKBETAG('f','r','e','e'):
+        case MKBETAG('s','k','i','p'):
+            break;
+        default:
+            return -1;
+        }
+
+        if (boxSize == 1)
+        {
+            if (end - p < 16)
+                return 0;
+            boxSize = AV_RB64(p + 8);
+        }
+
+        if (boxSize < 8 || boxSize > CMAF_MAX_BOX_SIZE)
+            return -1;
+
+        if (boxSize > end - p)
+            return 0;
+
+        p += boxSize;
+        if (type == BOX_MOOV)
+            return p - buf;
+    }
+
+    return 0;
+}
+
+int CMAFDemuxer_ParseInit(CMAFDemuxer demuxer, const uint8_t* buf, int size)
+{
+    const uint8_t* p = buf;
+    Box_t box;
+    int ret;
+
+    if (!demuxer)
+        return AVERROR(EINVAL);
+
+    while (next_box(&p, buf + size, &box))
+    {
+        if (box.mType != BOX_MOOV)
+            continue;
+
+        if ((ret = parse_moov(demuxer, box.mData, box.mSize)) < 0)
+            return ret;
+
+        demuxer->mInitDone = true;
+        demuxer->mPos = size;
+        return 0;
+    }
+
+    return AVERROR_INVALIDDATA;
+}
+
+int CMAFDemuxer_ReadPacket(CMAFDemuxer demuxer, AVPacket* pkt)
+{
+    CMAFDemuxer_t* d = demuxer;
+    int ret;
+
+    if (!d)
+        return AVERROR(EINVAL);
+
+    while (1)
+    {
+        uint32_t type;
+        int64_t  size;
+        int64_t  start;
+
+        if (d->mInMdat)
+        {
+            if ((ret = read_sample(d, pkt)) != 0)
+                return ret < 0 ? ret : 0;
+            continue;
+        }
+
+        start = d->mPos;
+        if ((ret = read_box_header(d, &type, &size)) < 0)
+            return ret;
+
+        if (type == BOX_MDAT)
+        {
+            d->mInMdat  = true;
+            d->mMdatEnd = size < 0 ? INT64_MAX : d->mPos + size;
+            continue;
+        }
+
+        if (size < 0)
+        {
+            LOG_WARN("box extended to the end is ignored\n");
+            return AVERROR_EOF;
+        }
+
+        if (type == BOX_MOOV || type == BOX_MOOF)
+        {
+            if (size > CMAF_MAX_BOX_SIZE)
+                return AVERROR_INVALIDDATA;
+
+            if ((ret = read_box_payload(d, size)) < 0)
+                return ret;
+
+            if (type == BOX_MOOV)
+                ret = parse_moov(d, d->mBoxBuf, size);
+            else if ((ret = parse_moof(d, d->mBoxBuf, size, start)) < 0)
+            {
+                LOG_WARN("invalid moof is skipped ! ret = %d\n", ret);
+                ret = 0;
+            }
+
+            if (ret < 0)
+                return ret;
+            continue;
+        }
+
+        /* styp, sidx, emsg, prft, ... */
+        if ((ret = skip_bytes(d, size)) < 0)
+            return ret;
+    }
+}
+
+void CMAFDemuxer_SetPacketPool(CMAFDemuxer demuxer, PacketPool pool)
+{
+    if (!demuxer)
+        return;
+
+    demuxer->mPool = pool;
+}
+
+void CMAFDemuxer_Reset(CMAFDemuxer demuxer)
+{
+    if (!demuxer)
+        return;
+
+    demuxer->mPos        = 0;
+    demuxer->mInMdat     = false;
+    demuxer->mSampleCnt  = 0;
+    demuxer->mSampleIndex = 0;
+}
+
+int CMAFDemuxer_GetTrackCount(CMAFDemuxer demuxer)
+{
+    return demuxer ? demuxer->mTrackCnt : 0;
+}
+
+const CMAFTrackInfo_t* CMAFDemuxer_GetTrackInfo(CMAFDemuxer demuxer, int index)
+{
+    if (!demuxer || index < 0 || index >= demuxer->mTrackCnt)
+        return NULL;
+
+    return &demuxer->mTracks[index].mInfo;
+}
@@ -0,0 +1,68 @@
+#ifndef __CMAF_DEMUXER_H_
+#define __CMAF_DEMUXER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet_pool.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavcodec/avcodec.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+typedef struct CMAFDemuxer_s* CMAFDemuxer;
+
+/* Same contract as AVIOContext read_packet, returns <= 0 at the end of data */
+typedef int (*CMAFDemuxerRead_fn)(void* opaque, uint8_t* buf, int size);
+
+typedef struct CMAFTrackInfo_s {
+    int              mTrackId;
+    int              mTimeScale;   /* time base of packets is 1/mTimeScale */
+    enum AVMediaType mCodecType;
+    enum AVCodecID   mCodecId;
+
+    int              mWidth;
+    int              mHeight;
+    int              mChannels;
+    int              mSampleRate;
+
+    uint8_t*         mExtraData;
+    int              mExtraDataSize;
+} CMAFTrackInfo_t;
+
+CMAFDemuxer CMAFDemuxer_Create(CMAFDemuxerRead_fn read, void* opaque);
+void        CMAFDemuxer_Delete(CMAFDemuxer demuxer);
+
+/*
+ * Checks leading boxes of a stream.
+ * Returns end offset of moov if it is complete in buf, 0 if more data is needed,
+ * or -1 if buf does not start with fragmented mp4 init section.
+ */
+int  CMAFDemuxer_FindInitEnd(const uint8_t* buf, int size);
+
+/* Sample payload is taken from pool, which has to outlive the demuxer */
+void CMAFDemuxer_SetPacketPool(CMAFDemuxer demuxer, PacketPool pool);
+
+/* Parses init section (ftyp/moov) once, track table is fixed after this */
+int  CMAFDemuxer_ParseInit(CMAFDemuxer demuxer, const uint8_t* buf, int size);
+
+/*
+ * Returns 0, AVERROR_EOF at the end of data or the error from read callback.
+ * pkt->pos is the position of sample in bytes of stream since create or reset, init section included.
+ */
+int  CMAFDemuxer_ReadPacket(CMAFDemuxer demuxer, AVPacket* pkt);
+
+/* Drops fragment state, keeps parsed init section */
+void CMAFDemuxer_Reset(CMAFDemuxer demuxer);
+
+int                    CMAFDemuxer_GetTrackCount(CMAFDemuxer demuxer);
+const CMAFTrackInfo_t* CMAFDemuxer_GetTrackInfo(CMAFDemuxer demuxer, int index);
+
+#endif /* __CMAF_DEMUXER_H_ */
@@ -0,0 +1,285 @@
+#include "hls_abr.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/avutil.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "hls_common.h"
+
+#define FAST_HALF_LIFE   (3.0)  /* seconds of media */
+#define SLOW_HALF_LIFE   (8.0)
+
+typedef struct EWMA_s {
+    double mHalfLife;
+    double mEstimate;
+    double mTotalWeight;
+} EWMA_t;
+
+typedef struct HLSABR_s {
+    ABRConfig_t mConfig;
+
+    /* ladder sorted by bandwidth, ascending */
+    int*        mOrder;       /* variant index of each level */
+    int*        mBandwidths;
+    double*     mUtilities;   /* BOLA utility, log(bandwidth / lowest) + 1 */
+    int         mLevelCnt;
+
+    EWMA_t      mFast;
+    EWMA_t      mSlow;
+    int         mSampleCnt;
+    int64_t     mBufferLevel;
+    int64_t     mLastSampleTime;
+
+    bool        mUseBola;     /* hybrid mode state */
+    int64_t     mLastSwitchTime;
+} HLSABR_t;
+
+static void ewma_add(EWMA_t* ewma, double weight, double value)
+{
+    double alpha = pow(0.5, weight / ewma->mHalfLife);
+
+    ewma->mEstimate = alpha * ewma->mEstimate + (1 - alpha) * value;
+    ewma->mTotalWeight += weight;
+}
+
+static double ewma_get(EWMA_t* ewma)
+{
+    /* zero bias correction of first samples */
+    return ewma->mEstimate / (1 - pow(0.5, ewma->mTotalWeight / ewma->mHalfLife));
+}
+
+static int level_of_variant(HLSABR_t* abr, int index)
+{
+    int ii;
+
+    for (ii = 0; ii < abr->mLevelCnt; ii++)
+    {
+        if (abr->mOrder[ii] == index)
+            return ii;
+    }
+    return 0;
+}
+
+static int select_throughput(HLSABR_t* abr)
+{
+    int64_t usable = HLS_ABR_GetThroughput(abr) * (100 - abr->mConfig.mSafetyMargin) / 100;
+    int level;
+
+    for (level = abr->mLevelCnt - 1; level > 0; level--)
+    {
+        if (abr->mBandwidths[level] <= usable)
+            break;
+    }
+    return level;
+}
+
+/*
+ * BOLA-BASIC : maximizes (V * (utility + gp) - buffer) / bitrate.
+ * Lowest level is chosen at mMinBuffer, top level from mBufferTarget.
+ * Switching up is capped by throughput (BOLA-O), otherwise it oscillates on a dropping link.
+ */
+static int select_bola(HLSABR_t* abr, int current)
+{
+    double minBuffer = (double)abr->mConfig.mMinBuffer / AV_TIME_BASE;
+    double target    = (double)abr->mConfig.mBufferTarget / AV_TIME_BASE;
+    double buffer    = (double)abr->mBufferLevel / AV_TIME_BASE;
+    double gp, vp, score, bestScore = 0;
+    int level, best = 0;
+
+    if (abr->mLevelCnt < 2)
+        return 0;
+
+    if (minBuffer <= 0)
+        minBuffer = 1;
+    if (target <= minBuffer)
+        target = minBuffer * 2;
+
+    gp = (abr->mUtilities[abr->mLevelCnt - 1] - 1) / (target / minBuffer - 1);
+    vp = minBuffer / gp;
+
+    for (level = 0; level < abr->mLevelCnt; level++)
+    {
+        score = (vp * (abr->mUtilities[level] + gp) - buffer) / abr->mBandwidths[level];
+        if (level == 0 || score >= bestScore)
+        {
+            bestScore = score;
+            best = level;
+        }
+    }
+
+    if (best > current)
+    {
+        int sustainable = select_throughput(abr);
+        if (best > sustainable)
+            best = _MAX(sustainable, current);
+    }
+    return best;
+}
+
+static int select_hybrid(HLSABR_t* abr, int current)
+{
+    /* hysteresis between policies, BOLA is unstable with almost empty buffer */
+    if (abr->mUseBola && abr->mBufferLevel < abr->mConfig.mMinBuffer)
+        abr->mUseBola = false;
+    else if (!abr->mUseBola && abr->mBufferLevel >= abr->mConfig.mBufferTarget / 2)
+        abr->mUseBola = true;
+
+    return abr->mUseBola ? select_bola(abr, current) : select_throughput(abr);
+}
+
+HLSABR HLS_ABR_Create(const ABRConfig_t* config, const int* bandwidths, int variantCnt)
+{
+    HLSABR_t* abr = NULL;
+    int ii, jj;
+
+    if (!config || !bandwidths || variantCnt <= 0)
+        return NULL;
+
+    abr = (HLSABR_t*)calloc(1, sizeof(HLSABR_t));
+    if (!abr)
+        goto ERROR;
+
+    abr->mOrder      = (int*)malloc(variantCnt * sizeof(int));
+    abr->mBandwidths = (int*)malloc(variantCnt * sizeof(int));
+    abr->mUtilities  = (double*)malloc(variantCnt * sizeof(double));
+    if (!abr->mOrder || !abr->mBandwidths || !abr->mUtilities)
+        goto ERROR;
+
+    abr->mConfig   = *config;
+    abr->mLevelCnt = variantCnt;
+    abr->mFast.mHalfLife = FAST_HALF_LIFE;
+    abr->mSlow.mHalfLife = SLOW_HALF_LIFE;
+    abr->mLastSwitchTime = -1;
+
+    /* insertion sort, ladder is short */
+    for (ii = 0; ii < variantCnt; ii++)
+    {
+        for (jj = ii; jj > 0 && abr->mBandwidths[jj - 1] > bandwidths[ii]; jj--)
+        {
+            abr->mBandwidths[jj] = abr->mBandwidths[jj - 1];
+            abr->mOrder[jj]      = abr->mOrder[jj - 1];
+        }
+        abr->mBandwidths[jj] = bandwidths[ii];
+        abr->mOrder[jj]      = ii;
+    }
+
+    for (ii = 0; ii < variantCnt; ii++)
+    {
+        if (abr->mBandwidths[ii] <= 0)
+            abr->mBandwidths[ii] = 1;
+        abr->mUtilities[ii] = log((double)abr->mBandwidths[ii] / abr->mBandwidths[0]) + 1;
+    }
+
+    return abr;
+
+ERROR:
+    LOG_ERROR("failed to create abr !\n");
+    HLS_ABR_Delete(abr);
+    return NULL;
+}
+
+void HLS_ABR_Delete(HLSABR abr)
+{
+    if (!abr)
+        return;
+
+    free(abr->mOrder);
+    free(abr->mBandwidths);
+    free(abr->mUtilities);
+    free(abr);
+}
+
+void HLS_ABR_AddSample(HLSABR abr, const ABRSample_t* sample)
+{
+    double throughput, weight;
+
+    if (!abr || !sample)
+        return;
+
+    abr->mBufferLevel = sample->mBufferLevel;
+    abr->mLastSampleTime = sample->mTime;
+
+    if (sample->mSize <= 0 || sample->mDownloadTime <= 0)
+        return;
+
+    throughput = (double)sample->mSize * 8 * 1000000 / sample->mDownloadTime;
+    weight     = sample->mDuration > 0 ? (double)sample->mDuration / AV_TIME_BASE : 1.0;
+
+    ewma_add(&abr->mFast, weight, throughput);
+    ewma_add(&abr->mSlow, weight, throughput);
+    abr->mSampleCnt++;
+}
+
+int HLS_ABR_SelectVariant(HLSABR abr, int currentIndex)
+{
+    int current, target;
+    int64_t now;
+
+    if (!abr || abr->mSampleCnt == 0)
+        return currentIndex;
+
+    current = level_of_variant(abr, currentIndex);
+
+    switch (abr->mConfig.mPolicy)
+    {
+        case ABR_POLICY_BOLA:   target = select_bola(abr, current);   break;
+        case ABR_POLICY_HYBRID: target = select_hybrid(abr, current); break;
+        default:                target = select_throughput(abr);      break;
+    }
+
+    if (target == current)
+        return currentIndex;
+
+    /* switch rate limit, except going down when buffer is about to run out */
+    now = abr->mLastSampleTime;
+    if (abr->mLastSwitchTime >= 0 && now - abr->mLastSwitchTime < abr->mConfig.mMinSwitchInterval &&
+        !(target < current && abr->mBufferLevel < abr->mConfig.mMinBuffer))
+        return currentIndex;
+
+#ifdef ENABLE_DEBUG_ADAPTIVE_INFO
+    LOG_TRACE("ABR policy %d : throughput %lld, buffer %lld, level %d -> %d\n", abr->mConfig.mPolicy,
+              HLS_ABR_GetThroughput(abr), abr->mBufferLevel, current, target);
+#endif
+
+    abr->mLastSwitchTime = now;
+    return abr->mOrder[target];
+}
+
+int HLS_ABR_Update(HLSABR abr, const ABRSample_t* sample, int64_t codecBuffered, int currentIndex)
+{
+    ABRSample_t total;
+
+    if (!abr || !sample)
+        return currentIndex;
+
+    total = *sample;
+    total.mBufferLevel += _MAX(codecBuffered, 0);
+
+    HLS_ABR_AddSample(abr, &total);
+    return HLS_ABR_SelectVariant(abr, currentIndex);
+}
+
+int64_t HLS_ABR_GetThroughput(HLSABR abr)
+{
+    double fast, slow;
+
+    if (!abr || abr->mSampleCnt == 0)
+        return 0;
+
+    /* conservative, drops follow fast estimate and rises follow slow one */
+    fast = ewma_get(&abr->mFast);
+    slow = ewma_get(&abr->mSlow);
+
+    return (int64_t)(fast < slow ? fast : slow);
+}
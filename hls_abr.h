@@ -0,0 +1,51 @@
+#ifndef __HLS_ABR_H_
+#define __HLS_ABR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    ABR_POLICY_THROUGHPUT = 0, /* highest variant below estimated throughput minus safety margin */
+    ABR_POLICY_BOLA,           /* buffer based, BOLA-BASIC utility */
+    ABR_POLICY_HYBRID,         /* throughput while buffer is low, BOLA once buffer is built */
+} ABRPolicy_e;
+
+/* Times are in AV_TIME_BASE */
+typedef struct ABRConfig_s {
+    ABRPolicy_e mPolicy;
+    int         mSafetyMargin;      /* percent of estimated throughput left unused */
+    int64_t     mMinSwitchInterval; /* no switch within this time after previous one */
+    int64_t     mMinBuffer;         /* below this switching down is always allowed */
+    int64_t     mBufferTarget;      /* buffer level where BOLA selects the top variant */
+} ABRConfig_t;
+
+/* Inputs of one downloaded segment */
+typedef struct ABRSample_s {
+    int64_t     mTime;          /* us, when download is completed, clock for switch rate limit */
+    int64_t     mSize;          /* bytes */
+    int64_t     mDownloadTime;  /* us */
+    int64_t     mDuration;      /* media duration of segment */
+    int64_t     mBufferLevel;   /* media duration downloaded but not yet demuxed */
+} ABRSample_t;
+
+typedef struct HLSABR_s* HLSABR;
+
+/* bandwidths : BANDWIDTH of each variant, in variant index order, needs not to be sorted */
+HLSABR HLS_ABR_Create(const ABRConfig_t* config, const int* bandwidths, int variantCnt);
+void   HLS_ABR_Delete(HLSABR abr);
+
+void    HLS_ABR_AddSample(HLSABR abr, const ABRSample_t* sample);
+
+/* Returns variant index to switch to, current index if no switch */
+int     HLS_ABR_SelectVariant(HLSABR abr, int currentIndex);
+
+/*
+ * Decision on download completion, the step shared by demuxer and tools/abr_sim.c.
+ * codecBuffered is media queued in decoders, played before a stall as well so it counts as buffer.
+ * Returns variant index to switch to, current index if no switch.
+ */
+int     HLS_ABR_Update(HLSABR abr, const ABRSample_t* sample, int64_t codecBuffered, int currentIndex);
+
+int64_t HLS_ABR_GetThroughput(HLSABR abr); /* bits per second, 0 if not estimated yet */
+
+#endif /* __HLS_ABR_H_ */
@@ -4,8 +4,8 @@
 #include "hls_log.h"
 #include <stdint.h>
 
-#define _MAX(x, y)     ((x) > (y)) ? (x):(y)
-#define _MIN(x, y)     ((x) < (y)) ? (x):(y)
+#define _MAX(x, y)     (((x) > (y)) ? (x):(y))
+#define _MIN(x, y)     (((x) < (y)) ? (x):(y))
 
 #define AV_PKT_FLAG_SEGMENT_CHANGED    0x8000
 
@@ -19,8 +19,16 @@
 
 #define INITIAL_BUFFER_SIZE 32768
 
+/* Result of MediaObjectBuffer / PacketBuffer */
+#define BUFFER_SUCCESS        (0)
+#define BUFFER_ERROR          (-1)
+#define BUFFER_ERROR_EMPTY    (-2)
+#define BUFFER_ERROR_FULL     (-3)
+#define BUFFER_ERROR_TIMEOUT  (-4)
+#define BUFFER_ERROR_EOS      (-5)
+
 #define ENABLE_SEGMENT_SEEK
-//#define ENABLE_ADJUST_PTS
+#define ENABLE_ADJUST_PTS /* packet timestamps are mapped to playlist time, see hls_session_map_timestamp */
 
 #define ENABLE_BANDWIDTH_POPUP
 #define ENABLE_DEBUG_ADAPTIVE_INFO
@@ -28,6 +36,11 @@
 /* DEBUG */
 //#define ENABLE_DEBUG_DROP_COUNT
 //#define ENABLE_DEBUG_STOP_PERFORMANCE
+//#define ENABLE_DEBUG_SEGMENT_PERFORMANCE
+//#define ENABLE_DEBUG_INTERLEAVE_PERFORMANCE
+//#define ENABLE_DEBUG_STARTUP_PERFORMANCE
+//#define ENABLE_DEBUG_PARSER_PERFORMANCE
+//#define ENABLE_DEBUG_MEMORY_FOOTPRINT
 
 char* ltrim(char *s);
 char* rtrim(char* s);
@@ -1,6 +1,8 @@
 #include <string.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <errno.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -22,7 +24,13 @@ extern "C"
 
 #include "hls_common.h"
 #include "hls_receiver.h"
+#include "hls_abr.h"
 #include "m3u8_parser.h"
+#include "ts_demuxer.h"
+#include "cmaf_demuxer.h"
+#include "packet_buffer.h"
+#include "packet_pool.h"
+#include "packet_interleaver.h"
 #include "util.h"
 #include "hls_log.h"
 
@@ -30,15 +38,126 @@ static AVRational g_Rational = {1, AV_TIME_BASE};
 
 typedef struct StreamInfo_s {
     int         mId;
+    AVRational  mTimeBase;
     int64_t     mOrignStartPts;
     int64_t     mSegmentStartPts;
+
+    /* extradata of sub demuxer stream, sent as AV_PKT_DATA_NEW_EXTRADATA when it changes on reopen */
+    uint8_t*    mExtraData;
+    int         mExtraDataSize;
+    bool        mExtraDataChanged;
 } StreamInfo_t;
 
+typedef enum {
+    SESSION_DEMUX_GENERIC = 0, /* libavformat sub demuxer over mIO */
+    SESSION_DEMUX_TS,          /* in-tree TS demuxer, no probing per segment */
+    SESSION_DEMUX_CMAF,        /* in-tree fragmented mp4 demuxer, init section is parsed once */
+} SessionDemuxType_e;
+
+#define MAX_PROBE_SIZE  (2 * 1024 * 1024)
+
+#define PACKET_WAIT_TIMEOUT  (100) /* ms, interrupt callback is checked in between */
+#define PACKET_POOL_SIZE     (1024)
+
+#define FAST_START_ANALYZE_DURATION  (AV_TIME_BASE / 2)
+
+#define MAX_SEGMENT_BOUNDARIES  (8) /* segments read ahead of the packets of sub demuxer */
+
+#ifdef ENABLE_ADJUST_PTS
+#define MAX_TIMELINE_OFFSETS   (16)   /* discontinuity sequences kept for sessions behind the main one */
+#define TIMELINE_WAIT_TIMEOUT  (1000) /* ms, session waits main session for offset of a new sequence */
+
+typedef struct TimelineOffset_s {
+    int         mSeq;
+    int64_t     mOffset;
+    int64_t     mStart;             /* mapped time of the packet offset is taken at, to fold wrap of others */
+} TimelineOffset_t;
+
+/*
+ * Time offset of each discontinuity sequence. Main session takes it and the others use the same one,
+ * so relative timestamps of their media are kept. A session takes its own only if main doesn't get to
+ * the sequence in time.
+ */
+typedef struct Timeline_s {
+    pthread_mutex_t  mLock;
+    pthread_cond_t   mCond;
+    TimelineOffset_t mOffsets[MAX_TIMELINE_OFFSETS]; /* ring, oldest is replaced */
+    int              mHead;
+    int              mCnt;
+    int              mLastSeq;      /* last published sequence, valid if mCnt > 0 */
+    bool             mShared;       /* main session is opened */
+    bool             mMainRunning;  /* demux thread of main session may still publish */
+} Timeline_t;
+#endif
+
+typedef struct CodecTag_s {
+    const char*      mTag;     /* sample entry of RFC 6381 codec string */
+    enum AVMediaType mType;
+    enum AVCodecID   mCodecId;
+} CodecTag_t;
+
+static const CodecTag_t g_CodecTags[] = {
+    { "avc1", AVMEDIA_TYPE_VIDEO,    AV_CODEC_ID_H264   },
+    { "avc3", AVMEDIA_TYPE_VIDEO,    AV_CODEC_ID_H264   },
+    { "hvc1", AVMEDIA_TYPE_VIDEO,    AV_CODEC_ID_HEVC   },
+    { "hev1", AVMEDIA_TYPE_VIDEO,    AV_CODEC_ID_HEVC   },
+    { "av01", AVMEDIA_TYPE_VIDEO,    AV_CODEC_ID_AV1    },
+    { "vp09", AVMEDIA_TYPE_VIDEO,    AV_CODEC_ID_VP9    },
+    { "mp4a", AVMEDIA_TYPE_AUDIO,    AV_CODEC_ID_AAC    },
+    { "ac-3", AVMEDIA_TYPE_AUDIO,    AV_CODEC_ID_AC3    },
+    { "ec-3", AVMEDIA_TYPE_AUDIO,    AV_CODEC_ID_EAC3   },
+    { "Opus", AVMEDIA_TYPE_AUDIO,    AV_CODEC_ID_OPUS   },
+    { "fLaC", AVMEDIA_TYPE_AUDIO,    AV_CODEC_ID_FLAC   },
+    { "wvtt", AVMEDIA_TYPE_SUBTITLE, AV_CODEC_ID_WEBVTT },
+    { NULL,   AVMEDIA_TYPE_UNKNOWN,  AV_CODEC_ID_NONE   },
+};
+
+/* container of segments by extension, used to skip probing in fast start */
+static const struct {
+    const char* mExt;
+    const char* mFormat;
+} g_SegmentFormats[] = {
+    { "ts",   "mpegts" },
+    { "aac",  "aac"    },
+    { "mp3",  "mp3"    },
+    { "ac3",  "ac3"    },
+    { "ec3",  "eac3"   },
+    { "mp4",  "mov"    },
+    { "m4s",  "mov"    },
+    { "m4a",  "mov"    },
+    { "m4v",  "mov"    },
+    { "cmfv", "mov"    },
+    { "cmfa", "mov"    },
+    { "vtt",  "webvtt" },
+    { "webvtt", "webvtt" },
+};
+
+/* start of a segment in the bytes handed to sub demuxer */
+typedef struct SegmentBoundary_s {
+    int64_t     mPos;
+    bool        mChanged;           /* passed over without reopening sub demuxer */
+    int64_t     mStartPts;
+    int         mDiscontinuitySeq;
+    int64_t     mProgramDateTime;
+} SegmentBoundary_t;
+
 typedef struct SessionContext_s {
     int               mEOF;
+    int               mIndex;
+    AVFormatContext*  mOwner;
+    Playlist_t*       mPlaylist;  /* playlist session is opened with, receiver may switch it */
 
     HLSReceiver       mReceiver;
 
+    SessionDemuxType_e mDemuxType;
+    TSDemuxer         mTSDemuxer;
+    CMAFDemuxer       mCMAFDemuxer;
+
+    /* first bytes read to detect sub demuxer, handed to it before receiver data */
+    unsigned char*    mProbeBuf;
+    int               mProbeSize;
+    int               mProbePos;
+
     AVFormatContext*  mContext;
     AVIOContext       mIO;
     unsigned char*    mBuffer;
@@ -49,7 +168,40 @@ typedef struct SessionContext_s {
 
     int64_t           mSeekTimestamp;
     int64_t           mSeekStreamIndex;
-    AVPacket          mPkt; 
+
+    /* demux thread reads packets into mPackets, hls_read_packet() only interleaves them */
+    pthread_t         mDemuxThread;
+    bool              mDemuxRunning;
+    bool              mExitDemux;
+    bool              mNeedNextSegment; /* reopen sub demuxer on demux thread first, e.g. after seek */
+    bool              mSegmentChanged;
+    int               mDemuxResult;     /* valid after mPackets reached EOS */
+
+    /* segments are taken in-band, a boundary applies from the first packet at or after its position */
+    int64_t           mReadPos;         /* bytes handed to sub demuxer since it is opened or reset */
+    bool              mNewSegment;      /* next bytes of receiver start a segment, e.g. after reopen */
+    SegmentBoundary_t mBoundaries[MAX_SEGMENT_BOUNDARIES];
+    int               mBoundaryHead;
+    int               mBoundaryCnt;
+    SegmentBoundary_t mSegment;         /* segment of the last filtered packet */
+    PacketBuffer      mPackets;
+    PacketPool        mPacketPool;      /* shared by all sessions, owned by HLSContext_t */
+    AVPacket*         mPkt;             /* head packet taken from mPackets, NULL if none */
+    int64_t           mStallStart;      /* tick head packet started to wait for this session, 0 if not waiting */
+
+    int64_t           mDtsWrap;         /* wrap period in AV_TIME_BASE, 0 if timestamps don't wrap */
+
+#ifdef ENABLE_ADJUST_PTS
+    /* maps timestamps of sub demuxer to playlist time, offset is constant within discontinuity sequence */
+    Timeline_t*       mTimeline;        /* shared by all sessions, owned by HLSContext_t */
+    bool              mMainStream;      /* publishes offsets to mTimeline */
+    int64_t           mTimeOffset;      /* AV_NOPTS_VALUE until the first packet after start or seek */
+    int               mTimelineSeq;     /* discontinuity sequence mTimeOffset is taken for */
+    int64_t           mTimelineLastTs;  /* last timestamp before mapping, for wrap around */
+    int64_t           mTimelineEnd;     /* end of last mapped packet */
+    int64_t           mAnchorDateTime;  /* program date time of segment at mAnchorTime, AV_NOPTS_VALUE if none */
+    int64_t           mAnchorTime;
+#endif
 
 #ifdef ENABLE_DEBUG_DROP_COUNT
     int               mDropCnt;
@@ -70,17 +222,71 @@ typedef struct HLSContext_s {
 
     int                mStreamCnt;
 
-    int                mCodecBufLevel;
-    int                mCodecVideoBufSize;
+    HLSABR             mABR;
+    int                mABRPolicy;
+    int                mABRSafetyMargin;      // percent
+    int                mABRMinSwitchInterval; // ms
+    int                mABRMinBuffer;         // ms
+    int                mABRBufferTarget;      // ms
+
+    /* downstream buffer feedback, updated by player at runtime with av_opt_set() */
+    int                mCodecBufLevel;      // ms of media queued in decoders, 0 if not reported
+    int                mCodecVideoBufSize;  // bytes, capacity of decoder input buffer
     int                mCodecAudioBufSize;
-    int                mCodecVideoDataSize;
+    int                mCodecVideoDataSize; // bytes, currently queued in decoder input buffer
     int                mCodecAudioDataSize;
 
     pthread_mutex_t    mLock;
 
+#ifdef ENABLE_ADJUST_PTS
+    Timeline_t         mTimeline;
+#endif
+
     int                mProbe; // During probing media, No need to change adaptive.
- 
-    bool               mIsSegmentChanged;
+    int                mContinuousDemux; // Keep sub demuxer over segment boundary, reopen only on discontinuity.
+    int                mNativeTS; // Use in-tree TS demuxer instead of libavformat mpegts.
+    int                mNativeCMAF; // Use in-tree fMP4 demuxer instead of libavformat mov.
+    int                mFastStart; // Take container from segment extension and shorten stream analysis.
+    int                mPacketQueueSize; // Max packets read ahead by demux thread of each session.
+    int                mInterleaveWindow; // ms of dts head packet may lead a stalled session before going out without it.
+    int                mInterleaveTimeout; // ms head packet waits for a stalled session before going out without it.
+    int                mLazyLoad; // Load only the starting variant at open, the others after first packet.
+    int                mPlaylistConnections; // Max concurrent playlist requests to each host.
+    char*              mPlaylistCacheDir; // Directory of parsed playlist cache, disabled if not set.
+    int                mPlaylistCacheTTL; // Seconds master in the cache is used without revalidation.
+    int                mCacheRestored; // Playlists restored from the cache at open.
+
+    /* capability of sink, variants beyond it are pruned before loading. 0 or NULL for no limit */
+    int                mMaxWidth;
+    int                mMaxHeight;
+    double             mMaxFrameRate;
+    int                mMaxBitrate;
+    char*              mAllowedCodecs; // comma separated sample entries, e.g. "avc1,mp4a"
+
+    /* background loader of playlists which are not needed to start */
+    pthread_t          mLoaderThread;
+    bool               mLoaderStarted;
+    bool               mExitLoader;
+    AVIOInterruptCB    mLoaderIntCB;
+
+    PacketInterleaver  mInterleaver;  // orders head packets of sessions, indexed by session index
+    int                mSeekCnt;      // bumped by seek, packet taken without mLock is dropped if it changed
+    PacketPool         mPacketPool;
+
+    /* snapshot of main playlist which s->duration is taken from, see hls_update_duration */
+    Playlist_t*        mDurationPlaylist;
+    int64_t            mDurationVersion;
+
+#ifdef ENABLE_DEBUG_STARTUP_PERFORMANCE
+    int64_t            mStartupTime;
+    bool               mFirstPacket;
+#endif
+
+#ifdef ENABLE_DEBUG_INTERLEAVE_PERFORMANCE
+    int64_t            mInterleaveStart;
+    int64_t            mInterleaveTime;
+    int                mInterleaveCnt;
+#endif
 } HLSContext_t;
 
 static void avio_reset2(AVIOContext* io)
@@ -93,12 +299,6 @@ static void avio_reset2(AVIOContext* io)
     io->is_segment_media = 1;
 }
 
-static void reset_packet(AVPacket* pkt)
-{
-    av_init_packet(pkt);
-    pkt->data = NULL;
-}
-
 static void add_metadata_from_renditions(AVStream* st, Playlist_t* pls)
 {
     int rend_idx = 0;
@@ -119,30 +319,49 @@ static void add_metadata_from_renditions(AVStream* st, Playlist_t* pls)
     }
 }
 
-static int hls_switch_variant(HLSContext_t* c, HLSReceiver receiver, Playlist_t* pls, int bandwidth)
+/* Media duration queued in decoders in AV_TIME_BASE, estimated from queued bytes if level is not reported */
+static int64_t hls_get_codec_buffered(HLSContext_t* c)
 {
-    Variant_t* curVar = c->mInfo.mVariants[c->mVariantIndex];
+    int bandwidth;
+    int64_t dataSize;
+
+    if (c->mCodecBufLevel > 0)
+        return (int64_t)c->mCodecBufLevel * 1000;
+
+    dataSize  = (int64_t)c->mCodecVideoDataSize + c->mCodecAudioDataSize;
+    bandwidth = c->mInfo.mVariants[c->mVariantIndex]->mBandwidth;
+    if (dataSize <= 0 || bandwidth <= 0)
+        return 0;
+
+    return dataSize * 8 * AV_TIME_BASE / bandwidth;
+}
+
+static bool hls_is_codec_buffer_full(HLSContext_t* c)
+{
+    return (c->mCodecVideoBufSize > 0 && c->mCodecVideoDataSize >= c->mCodecVideoBufSize) ||
+           (c->mCodecAudioBufSize > 0 && c->mCodecAudioDataSize >= c->mCodecAudioBufSize);
+}
+
+static bool hls_has_codec_feedback(HLSContext_t* c)
+{
+    return c->mCodecBufLevel > 0 || c->mCodecVideoBufSize > 0 || c->mCodecAudioBufSize > 0 ||
+           c->mCodecVideoDataSize > 0 || c->mCodecAudioDataSize > 0;
+}
 
-    int ii, diff;
-    int newVariantIndex   = -1;
+static int hls_switch_variant(HLSContext_t* c, HLSReceiver receiver, Playlist_t* pls, const ABRSample_t* sample)
+{
+    int newVariantIndex;
 
     if (c->mProbe == 1)
         return 0;
 
-    for (ii = 0; ii < c->mInfo.mVariantCnt; ii++)
-    {
-        if (c->mInfo.mVariants[ii]->mBandwidth < bandwidth)
-        {
-            if (newVariantIndex == -1 || diff > bandwidth - c->mInfo.mVariants[ii]->mBandwidth)
-            {
-                diff = bandwidth - c->mInfo.mVariants[ii]->mBandwidth;
-                newVariantIndex = ii;
-            }
-        }
-    }
+    newVariantIndex = HLS_ABR_Update(c->mABR, sample, hls_get_codec_buffered(c), c->mVariantIndex);
 
     if (newVariantIndex >= 0 && c->mVariantIndex != newVariantIndex)
     {
+#ifdef ENABLE_DEBUG_ADAPTIVE_INFO
+        Variant_t* curVar = c->mInfo.mVariants[c->mVariantIndex];
+#endif
         Variant_t* nextVar = c->mInfo.mVariants[newVariantIndex];
         c->mVariantIndex = newVariantIndex;
        
@@ -157,6 +376,81 @@ static int hls_switch_variant(HLSContext_t* c, HLSReceiver receiver, Playlist_t*
     return -1;    
 }
 
+static void hls_session_add_boundary(SessionContext_t* session, int64_t pos, bool changed)
+{
+    SegmentBoundary_t* boundary;
+
+    /* sub demuxer is far behind, the oldest is superseded by the ones after it */
+    if (session->mBoundaryCnt == MAX_SEGMENT_BOUNDARIES)
+    {
+        session->mBoundaryHead = (session->mBoundaryHead + 1) % MAX_SEGMENT_BOUNDARIES;
+        session->mBoundaryCnt--;
+    }
+
+    boundary = &session->mBoundaries[(session->mBoundaryHead + session->mBoundaryCnt) % MAX_SEGMENT_BOUNDARIES];
+    boundary->mPos              = pos;
+    boundary->mChanged          = changed;
+    boundary->mStartPts         = HLS_Receiver_GetCurrentSegmentPts(session->mReceiver);
+    boundary->mDiscontinuitySeq = HLS_Receiver_GetCurrentDiscontinuitySeq(session->mReceiver);
+    boundary->mProgramDateTime  = HLS_Receiver_GetCurrentProgramDateTime(session->mReceiver);
+    session->mBoundaryCnt++;
+}
+
+/*
+ * Reads from receiver, bytes are at pos of the stream handed to sub demuxer. Receiver never returns
+ * bytes of two segments at once, so a segment started during this read starts at pos.
+ */
+static int session_receive(SessionContext_t* session, uint8_t* buf, int size, int64_t pos)
+{
+    int ret = HLS_Receiver_Read(session->mReceiver, buf, size);
+
+    if (ret <= 0)
+        return ret;
+
+    if (HLS_Receiver_CheckSegmentChanged(session->mReceiver))
+    {
+        hls_session_add_boundary(session, pos, true);
+        if (session->mTSDemuxer)
+            TSDemuxer_SetSegmentStart(session->mTSDemuxer, pos);
+    }
+    else if (session->mNewSegment)
+        hls_session_add_boundary(session, pos, false);
+    session->mNewSegment = false;
+
+    return ret;
+}
+
+static int session_read(SessionContext_t* session, uint8_t *buf, int buf_size)
+{
+    int ret;
+
+    if (session->mProbePos < session->mProbeSize)
+    {
+        int size = _MIN(buf_size, session->mProbeSize - session->mProbePos);
+
+        memcpy(buf, session->mProbeBuf + session->mProbePos, size);
+        session->mProbePos += size;
+        session->mReadPos += size;
+        return size;
+    }
+
+    ret = session_receive(session, buf, buf_size, session->mReadPos);
+    if (ret > 0)
+        session->mReadPos += ret;
+
+    return ret;
+}
+
+static int TSRead(void *opaque, uint8_t *buf, int buf_size)
+{
+    return session_read((SessionContext_t*)opaque, buf, buf_size);
+}
+
+static int CMAFRead(void *opaque, uint8_t *buf, int buf_size)
+{
+    return session_read((SessionContext_t*)opaque, buf, buf_size);
+}
+
 static int IORead(void *opaque, uint8_t *buf, int buf_size)
 {
     int ret;
@@ -164,7 +458,7 @@ static int IORead(void *opaque, uint8_t *buf, int buf_size)
     if (!session)
         return 0;
 
-    ret =  HLS_Receiver_Read(session->mReceiver, buf, buf_size);
+    ret =  session_read(session, buf, buf_size);
 #ifdef ENABLE_READ_DATA_DUMP
     LOG_INFO("--- ret : %d\n", ret);
     if (ret >= 0)
@@ -174,215 +468,1270 @@ static int IORead(void *opaque, uint8_t *buf, int buf_size)
     return ret;
 }
 
-static void download_complete_callback(HLSReceiver receiver, Playlist_t* pls, int bandwidth, void* opaque)
+static void download_complete_callback(HLSReceiver receiver, Playlist_t* pls, const ABRSample_t* sample, void* opaque)
 {
     HLSContext_t* c = (HLSContext_t*)opaque;
 
     Variant_t* curVar = c->mInfo.mVariants[c->mVariantIndex];
-    LOG_TRACE("@@@@@@@ Downlaod Completed : Variant : %d, Bandwidth : %d, MeasureBandwidth %d @@@@@@@\n", c->mVariantIndex, curVar->mBandwidth, bandwidth);
+    LOG_TRACE("@@@@@@@ Downlaod Completed : Variant : %d, Bandwidth : %d, MeasureBandwidth %lld, Buffer %lld @@@@@@@\n", c->mVariantIndex, curVar->mBandwidth,
+              sample->mSize * 8 * 1000000 / _MAX(sample->mDownloadTime, 1), sample->mBufferLevel);
 
-    hls_switch_variant(c, receiver, pls, bandwidth);
+    hls_switch_variant(c, receiver, pls, sample);
 }
 
-static SessionContext_t* hls_session_open(AVFormatContext* s, Playlist_t* pls, int isMainStream)
+static bool prefetch_callback(HLSReceiver receiver, int64_t bufferLevel, void* opaque)
+{
+    HLSContext_t* c = (HLSContext_t*)opaque;
+    int64_t target = (int64_t)c->mABRBufferTarget * 1000;
+
+    /* no feedback from player, prefetch as deep as receiver buffer allows */
+    if (!hls_has_codec_feedback(c))
+        return true;
+
+    if (hls_is_codec_buffer_full(c))
+        return false;
+
+    return target <= 0 || bufferLevel + hls_get_codec_buffered(c) < target;
+}
+
+static int hls_session_new_stream(AVFormatContext* s, SessionContext_t* session, AVRational timeBase, AVStream** out)
 {
-    int ret = 0;
-    int ii;
-    ff_const59 AVInputFormat *in_fmt = NULL;
     HLSContext_t* c = (HLSContext_t*)s->priv_data;
-    SessionContext_t* session = (SessionContext_t*)av_mallocz(sizeof(SessionContext_t));
-    if (!session)
+    StreamInfo_t* streamInfo = NULL;
+    AVStream*     st = NULL;
+
+    if (!(streamInfo = (StreamInfo_t*)av_malloc(sizeof(StreamInfo_t))))
+        return AVERROR(ENOMEM);
+
+    if (!(st = avformat_new_stream(s, NULL)))
     {
-        LOG_ERROR("failed to alloc session !\n");
-        goto ERROR;
+        av_free(streamInfo);
+        return AVERROR(ENOMEM);
     }
 
-    if (isMainStream)
-        session->mReceiver = HLS_Receiver_Create(pls, c->mIntCB, download_complete_callback, c);
-    else
-        session->mReceiver = HLS_Receiver_Create(pls, c->mIntCB, NULL, c);
+    st->id = c->mStreamCnt;
+    st->time_base.num = g_Rational.num;
+    st->time_base.den = g_Rational.den;
 
-    if (!session->mReceiver)
+    streamInfo->mId              = st->index;
+    streamInfo->mTimeBase        = timeBase;
+    streamInfo->mOrignStartPts   = -1;
+    streamInfo->mSegmentStartPts = HLS_Receiver_GetCurrentSegmentPts(session->mReceiver);
+    streamInfo->mExtraData        = NULL;
+    streamInfo->mExtraDataSize    = 0;
+    streamInfo->mExtraDataChanged = false;
+
+    dynarray_add(&session->mStreamInfos,  &session->mStreamInfoCnt, streamInfo);
+
+    if (timeBase.num == 1 && timeBase.den == TS_PTS_TIMEBASE)
+        session->mDtsWrap = av_rescale(1LL << 33, AV_TIME_BASE, TS_PTS_TIMEBASE);
+
+    c->mStreamCnt++;
+
+    *out = st;
+    return 0;
+}
+
+/* Keeps extradata of sub demuxer stream, returns 1 if it differs from the kept one */
+static int hls_stream_info_set_extradata(StreamInfo_t* streamInfo, const uint8_t* data, int size)
+{
+    uint8_t* copy;
+
+    if (size == streamInfo->mExtraDataSize && (size == 0 || !memcmp(data, streamInfo->mExtraData, size)))
+        return 0;
+
+    if (!(copy = (uint8_t*)av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE)))
+        return AVERROR(ENOMEM);
+
+    memcpy(copy, data, size);
+    av_free(streamInfo->mExtraData);
+    streamInfo->mExtraData = copy;
+    streamInfo->mExtraDataSize = size;
+
+    return 1;
+}
+
+/* Reads first bytes of the session to decide sub demuxer, bytes are replayed by session_read() */
+static int hls_session_probe(SessionContext_t* session, int size)
+{
+    unsigned char* buf;
+    int ret;
+
+    if (size > MAX_PROBE_SIZE)
+        return AVERROR(ENOMEM);
+
+    /* bytes probed so far are kept on failure, they are still replayed */
+    if (!(buf = (unsigned char*)av_realloc(session->mProbeBuf, size)))
+        return AVERROR(ENOMEM);
+    session->mProbeBuf = buf;
+
+    while (session->mProbeSize < size)
     {
-        LOG_ERROR("failed to create receiver !\n");
-        goto ERROR;
+        /* probed bytes are handed to sub demuxer from the start of stream */
+        ret = session_receive(session, session->mProbeBuf + session->mProbeSize, size - session->mProbeSize, session->mProbeSize);
+        if (ret <= 0)
+            return ret < 0 ? ret : AVERROR_EOF;
+        session->mProbeSize += ret;
     }
 
-    HLS_Receiver_Start(session->mReceiver);
+    return 0;
+}
 
-    session->mBuffer = (unsigned char*)av_malloc(INITIAL_BUFFER_SIZE);
-    if (!session->mBuffer)
+static int hls_session_open_ts(SessionContext_t* session)
+{
+    int ret;
+
+    if (!(session->mTSDemuxer = TSDemuxer_Create(TSRead, session)))
+        return AVERROR(ENOMEM);
+
+    TSDemuxer_SetPacketPool(session->mTSDemuxer, session->mPacketPool);
+
+    if ((ret = TSDemuxer_ReadHeader(session->mTSDemuxer)) < 0)
     {
-        LOG_ERROR("failed to alloc buffer !\n");
-        goto ERROR;
+        LOG_ERROR("failed to read ts header ! ret = %d\n", ret);
+        return ret;
     }
-    session->mBufferSize = INITIAL_BUFFER_SIZE;
 
-    session->mContext = avformat_alloc_context();
+    return 0;
+}
 
-    ffio_init_context(&session->mIO, session->mBuffer, session->mBufferSize, 0, session, IORead, NULL, NULL); 
-    session->mIO.seekable = 0;
-    session->mIO.is_segment_media = 1;
+/* Returns end offset of init section, or 0 if the session is not fragmented mp4 */
+static int hls_session_probe_cmaf(SessionContext_t* session)
+{
+    int initEnd;
 
-    ff_copy_whiteblacklists(session->mContext, s);
+    while ((initEnd = CMAFDemuxer_FindInitEnd(session->mProbeBuf, session->mProbeSize)) == 0)
+    {
+        if (hls_session_probe(session, session->mProbeSize + 4096) < 0)
+            return 0;
+    }
 
-    session->mContext->flags = AVFMT_FLAG_CUSTOM_IO;
-    session->mContext->probesize = s->probesize > 0 ? s->probesize : 1024 * 4;
-    session->mContext->max_analyze_duration = s->max_analyze_duration > 0 ? s->max_analyze_duration : 4 * AV_TIME_BASE;
-    ret = av_probe_input_buffer(&session->mIO, &in_fmt, "", NULL, 0, 0);
-    if (ret < 0)
+    return _MAX(initEnd, 0);
+}
+
+static int hls_session_open_cmaf(SessionContext_t* session, int initEnd)
+{
+    int ret;
+
+    if (!(session->mCMAFDemuxer = CMAFDemuxer_Create(CMAFRead, session)))
+        return AVERROR(ENOMEM);
+
+    CMAFDemuxer_SetPacketPool(session->mCMAFDemuxer, session->mPacketPool);
+
+    if ((ret = CMAFDemuxer_ParseInit(session->mCMAFDemuxer, session->mProbeBuf, initEnd)) < 0)
     {
-        LOG_ERROR("failed to probe input buffer !\n");
+        LOG_INFO("init section is not supported, fall back to generic demuxer\n");
+        CMAFDemuxer_Delete(session->mCMAFDemuxer);
+        session->mCMAFDemuxer = NULL;
+        return ret;
     }
 
-    session->mSeekTimestamp = AV_NOPTS_VALUE;
-    session->mSeekStreamIndex = -1;
-    reset_packet(&session->mPkt);
+    /* init section is consumed here and never replayed again unless it is changed */
+    session->mProbePos = initEnd;
+    session->mReadPos  = initEnd;
+    HLS_Receiver_SetReplayInitOnChange(session->mReceiver, true);
 
-    dynarray_add(&c->mSessions, &c->mSessionCnt, session);
+    return 0;
+}
 
-    session->mContext->pb = &session->mIO;
+/* Registers AVStreams of an opened session, called in playlist order so stream indexes are deterministic */
+static int hls_session_add_streams(AVFormatContext* s, SessionContext_t* session)
+{
+    Playlist_t* pls = session->mPlaylist;
+    AVStream* st;
+    int ii, ret;
 
-    ret = avformat_open_input(&session->mContext, "", in_fmt, NULL);
-    if (ret < 0)
+    if (session->mDemuxType == SESSION_DEMUX_TS)
     {
-        LOG_ERROR("Open avformat input failed !!\n");
+        AVRational timeBase = { 1, TS_PTS_TIMEBASE };
 
-        if (session->mContext)
-            avformat_close_input(&session->mContext);
-        goto ERROR;
+        for (ii = 0; ii < TSDemuxer_GetStreamCount(session->mTSDemuxer); ii++)
+        {
+            const TSStreamInfo_t* info = TSDemuxer_GetStreamInfo(session->mTSDemuxer, ii);
+            if ((ret = hls_session_new_stream(s, session, timeBase, &st)) < 0)
+                return ret;
+
+            /* codec parameters are filled by parser of outer context */
+            st->codecpar->codec_type = info->mCodecType;
+            st->codecpar->codec_id   = info->mCodecId;
+            st->need_parsing         = AVSTREAM_PARSE_FULL;
+
+            add_metadata_from_renditions(st, pls);
+        }
+        return 0;
+    }
+
+    if (session->mDemuxType == SESSION_DEMUX_CMAF)
+    {
+        for (ii = 0; ii < CMAFDemuxer_GetTrackCount(session->mCMAFDemuxer); ii++)
+        {
+            const CMAFTrackInfo_t* info = CMAFDemuxer_GetTrackInfo(session->mCMAFDemuxer, ii);
+            AVRational timeBase = { 1, info->mTimeScale };
+            if ((ret = hls_session_new_stream(s, session, timeBase, &st)) < 0)
+                return ret;
+
+            st->codecpar->codec_type  = info->mCodecType;
+            st->codecpar->codec_id    = info->mCodecId;
+            st->codecpar->width       = info->mWidth;
+            st->codecpar->height      = info->mHeight;
+            st->codecpar->channels    = info->mChannels;
+            st->codecpar->sample_rate = info->mSampleRate;
+
+            if (info->mExtraDataSize > 0)
+            {
+                st->codecpar->extradata = (uint8_t*)av_mallocz(info->mExtraDataSize + AV_INPUT_BUFFER_PADDING_SIZE);
+                if (!st->codecpar->extradata)
+                    return AVERROR(ENOMEM);
+
+                memcpy(st->codecpar->extradata, info->mExtraData, info->mExtraDataSize);
+                st->codecpar->extradata_size = info->mExtraDataSize;
+            }
+
+            add_metadata_from_renditions(st, pls);
+        }
+        return 0;
     }
 
-    ret = avformat_find_stream_info(session->mContext, NULL);
     for (ii = 0; ii < session->mContext->nb_streams; ii++)
     {
-        StreamInfo_t* streamInfo = NULL;
-        AVStream*     st = avformat_new_stream(s, NULL);
-        AVStream*     ist = session->mContext->streams[ii];
+        AVStream* ist = session->mContext->streams[ii];
+        if ((ret = hls_session_new_stream(s, session, ist->time_base, &st)) < 0)
+            return ret;
 
-        st->id = c->mStreamCnt;
-        st->time_base.num = g_Rational.num;
-        st->time_base.den = g_Rational.den;
         st->r_frame_rate.num = ist->r_frame_rate.num;
         st->r_frame_rate.den = ist->r_frame_rate.den;
 
         avcodec_parameters_copy(st->codecpar, ist->codecpar);
 
-        streamInfo = (StreamInfo_t*)av_malloc(sizeof(StreamInfo_t));
-        streamInfo->mId              = st->index;
-        streamInfo->mOrignStartPts   = -1;
-        streamInfo->mSegmentStartPts = HLS_Receiver_GetCurrentSegmentPts(session->mReceiver);
+        /* reopen compares with it, so that only a changed one is sent */
+        if (hls_stream_info_set_extradata(session->mStreamInfos[session->mStreamInfoCnt - 1],
+                                          ist->codecpar->extradata, ist->codecpar->extradata_size) < 0)
+            return AVERROR(ENOMEM);
+
+        add_metadata_from_renditions(st, pls);
+    }
+
+    return 0;
+}
+
+/* Parses one RFC 6381 entry, e.g. "avc1.64001f", "hvc1.1.6.L93.B0" or "mp4a.40.2" */
+static const CodecTag_t* hls_parse_codec(const char* codec, int* profile, int* level)
+{
+    const char* params = strchr(codec, '.');
+    int len = params ? (int)(params - codec) : (int)strlen(codec);
+    int ii;
+
+    *profile = FF_PROFILE_UNKNOWN;
+    *level   = FF_LEVEL_UNKNOWN;
+
+    for (ii = 0; g_CodecTags[ii].mTag; ii++)
+    {
+        if (len == 4 && !strncmp(codec, g_CodecTags[ii].mTag, 4))
+            break;
+    }
+    if (!g_CodecTags[ii].mTag)
+        return NULL;
+
+    if (!params++)
+        return &g_CodecTags[ii];
+
+    switch (g_CodecTags[ii].mCodecId)
+    {
+        case AV_CODEC_ID_H264: /* profile_idc, constraint flags, level_idc */
+        {
+            unsigned int value;
+            if (strlen(params) >= 6 && sscanf(params, "%6x", &value) == 1)
+            {
+                *profile = (value >> 16) & 0xff;
+                *level   = value & 0xff;
+            }
+            break;
+        }
+        case AV_CODEC_ID_HEVC: /* [profile space]profile.compat.[LH]level */
+        {
+            const char* ptr = params;
+            if (*ptr >= 'A' && *ptr <= 'C')
+                ptr++;
+            *profile = atoi(ptr);
+            if ((ptr = strstr(params, ".L")) || (ptr = strstr(params, ".H")))
+                *level = atoi(ptr + 2);
+            break;
+        }
+        case AV_CODEC_ID_AAC: /* 40.<audio object type> */
+        {
+            int oti = 0, aot = 0;
+            sscanf(params, "%x.%d", &oti, &aot);
+            if (oti != 0x40 || aot == 34)
+                return NULL; /* mpeg audio in mp4a, not AAC */
+            if (aot > 0)
+                *profile = aot - 1; /* FF_PROFILE_AAC_* */
+            break;
+        }
+        default:
+            break;
+    }
+
+    return &g_CodecTags[ii];
+}
+
+/* Container from extension of first segment (or init section), NULL if unknown */
+static ff_const59 AVInputFormat* hls_guess_input_format(Playlist_t* pls)
+{
+    ff_const59 AVInputFormat* fmt = NULL;
+    PlaylistSnapshot_t* snap = HLS_M3U8_AcquireSnapshot(pls);
+    Segment_t* seg = NULL;
+    char path[MAX_URL_SIZE];
+    char* ext;
+    int ii;
+
+    if (!snap || !(seg = HLS_M3U8_GetSegment(snap, 0)))
+        goto EXIT;
+
+    if (seg->mInitSection)
+    {
+        fmt = av_find_input_format("mov");
+        goto EXIT;
+    }
+
+    av_strlcpy(path, seg->mURL, sizeof(path));
+    path[strcspn(path, "?#")] = '\0';
+
+    ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '/'))
+        goto EXIT;
+    ext++;
+
+    for (ii = 0; ii < sizeof(g_SegmentFormats) / sizeof(g_SegmentFormats[0]); ii++)
+    {
+        if (!av_strcasecmp(ext, g_SegmentFormats[ii].mExt))
+        {
+            fmt = av_find_input_format(g_SegmentFormats[ii].mFormat);
+            break;
+        }
+    }
+
+EXIT:
+    HLS_M3U8_UnrefSegment(seg);
+    HLS_M3U8_ReleaseSnapshot(snap);
+    return fmt;
+}
+
+/*
+ * Fills stream parameters still unknown from CODECS/RESOLUTION/FRAME-RATE of EXT-X-STREAM-INF,
+ * so that outer stream analysis has less to find. Known parameters are never overridden.
+ */
+static void hls_apply_variant_info(AVFormatContext* s, SessionContext_t* session, Variant_t* var)
+{
+    int ii;
+
+    for (ii = 0; ii < session->mStreamInfoCnt; ii++)
+    {
+        AVStream* st = s->streams[session->mStreamInfos[ii]->mId];
+        AVCodecParameters* par = st->codecpar;
+        char codecs[MAX_CODECS_LEN];
+        char* save = NULL;
+        char* tok;
+
+        av_strlcpy(codecs, var->mCodecs, sizeof(codecs));
+        for (tok = strtok_r(codecs, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save))
+        {
+            int profile, level;
+            const CodecTag_t* tag = hls_parse_codec(tok, &profile, &level);
+
+            if (!tag || tag->mType != par->codec_type)
+                continue;
+            if (par->codec_id != AV_CODEC_ID_NONE && par->codec_id != tag->mCodecId)
+                continue;
+
+            par->codec_id = tag->mCodecId;
+            if (par->profile == FF_PROFILE_UNKNOWN)
+                par->profile = profile;
+            if (par->level == FF_LEVEL_UNKNOWN)
+                par->level = level;
+            break;
+        }
+
+        if (par->codec_type != AVMEDIA_TYPE_VIDEO)
+            continue;
+
+        if (var->mWidth > 0 && par->width == 0)
+        {
+            par->width  = var->mWidth;
+            par->height = var->mHeight;
+        }
+
+        if (var->mFrameRate > 0 && st->avg_frame_rate.num == 0)
+        {
+            st->avg_frame_rate = av_d2q(var->mFrameRate, 1001000);
+            if (st->r_frame_rate.num == 0)
+                st->r_frame_rate = st->avg_frame_rate;
+        }
+    }
+}
+
+/*
+ * Opens receiver and sub demuxer of a playlist, blocks until first segment is probed.
+ * Doesn't touch streams or sessions of s, so that sessions can be opened in parallel.
+ */
+static SessionContext_t* hls_session_open(AVFormatContext* s, Playlist_t* pls, int isMainStream)
+{
+    int ret = 0;
+    ff_const59 AVInputFormat *in_fmt = NULL;
+    HLSContext_t* c = (HLSContext_t*)s->priv_data;
+    bool native = c->mNativeTS || c->mNativeCMAF;
+    SessionContext_t* session = (SessionContext_t*)av_mallocz(sizeof(SessionContext_t));
+    if (!session)
+    {
+        LOG_ERROR("failed to alloc session !\n");
+        goto ERROR;
+    }
+
+    session->mOwner = s;
+    session->mPlaylist = pls;
+    session->mPacketPool = c->mPacketPool;
+    session->mNewSegment = true;
+    session->mSegment.mStartPts = AV_NOPTS_VALUE;
+    session->mSegment.mProgramDateTime = AV_NOPTS_VALUE;
+#ifdef ENABLE_ADJUST_PTS
+    session->mTimeline = &c->mTimeline;
+    session->mMainStream = isMainStream;
+    session->mTimeOffset = AV_NOPTS_VALUE;
+    session->mTimelineLastTs = AV_NOPTS_VALUE;
+    session->mTimelineEnd = AV_NOPTS_VALUE;
+    session->mAnchorDateTime = AV_NOPTS_VALUE;
+#endif
+
+    session->mPackets = PacketBuffer_Create(c->mPacketQueueSize, c->mPacketPool);
+    if (!session->mPackets)
+    {
+        LOG_ERROR("failed to create packet buffer !\n");
+        goto ERROR;
+    }
+
+    if (isMainStream)
+        session->mReceiver = HLS_Receiver_Create(pls, c->mIntCB, download_complete_callback, c);
+    else
+        session->mReceiver = HLS_Receiver_Create(pls, c->mIntCB, NULL, c);
+
+    if (!session->mReceiver)
+    {
+        LOG_ERROR("failed to create receiver !\n");
+        goto ERROR;
+    }
+
+    HLS_Receiver_SetContinuous(session->mReceiver, c->mContinuousDemux);
+    HLS_Receiver_SetPrefetchCallback(session->mReceiver, prefetch_callback);
+    HLS_Receiver_Start(session->mReceiver);
+
+    session->mSeekTimestamp = AV_NOPTS_VALUE;
+    session->mSeekStreamIndex = -1;
+
+    if (native && (ret = hls_session_probe(session, TS_PACKET_SIZE * 3)) < 0)
+    {
+        if (ret != AVERROR_EOF || session->mProbeSize == 0)
+        {
+            LOG_ERROR("failed to read first bytes of session ! ret = %d\n", ret);
+            goto ERROR;
+        }
+
+        /* too short to tell, bytes read so far are still replayed to generic demuxer */
+        LOG_INFO("only %d bytes to probe, fall back to generic demuxer\n", session->mProbeSize);
+        native = false;
+    }
+
+    if (native && c->mNativeTS && TSDemuxer_Probe(session->mProbeBuf, session->mProbeSize))
+    {
+        session->mDemuxType = SESSION_DEMUX_TS;
+        if (hls_session_open_ts(session) < 0)
+            goto ERROR;
+
+        goto EXIT;
+    }
+
+    if (native && c->mNativeCMAF && (ret = hls_session_probe_cmaf(session)) > 0 &&
+        hls_session_open_cmaf(session, ret) == 0)
+    {
+        session->mDemuxType = SESSION_DEMUX_CMAF;
+        goto EXIT;
+    }
+
+    session->mBuffer = (unsigned char*)av_malloc(INITIAL_BUFFER_SIZE);
+    if (!session->mBuffer)
+    {
+        LOG_ERROR("failed to alloc buffer !\n");
+        goto ERROR;
+    }
+    session->mBufferSize = INITIAL_BUFFER_SIZE;
+
+    session->mContext = avformat_alloc_context();
+
+    ffio_init_context(&session->mIO, session->mBuffer, session->mBufferSize, 0, session, IORead, NULL, NULL); 
+    session->mIO.seekable = 0;
+    session->mIO.is_segment_media = 1;
+
+    ff_copy_whiteblacklists(session->mContext, s);
+
+    session->mContext->flags = AVFMT_FLAG_CUSTOM_IO;
+    session->mContext->probesize = s->probesize > 0 ? s->probesize : 1024 * 4;
+    session->mContext->max_analyze_duration = s->max_analyze_duration > 0 ? s->max_analyze_duration : 4 * AV_TIME_BASE;
+
+    /* stream parameters come from CODECS, analysis only has to find extradata */
+    if (c->mFastStart && (in_fmt = hls_guess_input_format(pls)))
+    {
+        session->mContext->max_analyze_duration = FAST_START_ANALYZE_DURATION;
+        session->mContext->fps_probe_size = 0;
+    }
+    else if ((ret = av_probe_input_buffer(&session->mIO, &in_fmt, "", NULL, 0, 0)) < 0)
+    {
+        LOG_ERROR("failed to probe input buffer !\n");
+    }
+
+    session->mContext->pb = &session->mIO;
+
+    ret = avformat_open_input(&session->mContext, "", in_fmt, NULL);
+    if (ret < 0)
+    {
+        LOG_ERROR("Open avformat input failed !!\n");
+
+        if (session->mContext)
+            avformat_close_input(&session->mContext);
+        goto ERROR;
+    }
+
+    ret = avformat_find_stream_info(session->mContext, NULL);
+
+    goto EXIT;
+ERROR:
+    if (session)
+    {
+        if (session->mReceiver)
+            HLS_Receiver_Delete(session->mReceiver);
+
+        if (session->mContext)
+            av_free(session->mContext);
+
+        if (session->mTSDemuxer)
+            TSDemuxer_Delete(session->mTSDemuxer);
+
+        if (session->mCMAFDemuxer)
+            CMAFDemuxer_Delete(session->mCMAFDemuxer);
+
+        PacketBuffer_Delete(session->mPackets);
+        av_free(session->mProbeBuf);
+        av_free(session);
+        session = NULL;
+    }
+
+EXIT:
+    return session;
+}
+
+static int hls_session_read_frame(SessionContext_t* session, AVPacket* pkt)
+{
+    if (session->mDemuxType == SESSION_DEMUX_TS)
+        return TSDemuxer_ReadPacket(session->mTSDemuxer, pkt);
+
+    if (session->mDemuxType == SESSION_DEMUX_CMAF)
+        return CMAFDemuxer_ReadPacket(session->mCMAFDemuxer, pkt);
+
+    return av_read_frame(session->mContext, pkt);
+}
+
+static int hls_session_next_segment(SessionContext_t* session)
+{
+    int ret;
+    int ii;
+    AVFormatContext* newContext = NULL;
+#ifdef ENABLE_DEBUG_SEGMENT_PERFORMANCE
+    int64_t startTime = get_tick();
+#endif
+
+__TRACE_ENTER__;
+    avio_reset2(&session->mIO);
+
+    /* bytes are counted from the start of the next segment again */
+    session->mReadPos = 0;
+    session->mBoundaryCnt = 0;
+    session->mNewSegment = true;
+
+    /* PAT/PMT or init section are kept, only partial data of previous segment is dropped */
+    if (session->mDemuxType == SESSION_DEMUX_TS || session->mDemuxType == SESSION_DEMUX_CMAF)
+    {
+        if (session->mDemuxType == SESSION_DEMUX_TS)
+            TSDemuxer_Reset(session->mTSDemuxer);
+        else
+            CMAFDemuxer_Reset(session->mCMAFDemuxer);
+
+        for (ii = 0; ii < session->mStreamInfoCnt; ii++)
+            session->mStreamInfos[ii]->mOrignStartPts = -1;
+        return 0;
+    }
+
+    if (!(newContext = avformat_alloc_context()))
+    {
+        return AVERROR(ENOMEM);
+    }
+    newContext->pb = &session->mIO;
+    ret = avformat_open_input(&newContext, "", NULL, NULL);
+    if (ret < 0)
+    {
+        if (newContext)
+            avformat_close_input(&newContext);
+
+        LOG_ERROR("failed to open input ! ret = %d\n", ret);
+        return ret;
+    }
+
+    /* Change context */
+    if (session->mContext)
+    {
+        avformat_close_input(&session->mContext);
+        session->mContext = NULL;
+    }
+    session->mContext = newContext;
+
+    ret = avformat_find_stream_info(session->mContext, NULL);
+
+    /* streams found after open have no AVStream, their packets are dropped by hls_session_filter_packet */
+    for (ii = 0; ii < session->mContext->nb_streams && ii < session->mStreamInfoCnt; ii++)
+    {
+        StreamInfo_t* streamInfo = session->mStreamInfos[ii];
+        AVStream* ist = session->mContext->streams[ii];
+
+        /* codecpar of outer stream belongs to caller thread, new extradata goes with the next packet */
+        if (ist->codecpar->extradata_size > 0 && ist->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+            (ret = hls_stream_info_set_extradata(streamInfo, ist->codecpar->extradata, ist->codecpar->extradata_size)) != 0)
+        {
+            if (ret < 0)
+            {
+                LOG_ERROR("Alloc extra data is failed !\n");
+                return ret;
+            }
+            streamInfo->mExtraDataChanged = true;
+        }
+        streamInfo->mTimeBase = ist->time_base;
+        streamInfo->mOrignStartPts = -1;
+    }
+
+#ifdef ENABLE_DEBUG_SEGMENT_PERFORMANCE
+    LOG_TRACE("###### Reopen sub demuxer time : [%lld] \n", get_tick() - startTime);
+#endif
+    return 0;
+}
+
+#ifdef ENABLE_ADJUST_PTS
+static void hls_timeline_init(Timeline_t* timeline)
+{
+    memset(timeline, 0x00, sizeof(Timeline_t));
+    pthread_mutex_init(&timeline->mLock, NULL);
+    pthread_cond_init(&timeline->mCond, NULL);
+}
+
+static void hls_timeline_destroy(Timeline_t* timeline)
+{
+    pthread_mutex_destroy(&timeline->mLock);
+    pthread_cond_destroy(&timeline->mCond);
+}
+
+/* Drops offsets of before seek, demux threads are stopped */
+static void hls_timeline_reset(Timeline_t* timeline)
+{
+    pthread_mutex_lock(&timeline->mLock);
+    timeline->mHead = timeline->mCnt = 0;
+    pthread_mutex_unlock(&timeline->mLock);
+}
+
+/* Sessions waiting for main session give up once it stops */
+static void hls_timeline_set_main_running(Timeline_t* timeline, bool running)
+{
+    pthread_mutex_lock(&timeline->mLock);
+    timeline->mMainRunning = running;
+    pthread_cond_broadcast(&timeline->mCond);
+    pthread_mutex_unlock(&timeline->mLock);
+}
+
+/* Wakes waiting sessions to check mExitDemux */
+static void hls_timeline_wake(Timeline_t* timeline)
+{
+    pthread_mutex_lock(&timeline->mLock);
+    pthread_cond_broadcast(&timeline->mCond);
+    pthread_mutex_unlock(&timeline->mLock);
+}
+
+/* Called with timeline locked, NULL if main session has not published seq */
+static TimelineOffset_t* hls_timeline_find(Timeline_t* timeline, int seq)
+{
+    int ii;
+
+    for (ii = 0; ii < timeline->mCnt; ii++)
+    {
+        TimelineOffset_t* entry = &timeline->mOffsets[(timeline->mHead + ii) % MAX_TIMELINE_OFFSETS];
+        if (entry->mSeq == seq)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void hls_timeline_publish(Timeline_t* timeline, int seq, int64_t offset, int64_t start)
+{
+    TimelineOffset_t* entry;
+
+    pthread_mutex_lock(&timeline->mLock);
+
+    if (!(entry = hls_timeline_find(timeline, seq)))
+    {
+        if (timeline->mCnt < MAX_TIMELINE_OFFSETS)
+        {
+            entry = &timeline->mOffsets[(timeline->mHead + timeline->mCnt) % MAX_TIMELINE_OFFSETS];
+            timeline->mCnt++;
+        }
+        else
+        {
+            entry = &timeline->mOffsets[timeline->mHead];
+            timeline->mHead = (timeline->mHead + 1) % MAX_TIMELINE_OFFSETS;
+        }
+    }
+
+    entry->mSeq    = seq;
+    entry->mOffset = offset;
+    entry->mStart  = start;
+    timeline->mLastSeq = seq;
+
+    pthread_cond_broadcast(&timeline->mCond);
+    pthread_mutex_unlock(&timeline->mLock);
+}
+
+/*
+ * Waits main session for offset of seq, at most TIMELINE_WAIT_TIMEOUT since main may be blocked on
+ * its full queue behind this one. Returns false if session has to take its own.
+ */
+static bool hls_timeline_wait(SessionContext_t* session, int seq, TimelineOffset_t* offset)
+{
+    Timeline_t* timeline = session->mTimeline;
+    TimelineOffset_t* entry;
+    struct timespec target;
+
+    clock_gettime(CLOCK_REALTIME, &target);
+    target.tv_sec  += TIMELINE_WAIT_TIMEOUT / 1000;
+    target.tv_nsec += (TIMELINE_WAIT_TIMEOUT % 1000) * 1000000;
+    if (target.tv_nsec >= 1000000000)
+    {
+        target.tv_nsec -= 1000000000;
+        target.tv_sec++;
+    }
+
+    pthread_mutex_lock(&timeline->mLock);
+
+    /* main session which is past seq already never publishes it */
+    while (!(entry = hls_timeline_find(timeline, seq)) && timeline->mMainRunning && !session->mExitDemux &&
+           !(timeline->mCnt > 0 && timeline->mLastSeq > seq))
+    {
+        if (pthread_cond_timedwait(&timeline->mCond, &timeline->mLock, &target) == ETIMEDOUT)
+            break;
+    }
+
+    if (entry)
+        *offset = *entry;
+
+    pthread_mutex_unlock(&timeline->mLock);
+
+    return entry != NULL;
+}
+
+/*
+ * Takes time offset at the first packet of a segment, only if it starts a new discontinuity sequence
+ * or nothing is mapped yet. Sessions other than main take the offset of main session. Main one uses start
+ * of the segment in playlist time, or the one derived from program date time. Without both, the timeline
+ * continues from the end of last mapped packet.
+ */
+static void hls_session_update_timeline(SessionContext_t* session, int64_t ts)
+{
+    int seq = session->mSegment.mDiscontinuitySeq;
+    int64_t dateTime = session->mSegment.mProgramDateTime;
+    int64_t wrap = session->mDtsWrap;
+    TimelineOffset_t shared;
+    int64_t start;
+
+    if (session->mTimeOffset != AV_NOPTS_VALUE && seq == session->mTimelineSeq)
+        return;
+
+    if (session->mTimeline->mShared && !session->mMainStream && hls_timeline_wait(session, seq, &shared))
+    {
+        /* first packets of main and this one may be on different sides of 33 bit wrap */
+        start = ts + shared.mOffset;
+        if (wrap > 0 && start - shared.mStart < -wrap / 2)
+            shared.mOffset += wrap;
+        else if (wrap > 0 && start - shared.mStart > wrap / 2)
+            shared.mOffset -= wrap;
+
+        LOG_INFO("session : %d, discontinuity sequence %d -> %d, time offset %lld -> %lld of main session\n",
+                 session->mIndex, session->mTimelineSeq, seq, session->mTimeOffset, shared.mOffset);
+
+        session->mTimeOffset = shared.mOffset;
+        session->mTimelineSeq = seq;
+        session->mTimelineLastTs = AV_NOPTS_VALUE;
+        return;
+    }
+
+    start = session->mSegment.mStartPts;
+    if (start == AV_NOPTS_VALUE && dateTime != AV_NOPTS_VALUE && session->mAnchorDateTime != AV_NOPTS_VALUE)
+        start = session->mAnchorTime + dateTime - session->mAnchorDateTime;
+    if (start == AV_NOPTS_VALUE)
+        start = session->mTimelineEnd;
+    if (start == AV_NOPTS_VALUE)
+        start = ts; /* live start without playlist time, media time is kept */
+
+    LOG_INFO("session : %d, discontinuity sequence %d -> %d, time offset %lld -> %lld\n", session->mIndex,
+             session->mTimelineSeq, seq, session->mTimeOffset, start - ts);
+
+    session->mTimeOffset = start - ts;
+    session->mTimelineSeq = seq;
+    session->mTimelineLastTs = AV_NOPTS_VALUE;
+
+    if (dateTime != AV_NOPTS_VALUE)
+    {
+        session->mAnchorDateTime = dateTime;
+        session->mAnchorTime = start;
+    }
+
+    if (session->mMainStream)
+        hls_timeline_publish(session->mTimeline, seq, session->mTimeOffset, start);
+}
+
+/* Rewrites pts/dts of packet in AV_TIME_BASE to playlist time, so output is monotonic over discontinuity */
+static void hls_session_map_timestamp(SessionContext_t* session, AVPacket* pkt)
+{
+    StreamInfo_t* streamInfo = session->mStreamInfos[pkt->stream_index];
+    int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    int64_t wrap = session->mDtsWrap;
+    int64_t end;
+
+    if (ts == AV_NOPTS_VALUE)
+        return;
+
+    /* reset at each segment which is read by a new sub demuxer */
+    if (streamInfo->mOrignStartPts == -1)
+    {
+        streamInfo->mOrignStartPts = ts;
+        hls_session_update_timeline(session, ts);
+    }
+
+    /* 33 bit MPEG-TS timestamps wrap inside a discontinuity sequence */
+    if (wrap > 0 && session->mTimelineLastTs != AV_NOPTS_VALUE)
+    {
+        if (ts - session->mTimelineLastTs < -wrap / 2)
+            session->mTimeOffset += wrap;
+        else if (ts - session->mTimelineLastTs > wrap / 2)
+            session->mTimeOffset -= wrap;
+    }
+    session->mTimelineLastTs = ts;
+
+    if (pkt->pts != AV_NOPTS_VALUE)
+        pkt->pts += session->mTimeOffset;
+    if (pkt->dts != AV_NOPTS_VALUE)
+        pkt->dts += session->mTimeOffset;
+
+    end = ts + session->mTimeOffset + _MAX(pkt->duration, 0);
+    if (session->mTimelineEnd == AV_NOPTS_VALUE || end > session->mTimelineEnd)
+        session->mTimelineEnd = end;
+}
+#endif
+
+static void hls_session_apply_boundary(SessionContext_t* session)
+{
+    SegmentBoundary_t* boundary = &session->mBoundaries[session->mBoundaryHead];
+    int ii;
+
+    for (ii = 0; ii < session->mStreamInfoCnt; ii++)
+        session->mStreamInfos[ii]->mSegmentStartPts = boundary->mStartPts;
+
+    /* segment boundary is passed by receiver without reopening sub demuxer */
+    if (boundary->mChanged)
+    {
+        session->mSegmentChanged = true;
+#ifdef ENABLE_DEBUG_SEGMENT_PERFORMANCE
+        LOG_TRACE("###### session : %d continued to next segment at %lld, SegmentPts : %lld\n", session->mIndex, boundary->mPos, boundary->mStartPts);
+#endif
+    }
+
+    session->mSegment = *boundary;
+    session->mBoundaryHead = (session->mBoundaryHead + 1) % MAX_SEGMENT_BOUNDARIES;
+    session->mBoundaryCnt--;
+}
+
+/* Returns false if the packet is dropped, e.g. before seek position */
+static bool hls_session_filter_packet(SessionContext_t* session, AVPacket* pkt)
+{
+    AVRational timeBase;
+
+    /* stream found by sub demuxer after open, e.g. new PMT entry, has no AVStream in outer context */
+    if (pkt->stream_index < 0 || pkt->stream_index >= session->mStreamInfoCnt)
+    {
+        LOG_DEBUG("drop packet of unknown stream %d - session index : %d\n", pkt->stream_index, session->mIndex);
+        return false;
+    }
+    timeBase = session->mStreamInfos[pkt->stream_index]->mTimeBase;
+
+    /* packet without position is taken as the first one after the bytes read so far */
+    while (session->mBoundaryCnt > 0 &&
+           (pkt->pos < 0 || pkt->pos >= session->mBoundaries[session->mBoundaryHead].mPos))
+        hls_session_apply_boundary(session);
+
+    if (session->mSegmentChanged)
+    {
+        pkt->flags = AV_PKT_FLAG_SEGMENT_CHANGED;
+        session->mSegmentChanged = false;
+    }
+
+    if (pkt->pts != AV_NOPTS_VALUE)
+        pkt->pts = av_rescale_q(pkt->pts, timeBase, g_Rational);
+    if (pkt->dts != AV_NOPTS_VALUE)
+        pkt->dts = av_rescale_q(pkt->dts, timeBase, g_Rational);
+    if (pkt->duration > 0)
+        pkt->duration = av_rescale_q(pkt->duration, timeBase, g_Rational);
+
+#ifdef ENABLE_ADJUST_PTS
+    /* before seek check, seek timestamp is in playlist time */
+    hls_session_map_timestamp(session, pkt);
+#endif
+
+    if (session->mSeekTimestamp == AV_NOPTS_VALUE)
+    {
+#ifdef ENABLE_DEBUG_DROP_COUNT
+        if (session->mDropCnt > 0)
+        {
+            LOG_TRACE("@@@@@@@@@ DROP PKT : Session : %d, Cnt : %d\n", session->mIndex, session->mDropCnt);
+            session->mDropCnt = 0;
+        }
+#endif
+        return true;
+    }
+
+    if (session->mSeekStreamIndex < 0  || session->mSeekStreamIndex == pkt->stream_index)
+    {
+        if (pkt->dts == AV_NOPTS_VALUE)
+        {
+            session->mSeekTimestamp = AV_NOPTS_VALUE;
+            return true;
+        }
+
+        if (pkt->dts >= session->mSeekTimestamp 
+            /* && (pkt->flags & AV_PKT_FLAG_KEY) */) // TBD. Check it !!!!
+        {
+            session->mSeekTimestamp = AV_NOPTS_VALUE;
+            return true;
+        }
+    }
+#ifdef ENABLE_DEBUG_DROP_COUNT
+    session->mDropCnt ++;
+#endif
+    return false;
+}
+
+/* Sends extradata changed by reopen with the first packet of its stream, like CMAFDemuxer does */
+static void hls_session_attach_extradata(SessionContext_t* session, AVPacket* pkt)
+{
+    StreamInfo_t* streamInfo = session->mStreamInfos[pkt->stream_index];
+    uint8_t* side;
+
+    if (!streamInfo->mExtraDataChanged)
+        return;
+
+    side = av_packet_new_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA, streamInfo->mExtraDataSize);
+    if (side)
+    {
+        memcpy(side, streamInfo->mExtraData, streamInfo->mExtraDataSize);
+        streamInfo->mExtraDataChanged = false;
+    }
+}
+
+static void* hls_session_demux_proc(void* param)
+{
+    SessionContext_t* session = (SessionContext_t*)param;
+    AVPacket* pkt = NULL;
+    int ret = 0;
+
+    if (session->mNeedNextSegment)
+    {
+        session->mNeedNextSegment = false;
+        hls_session_next_segment(session);
+    }
+
+    while (!session->mExitDemux)
+    {
+        if (!pkt && !(pkt = PacketPool_Get(session->mPacketPool)))
+        {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+
+        ret = hls_session_read_frame(session, pkt);
+        if (session->mExitDemux)
+            break;
+
+        if (ret < 0) /* failed to read frame */
+        {
+            if (ret == AVERROR(EAGAIN))
+            {
+                LOG_INFO("EAGAIN - retry read frame !\n");
+                continue;
+            }
+            else if (ret == AVERROR_EOF)
+            {
+                LOG_INFO("AVERROR_EOF - session index : %d\n", session->mIndex);
+                if ((ret = hls_session_next_segment(session)) != 0)
+                {
+                    LOG_INFO("hls_session_next_segment failed (%d)! end session : index %d\n", ret, session->mIndex);
+                    ret = HLS_SESSION_EOF;
+                    break;
+                }
+
+                session->mSegmentChanged = true;
+                LOG_TRACE("####### session : %d reopened for next segment\n", session->mIndex);
+                continue;
+            }
+            break;
+        }
+
+        if (!hls_session_filter_packet(session, pkt))
+        {
+            av_packet_unref(pkt);
+            continue;
+        }
+        hls_session_attach_extradata(session, pkt);
+
+        /* blocks while queue is full, returns error only when aborted */
+        if (PacketBuffer_Put(session->mPackets, pkt, -1) != BUFFER_SUCCESS)
+            break;
+        pkt = NULL;
+    }
+
+    PacketPool_Put(session->mPacketPool, &pkt);
+
+#ifdef ENABLE_ADJUST_PTS
+    if (session->mMainStream)
+        hls_timeline_set_main_running(session->mTimeline, false);
+#endif
+
+    if (session->mExitDemux)
+        ret = AVERROR_EXIT;
+
+    session->mDemuxResult = ret;
+    PacketBuffer_SetEOS(session->mPackets, true);
+
+    return NULL;
+}
+
+static int hls_session_start_demux(SessionContext_t* session)
+{
+    if (session->mDemuxRunning)
+        return 0;
+
+    session->mExitDemux = false;
+    session->mDemuxResult = 0;
+    session->mStallStart = 0;
+    PacketBuffer_SetAbort(session->mPackets, false);
+    PacketBuffer_SetEOS(session->mPackets, false);
+
+#ifdef ENABLE_ADJUST_PTS
+    if (session->mMainStream)
+        hls_timeline_set_main_running(session->mTimeline, true);
+#endif
+
+    if (pthread_create(&session->mDemuxThread, NULL, hls_session_demux_proc, session))
+    {
+        LOG_ERROR("pthread_create() fault.\n");
+#ifdef ENABLE_ADJUST_PTS
+        if (session->mMainStream)
+            hls_timeline_set_main_running(session->mTimeline, false);
+#endif
+        return -1;
+    }
+    session->mDemuxRunning = true;
+
+    return 0;
+}
+
+/* Stops demux thread and drops all queued packets, sub demuxer state is kept */
+static void hls_session_stop_demux(SessionContext_t* session)
+{
+    if (!session->mDemuxRunning)
+        return;
+
+    session->mExitDemux = true;
+    PacketBuffer_SetAbort(session->mPackets, true);
+    HLS_Receiver_Interrupt(session->mReceiver);
+#ifdef ENABLE_ADJUST_PTS
+    hls_timeline_wake(session->mTimeline);
+#endif
+
+    pthread_join(session->mDemuxThread, NULL);
+    session->mDemuxRunning = false;
+
+    PacketBuffer_Flush(session->mPackets);
+    PacketPool_Put(session->mPacketPool, &session->mPkt);
+}
+
+static void hls_session_close(AVFormatContext* s, SessionContext_t* session)
+{
+    int ii;
+
+    hls_session_stop_demux(session);
+
+    if (session->mReceiver)
+    {
+        HLS_Receiver_Delete(session->mReceiver);
+        session->mReceiver = NULL;
+    }
+
+    if (session->mTSDemuxer)
+    {
+        TSDemuxer_Delete(session->mTSDemuxer);
+        session->mTSDemuxer = NULL;
+    }
+
+    if (session->mCMAFDemuxer)
+    {
+        CMAFDemuxer_Delete(session->mCMAFDemuxer);
+        session->mCMAFDemuxer = NULL;
+    }
+
+    av_freep(&session->mProbeBuf);
+    session->mProbeSize = session->mProbePos = 0;
+
+    for (ii = 0; ii < session->mStreamInfoCnt; ii++)
+    {
+        av_free(session->mStreamInfos[ii]->mExtraData);
+        av_free(session->mStreamInfos[ii]);
+    }
+    av_freep(&session->mStreamInfos);
+    session->mStreamInfoCnt = 0;
+
+    PacketBuffer_Delete(session->mPackets);
+    session->mPackets = NULL;
+
+    if (session->mContext)
+    {
+        avformat_close_input(&session->mContext);
+        session->mContext = NULL;
+
+#if 0 // TBD. Crash, check it 
+        av_free(session->mBuffer);
+#endif
+        session->mBuffer = NULL;
+        session->mBufferSize = 0;
+    }
+
+    // TBD. Check it !!
+    // avio_close(&session->mIO);
+}
+
+static int hls_loader_interrupt_callback(void* opaque)
+{
+    HLSContext_t* c = (HLSContext_t*)opaque;
 
-        dynarray_add(&session->mStreamInfos,  &session->mStreamInfoCnt, streamInfo);
+    if (ff_check_interrupt(c->mIntCB))
+        return 1;
 
-        add_metadata_from_renditions(st, pls);
+    return c->mExitLoader;
+}
 
-        c->mStreamCnt++;
-    }
+/* Sample entry of a codec string, e.g. "avc1" of "avc1.64001f", is looked up in the comma separated list */
+static bool hls_is_codec_allowed(const char* allowed, const char* codec)
+{
+    int len = strcspn(codec, ".");
 
-    goto EXIT;
-ERROR:
-    if (session)
+    while (*allowed)
     {
-        if (!session->mReceiver)
-            HLS_Receiver_Delete(session->mReceiver);
+        int n = strcspn(allowed, ", ");
 
-        if (session->mContext)
-            av_free(session->mContext);
+        if (n == len && !strncmp(allowed, codec, len))
+            return true;
 
-        free(session);
-        session = NULL;
+        allowed += n;
+        allowed += strspn(allowed, ", ");
     }
 
-EXIT:
-    return session;
+    return false;
 }
 
-static int hls_session_next_segment(AVFormatContext* s, SessionContext_t* session)
+/* Attributes which are not given in EXT-X-STREAM-INF never prune a variant */
+static int hls_variant_filter(const Variant_t* var, void* opaque)
 {
-    int ret;
-    int ii;
-    AVFormatContext* newContext = NULL;
+    HLSContext_t* c = (HLSContext_t*)opaque;
 
-__TRACE_ENTER__;
-    avio_reset2(&session->mIO);
-    reset_packet(&session->mPkt);
+    if (c->mMaxWidth > 0 && var->mWidth > c->mMaxWidth)
+        return 0;
+    if (c->mMaxHeight > 0 && var->mHeight > c->mMaxHeight)
+        return 0;
+    if (c->mMaxFrameRate > 0 && var->mFrameRate > c->mMaxFrameRate)
+        return 0;
+    if (c->mMaxBitrate > 0 && var->mBandwidth > c->mMaxBitrate)
+        return 0;
 
-    if (!(newContext = avformat_alloc_context()))
-    {
-        return AVERROR(ENOMEM);
-    }
-    newContext->pb = &session->mIO;
-    ret = avformat_open_input(&newContext, "", NULL, NULL);
-    if (ret < 0)
+    if (c->mAllowedCodecs && c->mAllowedCodecs[0])
     {
-        if (newContext)
-            avformat_close_input(&newContext);
+        char codecs[MAX_CODECS_LEN];
+        char* save = NULL;
+        char* tok;
 
-        LOG_ERROR("failed to open input ! ret = %d\n", ret);
-        return ret;
+        av_strlcpy(codecs, var->mCodecs, sizeof(codecs));
+        for (tok = strtok_r(codecs, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save))
+        {
+            if (!hls_is_codec_allowed(c->mAllowedCodecs, tok))
+                return 0;
+        }
     }
 
-    /* Change context */
-    if (session->mContext)
-    {
-        avformat_close_input(&session->mContext);
-        session->mContext = NULL;
-    }
-    session->mContext = newContext;
+    return 1;
+}
 
-    ret = avformat_find_stream_info(session->mContext, NULL);
-    for (ii = 0; ii < session->mContext->nb_streams; ii++)
-    {
-        AVStream* st = s->streams[session->mStreamInfos[ii]->mId];
-        AVStream* ist = session->mContext->streams[ii];
+/* Called once all playlists are loaded, nothing to write if they all came from the cache */
+static void hls_save_playlist_cache(HLSContext_t* c)
+{
+    if (!c->mPlaylistCacheDir || !c->mPlaylistCacheDir[0] || c->mCacheRestored >= c->mInfo.mPlaylistCnt)
+        return;
 
-        if (ist->codecpar->extradata_size > 0 && ist->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
-        {
-            uint8_t *e;
+    HLS_M3U8_SaveCache(&c->mInfo, c->mPlaylistCacheDir);
+}
 
-            if (st->codecpar->extradata)
-                av_free(st->codecpar->extradata);
+static void* hls_loader_proc(void* param)
+{
+    HLSContext_t* c = (HLSContext_t*)param;
 
-            e = (uint8_t *)av_malloc(ist->codecpar->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
-            if (!e)
-            {
-                LOG_ERROR("Alloc extra data is failed !\n");
-                return AVERROR(ENOMEM);
-            }
-            memcpy(e, ist->codecpar->extradata, ist->codecpar->extradata_size);
-            st->codecpar->extradata = e;
-            st->codecpar->extradata_size = ist->codecpar->extradata_size;
-        }
-        session->mStreamInfos[ii]->mSegmentStartPts = HLS_Receiver_GetCurrentSegmentPts(session->mReceiver);
-        session->mStreamInfos[ii]->mOrignStartPts = -1;
-    }
+    /* failure is not fatal, receiver loads it again on switching */
+    if (HLS_M3U8_LoadAll(&c->mInfo, &c->mLoaderIntCB, c->mPlaylistConnections))
+        LOG_WARN("background loading of playlists is failed\n");
+    else
+        hls_save_playlist_cache(c);
 
-    return 0;
+    return NULL;
 }
 
-static void hls_session_close(AVFormatContext* s, SessionContext_t* session)
+static void hls_start_loader(HLSContext_t* c)
 {
-    if (session->mReceiver)
-    {
-        HLS_Receiver_Delete(session->mReceiver);
-        session->mReceiver = NULL;
-    }
+    c->mLoaderStarted = true;
+    c->mExitLoader = false;
+    c->mLoaderIntCB.callback = hls_loader_interrupt_callback;
+    c->mLoaderIntCB.opaque   = c;
 
-    if (session->mContext)
+    if (pthread_create(&c->mLoaderThread, NULL, hls_loader_proc, c) != 0)
     {
-        avformat_close_input(&session->mContext);
-        session->mContext = NULL;
-
-#if 0 // TBD. Crash, check it 
-        av_free(session->mBuffer);
-#endif
-        session->mBuffer = NULL;
-        session->mBufferSize = 0;
+        LOG_WARN("failed to create loader thread, playlists are loaded on demand\n");
+        c->mLoaderStarted = false;
+        c->mLazyLoad = 0;
     }
+}
 
-    // TBD. Check it !!
-    // avio_close(&session->mIO);
+static void hls_stop_loader(HLSContext_t* c)
+{
+    if (!c->mLoaderStarted)
+        return;
+
+    c->mExitLoader = true;
+    pthread_join(c->mLoaderThread, NULL);
+    c->mLoaderStarted = false;
 }
 
 static int hls_close(AVFormatContext *s)
@@ -390,16 +1739,30 @@ static int hls_close(AVFormatContext *s)
     HLSContext_t* c = (HLSContext_t*)s->priv_data;
     int ii;
 
+    hls_stop_loader(c);
+
     for (ii = 0; ii < c->mSessionCnt; ii++)
     {
         SessionContext_t* session = c->mSessions[ii];
         hls_session_close(s, session);
     }
 
+    HLS_ABR_Delete(c->mABR);
+    c->mABR = NULL;
+
+    PacketInterleaver_Delete(c->mInterleaver);
+    c->mInterleaver = NULL;
+
+    PacketPool_Delete(c->mPacketPool);
+    c->mPacketPool = NULL;
+
     // TBD. IMPLEMENTS HERE
 
     HLS_M3U8_Delete(&c->mInfo);
     pthread_mutex_destroy(&c->mLock);
+#ifdef ENABLE_ADJUST_PTS
+    hls_timeline_destroy(&c->mTimeline);
+#endif
 
     return 0;
 }
@@ -437,6 +1800,119 @@ static int hls_change_playlist_manually(HLSContext_t* c)
     return 0;
 }
 
+typedef struct SessionOpenTask_s {
+    AVFormatContext*  mOwner;
+    Playlist_t*       mPlaylist;
+    int               mIsMainStream;
+
+    pthread_t         mThread;
+    bool              mStarted;
+    SessionContext_t* mSession;
+} SessionOpenTask_t;
+
+static void* hls_session_open_proc(void* param)
+{
+    SessionOpenTask_t* task = (SessionOpenTask_t*)param;
+
+    task->mSession = hls_session_open(task->mOwner, task->mPlaylist, task->mIsMainStream);
+    return NULL;
+}
+
+/*
+ * Opens sessions of a variant concurrently, startup takes the slowest rendition instead of sum of them.
+ * Returns the first error if any playlist fails to open, sessions of the others are kept anyway.
+ */
+static int hls_open_sessions(AVFormatContext* s, Variant_t* var)
+{
+    HLSContext_t* c = (HLSContext_t*)s->priv_data;
+    SessionOpenTask_t* tasks;
+    int ii, err, ret = 0;
+
+    tasks = (SessionOpenTask_t*)av_mallocz(var->mPlaylistCnt * sizeof(SessionOpenTask_t));
+    if (!tasks)
+        return AVERROR(ENOMEM);
+
+    for (ii = 0; ii < var->mPlaylistCnt; ii++)
+    {
+        SessionOpenTask_t* task = &tasks[ii];
+
+        task->mOwner        = s;
+        task->mPlaylist     = var->mPlaylists[ii];
+        task->mIsMainStream = (ii == 0);
+
+        /* last one or failed to create thread, open on this thread */
+        if (ii < var->mPlaylistCnt - 1 && pthread_create(&task->mThread, NULL, hls_session_open_proc, task) == 0)
+            task->mStarted = true;
+        else
+            hls_session_open_proc(task);
+    }
+
+    for (ii = 0; ii < var->mPlaylistCnt; ii++)
+    {
+        SessionOpenTask_t* task = &tasks[ii];
+        SessionContext_t* session;
+
+        if (task->mStarted)
+            pthread_join(task->mThread, NULL);
+
+        if (!(session = task->mSession))
+        {
+            LOG_ERROR("failed to open session of playlist %d !\n", ii);
+            ret = ret < 0 ? ret : AVERROR(EIO);
+            continue;
+        }
+
+        session->mIndex = c->mSessionCnt;
+        if ((err = hls_session_add_streams(s, session)) < 0)
+        {
+            LOG_ERROR("failed to add streams of playlist %d ! ret = %d\n", ii, err);
+            hls_session_close(s, session);
+            av_free(session);
+            ret = ret < 0 ? ret : err;
+            continue;
+        }
+
+        hls_apply_variant_info(s, session, var);
+        dynarray_add(&c->mSessions, &c->mSessionCnt, session);
+    }
+
+#ifdef ENABLE_ADJUST_PTS
+    /* without main session every session maps on its own */
+    c->mTimeline.mShared = c->mSessionCnt > 1 && c->mSessions[0]->mMainStream;
+#endif
+
+    av_free(tasks);
+    return ret;
+}
+
+/*
+ * Total duration of finished playlist. EVENT playlist only grows, so its duration and start time are
+ * updated whenever the main playlist is reloaded. Sliding live window has no duration.
+ */
+static void hls_update_duration(AVFormatContext* s)
+{
+    HLSContext_t* c = (HLSContext_t*)s->priv_data;
+    Playlist_t* pls = c->mInfo.mVariants[c->mVariantIndex]->mPlaylists[0];
+    PlaylistSnapshot_t* snap = HLS_M3U8_AcquireSnapshot(pls);
+
+    if (pls != c->mDurationPlaylist || snap->mVersion != c->mDurationVersion)
+    {
+        c->mDurationPlaylist = pls;
+        c->mDurationVersion  = snap->mVersion;
+
+        if (snap->mSegmentCnt > 0 && snap->mFinished)
+            s->duration = HLS_M3U8_GetDuration(snap);
+        else if (snap->mSegmentCnt > 0 && snap->mType == PLS_TYPE_EVENT &&
+                 HLS_M3U8_GetSegmentStartPts(snap, 0) != AV_NOPTS_VALUE)
+        {
+            s->start_time = HLS_M3U8_GetSegmentStartPts(snap, 0);
+            s->duration   = HLS_M3U8_GetDuration(snap);
+        }
+    }
+
+    HLS_M3U8_ReleaseSnapshot(snap);
+}
+
 static int hls_read_header(AVFormatContext* s)
 {
     HLSContext_t* c = (HLSContext_t*)s->priv_data;
@@ -446,14 +1922,33 @@ static int hls_read_header(AVFormatContext* s)
 
     c->mIntCB = &s->interrupt_callback;
 
+#ifdef ENABLE_DEBUG_STARTUP_PERFORMANCE
+    c->mStartupTime = get_tick();
+    c->mFirstPacket = true;
+#endif
+
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
     pthread_mutex_init(&c->mLock, &attr);
     pthread_mutexattr_destroy(&attr);
+#ifdef ENABLE_ADJUST_PTS
+    hls_timeline_init(&c->mTimeline);
+#endif
+
+    c->mPacketPool = PacketPool_Create(PACKET_POOL_SIZE);
 
     /* Download and Parse HLS M3U8 file */
     do {
-        ret = HLS_M3U8_Parse(&c->mInfo, s->url, c->mIntCB, NULL);
+        ret = HLS_M3U8_OpenMaster(&c->mInfo, s->url, c->mPlaylistCacheDir, c->mPlaylistCacheTTL, c->mIntCB);
+        if (ret == 0 && HLS_M3U8_FilterVariants(&c->mInfo, hls_variant_filter, c) < 0)
+            LOG_WARN("failed to prune variants, all are kept\n");
+        if (ret == 0 && c->mPlaylistCacheDir && c->mPlaylistCacheDir[0])
+        {
+            int restored = HLS_M3U8_LoadCache(&c->mInfo, c->mPlaylistCacheDir);
+            c->mCacheRestored = _MAX(restored, 0);
+        }
+        if (ret == 0 && !c->mLazyLoad && (ret = HLS_M3U8_LoadAll(&c->mInfo, c->mIntCB, c->mPlaylistConnections)) == 0)
+            hls_save_playlist_cache(c);
         if (ret < 0)
         {
             LOG_ERROR("cannot parse M3U8 !\n");
@@ -463,40 +1958,72 @@ static int hls_read_header(AVFormatContext* s)
         HLS_M3U8_Dump(&c->mInfo);
     } while (0);
 
-    /* Calculate total duration */
-    do {
-        int64_t duration = 0;
-        Playlist_t* pls = c->mInfo.mVariants[0]->mPlaylists[0];
-        if(pls && pls->mFinished)
-        {
-            for (ii = 0; ii < pls->mSegmentCnt; ii++)
-                duration += pls->mSegments[ii]->mDuration;
+#ifdef ENABLE_DEBUG_STARTUP_PERFORMANCE
+    LOG_TRACE("###### Startup : parse m3u8 [%lld]\n", get_tick() - c->mStartupTime);
+#endif
 
-            s->duration = duration;
-        }
+    do {
+        ABRConfig_t config;
+        int* bandwidths = (int*)av_malloc_array(c->mInfo.mVariantCnt, sizeof(int));
+        if (!bandwidths)
+            return AVERROR(ENOMEM);
+
+        for (ii = 0; ii < c->mInfo.mVariantCnt; ii++)
+            bandwidths[ii] = c->mInfo.mVariants[ii]->mBandwidth;
+
+        config.mPolicy            = (ABRPolicy_e)c->mABRPolicy;
+        config.mSafetyMargin      = c->mABRSafetyMargin;
+        config.mMinSwitchInterval = (int64_t)c->mABRMinSwitchInterval * 1000;
+        config.mMinBuffer         = (int64_t)c->mABRMinBuffer * 1000;
+        config.mBufferTarget      = (int64_t)c->mABRBufferTarget * 1000;
+
+        c->mABR = HLS_ABR_Create(&config, bandwidths, c->mInfo.mVariantCnt);
+        av_free(bandwidths);
     } while (0);
 
-    do {
-        Variant_t* var = NULL;
-        
-        if (c->mManualVariantIndex < 0 )
-            c->mVariantIndex = 0;
-            
-        else if (c->mManualVariantIndex >= c->mInfo.mVariantCnt)
-        {
-            c->mManualVariantIndex = c->mInfo.mVariantCnt -1;
-            c->mVariantIndex = c->mManualVariantIndex;
-        }
+    if (c->mManualVariantIndex < 0)
+        c->mVariantIndex = 0;
+    else if (c->mManualVariantIndex >= c->mInfo.mVariantCnt)
+    {
+        c->mManualVariantIndex = c->mInfo.mVariantCnt -1;
+        c->mVariantIndex = c->mManualVariantIndex;
+    }
+
+    /* only the starting variant and its renditions are needed to open */
+    if (c->mLazyLoad && (ret = HLS_M3U8_LoadVariant(c->mInfo.mVariants[c->mVariantIndex], c->mIntCB, NULL)) < 0)
+    {
+        LOG_ERROR("cannot load playlists of variant %d !\n", c->mVariantIndex);
+        return ret;
+    }
 
-        var = c->mInfo.mVariants[c->mVariantIndex];
+    hls_update_duration(s);
+
+    do {
+        Variant_t* var = c->mInfo.mVariants[c->mVariantIndex];
 
         c->mProbe = 1;
-        for (ii = 0; ii < var->mPlaylistCnt; ii++)
+        ret = hls_open_sessions(s, var);
+        c->mProbe = 0;
+
+        if (c->mSessionCnt == 0)
         {
-            Playlist_t* playlist = var->mPlaylists[ii];
-            hls_session_open(s, playlist, ii == 0);
+            LOG_ERROR("no session of variant %d is opened !\n", c->mVariantIndex);
+            return ret < 0 ? ret : AVERROR_INVALIDDATA;
         }
-        c->mProbe = 0;
+        if (ret < 0)
+            LOG_WARN("%d of %d playlists failed to open, play the others\n", var->mPlaylistCnt - c->mSessionCnt, var->mPlaylistCnt);
+
+#ifdef ENABLE_DEBUG_STARTUP_PERFORMANCE
+        LOG_TRACE("###### Startup : open %d sessions [%lld]\n", c->mSessionCnt, get_tick() - c->mStartupTime);
+#endif
+
+        if (!(c->mInterleaver = PacketInterleaver_Create(c->mSessionCnt)))
+            return AVERROR(ENOMEM);
+        for (ii = 0; ii < c->mSessionCnt; ii++)
+            PacketInterleaver_SetWrap(c->mInterleaver, ii, c->mSessions[ii]->mDtsWrap);
+
+        for (ii = 0; ii < c->mSessionCnt; ii++)
+            hls_session_start_demux(c->mSessions[ii]);
 
 #ifdef ENABLE_DEBUG_ADAPTIVE_INFO
         LOG_ERROR("Set Adaptive - BandWidth: %d\n", var->mBandwidth);
@@ -506,153 +2033,190 @@ __TRACE_LEAVE__;
     return 0;
 }
 
+/* Hands result of PacketBuffer_Get() on a pending session to interleaver. Returns 0 if it has a head packet or ended */
+static int hls_session_admit(HLSContext_t* c, SessionContext_t* session, int result, AVPacket* pkt)
+{
+    int ret;
+
+    if (result == BUFFER_SUCCESS)
+    {
+        if (session->mStallStart)
+            LOG_DEBUG("session %d is back after %lld us\n", session->mIndex, get_tick() - session->mStallStart);
+        session->mPkt = pkt;
+        session->mStallStart = 0;
+        PacketInterleaver_Push(c->mInterleaver, session->mIndex, pkt->dts);
+        return 0;
+    }
+
+    /* queue is drained and demux thread is finished */
+    ret = session->mDemuxResult;
+    if (ret == HLS_SESSION_EOF)
+    {
+        LOG_INFO("HLS_SESSION_EOF - end session : index %d\n", session->mIndex);
+        session->mEOF = 1;
+        session->mStallStart = 0;
+        PacketInterleaver_End(c->mInterleaver, session->mIndex);
+        return 0;
+    }
+    else if (ret == AVERROR_EXIT)
+    {
+        LOG_INFO("AVERROR_EXIT - end play\n");
+        return ret;
+    }
+
+    LOG_ERROR("session terminated with error : %d\n", ret);
+    return ret < 0 ? ret : AVERROR(EIO);
+}
+
+/*
+ * Whether head packet of dts goes out while the pending session has none yet.
+ * The session can't provide one before its last dts, so it is waited for only within the window, up to the timeout.
+ * Returns -1 if so, otherwise ms left to wait for it.
+ */
+static int hls_session_wait_time(HLSContext_t* c, SessionContext_t* session, int64_t head, int64_t now)
+{
+    int64_t last, left;
+
+    if (head == AV_NOPTS_VALUE)
+        return -1;
+
+    last = PacketInterleaver_GetLastDts(c->mInterleaver, session->mIndex);
+    if (last != AV_NOPTS_VALUE && (head <= last || head - last > (int64_t)c->mInterleaveWindow * 1000))
+        return -1;
+
+    if (!session->mStallStart)
+        session->mStallStart = now;
+
+    left = session->mStallStart + (int64_t)c->mInterleaveTimeout * 1000 - now;
+    if (left <= 0)
+    {
+        LOG_DEBUG("session %d is stalled, head packet goes out without it\n", session->mIndex);
+        return -1;
+    }
+
+    return (int)((left + 999) / 1000);
+}
+
 static int hls_read_packet(AVFormatContext *s, AVPacket *out_pkt)
 {
     HLSContext_t* c = (HLSContext_t*)s->priv_data;
-    int ii, ret;
-    int minPtsIndex = -1;
+    SessionContext_t* session = NULL;
+    AVPacket* pkt = NULL;
+    int64_t head, now;
+    int ii, index, wait, left, seekCnt, ret;
 
 //    hls_change_playlist_manually(c);
 
     pthread_mutex_lock(&c->mLock);
 
-    for (ii = 0; ii < c->mSessionCnt; ii++)
+    while (1)
     {
-        SessionContext_t* session = c->mSessions[ii];
-       
-        if (session->mEOF)
-            continue;
+        /* only sessions whose head packet is output need a new one, others stay in heap */
+        for (ii = 0; ii < PacketInterleaver_GetPendingCount(c->mInterleaver); )
+        {
+            session = c->mSessions[PacketInterleaver_GetPending(c->mInterleaver, ii)];
 
-        if (!session->mPkt.data)
+            if ((ret = PacketBuffer_Get(session->mPackets, &pkt, 0)) == BUFFER_ERROR_EMPTY)
+                ii++;
+            else if ((ret = hls_session_admit(c, session, ret, pkt)) < 0)
+                goto EXIT;
+        }
+
+        /* pending sessions are stalled, head packet goes out unless one of them may still precede it */
+        session = NULL;
+        wait = PACKET_WAIT_TIMEOUT;
+        if (PacketInterleaver_Peek(c->mInterleaver, &head) >= 0)
         {
-            while (1)
+            now = get_tick();
+            for (ii = 0; ii < PacketInterleaver_GetPendingCount(c->mInterleaver); ii++)
             {
-                ret = av_read_frame(session->mContext, &session->mPkt);
-                if (ret < 0) /* failed to read frame */
-                {
-                    if (ret == AVERROR(EAGAIN))
-                    {
-                        LOG_INFO("EAGAIN - retry read frame !\n");
-                        continue;
-                    }
-                    else if (ret == AVERROR_EOF)
-                    {
-                        LOG_INFO("AVERROR_EOF - session index : %d\n", ii);
-                        if ((ret = hls_session_next_segment(s, session)) == 0)
-                        {
-                            c->mIsSegmentChanged = true;    
-                            LOG_TRACE("####### session : %d SegmentPts : %lld\n", ii, session->mStreamInfos[0]->mSegmentStartPts);
-                        }
-                        else
-                        {
-                            LOG_INFO("hls_session_next_segment failed (%d)! end session : index %d\n", ret, ii);
-                            session->mEOF = 1;
-                            break;
-                        }
-                        continue;
-                    }
-                    else if (ret == HLS_SESSION_EOF)
-                    {
-                        LOG_INFO("HLS_SESSION_EOF - end session : index %d\n", ii);
-                        session->mEOF = 1;
-                        break;
-                    }
-                    else if (ret == AVERROR_EXIT)
-                    {
-                        LOG_INFO("AVERROR_EXIT - end play\n");
-                        goto EXIT;
-                    }
-
-                    LOG_ERROR("session terminated with error : %d\n", ret);
-                    goto EXIT;
-                }
-                else /* Successed to read frame */
-                {
-                    AVPacket* pkt = &session->mPkt;
-                    AVStream* ist = session->mContext->streams[pkt->stream_index];
-
-                    if (c->mIsSegmentChanged)
-                    {
-                        pkt->flags = AV_PKT_FLAG_SEGMENT_CHANGED;
-                        c->mIsSegmentChanged = false;
-                    }
-
-                    if (pkt->pts != AV_NOPTS_VALUE)
-                        pkt->pts = av_rescale_q(pkt->pts, ist->time_base, g_Rational);
-                    if (pkt->dts != AV_NOPTS_VALUE)
-                        pkt->dts = av_rescale_q(pkt->dts, ist->time_base, g_Rational);
-                }
-
-                if (session->mSeekTimestamp == AV_NOPTS_VALUE)
-                {
-#ifdef ENABLE_DEBUG_DROP_COUNT
-                    if (session->mDropCnt > 0)
-                    {
-                        LOG_TRACE("@@@@@@@@@ DROP PKT : Session : %d, Cnt : %d\n", ii, session->mDropCnt);
-                        session->mDropCnt = 0;
-                    }
-#endif
-                    break;
-                }
+                SessionContext_t* pending = c->mSessions[PacketInterleaver_GetPending(c->mInterleaver, ii)];
 
-                if (session->mSeekStreamIndex < 0  || session->mSeekStreamIndex == session->mPkt.stream_index)
+                if ((left = hls_session_wait_time(c, pending, head, now)) >= 0 && !session)
                 {
-                    if (session->mPkt.dts == AV_NOPTS_VALUE)
-                    {
-                        session->mSeekTimestamp = AV_NOPTS_VALUE;
-                        break;
-                    }
-
-                    if (session->mPkt.dts >= session->mSeekTimestamp 
-                        /* && (session->mPkt.flags & AV_PKT_FLAG_KEY) */) // TBD. Check it !!!!
-                    {
-                        session->mSeekTimestamp = AV_NOPTS_VALUE;
-                        break;
-                    }
+                    session = pending;
+                    wait = _MIN(wait, left);
                 }
-#ifdef ENABLE_DEBUG_DROP_COUNT
-                session->mDropCnt ++;
-#endif
-                av_packet_unref(&session->mPkt);
             }
-
-            if (!session->mPkt.data)
-                continue;
+            if (!session)
+                break;
         }
-    }
+        else if (PacketInterleaver_GetPendingCount(c->mInterleaver) > 0)
+            session = c->mSessions[PacketInterleaver_GetPending(c->mInterleaver, 0)];
+        else
+            break;
 
-    for (ii = 0; ii  < c->mSessionCnt; ii++)
-    {
-        SessionContext_t* session = c->mSessions[ii];
-        if (session->mEOF == 1)
-            continue;
+        if (ff_check_interrupt(c->mIntCB))
+        {
+            LOG_INFO("interrupted while waiting packet - session index : %d\n", session->mIndex);
+            ret = AVERROR_EXIT;
+            goto EXIT;
+        }
 
-        if (!session->mPkt.data)
-            continue;
+        /* seek may run meanwhile, it stops demux threads under mLock */
+        seekCnt = c->mSeekCnt;
+        pthread_mutex_unlock(&c->mLock);
+        ret = PacketBuffer_Get(session->mPackets, &pkt, _MAX(wait, 1));
+        pthread_mutex_lock(&c->mLock);
 
-        if (minPtsIndex == -1)
-            minPtsIndex = ii;
-        else
+        if (seekCnt != c->mSeekCnt)
         {
-            int64_t dts    = session->mPkt.dts;
-            int64_t mindts = c->mSessions[minPtsIndex]->mPkt.dts;
-
-            if (dts == AV_NOPTS_VALUE || av_compare_mod(dts, mindts, 1LL << 33) < 0)
-                minPtsIndex = ii;
+            if (ret == BUFFER_SUCCESS)
+                PacketPool_Put(session->mPacketPool, &pkt);
+            continue;
         }
+        if (ret == BUFFER_ERROR_TIMEOUT)
+            continue;
+        if ((ret = hls_session_admit(c, session, ret, pkt)) < 0)
+            goto EXIT;
     }
-    if (minPtsIndex == -1)
+
+#ifdef ENABLE_DEBUG_INTERLEAVE_PERFORMANCE
+    int64_t startTime = get_tick();
+#endif
+
+    if ((index = PacketInterleaver_Pop(c->mInterleaver)) < 0)
     {
-        LOG_INFO("minPtsIndex is -1\n");
+        LOG_INFO("all sessions are finished\n");
         ret = AVERROR_EOF;
         goto EXIT;
     }
 
-    *out_pkt = c->mSessions[minPtsIndex]->mPkt;
-    out_pkt->stream_index = c->mSessions[minPtsIndex]->mStreamInfos[out_pkt->stream_index]->mId;
-    reset_packet(&c->mSessions[minPtsIndex]->mPkt);
+    session = c->mSessions[index];
+    av_packet_move_ref(out_pkt, session->mPkt);
+    /* queued packets are of known streams only, see hls_session_filter_packet */
+    out_pkt->stream_index = session->mStreamInfos[out_pkt->stream_index]->mId;
+    PacketPool_Put(session->mPacketPool, &session->mPkt);
     ret = 0;
 
+    hls_update_duration(s);
+
+    /* first frame is out, rest of the ladder is loaded without delaying startup */
+    if (c->mLazyLoad && !c->mLoaderStarted)
+        hls_start_loader(c);
+
+#ifdef ENABLE_DEBUG_STARTUP_PERFORMANCE
+    if (c->mFirstPacket)
+    {
+        LOG_TRACE("###### Startup : first packet [%lld]\n", get_tick() - c->mStartupTime);
+        c->mFirstPacket = false;
+    }
+#endif
+
+#ifdef ENABLE_DEBUG_INTERLEAVE_PERFORMANCE
+    c->mInterleaveTime += get_tick() - startTime;
+    if (c->mInterleaveCnt++ == 0)
+        c->mInterleaveStart = startTime;
+    else if (c->mInterleaveCnt == 10000)
+    {
+        int64_t elapsed = get_tick() - c->mInterleaveStart;
+        LOG_TRACE("###### Interleave : sessions %d, %lld pkt/s, %lld ns/pkt in interleaver\n", c->mSessionCnt,
+                  elapsed > 0 ? c->mInterleaveCnt * 1000000LL / elapsed : 0LL, c->mInterleaveTime * 1000 / c->mInterleaveCnt);
+        c->mInterleaveCnt = 0;
+        c->mInterleaveTime = 0;
+    }
+#endif
+
 EXIT:
     pthread_mutex_unlock(&c->mLock);
 
@@ -662,22 +2226,18 @@ EXIT:
 #ifdef ENABLE_SEGMENT_SEEK
 static int64_t get_seek_timestamp_of_main_stream(HLSContext_t* c, int64_t timestamp)
 {
-    int ii;
-    Segment_t* segToSeek = NULL;
+    int index;
+    int64_t pts = timestamp;
     Variant_t* var = c->mInfo.mVariants[c->mVariantIndex];
     
-    Playlist_t* pls = var->mPlaylists[0]; // Main Stream
-    segToSeek = pls->mSegments[0];
-
-    for (ii = 0; ii < pls->mSegmentCnt; ii++)
-    {
-        segToSeek = pls->mSegments[ii];
+    PlaylistSnapshot_t* snap = HLS_M3U8_AcquireSnapshot(var->mPlaylists[0]); // Main Stream
+    int64_t firstPts = snap->mSegmentCnt > 0 ? HLS_M3U8_GetSegmentStartPts(snap, 0) : AV_NOPTS_VALUE;
 
-        if (segToSeek->mStartPts + segToSeek->mDuration > timestamp)
-            break;
-    }
+    if (firstPts != AV_NOPTS_VALUE && (index = HLS_M3U8_FindSegment(snap, timestamp - firstPts)) >= 0)
+        pts = HLS_M3U8_GetSegmentStartPts(snap, index);
+    HLS_M3U8_ReleaseSnapshot(snap);
 
-    return segToSeek->mStartPts;
+    return pts;
 }
 #endif
 
@@ -705,7 +2265,7 @@ static int hls_read_seek(AVFormatContext *s, int stream_index, int64_t timestamp
         SessionContext_t* session = c->mSessions[ii];
         LOG_INFO("ii : %d, session : %p\n", ii, session);
 
-        for (jj = 0; jj < session->mContext->nb_streams; jj++)
+        for (jj = 0; jj < session->mStreamInfoCnt; jj++)
         {
             StreamInfo_t* streamInfo = session->mStreamInfos[jj];
             if (streamInfo->mId == stream_index)
@@ -724,20 +2284,33 @@ static int hls_read_seek(AVFormatContext *s, int stream_index, int64_t timestamp
         goto EXIT;
     }
 
+    for (ii = 0; ii < c->mSessionCnt; ii++)
+        hls_session_stop_demux(c->mSessions[ii]);
+
+    PacketInterleaver_Reset(c->mInterleaver);
+    c->mSeekCnt++;
+#ifdef ENABLE_ADJUST_PTS
+    hls_timeline_reset(&c->mTimeline);
+#endif
+
     for (ii = 0; ii < c->mSessionCnt; ii++)
     {
         SessionContext_t* session = c->mSessions[ii];
 
-        av_packet_unref(&session->mPkt);
-
         avio_reset2(&session->mIO);
+        session->mProbeSize = session->mProbePos = 0;
         session->mEOF = 0;
 #ifdef ENABLE_DEBUG_DROP_COUNT
         session->mDropCnt = 0;
 #endif
 
-        ff_read_frame_flush(session->mContext);
+        if (session->mContext)
+            ff_read_frame_flush(session->mContext);
         session->mSeekTimestamp = seek_timestamp;
+#ifdef ENABLE_ADJUST_PTS
+        session->mTimeOffset = AV_NOPTS_VALUE;
+        session->mTimelineEnd = AV_NOPTS_VALUE;
+#endif
 
         if (session_to_seek == session)
             session->mSeekStreamIndex = stream_subdemuxer_index;
@@ -746,7 +2319,8 @@ static int hls_read_seek(AVFormatContext *s, int stream_index, int64_t timestamp
 
         HLS_Receiver_Seek(session->mReceiver, seek_timestamp);
 
-        hls_session_next_segment(s, session);
+        session->mNeedNextSegment = true;
+        hls_session_start_demux(session);
     }
     ret = 0;
 
@@ -772,13 +2346,37 @@ static int hls_probe(const AVProbeData *p)
 
 #define OFFSET(x) offsetof(HLSContext_t, x)
 #define FLAGS AV_OPT_FLAG_DECODING_PARAM
+#define RUNTIME_FLAGS (FLAGS | AV_OPT_FLAG_RUNTIME_PARAM) /* downstream feedback, updated by player with av_opt_set() */
 static const AVOption hls_options[] = {
     {"manual_index", "manual index to select variant index, -1 mean auto", OFFSET(mManualVariantIndex), AV_OPT_TYPE_INT, {.i64 = 3}, 0, INT_MAX, FLAGS},
-    {"codec_buf_level",       "setting codec buffer level",    OFFSET(mCodecBufLevel),      AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, FLAGS},
-    {"codec_video_buf_size",  "setting codec video buf size",  OFFSET(mCodecVideoBufSize),  AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, FLAGS},
-    {"codec_audio_buf_size",  "setting codec audio buf size",  OFFSET(mCodecAudioBufSize),  AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, FLAGS},
-    {"codec_video_data_size", "setting codec video data size", OFFSET(mCodecVideoDataSize), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, FLAGS},
-    {"codec_audio_data_size", "setting codec audio data size", OFFSET(mCodecAudioDataSize), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, FLAGS},
+    {"native_ts", "use in-tree demuxer for MPEG-TS segments", OFFSET(mNativeTS), AV_OPT_TYPE_BOOL, {.i64 = 1}, 0, 1, FLAGS},
+    {"native_cmaf", "use in-tree demuxer for fragmented mp4 segments", OFFSET(mNativeCMAF), AV_OPT_TYPE_BOOL, {.i64 = 1}, 0, 1, FLAGS},
+    {"packet_queue_size", "max packets read ahead by demux thread of each session", OFFSET(mPacketQueueSize), AV_OPT_TYPE_INT, {.i64 = 256}, 1, INT_MAX, FLAGS},
+    {"interleave_window", "ms of dts output may lead a stalled session before it goes on without it", OFFSET(mInterleaveWindow), AV_OPT_TYPE_INT, {.i64 = 1000}, 0, INT_MAX, FLAGS},
+    {"interleave_timeout", "ms output waits for a stalled session before it goes on without it", OFFSET(mInterleaveTimeout), AV_OPT_TYPE_INT, {.i64 = 1000}, 0, INT_MAX, FLAGS},
+    {"lazy_load", "load playlists of other variants in background after first packet", OFFSET(mLazyLoad), AV_OPT_TYPE_BOOL, {.i64 = 1}, 0, 1, FLAGS},
+    {"playlist_connections", "max concurrent playlist requests to each host", OFFSET(mPlaylistConnections), AV_OPT_TYPE_INT, {.i64 = MAX_PLAYLIST_CONNECTIONS_PER_HOST}, 1, MAX_PLAYLIST_LOADERS, FLAGS},
+    {"max_resolution", "prune variants of larger RESOLUTION, WxH", OFFSET(mMaxWidth), AV_OPT_TYPE_IMAGE_SIZE, {.str = NULL}, 0, 0, FLAGS},
+    {"max_frame_rate", "prune variants of higher FRAME-RATE, 0 for no limit", OFFSET(mMaxFrameRate), AV_OPT_TYPE_DOUBLE, {.dbl = 0}, 0, 1000, FLAGS},
+    {"max_bitrate", "prune variants of higher BANDWIDTH in bit/s, 0 for no limit", OFFSET(mMaxBitrate), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, FLAGS},
+    {"allowed_codecs", "comma separated sample entries of CODECS to accept, e.g. avc1,mp4a", OFFSET(mAllowedCodecs), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, FLAGS},
+    {"playlist_cache_dir", "directory to keep parsed VOD playlists for the next open", OFFSET(mPlaylistCacheDir), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, FLAGS},
+    {"playlist_cache_ttl", "seconds cached master is used without revalidation", OFFSET(mPlaylistCacheTTL), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, FLAGS},
+    {"fast_start", "skip container probing and shorten analysis using CODECS of variant", OFFSET(mFastStart), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, FLAGS},
+    {"continuous_demux", "keep sub demuxer open over segment boundary", OFFSET(mContinuousDemux), AV_OPT_TYPE_BOOL, {.i64 = 1}, 0, 1, FLAGS},
+    {"abr_policy", "adaptive bitrate policy", OFFSET(mABRPolicy), AV_OPT_TYPE_INT, {.i64 = ABR_POLICY_THROUGHPUT}, ABR_POLICY_THROUGHPUT, ABR_POLICY_HYBRID, FLAGS, "abr_policy"},
+        {"throughput", "highest variant below estimated throughput", 0, AV_OPT_TYPE_CONST, {.i64 = ABR_POLICY_THROUGHPUT}, 0, 0, FLAGS, "abr_policy"},
+        {"bola",       "buffer based (BOLA)",                         0, AV_OPT_TYPE_CONST, {.i64 = ABR_POLICY_BOLA},       0, 0, FLAGS, "abr_policy"},
+        {"hybrid",     "throughput at low buffer, BOLA otherwise",    0, AV_OPT_TYPE_CONST, {.i64 = ABR_POLICY_HYBRID},     0, 0, FLAGS, "abr_policy"},
+    {"abr_safety_margin", "percent of estimated throughput left unused", OFFSET(mABRSafetyMargin), AV_OPT_TYPE_INT, {.i64 = 20}, 0, 90, FLAGS},
+    {"abr_min_switch_interval", "min interval between variant switches in ms", OFFSET(mABRMinSwitchInterval), AV_OPT_TYPE_INT, {.i64 = 8000}, 0, INT_MAX, FLAGS},
+    {"abr_min_buffer", "buffer level in ms below which switching down is always allowed", OFFSET(mABRMinBuffer), AV_OPT_TYPE_INT, {.i64 = 4000}, 0, INT_MAX, FLAGS},
+    {"abr_buffer_target", "buffer level in ms where BOLA selects the top variant", OFFSET(mABRBufferTarget), AV_OPT_TYPE_INT, {.i64 = 12000}, 0, INT_MAX, FLAGS},
+    {"codec_buf_level",       "media duration in ms queued in decoders",           OFFSET(mCodecBufLevel),      AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, RUNTIME_FLAGS},
+    {"codec_video_buf_size",  "capacity in bytes of video decoder input buffer",    OFFSET(mCodecVideoBufSize),  AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, RUNTIME_FLAGS},
+    {"codec_audio_buf_size",  "capacity in bytes of audio decoder input buffer",    OFFSET(mCodecAudioBufSize),  AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, RUNTIME_FLAGS},
+    {"codec_video_data_size", "bytes queued in video decoder input buffer",         OFFSET(mCodecVideoDataSize), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, RUNTIME_FLAGS},
+    {"codec_audio_data_size", "bytes queued in audio decoder input buffer",         OFFSET(mCodecAudioDataSize), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, RUNTIME_FLAGS},
     {NULL}
 };
 
@@ -35,11 +35,21 @@ typedef struct HLSReceiver_s {
 
     MediaObject           mCurrentMedia;
     int64_t               mCurrentStartPts;
+    int                   mCurrentDiscontinuitySeq;
+    int64_t               mCurrentProgramDateTime;
+    int64_t               mDownloadedEndPts; /* end of last downloaded segment, for buffer level */
+
+    bool                  mContinuous;     /* keep reading over segment boundary, see continue_to_next_media() */
+    bool                  mSegmentChanged; /* segment boundary passed without EOF */
+
+    bool                  mReplayInitOnChange; /* demuxer keeps init state, replay only a different init section */
+    Segment_t*            mLastInitSection;    /* last replayed init section, referenced */
 
     MediaObject           mCachedInitSegments[MAX_INIT_SEGMENTS];
     int                   mCachedInitSegmentCnt;
 
     OnDonwloadComplete_fn mCompleteCB;
+    OnPrefetch_fn         mPrefetchCB;
     void*                 mOpaque;
 
     AVIOContext*          mM3u8IO;
@@ -74,7 +84,8 @@ static void cache_init_segment(HLSReceiver_t* receiver, Segment_t* initSeg, Medi
         receiver->mCachedInitSegments[receiver->mCachedInitSegmentCnt] = NULL;
     }
 
-    receiver->mCachedInitSegments[receiver->mCachedInitSegmentCnt++] = obj;
+    receiver->mCachedInitSegments[receiver->mCachedInitSegmentCnt] = obj;
+    receiver->mCachedInitSegmentCnt = (receiver->mCachedInitSegmentCnt + 1) % MAX_INIT_SEGMENTS;
 }
 
 static void clear_cached_init_segment(HLSReceiver_t* receiver)
@@ -91,10 +102,21 @@ static void clear_cached_init_segment(HLSReceiver_t* receiver)
     receiver->mCachedInitSegmentCnt = 0;
 }
 
-static int64_t default_reload_interval(Playlist_t* pls)
+static int64_t default_reload_interval(PlaylistSnapshot_t* snap)
 {
-    return pls->mSegmentCnt > 0 ? pls->mSegments[pls->mSegmentCnt - 1]->mDuration :
-                                  pls->mTargetDuration;
+    return snap->mSegmentCnt > 0 ? HLS_M3U8_GetSegmentDuration(snap, snap->mSegmentCnt - 1) :
+                                   snap->mTargetDuration;
+}
+
+static Playlist_t* get_playlist(HLSReceiver_t* receiver)
+{
+    Playlist_t* pls;
+
+    _LOCK(receiver);
+    pls = receiver->mPlaylist;
+    _UNLOCK(receiver);
+
+    return pls;
 }
 
 static int _abort_interrupt_callback(void* opaque)
@@ -111,47 +133,84 @@ static void* _buffering_task_proc(void* param)
 {
     HLSReceiver_t* receiver = (HLSReceiver_t*)param;
     int64_t reload_duration = 0;
+    PlaylistSnapshot_t* snap = NULL;
+    Playlist_t* lastPls = get_playlist(receiver);
 
-    _LOCK(receiver);
-    reload_duration = default_reload_interval(receiver->mPlaylist);
-    _UNLOCK(receiver);
+    snap = HLS_M3U8_AcquireSnapshot(lastPls);
+    reload_duration = default_reload_interval(snap);
+    HLS_M3U8_ReleaseSnapshot(snap);
 
     while (!receiver->mExitBuffering)
     {
+        Playlist_t*  pls = NULL;
         Segment_t*   seg = NULL;
         MediaObject  obj = NULL;
         int          index = 0;
+        int64_t      segDuration, segEndPts;
+        int          discontinuity;
 
         if (_INTERRUPTED(receiver))
             break;
 
-        _LOCK(receiver);
-        if (!receiver->mPlaylist->mFinished && /* LIVE */
-             get_tick() - receiver->mPlaylist->mLastLoadTime >= reload_duration)
+        /* downstream is full enough, keep only the segment being demuxed */
+        if (receiver->mPrefetchCB && !MediaObjectBuffer_IsEmpty(receiver->mBuffer) &&
+            !receiver->mPrefetchCB(receiver, _MAX(receiver->mDownloadedEndPts - receiver->mCurrentStartPts, 0), receiver->mOpaque))
+        {
+            usleep(10*1000);
+            continue;
+        }
+
+        pls  = get_playlist(receiver);
+
+        /* switched to a playlist known from master only, load it before taking its segments */
+        if (!HLS_M3U8_IsLoaded(pls) && HLS_M3U8_Load(pls, &receiver->mIntCB, &receiver->mM3u8IO))
         {
-            if (HLS_M3U8_Update(receiver->mPlaylist, &receiver->mIntCB, &receiver->mM3u8IO))
+            if (_INTERRUPTED(receiver))
+                break;
+
+            usleep(100*1000);
+            continue;
+        }
+
+        snap = HLS_M3U8_AcquireSnapshot(pls);
+        if (!snap->mFinished && /* LIVE */
+             get_tick() - pls->mLastLoadTime >= reload_duration)
+        {
+            int ret;
+
+            /* Readers keep using the current snapshot while reloading */
+            HLS_M3U8_ReleaseSnapshot(snap);
+            if ((ret = HLS_M3U8_Update(pls, &receiver->mIntCB, &receiver->mM3u8IO)) < 0)
             {
                 LOG_ERROR("!!!!! Failed to update !!!!\n");
                 if (_INTERRUPTED(receiver))
-                {
-                    _UNLOCK(receiver);
                     break;
-                }
             }
+            /* HLS_M3U8_NOT_MODIFIED keeps the snapshot, back-off below is the same as for no new segment */
+            snap = HLS_M3U8_AcquireSnapshot(pls);
         }
 
-        index = receiver->mCurrentSeqNo - receiver->mPlaylist->mStartSeqNo;
-        if (index < receiver->mPlaylist->mSegmentCnt)
+        index = receiver->mCurrentSeqNo - snap->mStartSeqNo;
+        if (index < 0)
+        {
+            LOG_WARN("Segment %d is out of live window, jump to %d\n", receiver->mCurrentSeqNo, snap->mStartSeqNo);
+            receiver->mCurrentSeqNo = snap->mStartSeqNo;
+            index = 0;
+        }
+
+        if (index < snap->mSegmentCnt)
         {    
-            seg = receiver->mPlaylist->mSegments[index];
+            seg = HLS_M3U8_GetSegment(snap, index);
         }
         else
         {
-            reload_duration = default_reload_interval(receiver->mPlaylist) / 2;
-            if (receiver->mPlaylist->mFinished)
+            bool finished = snap->mFinished;
+
+            reload_duration = default_reload_interval(snap) / 2;
+            HLS_M3U8_ReleaseSnapshot(snap);
+            if (finished)
             {
 //              LOG_INFO("playlist is finished and all segment is ended !!!!\n");
-                _UNLOCK(receiver);
                 if (MediaObjectBuffer_IsEmpty(receiver->mBuffer))
                     break;
     
@@ -159,17 +218,9 @@ static void* _buffering_task_proc(void* param)
                 continue;
             }
 
-            _UNLOCK(receiver);
             usleep(10* 1000);
             continue;
         }
-        _UNLOCK(receiver);
-
-        if (!seg)
-        {
-            usleep(10 * 1000);
-            continue;
-        }
 
         /* Save Init segment to cache */
         if (seg->mInitSection)
@@ -184,6 +235,15 @@ static void* _buffering_task_proc(void* param)
         }
 
         obj = MediaObject_Create(seg, &receiver->mIntCB);
+        reload_duration = default_reload_interval(snap);
+        HLS_M3U8_ReleaseSnapshot(snap);
+
+        /* obj holds its own reference, and may be consumed by reader once it is put */
+        discontinuity = seg->mDiscontinuity;
+        segDuration   = seg->mDuration;
+        segEndPts     = seg->mStartPts + seg->mDuration;
+        HLS_M3U8_UnrefSegment(seg);
+
         if (!obj)
         {
             LOG_ERROR("Media Object create faield !!\n");
@@ -193,6 +253,11 @@ static void* _buffering_task_proc(void* param)
             usleep(100*1000);
             continue;
         }
+
+        /* variant is switched or timeline is broken, demuxer should be reopened */
+        if (discontinuity || pls != lastPls)
+            MediaObject_SetDiscontinuity(obj, true);
+        lastPls = pls;
        
         if (MediaObject_StartDownload(obj))
         {
@@ -217,14 +282,22 @@ static void* _buffering_task_proc(void* param)
         if (_INTERRUPTED(receiver))
             break;
 
+        receiver->mDownloadedEndPts = segEndPts;
+
         if (receiver->mCompleteCB)
-            receiver->mCompleteCB(receiver, receiver->mPlaylist, MediaObject_GetBandwidth(obj), receiver->mOpaque);
+        {
+            ABRSample_t sample;
+
+            sample.mTime         = get_tick();
+            sample.mSize         = MediaObject_GetDownloadSize(obj);
+            sample.mDownloadTime = MediaObject_GetDownloadTime(obj);
+            sample.mDuration     = segDuration;
+            sample.mBufferLevel  = _MAX(receiver->mDownloadedEndPts - receiver->mCurrentStartPts, 0);
+
+            receiver->mCompleteCB(receiver, pls, &sample, receiver->mOpaque);
+        }
 
         receiver->mCurrentSeqNo ++;
-        
-        _LOCK(receiver);
-        reload_duration = default_reload_interval(receiver->mPlaylist);
-        _UNLOCK(receiver);
     }
 
     MediaObjectBuffer_SetEOS(receiver->mBuffer, true);
@@ -234,25 +307,35 @@ static void* _buffering_task_proc(void* param)
 
 HLSReceiver HLS_Receiver_Create(Playlist_t* pls, AVIOInterruptCB* int_cb, OnDonwloadComplete_fn callback, void* opaque)
 {
+    PlaylistSnapshot_t* snap = NULL;
     HLSReceiver_t* receiver = (HLSReceiver_t*)malloc(sizeof(HLSReceiver_t));
     if (!receiver)
         goto ERROR;
 
     memset(receiver, 0x00, sizeof(HLSReceiver_t));
 
-    if (pls->mFinished)
+    snap = HLS_M3U8_AcquireSnapshot(pls);
+    if (snap->mFinished)
         receiver->mBuffer = MediaObjectBuffer_Create(VOD_SEGMENT_BUFFER_SIZE);
     else
         receiver->mBuffer = MediaObjectBuffer_Create(LIVE_SEGMENT_BUFFER_SIZE);
 
     if (!receiver->mBuffer)
+    {
+        HLS_M3U8_ReleaseSnapshot(snap);
         goto ERROR;
+    }
+
+    pthread_mutex_init(&receiver->mLock, NULL);
 
     receiver->mPlaylist = pls;
-    if (!pls->mFinished)
-        receiver->mCurrentSeqNo = pls->mStartSeqNo + FFMAX(pls->mSegmentCnt + LIVE_START_INDEX, 0);
+    receiver->mCurrentDiscontinuitySeq = -1;
+    receiver->mCurrentProgramDateTime = AV_NOPTS_VALUE;
+    if (!snap->mFinished)
+        receiver->mCurrentSeqNo = snap->mStartSeqNo + FFMAX(snap->mSegmentCnt + LIVE_START_INDEX, 0);
     else
-        receiver->mCurrentSeqNo = pls->mStartSeqNo;
+        receiver->mCurrentSeqNo = snap->mStartSeqNo;
+    HLS_M3U8_ReleaseSnapshot(snap);
 
     receiver->mParentIntCB    = int_cb;
     receiver->mIntCB.callback = _abort_interrupt_callback;
@@ -320,6 +403,7 @@ int HLS_Receiver_Stop(HLSReceiver receiver)
     }
     receiver->mCurrentInitMedia = NULL;
     receiver->mCurrentInitMediaOffset = 0;
+    receiver->mSegmentChanged = false;
     _UNLOCK(receiver);
 
     receiver->mIsRunning = false;
@@ -331,6 +415,24 @@ int HLS_Receiver_Stop(HLSReceiver receiver)
     return 0;
 }
 
+/*
+ * Wakes up a reader blocked in HLS_Receiver_Read() from another thread.
+ * Reading returns error until HLS_Receiver_Stop()/HLS_Receiver_Start() are called.
+ */
+void HLS_Receiver_Interrupt(HLSReceiver receiver)
+{
+    if (!receiver)
+        return;
+
+    receiver->mExitBuffering = true;
+    MediaObjectBuffer_SetEOS(receiver->mBuffer, true);
+
+    _LOCK(receiver);
+    if (receiver->mCurrentMedia)
+        MediaObject_StopDownload(receiver->mCurrentMedia);
+    _UNLOCK(receiver);
+}
+
 void HLS_Receiver_Delete(HLSReceiver receiver)
 {
     if (!receiver)
@@ -345,10 +447,66 @@ void HLS_Receiver_Delete(HLSReceiver receiver)
         avio_close(receiver->mM3u8IO);
 
     clear_cached_init_segment(receiver);
+    HLS_M3U8_UnrefSegment(receiver->mLastInitSection);
 
     free(receiver);
 }
 
+static void start_current_media(HLSReceiver_t* receiver, bool replayInit)
+{
+    Segment_t* seg = MediaObject_GetSegment(receiver->mCurrentMedia);
+    Segment_t* initSegment = seg->mInitSection;
+
+    receiver->mCurrentInitMedia = NULL;
+    if (replayInit && initSegment != NULL)
+    {
+        if (receiver->mReplayInitOnChange && initSegment == receiver->mLastInitSection)
+            replayInit = false;
+        else
+            receiver->mCurrentInitMedia = find_cached_init_segment(receiver, initSegment);
+    }
+
+    if (replayInit && initSegment != receiver->mLastInitSection)
+    {
+        HLS_M3U8_UnrefSegment(receiver->mLastInitSection);
+        receiver->mLastInitSection = HLS_M3U8_RefSegment(initSegment);
+    }
+
+    receiver->mCurrentInitMediaOffset = 0;
+    receiver->mCurrentStartPts = MediaObject_GetSegmentStartPts(receiver->mCurrentMedia);
+    receiver->mCurrentDiscontinuitySeq = seg->mDiscontinuitySeq;
+    receiver->mCurrentProgramDateTime = seg->mProgramDateTime;
+}
+
+/*
+ * Continuous mode: moves to the next media object without reporting EOF to demuxer,
+ * unless the next one is discontinuous (EXT-X-DISCONTINUITY, variant switch, new init section).
+ * Returns true if reading can go on with the next media object.
+ */
+static bool continue_to_next_media(HLSReceiver_t* receiver, MediaObject finished, int result)
+{
+    MediaObject next = NULL;
+    bool reopen;
+
+    if (!receiver->mContinuous || result != AVERROR_EOF)
+        return false;
+
+    if (MediaObjectBuffer_Get(receiver->mBuffer, &next, -1) != 0)
+        return false;
+
+    reopen = MediaObject_IsDiscontinuity(next) ||
+             MediaObject_GetSegment(next)->mInitSection != MediaObject_GetSegment(finished)->mInitSection;
+
+    _LOCK(receiver);
+    receiver->mCurrentMedia = next;
+    start_current_media(receiver, reopen);
+    if (!reopen)
+        receiver->mSegmentChanged = true;
+    _UNLOCK(receiver);
+
+    return !reopen;
+}
+
 int HLS_Receiver_Read(HLSReceiver receiver, unsigned char* buf, int bufLen)
 {
     int ret = 0;
@@ -360,45 +518,42 @@ int HLS_Receiver_Read(HLSReceiver receiver, unsigned char* buf, int bufLen)
         return -1;
     }
 
-    if (!receiver->mCurrentMedia)
+    while (1)
     {
-        Segment_t* initSegment = NULL;
-        if ((ret = MediaObjectBuffer_Get(receiver->mBuffer, &receiver->mCurrentMedia, -1)) != 0)
-        {
-            LOG_ERROR("Failed to read ! ret = %d\n", ret);
-            return HLS_SESSION_EOF;
-        }
-        
-        initSegment = MediaObject_GetSegment(receiver->mCurrentMedia)->mInitSection;
-        if (initSegment != NULL)
-            receiver->mCurrentInitMedia = find_cached_init_segment(receiver, initSegment);
-
-        receiver->mCurrentInitMediaOffset = 0;
-        receiver->mCurrentStartPts = MediaObject_GetSegmentStartPts(receiver->mCurrentMedia);
-    }
+        MediaObject obj = NULL;
 
-    if (receiver->mCurrentInitMedia)
-    {
-        ret = MediaObject_Peek(receiver->mCurrentInitMedia, buf, bufLen, receiver->mCurrentInitMediaOffset);
-        if (ret <= 0)
+        if (!receiver->mCurrentMedia)
         {
-            receiver->mCurrentInitMedia = NULL;
-            receiver->mCurrentInitMediaOffset = 0;
+            if ((ret = MediaObjectBuffer_Get(receiver->mBuffer, &receiver->mCurrentMedia, -1)) != 0)
+            {
+                LOG_ERROR("Failed to read ! ret = %d\n", ret);
+                return HLS_SESSION_EOF;
+            }
+
+            start_current_media(receiver, true);
         }
-        else
+
+        if (receiver->mCurrentInitMedia)
         {
-            receiver->mCurrentInitMediaOffset += ret;
-            readSize += ret;
+            ret = MediaObject_Peek(receiver->mCurrentInitMedia, buf, bufLen, receiver->mCurrentInitMediaOffset);
+            if (ret <= 0)
+            {
+                receiver->mCurrentInitMedia = NULL;
+                receiver->mCurrentInitMediaOffset = 0;
+            }
+            else
+            {
+                receiver->mCurrentInitMediaOffset += ret;
+                readSize += ret;
+            }
         }
-    }
 
-    if (bufLen - readSize == 0)
-        return readSize;
+        if (bufLen - readSize == 0)
+            return readSize;
         
-    ret = MediaObject_Read(receiver->mCurrentMedia, buf + readSize, bufLen - readSize);
-    if (ret <= 0)
-    {
-        MediaObject obj = NULL;
+        ret = MediaObject_Read(receiver->mCurrentMedia, buf + readSize, bufLen - readSize);
+        if (ret > 0)
+            return readSize + ret;
 
         _LOCK(receiver);
         if(receiver->mCurrentMedia)
@@ -410,20 +565,26 @@ int HLS_Receiver_Read(HLSReceiver receiver, unsigned char* buf, int bufLen)
         }
         _UNLOCK(receiver);
 
-        if (obj)
+        if (!obj)
+            return ret;
+
+        if (!continue_to_next_media(receiver, obj, ret))
+        {
             MediaObject_Delete(obj);
+            return ret;
+        }
 
-        return ret;
+        MediaObject_Delete(obj);
+        if (readSize > 0)
+            return readSize;
     }
-
-    readSize += ret;
-    return readSize;
 }
 
 int HLS_Receiver_Seek(HLSReceiver receiver, int64_t timestamp)
 {
     int ii;
-    int64_t pos = 0;
+    int64_t firstPts;
+    PlaylistSnapshot_t* snap = NULL;
 
     if (!receiver)
     {
@@ -434,31 +595,31 @@ int HLS_Receiver_Seek(HLSReceiver receiver, int64_t timestamp)
     HLS_Receiver_Stop(receiver);
 
     /* Calculator Current Sequence Number */
-    _LOCK(receiver);
-    for (ii = 0; ii < receiver->mPlaylist->mSegmentCnt; ii++)
+    snap = HLS_M3U8_AcquireSnapshot(get_playlist(receiver));
+    if (snap->mSegmentCnt == 0)
     {
-        int64_t diff = pos + receiver->mPlaylist->mSegments[ii]->mDuration - timestamp;
-        if (diff > 0)
-            break;
-
-        pos += receiver->mPlaylist->mSegments[ii]->mDuration;
+        LOG_ERROR("playlist has no segment !\n");
+        HLS_M3U8_ReleaseSnapshot(snap);
+        return -1;
     }
 
-    if (ii == receiver->mPlaylist->mSegmentCnt)
-        ii = receiver->mPlaylist->mSegmentCnt - 1;
+    /* live window does not start at zero, segment table is from its first segment */
+    firstPts = HLS_M3U8_GetSegmentStartPts(snap, 0);
+    ii = HLS_M3U8_FindSegment(snap, firstPts != AV_NOPTS_VALUE ? timestamp - firstPts : timestamp);
 
-    receiver->mCurrentSeqNo = receiver->mPlaylist->mStartSeqNo + ii;
+    _LOCK(receiver);
+    receiver->mCurrentSeqNo = snap->mStartSeqNo + ii;
     _UNLOCK(receiver);
 
     HLS_Receiver_Start(receiver);
 
     _LOCK(receiver);
-    {
-        int index = receiver->mCurrentSeqNo - receiver->mPlaylist->mStartSeqNo;
-        receiver->mCurrentStartPts = receiver->mPlaylist->mSegments[index]->mStartPts;
-    }
+    receiver->mCurrentStartPts = HLS_M3U8_GetSegmentStartPts(snap, ii);
+    receiver->mDownloadedEndPts = receiver->mCurrentStartPts;
     _UNLOCK(receiver);
 
+    HLS_M3U8_ReleaseSnapshot(snap);
+
     return 0;
 }
 
@@ -478,6 +639,47 @@ int HLS_Receiver_SetPlaylist(HLSReceiver receiver, Playlist_t* pls)
     return 0;
 }
 
+void HLS_Receiver_SetContinuous(HLSReceiver receiver, bool isContinuous)
+{
+    if (!receiver)
+        return;
+
+    receiver->mContinuous = isContinuous;
+}
+
+void HLS_Receiver_SetReplayInitOnChange(HLSReceiver receiver, bool onChangeOnly)
+{
+    if (!receiver)
+        return;
+
+    _LOCK(receiver);
+    receiver->mReplayInitOnChange = onChangeOnly;
+    _UNLOCK(receiver);
+}
+
+void HLS_Receiver_SetPrefetchCallback(HLSReceiver receiver, OnPrefetch_fn callback)
+{
+    if (!receiver)
+        return;
+
+    receiver->mPrefetchCB = callback;
+}
+
+bool HLS_Receiver_CheckSegmentChanged(HLSReceiver receiver)
+{
+    bool changed;
+
+    if (!receiver)
+        return false;
+
+    _LOCK(receiver);
+    changed = receiver->mSegmentChanged;
+    receiver->mSegmentChanged = false;
+    _UNLOCK(receiver);
+
+    return changed;
+}
+
 int64_t HLS_Receiver_GetCurrentSegmentPts(HLSReceiver receiver)
 {
     if (!receiver)
@@ -485,3 +687,19 @@ int64_t HLS_Receiver_GetCurrentSegmentPts(HLSReceiver receiver)
 
     return receiver->mCurrentStartPts;
 }
+
+int HLS_Receiver_GetCurrentDiscontinuitySeq(HLSReceiver receiver)
+{
+    if (!receiver)
+        return -1;
+
+    return receiver->mCurrentDiscontinuitySeq;
+}
+
+int64_t HLS_Receiver_GetCurrentProgramDateTime(HLSReceiver receiver)
+{
+    if (!receiver)
+        return AV_NOPTS_VALUE;
+
+    return receiver->mCurrentProgramDateTime;
+}
@@ -2,15 +2,20 @@
 #define __HLS_RECEIVER_H_
 
 #include "m3u8_parser.h"
+#include "hls_abr.h"
 #include <stdbool.h>
 
 typedef struct HLSReceiver_s*  HLSReceiver;
 
-typedef void (*OnDonwloadComplete_fn)(const HLSReceiver receiver, Playlist_t* pls, int bandwidth, void* opaque);
+typedef void (*OnDonwloadComplete_fn)(const HLSReceiver receiver, Playlist_t* pls, const ABRSample_t* sample, void* opaque);
+
+/* Asked before downloading next segment while one is buffered, bufferLevel is downloaded media not yet demuxed */
+typedef bool (*OnPrefetch_fn)(const HLSReceiver receiver, int64_t bufferLevel, void* opaque);
 
 HLSReceiver HLS_Receiver_Create(Playlist_t* playlist, AVIOInterruptCB* int_cb, OnDonwloadComplete_fn callback, void* opaque);
 int         HLS_Receiver_Start(HLSReceiver receiver);
 int         HLS_Receiver_Stop(HLSReceiver receiver);
+void        HLS_Receiver_Interrupt(HLSReceiver receiver);
 void        HLS_Receiver_Delete(HLSReceiver receiver);
 
 int HLS_Receiver_Read(HLSReceiver receiver, unsigned char* buf, int bufLen);
@@ -18,7 +23,14 @@ int HLS_Receiver_Seek(HLSReceiver receiver, int64_t timestamp);
 
 int HLS_Receiver_SetPlaylist(HLSReceiver receiver, Playlist_t* pls);
 
+void HLS_Receiver_SetContinuous(HLSReceiver receiver, bool isContinuous);
+bool HLS_Receiver_CheckSegmentChanged(HLSReceiver receiver);
+void HLS_Receiver_SetReplayInitOnChange(HLSReceiver receiver, bool onChangeOnly);
+void HLS_Receiver_SetPrefetchCallback(HLSReceiver receiver, OnPrefetch_fn callback);
+
 int64_t HLS_Receiver_GetCurrentSegmentPts(HLSReceiver receiver);
+int     HLS_Receiver_GetCurrentDiscontinuitySeq(HLSReceiver receiver);
+int64_t HLS_Receiver_GetCurrentProgramDateTime(HLSReceiver receiver); /* us since epoch, AV_NOPTS_VALUE if unknown */
 bool    HLS_Receiver_CheckEOS(HLSReceiver receiver);
 
 #endif /* __HLS_RECEIVER_H_ */
@@ -5,6 +5,12 @@
 #include "hls_common.h"
 
 #include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -23,10 +29,67 @@ extern "C"
 }
 #endif
 
+static uint64_t hash_data(const void* data, int64_t size)
+{
+    const uint8_t* ptr = (const uint8_t*)data;
+    uint64_t hash = 14695981039346656037ull; /* FNV-1a */
+    int64_t ii;
+
+    for (ii = 0; ii < size; ii++)
+        hash = (hash ^ ptr[ii]) * 1099511628211ull;
+
+    return hash;
+}
+
+/*
+ * Hash of playlist body to detect unchanged reloads, 8 bytes per step since FNV-1a of whole body costs
+ * as much as parsing small live playlist. In memory only, hash_data stays for the values kept in cache files.
+ */
+static uint64_t hash_body(const char* data, int size)
+{
+    uint64_t hash = 14695981039346656037ull ^ (uint64_t)size;
+    uint64_t word;
+    int ii;
+
+    for (ii = 0; ii + 8 <= size; ii += 8)
+    {
+        memcpy(&word, data + ii, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 32;
+    }
+
+    return (hash ^ hash_data(data + ii, size - ii)) * 1099511628211ull;
+}
+
+#define MIN_LOOKUP_TABLE_SIZE 64 /* power of 2, tables are kept at most half full */
+
+/* Returns slot of absURL in open addressing table, or the empty slot where it would be */
+static int find_playlist_slot(HLSInfo_t* info, const int* table, int size, const char* absURL)
+{
+    int mask = size - 1;
+    int slot = hash_data(absURL, strlen(absURL)) & mask;
+
+    while (table[slot] >= 0 && strcmp(info->mPlaylists[table[slot]]->mURL, absURL))
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
 static Playlist_t* find_playlist(HLSInfo_t* info, const char* absURL)
 {
     int ii;
 
+    if (!info->mLookupDisabled)
+    {
+        int slot;
+
+        if (!info->mPlaylistTable)
+            return NULL;
+
+        slot = find_playlist_slot(info, info->mPlaylistTable, info->mPlaylistTableSize, absURL);
+        return info->mPlaylistTable[slot] >= 0 ? info->mPlaylists[info->mPlaylistTable[slot]] : NULL;
+    }
+
     for (ii = 0; ii < info->mPlaylistCnt; ii++)
     {
         if (strcmp(info->mPlaylists[ii]->mURL, absURL) == 0)
@@ -36,6 +99,325 @@ static Playlist_t* find_playlist(HLSInfo_t* info, const char* absURL)
     return NULL;
 }
 
+/* Indexes info->mPlaylists[index], all before it are indexed already. Table is rebuilt when it gets half full */
+static void index_playlist(HLSInfo_t* info, int index)
+{
+    int ii;
+
+    if (info->mLookupDisabled)
+        return;
+
+    if ((index + 1) * 2 > info->mPlaylistTableSize)
+    {
+        int size = _MAX(info->mPlaylistTableSize * 2, MIN_LOOKUP_TABLE_SIZE);
+        int* table = (int*)av_malloc_array(size, sizeof(int));
+
+        if (!table)
+        {
+            info->mLookupDisabled = 1;
+            return;
+        }
+        memset(table, 0xff, size * sizeof(int));
+
+        for (ii = 0; ii < index; ii++)
+            table[find_playlist_slot(info, table, size, info->mPlaylists[ii]->mURL)] = ii;
+
+        av_free(info->mPlaylistTable);
+        info->mPlaylistTable     = table;
+        info->mPlaylistTableSize = size;
+    }
+
+    info->mPlaylistTable[find_playlist_slot(info, info->mPlaylistTable, info->mPlaylistTableSize, info->mPlaylists[index]->mURL)] = index;
+}
+
+typedef struct RenditionGroup_s {
+    Rendition_t* mHead;  /* NULL for empty slot */
+    Rendition_t* mTail;
+} RenditionGroup_t;
+
+static RenditionGroup_t* find_group_slot(RenditionGroup_t* table, int size, enum AVMediaType type, const char* groupId)
+{
+    int mask = size - 1;
+    int slot = (hash_data(groupId, strlen(groupId)) * 31 + type) & mask;
+
+    while (table[slot].mHead && (table[slot].mHead->mType != type || strcmp(table[slot].mHead->mGroupId, groupId)))
+        slot = (slot + 1) & mask;
+
+    return &table[slot];
+}
+
+static void index_rendition(HLSInfo_t* info, Rendition_t* rend)
+{
+    RenditionGroup_t* group;
+    int ii;
+
+    if (info->mLookupDisabled)
+        return;
+
+    /* may be an existing group, growing early is harmless */
+    if ((info->mGroupCnt + 1) * 2 > info->mGroupTableSize)
+    {
+        int size = _MAX(info->mGroupTableSize * 2, MIN_LOOKUP_TABLE_SIZE);
+        RenditionGroup_t* table = (RenditionGroup_t*)av_mallocz(size * sizeof(RenditionGroup_t));
+
+        if (!table)
+        {
+            info->mLookupDisabled = 1;
+            return;
+        }
+
+        for (ii = 0; ii < info->mGroupTableSize; ii++)
+        {
+            Rendition_t* head = info->mGroupTable[ii].mHead;
+            if (head)
+                *find_group_slot(table, size, head->mType, head->mGroupId) = info->mGroupTable[ii];
+        }
+
+        av_free(info->mGroupTable);
+        info->mGroupTable     = table;
+        info->mGroupTableSize = size;
+    }
+
+    group = find_group_slot(info->mGroupTable, info->mGroupTableSize, rend->mType, rend->mGroupId);
+    if (!group->mHead)
+    {
+        group->mHead = rend;
+        info->mGroupCnt++;
+    }
+    else
+    {
+        group->mTail->mNextInGroup = rend;
+    }
+    group->mTail = rend;
+}
+
+/*
+ * URL shared by segments, e.g. the key of EXT-X-KEY or the playlist URL which relative segment URLs are
+ * resolved against. Freed with the last segment referencing it.
+ */
+typedef struct SharedURL_s {
+    int  mRefCnt;
+    char mURL[1];
+} SharedURL_t;
+
+static SharedURL_t* new_shared_url(const char* url)
+{
+    int len = strlen(url);
+    SharedURL_t* shared = (SharedURL_t*)av_malloc(sizeof(SharedURL_t) + len);
+    if (!shared)
+        return NULL;
+
+    shared->mRefCnt = 1;
+    memcpy(shared->mURL, url, len + 1);
+
+    return shared;
+}
+
+static char* ref_shared_url(SharedURL_t* shared)
+{
+    if (!shared)
+        return NULL;
+
+    __atomic_add_fetch(&shared->mRefCnt, 1, __ATOMIC_ACQ_REL);
+    return shared->mURL;
+}
+
+static void unref_shared_url(SharedURL_t* shared)
+{
+    if (shared && __atomic_sub_fetch(&shared->mRefCnt, 1, __ATOMIC_ACQ_REL) == 0)
+        av_free(shared);
+}
+
+#define SHARED_URL_OF(url) ((SharedURL_t*)((url) - offsetof(SharedURL_t, mURL)))
+
+/* Cache file mapped by HLS_M3U8_LoadCache, unmapped with the last snapshot restored from it */
+typedef struct CacheMapping_s {
+    int      mRefCnt;
+    uint8_t* mAddr;
+    size_t   mSize;
+} CacheMapping_t;
+
+static CacheMapping_t* ref_cache_mapping(CacheMapping_t* map)
+{
+    __atomic_add_fetch(&map->mRefCnt, 1, __ATOMIC_ACQ_REL);
+    return map;
+}
+
+static void unref_cache_mapping(CacheMapping_t* map)
+{
+    if (map && __atomic_sub_fetch(&map->mRefCnt, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        munmap(map->mAddr, map->mSize);
+        av_free(map);
+    }
+}
+
+/* Key state of segments in indexed snapshot */
+typedef struct SegmentKey_s {
+    KeyType_e    mType;
+    char*        mURL;    /* SharedURL_t */
+    int          mHasIV;
+    uint8_t      mIV[16];
+} SegmentKey_t;
+
+/* One segment of indexed snapshot, duration and start pts are in the segment table */
+typedef struct SegmentEntry_s {
+    uint32_t     mLine;          /* offset of URI line in mData */
+    int          mKey;           /* index of mKeys, -1 if not encrypted */
+    int          mInitSection;   /* index of mInitSections, -1 if none */
+    int          mDiscontinuity;
+    int          mDiscontinuitySeq;
+    int64_t      mProgramDateTime;
+    int64_t      mUrlOffset;
+    int64_t      mSize;
+} SegmentEntry_t;
+
+static void free_segment_index(PlaylistSnapshot_t* snap)
+{
+    int ii;
+
+    if (snap->mCache)
+    {
+        for (ii = 0; ii < LAZY_SEGMENT_CACHE_SIZE; ii++)
+            HLS_M3U8_UnrefSegment(snap->mCache[ii]);
+        av_freep(&snap->mCache);
+        av_freep(&snap->mCacheIndex);
+        pthread_mutex_destroy(&snap->mCacheLock);
+    }
+
+    for (ii = 0; ii < snap->mKeyCnt; ii++)
+    {
+        unref_shared_url(SHARED_URL_OF(snap->mKeys[ii]->mURL));
+        av_free(snap->mKeys[ii]);
+    }
+    av_freep(&snap->mKeys);
+    snap->mKeyCnt = 0;
+
+    if (snap->mBaseURL)
+        unref_shared_url(SHARED_URL_OF(snap->mBaseURL));
+    snap->mBaseURL = NULL;
+
+    if (snap->mMapping)
+    {
+        /* tables are in the mapped file */
+        snap->mEntries          = NULL;
+        snap->mData             = NULL;
+        snap->mSegmentStartPts  = NULL;
+        snap->mSegmentEndOffset = NULL;
+        unref_cache_mapping(snap->mMapping);
+        snap->mMapping = NULL;
+    }
+
+    av_freep(&snap->mEntries);
+    av_freep(&snap->mData);
+    snap->mDataSize = 0;
+}
+
+static PlaylistSnapshot_t* alloc_snapshot(void)
+{
+    PlaylistSnapshot_t* snap = (PlaylistSnapshot_t*)av_mallocz(sizeof(PlaylistSnapshot_t));
+    if (!snap)
+        return NULL;
+
+    snap->mRefCnt = 1;
+
+    return snap;
+}
+
+static void free_snapshot(PlaylistSnapshot_t* snap)
+{
+    int ii;
+
+    if (!snap)
+        return;
+
+    /* indexed snapshot has no segment list, mSegmentCnt counts its entries */
+    if (snap->mSegments)
+    {
+        for (ii = 0; ii < snap->mSegmentCnt; ii++)
+            HLS_M3U8_UnrefSegment(snap->mSegments[ii]);
+        av_freep(&snap->mSegments);
+    }
+
+    for (ii = 0; ii < snap->mInitSectionCnt; ii++)
+        HLS_M3U8_UnrefSegment(snap->mInitSections[ii]);
+    av_freep(&snap->mInitSections);
+
+    free_segment_index(snap);
+
+    av_freep(&snap->mSegmentStartPts);
+    av_freep(&snap->mSegmentEndOffset);
+
+    av_free(snap);
+}
+
+/* Frees the retired snapshots nobody holds. Must be called by writer, with pls->mLock */
+static void reclaim_snapshots(Playlist_t* pls)
+{
+    PlaylistSnapshot_t** pp = &pls->mRetired;
+
+    /* a reader may have loaded a retired pointer without taking its reference yet */
+    if (__atomic_load_n(&pls->mReaders, __ATOMIC_SEQ_CST) > 0)
+        return;
+
+    while (*pp)
+    {
+        PlaylistSnapshot_t* snap = *pp;
+        if (__atomic_load_n(&snap->mRefCnt, __ATOMIC_SEQ_CST) == 0)
+        {
+            *pp = snap->mNextRetired;
+            free_snapshot(snap);
+        }
+        else
+        {
+            pp = &snap->mNextRetired;
+        }
+    }
+}
+
+/* Publishes new version of playlist. The reference of snap is moved to the playlist */
+static void publish_snapshot(Playlist_t* pls, PlaylistSnapshot_t* snap)
+{
+    PlaylistSnapshot_t* old;
+
+    pthread_mutex_lock(&pls->mLock);
+
+    snap->mVersion = ++pls->mVersion;
+    old = __atomic_exchange_n(&pls->mSnapshot, snap, __ATOMIC_SEQ_CST);
+    if (old)
+    {
+        old->mNextRetired = pls->mRetired;
+        pls->mRetired = old;
+        HLS_M3U8_ReleaseSnapshot(old);
+    }
+
+    reclaim_snapshots(pls);
+
+    pthread_mutex_unlock(&pls->mLock);
+}
+
+PlaylistSnapshot_t* HLS_M3U8_AcquireSnapshot(Playlist_t* pls)
+{
+    PlaylistSnapshot_t* snap;
+
+    if (!pls)
+        return NULL;
+
+    __atomic_add_fetch(&pls->mReaders, 1, __ATOMIC_SEQ_CST);
+    snap = __atomic_load_n(&pls->mSnapshot, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&snap->mRefCnt, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&pls->mReaders, 1, __ATOMIC_SEQ_CST);
+
+    return snap;
+}
+
+/* Never frees here, retired snapshot is reclaimed by the next writer of its playlist */
+void HLS_M3U8_ReleaseSnapshot(PlaylistSnapshot_t* snap)
+{
+    if (snap)
+        __atomic_sub_fetch(&snap->mRefCnt, 1, __ATOMIC_SEQ_CST);
+}
+
 static Playlist_t* new_playlist(HLSInfo_t* info, const char* url, const char* base)
 {
     char absURL[MAX_URL_SIZE];
@@ -51,31 +433,134 @@ static Playlist_t* new_playlist(HLSInfo_t* info, const char* url, const char* ba
     if (!pls)
         return NULL;
 
-    av_strlcpy(pls->mURL, absURL, sizeof(pls->mURL));
+    pls->mURL = av_strdup(absURL);
+    pls->mInfo = info;
+    pls->mSnapshot = alloc_snapshot();
+    if (!pls->mURL || !pls->mSnapshot)
+    {
+        free_snapshot(pls->mSnapshot);
+        av_free(pls->mURL);
+        av_free(pls);
+        return NULL;
+    }
+    pthread_mutex_init(&pls->mLock, NULL);
+    pthread_mutex_init(&pls->mLoadLock, NULL);
    
     dynarray_add(&info->mPlaylists, &info->mPlaylistCnt, pls);
+    index_playlist(info, info->mPlaylistCnt - 1);
  
     return pls;
 }
 
-static void free_segment_from_playlist(Playlist_t* pls)
+/* Segment and its URL are one allocation, url is kept as it is written in playlist and base is shared */
+static Segment_t* alloc_segment(const char* url, SharedURL_t* base)
 {
-    int ii;
-    for (ii = 0; ii < pls->mSegmentCnt; ii++)
-    {
-        Segment_t* seg = pls->mSegments[ii];
-        av_freep(&seg->mKeyURL);
-        av_freep(&seg->mURL);
-        av_freep(&seg);
-    }
+    int len = strlen(url);
+    Segment_t* seg = (Segment_t*)av_mallocz(sizeof(Segment_t) + len + 1);
+    if (!seg)
+        return NULL;
+
+    seg->mRefCnt           = 1;
+    seg->mStartPts         = AV_NOPTS_VALUE;
+    seg->mDiscontinuitySeq = -1; /* not known yet, see update_start_pts */
+    seg->mProgramDateTime  = AV_NOPTS_VALUE;
+    seg->mURL              = (char*)(seg + 1);
+    seg->mBaseURL          = ref_shared_url(base);
+    memcpy(seg->mURL, url, len + 1);
+
+    return seg;
+}
+
+int HLS_M3U8_GetSegmentURL(const Segment_t* seg, char* buf, int size)
+{
+    if (seg->mBaseURL)
+        ff_make_absolute_url(buf, size, seg->mBaseURL, seg->mURL);
+    else
+        av_strlcpy(buf, seg->mURL, size);
+
+    return 0;
+}
+
+static int is_same_location(const Segment_t* seg, const char* url, const char* base)
+{
+    if (strcmp(seg->mURL, url))
+        return 0;
+
+    return seg->mBaseURL == base || (seg->mBaseURL && base && !strcmp(seg->mBaseURL, base));
+}
+
+Segment_t* HLS_M3U8_RefSegment(Segment_t* seg)
+{
+    if (seg)
+        __atomic_add_fetch(&seg->mRefCnt, 1, __ATOMIC_ACQ_REL);
+
+    return seg;
+}
+
+void HLS_M3U8_UnrefSegment(Segment_t* seg)
+{
+    if (!seg)
+        return;
+
+    if (__atomic_sub_fetch(&seg->mRefCnt, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    HLS_M3U8_UnrefSegment(seg->mInitSection);
+    if (seg->mKeyURL)
+        unref_shared_url(SHARED_URL_OF(seg->mKeyURL));
+    if (seg->mBaseURL)
+        unref_shared_url(SHARED_URL_OF(seg->mBaseURL));
+    av_free(seg);
+}
+
+static int is_same_init_section(const Segment_t* sec1, const Segment_t* sec2)
+{
+    if (!sec1 || !sec2)
+        return sec1 == sec2;
+
+    return sec1->mUrlOffset == sec2->mUrlOffset && sec1->mSize == sec2->mSize &&
+           is_same_location(sec1, sec2->mURL, sec2->mBaseURL);
+}
+
+/*
+ * Returns the segment of previous load which has same sequence number, location, key and init section,
+ * NULL if changed. iv is the IV which the segment would get from this load.
+ */
+static Segment_t* find_reusable_segment(PlaylistSnapshot_t* prev, int seq, const char* url, const char* base,
+                                        int64_t offset, int64_t size, KeyType_e keyType, const char* keyURL,
+                                        const uint8_t* iv, const Segment_t* initSection)
+{
+    Segment_t* seg;
+    int index;
+
+    if (!prev || !prev->mSegments)
+        return NULL;
 
-    av_freep(&pls->mSegments);
-    pls->mSegmentCnt = 0;
+    index = seq - prev->mStartSeqNo;
+    if (index < 0 || index >= prev->mSegmentCnt)
+        return NULL;
+
+    seg = prev->mSegments[index];
+    if (seg->mSize != size || (size >= 0 && seg->mUrlOffset != offset) || !is_same_location(seg, url, base))
+        return NULL;
+
+    /* key rotation or new EXT-X-MAP at the same URL */
+    if (seg->mKeyType != keyType || memcmp(seg->mIV, iv, sizeof(seg->mIV)) ||
+        (seg->mKeyURL != keyURL && (!seg->mKeyURL || !keyURL || strcmp(seg->mKeyURL, keyURL))) ||
+        !is_same_init_section(seg->mInitSection, initSection))
+        return NULL;
+
+    return seg;
 }
 
 
 typedef struct VariantInfo_s {
     char mBandwidth[20];
+    char mCodecs[MAX_CODECS_LEN];
+    char mResolution[24];
+    char mFrameRate[16];
+    char mAverageBandwidth[20];
+    char mHdcpLevel[16];
     /* variant group ids: */
     char mAudioGroup[MAX_FIELD_LEN];
     char mVideoGroup[MAX_FIELD_LEN];
@@ -89,6 +574,31 @@ static void handle_variant_args(VariantInfo_t* info, const char *key, int key_le
         *dest     =        info->mBandwidth;
         *dest_len = sizeof(info->mBandwidth);
     }
+    else if (!strncmp(key, "CODECS=", key_len))
+    {
+        *dest     =        info->mCodecs;
+        *dest_len = sizeof(info->mCodecs);
+    }
+    else if (!strncmp(key, "RESOLUTION=", key_len))
+    {
+        *dest     =        info->mResolution;
+        *dest_len = sizeof(info->mResolution);
+    }
+    else if (!strncmp(key, "FRAME-RATE=", key_len))
+    {
+        *dest     =        info->mFrameRate;
+        *dest_len = sizeof(info->mFrameRate);
+    }
+    else if (!strncmp(key, "AVERAGE-BANDWIDTH=", key_len))
+    {
+        *dest     =        info->mAverageBandwidth;
+        *dest_len = sizeof(info->mAverageBandwidth);
+    }
+    else if (!strncmp(key, "HDCP-LEVEL=", key_len))
+    {
+        *dest     =        info->mHdcpLevel;
+        *dest_len = sizeof(info->mHdcpLevel);
+    }
     else if (!strncmp(key, "AUDIO=", key_len))
     {
         *dest     =        info->mAudioGroup;
@@ -123,6 +633,15 @@ static Variant_t* new_variant(HLSInfo_t* info, const VariantInfo_t* variantInfo,
     if (variantInfo)
     {
         variant->mBandwidth = atoi(variantInfo->mBandwidth);
+        av_strlcpy(variant->mCodecs, variantInfo->mCodecs, sizeof(variant->mCodecs));
+        if (sscanf(variantInfo->mResolution, "%dx%d", &variant->mWidth, &variant->mHeight) != 2)
+            variant->mWidth = variant->mHeight = 0;
+        variant->mFrameRate = atof(variantInfo->mFrameRate);
+        variant->mAverageBandwidth = atoi(variantInfo->mAverageBandwidth);
+        if (!strcmp(variantInfo->mHdcpLevel, "TYPE-0"))
+            variant->mHdcpLevel = HDCP_LEVEL_TYPE0;
+        else if (!strcmp(variantInfo->mHdcpLevel, "TYPE-1"))
+            variant->mHdcpLevel = HDCP_LEVEL_TYPE1;
         strcpy(variant->mAudioGroup,    variantInfo->mAudioGroup);
         strcpy(variant->mVideoGroup,    variantInfo->mVideoGroup);
         strcpy(variant->mSubtitleGroup, variantInfo->mSubtitleGroup);
@@ -273,6 +792,7 @@ printf("--- new_rendition : %s\n", rendInfo->mURI);
     strcpy(rend->mGroupId, rendInfo->mGroupId);
     strcpy(rend->mLanguage, rendInfo->mLanguage);
     strcpy(rend->mName, rendInfo->mName);
+    index_rendition(info, rend);
 
     /* add the playlist if this is an external rendition */
     if (rendInfo->mURI[0])
@@ -329,28 +849,49 @@ static void handle_init_section_args(InitSectionInfo_t* info, const char *key, i
     }
 }
 
-static Segment_t* new_init_section(Playlist_t* pls, InitSectionInfo_t* info, const char* url_base) 
+typedef struct ServerControlInfo_s {
+    char    mCanSkipUntil[20];
+} ServerControlInfo_t;
+
+static void handle_server_control_args(ServerControlInfo_t* info, const char *key, int key_len, char **dest, int *dest_len)
+{
+    if (!strncmp(key, "CAN-SKIP-UNTIL=", key_len))
+    {
+        *dest     =        info->mCanSkipUntil;
+        *dest_len = sizeof(info->mCanSkipUntil);
+    }
+    /*
+     * ignored:
+     * - CAN-SKIP-DATERANGES: date ranges are not used
+     * - HOLD-BACK, PART-HOLD-BACK, CAN-BLOCK-RELOAD: low-latency HLS is not supported
+     */
+}
+
+typedef struct SkipInfo_s {
+    char    mSkippedSegments[20];
+} SkipInfo_t;
+
+static void handle_skip_args(SkipInfo_t* info, const char *key, int key_len, char **dest, int *dest_len)
+{
+    if (!strncmp(key, "SKIPPED-SEGMENTS=", key_len))
+    {
+        *dest     =        info->mSkippedSegments;
+        *dest_len = sizeof(info->mSkippedSegments);
+    }
+}
+
+static Segment_t* new_init_section(PlaylistSnapshot_t* snap, InitSectionInfo_t* info, SharedURL_t* base)
 { 
     Segment_t* sec; 
     char *ptr; 
-    char tmp_str[MAX_URL_SIZE]; 
  
     if (!info->mURI[0]) 
         return NULL; 
  
-    sec = (Segment_t*)av_mallocz(sizeof(*sec)); 
+    sec = alloc_segment(info->mURI, base);
     if (!sec) 
         return NULL; 
  
-    ff_make_absolute_url(tmp_str, sizeof(tmp_str), url_base, info->mURI); 
-    sec->mURL = av_strdup(tmp_str); 
-
-    if (!sec->mURL)
-    { 
-        av_free(sec); 
-        return NULL; 
-    } 
- 
     if (info->mByterange[0])
     { 
         sec->mSize = strtoll(info->mByterange, NULL, 10); 
@@ -364,7 +905,7 @@ static Segment_t* new_init_section(Playlist_t* pls, InitSectionInfo_t* info, con
         sec->mSize = -1; 
     } 
  
-    dynarray_add(&pls->mInitSections, &pls->mInitSectionCnt, sec); 
+    dynarray_add(&snap->mInitSections, &snap->mInitSectionCnt, sec); 
  
     return sec; 
 }
@@ -385,503 +926,2811 @@ static int ensure_playlist(HLSInfo_t* info, Playlist_t** pls, const char* url)
     return 0;
 }
 
-static int is_same_server(const char* url1, const char* url2)
+static int ensure_snapshot(HLSInfo_t* info, Playlist_t** pls, PlaylistSnapshot_t** snap, const char* url)
 {
-    char proto1[32];
-    char proto2[32];
-    char hostname1[1024];
-    char hostname2[1024];
-    int  port1, port2;
+    int ret;
+
+    if ((ret = ensure_playlist(info, pls, url)) < 0)
+        return ret;
 
-    av_url_split(proto1, sizeof(proto1), NULL, 0, hostname1, sizeof(hostname1), &port1, NULL, 0, url1);
-    av_url_split(proto2, sizeof(proto2), NULL, 0, hostname2, sizeof(hostname2), &port2, NULL, 0, url2);
+    if (*snap)
+        return 0;
 
-    if (strcmp(proto1, proto2) == 0 && strcmp(hostname1, hostname2) == 0 && port1 == port2)
-        return 1;
+    *snap = alloc_snapshot();
+    if (!*snap)
+        return AVERROR(ENOMEM);
 
     return 0;
 }
 
-static int parse_playlist(HLSInfo_t* info, const char* url, Playlist_t* pls, const AVIOInterruptCB* int_cb, AVIOContext** io)
+/* Seek scans only touch these two arrays instead of chasing every Segment_t */
+static void build_segment_table(PlaylistSnapshot_t* snap)
 {
-    int ret;
-    char tmp_str[MAX_URL_SIZE];
-    char line[MAX_URL_SIZE];
-    
-    int is_variant = 0;
-    VariantInfo_t variantInfo;
+    int64_t offset = 0;
+    int ii;
 
-    KeyType_e eKeyType = KEY_TYPE_NONE;
-    char      keyURI[MAX_URL_SIZE];
-    int       has_iv = 0;
-    uint8_t   iv[16] = { 0, };
+    av_freep(&snap->mSegmentStartPts);
+    av_freep(&snap->mSegmentEndOffset);
 
-    int is_segment = 0;
-    int64_t segmentDuration = 0;
-    int64_t segmentSize = -1;
-    int64_t segmentOffset = 0;
+    if (snap->mSegmentCnt == 0)
+        return;
 
-    Segment_t* curInitSection = NULL;
+    snap->mSegmentStartPts  = (int64_t*)av_malloc_array(snap->mSegmentCnt, sizeof(int64_t));
+    snap->mSegmentEndOffset = (int64_t*)av_malloc_array(snap->mSegmentCnt, sizeof(int64_t));
+    if (!snap->mSegmentStartPts || !snap->mSegmentEndOffset)
+    {
+        av_freep(&snap->mSegmentStartPts);
+        av_freep(&snap->mSegmentEndOffset);
+        return;
+    }
 
-    AVIOContext* in = NULL;
-    URLContext* h = NULL;
+    for (ii = 0; ii < snap->mSegmentCnt; ii++)
+    {
+        offset += snap->mSegments[ii]->mDuration;
+        snap->mSegmentStartPts[ii]  = snap->mSegments[ii]->mStartPts;
+        snap->mSegmentEndOffset[ii] = offset;
+    }
+}
 
-    if (io && *io) /* KEEP ALIVE OPEN */
+int HLS_M3U8_FindSegment(PlaylistSnapshot_t* snap, int64_t offset)
+{
+    int low = 0, high;
+
+    if (!snap || snap->mSegmentCnt == 0)
+        return -1;
+
+    if (!snap->mSegmentEndOffset)
     {
+        int64_t end = 0;
+
+        for (low = 0; low < snap->mSegmentCnt - 1; low++)
+        {
+            end += snap->mSegments[low]->mDuration;
+            if (end > offset)
+                break;
+        }
+        return low;
+    }
+
+    /* first segment whose end is after offset, the last one if offset is beyond the end */
+    high = snap->mSegmentCnt - 1;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+
+        if (snap->mSegmentEndOffset[mid] > offset)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    return low;
+}
+
+int64_t HLS_M3U8_GetSegmentDuration(PlaylistSnapshot_t* snap, int index)
+{
+    if (!snap->mSegmentEndOffset)
+        return snap->mSegments[index]->mDuration;
+
+    return snap->mSegmentEndOffset[index] - (index > 0 ? snap->mSegmentEndOffset[index - 1] : 0);
+}
+
+int64_t HLS_M3U8_GetSegmentStartPts(PlaylistSnapshot_t* snap, int index)
+{
+    if (!snap->mSegmentStartPts)
+        return snap->mSegments[index]->mStartPts;
+
+    return snap->mSegmentStartPts[index];
+}
+
+int64_t HLS_M3U8_GetDuration(PlaylistSnapshot_t* snap)
+{
+    int64_t duration = 0;
+    int ii;
+
+    if (snap->mSegmentCnt > 0 && snap->mSegmentEndOffset)
+        return snap->mSegmentEndOffset[snap->mSegmentCnt - 1];
+
+    for (ii = 0; ii < snap->mSegmentCnt; ii++)
+        duration += snap->mSegments[ii]->mDuration;
+
+    return duration;
+}
+
+/* Builds segment of indexed snapshot from its entry, same as parse_playlist would have done at load */
+static Segment_t* materialize_segment(PlaylistSnapshot_t* snap, int index)
+{
+    SegmentEntry_t* entry = &snap->mEntries[index];
+    SegmentKey_t* key = entry->mKey >= 0 ? snap->mKeys[entry->mKey] : NULL;
+    Segment_t* seg = alloc_segment(snap->mData + entry->mLine, SHARED_URL_OF(snap->mBaseURL));
+    if (!seg)
+        return NULL;
+
+    seg->mStartPts      = HLS_M3U8_GetSegmentStartPts(snap, index);
+    seg->mDuration      = HLS_M3U8_GetSegmentDuration(snap, index);
+    seg->mDiscontinuity    = entry->mDiscontinuity;
+    seg->mDiscontinuitySeq = entry->mDiscontinuitySeq;
+    seg->mProgramDateTime  = entry->mProgramDateTime;
+    seg->mUrlOffset        = entry->mUrlOffset;
+    seg->mSize             = entry->mSize;
+
+    if (key)
+    {
+        seg->mKeyType = key->mType;
+        seg->mKeyURL  = ref_shared_url(SHARED_URL_OF(key->mURL));
+    }
+
+    if (key && key->mHasIV)
+        memcpy(seg->mIV, key->mIV, sizeof(seg->mIV));
+    else
+        AV_WB32(seg->mIV + 12, snap->mStartSeqNo + index);
+
+    if (entry->mInitSection >= 0)
+        seg->mInitSection = HLS_M3U8_RefSegment(snap->mInitSections[entry->mInitSection]);
+
+    return seg;
+}
+
+/* Published snapshot is immutable except this cache, which has its own lock */
+Segment_t* HLS_M3U8_GetSegment(PlaylistSnapshot_t* snap, int index)
+{
+    Segment_t* seg;
+    int slot;
+
+    if (!snap || index < 0 || index >= snap->mSegmentCnt)
+        return NULL;
+
+    if (!snap->mEntries)
+        return HLS_M3U8_RefSegment(snap->mSegments[index]);
+
+    slot = index % LAZY_SEGMENT_CACHE_SIZE;
+
+    pthread_mutex_lock(&snap->mCacheLock);
+    seg = snap->mCache[slot];
+    if (!seg || snap->mCacheIndex[slot] != index)
+    {
+        if ((seg = materialize_segment(snap, index)))
+        {
+            HLS_M3U8_UnrefSegment(snap->mCache[slot]);
+            snap->mCache[slot] = seg;
+            snap->mCacheIndex[slot] = index;
+        }
+    }
+    seg = HLS_M3U8_RefSegment(seg);
+    pthread_mutex_unlock(&snap->mCacheLock);
+
+    return seg;
+}
+
+/* Returns index of the new key in snap->mKeys */
+static int add_segment_key(PlaylistSnapshot_t* snap, KeyType_e type, SharedURL_t* url, int hasIV, const uint8_t* iv)
+{
+    SegmentKey_t* key = (SegmentKey_t*)av_mallocz(sizeof(SegmentKey_t));
+    if (!key)
+        return AVERROR(ENOMEM);
+
+    key->mType  = type;
+    key->mURL   = ref_shared_url(url);
+    key->mHasIV = hasIV;
+    if (hasIV)
+        memcpy(key->mIV, iv, sizeof(key->mIV));
+
+    dynarray_add(&snap->mKeys, &snap->mKeyCnt, key);
+
+    return snap->mKeyCnt - 1;
+}
+
+static int add_segment_entry(PlaylistSnapshot_t* snap, int* capacity, const SegmentEntry_t* entry, int64_t duration)
+{
+    int index = snap->mSegmentCnt;
+
+    if (index >= *capacity)
+    {
+        int newCapacity = _MAX(*capacity * 2, 1024);
+        void* entries = av_realloc_array(snap->mEntries, newCapacity, sizeof(SegmentEntry_t));
+        void* ends;
+
+        if (!entries)
+            return AVERROR(ENOMEM);
+        snap->mEntries = (SegmentEntry_t*)entries;
+
+        if (!(ends = av_realloc_array(snap->mSegmentEndOffset, newCapacity, sizeof(int64_t))))
+            return AVERROR(ENOMEM);
+        snap->mSegmentEndOffset = (int64_t*)ends;
+
+        *capacity = newCapacity;
+    }
+
+    snap->mEntries[index] = *entry;
+    snap->mSegmentEndOffset[index] = (index > 0 ? snap->mSegmentEndOffset[index - 1] : 0) + duration;
+    snap->mSegmentCnt++;
+
+    return 0;
+}
+
+/*
+ * Completes indexed snapshot, data is owned by snapshot from here. Live playlist is reloaded and merged
+ * segment by segment, so it is materialized at once and the index is dropped.
+ */
+static int finish_segment_index(PlaylistSnapshot_t* snap, char* data, int dataSize, SharedURL_t* base)
+{
+    Segment_t** segments = NULL;
+    int segmentCnt = 0;
+    int ii;
+
+    snap->mData     = data;
+    snap->mDataSize = dataSize;
+    snap->mBaseURL  = ref_shared_url(base);
+
+    snap->mSegmentStartPts = (int64_t*)av_malloc_array(snap->mSegmentCnt, sizeof(int64_t));
+    snap->mCache           = (Segment_t**)av_mallocz(LAZY_SEGMENT_CACHE_SIZE * sizeof(Segment_t*));
+    snap->mCacheIndex      = (int*)av_mallocz(LAZY_SEGMENT_CACHE_SIZE * sizeof(int));
+    if (!snap->mSegmentStartPts || !snap->mCache || !snap->mCacheIndex)
+    {
+        av_freep(&snap->mCache);
+        av_freep(&snap->mCacheIndex);
+        return AVERROR(ENOMEM);
+    }
+    pthread_mutex_init(&snap->mCacheLock, NULL);
+
+    for (ii = 0; ii < snap->mSegmentCnt; ii++)
+    {
+        if (!snap->mFinished)
+            snap->mSegmentStartPts[ii] = AV_NOPTS_VALUE;
+        else
+            snap->mSegmentStartPts[ii] = ii > 0 ? snap->mSegmentEndOffset[ii - 1] : 0;
+    }
+
+    if (snap->mFinished)
+        return 0;
+
+    for (ii = 0; ii < snap->mSegmentCnt; ii++)
+    {
+        Segment_t* seg = materialize_segment(snap, ii);
+        if (!seg)
+            break;
+
+        dynarray_add(&segments, &segmentCnt, seg);
+    }
+
+    if (segmentCnt != snap->mSegmentCnt)
+    {
+        for (ii = 0; ii < segmentCnt; ii++)
+            HLS_M3U8_UnrefSegment(segments[ii]);
+        av_free(segments);
+        return AVERROR(ENOMEM);
+    }
+
+    free_segment_index(snap);
+    av_freep(&snap->mSegmentStartPts);
+    av_freep(&snap->mSegmentEndOffset);
+    snap->mSegments = segments;
+
+    return 0;
+}
+
+/* Start pts of the first segment of live playlist which is loaded first time, see HLSInfo_t */
+static int64_t anchor_live_timeline(HLSInfo_t* info, PlaylistSnapshot_t* snap)
+{
+    Segment_t* first = snap->mSegments[0];
+    int64_t pts;
+
+    if (!info)
+        return 0;
+
+    pthread_mutex_lock(&info->mLiveAnchorLock);
+    if (!info->mLiveAnchorSet)
+    {
+        info->mLiveAnchorSet      = 1;
+        info->mLiveAnchorSeqNo    = snap->mStartSeqNo;
+        info->mLiveAnchorPts      = 0;
+        info->mLiveAnchorDateTime = first->mProgramDateTime;
+        pts = 0;
+    }
+    else if (first->mProgramDateTime != AV_NOPTS_VALUE && info->mLiveAnchorDateTime != AV_NOPTS_VALUE)
+        pts = info->mLiveAnchorPts + first->mProgramDateTime - info->mLiveAnchorDateTime;
+    else
+        pts = info->mLiveAnchorPts + (int64_t)(snap->mStartSeqNo - info->mLiveAnchorSeqNo) * snap->mTargetDuration;
+    pthread_mutex_unlock(&info->mLiveAnchorLock);
+
+    return pts;
+}
+
+/*
+ * Start pts of the first segment of live reload which is not shared with the previous load, e.g. its URL
+ * changed or the window moved past all of the previous segments. Taken by media sequence number from the
+ * previous load, otherwise by program date time or target duration from its last segment.
+ */
+static int64_t continue_live_timeline(PlaylistSnapshot_t* snap, PlaylistSnapshot_t* prev)
+{
+    Segment_t* first = snap->mSegments[0];
+    int index = snap->mStartSeqNo - prev->mStartSeqNo;
+    int last = prev->mSegmentCnt - 1;
+    int64_t lastPts = HLS_M3U8_GetSegmentStartPts(prev, last);
+    Segment_t* lastSeg;
+    int64_t pts;
+
+    if (index >= 0 && index <= last)
+        return HLS_M3U8_GetSegmentStartPts(prev, index);
+
+    if (lastPts == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;
+
+    if (!(lastSeg = HLS_M3U8_GetSegment(prev, last)))
+        return AV_NOPTS_VALUE;
+
+    if (first->mProgramDateTime != AV_NOPTS_VALUE && lastSeg->mProgramDateTime != AV_NOPTS_VALUE &&
+        first->mDiscontinuitySeq == lastSeg->mDiscontinuitySeq)
+        pts = lastPts + first->mProgramDateTime - lastSeg->mProgramDateTime;
+    else
+        pts = lastPts + HLS_M3U8_GetSegmentDuration(prev, last) + (int64_t)(index - last - 1) * snap->mTargetDuration;
+
+    HLS_M3U8_UnrefSegment(lastSeg);
+
+    return pts;
+}
+
+/*
+ * Segments reused from the previous load keep their start pts, and the following new segments
+ * continue from them. A finished playlist without any known start pts begins at zero, live one is
+ * placed on the timeline of previous load or the one shared with other playlists.
+ * Discontinuity sequence and program date time of new segments continue the same way.
+ */
+static void update_start_pts(Playlist_t* pls, PlaylistSnapshot_t* snap, PlaylistSnapshot_t* prev)
+{
+    int ii;
+    int64_t pts = AV_NOPTS_VALUE;
+
+    /* indexed snapshot has its table already */
+    if (snap->mEntries)
+        return;
+
+    for (ii = 0; ii < snap->mSegmentCnt; ii++)
+    {
+        Segment_t* seg = snap->mSegments[ii];
+        Segment_t* prevSeg = ii > 0 ? snap->mSegments[ii - 1] : NULL;
+
+        if (seg->mDiscontinuitySeq >= 0)
+            continue;
+
+        seg->mDiscontinuitySeq = prevSeg ? prevSeg->mDiscontinuitySeq + (seg->mDiscontinuity ? 1 : 0) : snap->mDiscontinuitySeq;
+
+        /* date time is not carried over discontinuity */
+        if (seg->mProgramDateTime == AV_NOPTS_VALUE && prevSeg && !seg->mDiscontinuity &&
+            prevSeg->mProgramDateTime != AV_NOPTS_VALUE)
+            seg->mProgramDateTime = prevSeg->mProgramDateTime + prevSeg->mDuration;
+    }
+
+    /* first segment without start pts is not shared with the previous load */
+    if (snap->mSegmentCnt > 0 && snap->mSegments[0]->mStartPts == AV_NOPTS_VALUE)
+    {
+        if (prev && prev->mSegmentCnt > 0)
+            snap->mSegments[0]->mStartPts = continue_live_timeline(snap, prev);
+        else if (snap->mFinished)
+            snap->mSegments[0]->mStartPts = 0;
+        else
+            snap->mSegments[0]->mStartPts = anchor_live_timeline(pls ? pls->mInfo : NULL, snap);
+    }
+
+    /* published segments are shared, only the new ones are written */
+    for (ii = 0; ii < snap->mSegmentCnt; ii++)
+    {
+        Segment_t* seg = snap->mSegments[ii];
+
+        if (seg->mStartPts != AV_NOPTS_VALUE)
+            pts = seg->mStartPts;
+        else
+            seg->mStartPts = pts;
+
+        if (pts != AV_NOPTS_VALUE)
+            pts += seg->mDuration;
+    }
+
+    build_segment_table(snap);
+}
+
+#define MAX_SERVER_KEY_LEN 1088
+
+/* "proto://hostname:port" of url, connections can be reused between urls of the same key */
+static void get_server_key(char* key, int size, const char* url)
+{
+    char proto[32];
+    char hostname[1024];
+    int  port;
+
+    av_url_split(proto, sizeof(proto), NULL, 0, hostname, sizeof(hostname), &port, NULL, 0, url);
+    snprintf(key, size, "%s://%s:%d", proto, hostname, port);
+}
+
+static int is_same_server(const char* url1, const char* url2)
+{
+    char key1[MAX_SERVER_KEY_LEN];
+    char key2[MAX_SERVER_KEY_LEN];
+
+    get_server_key(key1, sizeof(key1), url1);
+    get_server_key(key2, sizeof(key2), url2);
+
+    return strcmp(key1, key2) == 0;
+}
+
+typedef enum {
+    M3U8_TAG_NONE,     /* not a tag, URI or empty line */
+    M3U8_TAG_UNKNOWN,  /* comment or tag which is not supported */
+    M3U8_TAG_INF,
+    M3U8_TAG_STREAM_INF,
+    M3U8_TAG_MEDIA,
+    M3U8_TAG_KEY,
+    M3U8_TAG_TARGETDURATION,
+    M3U8_TAG_MEDIA_SEQUENCE,
+    M3U8_TAG_PLAYLIST_TYPE,
+    M3U8_TAG_SERVER_CONTROL,
+    M3U8_TAG_SKIP,
+    M3U8_TAG_ENDLIST,
+    M3U8_TAG_MAP,
+    M3U8_TAG_DISCONTINUITY,
+    M3U8_TAG_DISCONTINUITY_SEQUENCE,
+    M3U8_TAG_PROGRAM_DATE_TIME,
+    M3U8_TAG_BYTERANGE,
+} M3U8Tag_e;
+
+typedef struct M3U8TagName_s {
+    const char* mName;
+    M3U8Tag_e   mTag;
+} M3U8TagName_t;
+
+static const M3U8TagName_t g_TagNames[] = {
+    { "#EXTINF",                        M3U8_TAG_INF },
+    { "#EXT-X-STREAM-INF",              M3U8_TAG_STREAM_INF },
+    { "#EXT-X-MEDIA",                   M3U8_TAG_MEDIA },
+    { "#EXT-X-KEY",                     M3U8_TAG_KEY },
+    { "#EXT-X-TARGETDURATION",          M3U8_TAG_TARGETDURATION },
+    { "#EXT-X-MEDIA-SEQUENCE",          M3U8_TAG_MEDIA_SEQUENCE },
+    { "#EXT-X-PLAYLIST-TYPE",           M3U8_TAG_PLAYLIST_TYPE },
+    { "#EXT-X-SERVER-CONTROL",          M3U8_TAG_SERVER_CONTROL },
+    { "#EXT-X-SKIP",                    M3U8_TAG_SKIP },
+    { "#EXT-X-ENDLIST",                 M3U8_TAG_ENDLIST },
+    { "#EXT-X-MAP",                     M3U8_TAG_MAP },
+    { "#EXT-X-DISCONTINUITY",           M3U8_TAG_DISCONTINUITY },
+    { "#EXT-X-DISCONTINUITY-SEQUENCE",  M3U8_TAG_DISCONTINUITY_SEQUENCE },
+    { "#EXT-X-PROGRAM-DATE-TIME",       M3U8_TAG_PROGRAM_DATE_TIME },
+    { "#EXT-X-BYTERANGE",               M3U8_TAG_BYTERANGE },
+};
+
+#define TAG_HASH_SIZE     64 /* power of 2, larger than twice the number of tags */
+#define PLAYLIST_READ_SIZE (64 * 1024)
+
+/* open addressing table of g_TagNames indexed by hash of tag name, -1 for empty slot */
+static int            g_TagHash[TAG_HASH_SIZE];
+static pthread_once_t g_TagHashOnce = PTHREAD_ONCE_INIT;
+
+static uint32_t hash_tag_name(const char* name, int len)
+{
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    int ii;
+
+    for (ii = 0; ii < len; ii++)
+        hash = (hash ^ (uint8_t)name[ii]) * 16777619u;
+
+    return hash;
+}
+
+static void init_tag_hash(void)
+{
+    int ii;
+
+    memset(g_TagHash, 0xff, sizeof(g_TagHash));
+
+    for (ii = 0; ii < FF_ARRAY_ELEMS(g_TagNames); ii++)
+    {
+        const char* name = g_TagNames[ii].mName;
+        uint32_t slot = hash_tag_name(name, strlen(name)) & (TAG_HASH_SIZE - 1);
+
+        while (g_TagHash[slot] >= 0)
+            slot = (slot + 1) & (TAG_HASH_SIZE - 1);
+
+        g_TagHash[slot] = ii;
+    }
+}
+
+/* Classifies a line by its tag name, attributes (after ':') are returned in ptr without copy */
+static M3U8Tag_e get_tag(const char* line, const char** ptr)
+{
+    const char* name = line;
+    int len = 0;
+    uint32_t slot;
+
+    if (line[0] != '#')
+        return M3U8_TAG_NONE;
+
+    if (strncmp(line, "#EXT", 4))
+        return M3U8_TAG_UNKNOWN;
+
+    while (name[len] && name[len] != ':')
+        len++;
+
+    *ptr = name[len] == ':' ? name + len + 1 : name + len;
+
+    slot = hash_tag_name(name, len) & (TAG_HASH_SIZE - 1);
+    while (g_TagHash[slot] >= 0)
+    {
+        const M3U8TagName_t* tag = &g_TagNames[g_TagHash[slot]];
+
+        if (!strncmp(tag->mName, name, len) && tag->mName[len] == '\0')
+            return tag->mTag;
+
+        slot = (slot + 1) & (TAG_HASH_SIZE - 1);
+    }
+
+    return M3U8_TAG_UNKNOWN;
+}
+
+/* Cuts the next line in place, trailing white spaces are removed. Returns NULL at the end of data */
+static char* next_line(char** cur, char* end)
+{
+    char* line = *cur;
+    char* eol;
+
+    if (line >= end)
+        return NULL;
+
+    eol = (char*)memchr(line, '\n', end - line);
+    if (!eol)
+        eol = end;
+
+    *cur = eol < end ? eol + 1 : end;
+    *eol = '\0';
+
+    while (eol > line && av_isspace(eol[-1]))
+        *--eol = '\0';
+
+    return line;
+}
+
+/* Reads whole response into one buffer which is nul terminated, so lines can be tokenized in place */
+static int read_playlist_data(AVIOContext* in, char** data, int* size)
+{
+    int64_t total = avio_size(in);
+    int capacity = total > 0 && total < INT_MAX / 2 ? total + 1 : PLAYLIST_READ_SIZE;
+    int len = 0;
+    char* buf = NULL;
+    int ret;
+
+    for (;;)
+    {
+        if (!buf || capacity - len < 2)
+        {
+            char* tmp;
+
+            if (buf)
+            {
+                if (capacity > INT_MAX / 2)
+                {
+                    av_free(buf);
+                    return AVERROR(ENOMEM);
+                }
+                capacity *= 2;
+            }
+
+            if (!(tmp = (char*)av_realloc(buf, capacity)))
+            {
+                av_free(buf);
+                return AVERROR(ENOMEM);
+            }
+            buf = tmp;
+        }
+
+        ret = avio_read(in, (unsigned char*)buf + len, capacity - len - 1);
+        if (ret == AVERROR_EOF || ret == 0)
+            break;
+
+        if (ret < 0)
+        {
+            av_free(buf);
+            return ret;
+        }
+        len += ret;
+    }
+
+    buf[len] = '\0';
+    *data = buf;
+    *size = len;
+
+    return 0;
+}
+
+/* ETag and Last-Modified of response, empty if http protocol doesn't export them as stock ffmpeg */
+static void save_validators(char* etag, char* lastModified, AVIOContext* in)
+{
+    uint8_t* value = NULL;
+
+    etag[0] = '\0';
+    if (av_opt_get(in, "etag", AV_OPT_SEARCH_CHILDREN, &value) >= 0 && value)
+        av_strlcpy(etag, (const char*)value, MAX_VALIDATOR_LEN);
+    av_freep(&value);
+
+    lastModified[0] = '\0';
+    if (av_opt_get(in, "last_modified", AV_OPT_SEARCH_CHILDREN, &value) >= 0 && value)
+        av_strlcpy(lastModified, (const char*)value, MAX_VALIDATOR_LEN);
+    av_freep(&value);
+}
+
+/* "YYYY-MM-DDThh:mm:ss[.fff](Z|+hh:mm|-hh:mm)" to us since epoch, AV_NOPTS_VALUE if it is not valid */
+static int64_t parse_date_time(const char* str)
+{
+    int year, month, day, hour, minute, len = 0;
+    int tzHour = 0, tzMinute = 0;
+    double second;
+    int64_t era, yoe, doy, days, seconds;
+    const char* tz;
+
+    if (sscanf(str, "%d-%d-%dT%d:%d:%lf%n", &year, &month, &day, &hour, &minute, &second, &len) != 6 || len == 0)
+        return AV_NOPTS_VALUE;
+
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second < 0 || second >= 61)
+        return AV_NOPTS_VALUE;
+
+    tz = str + len;
+    if (*tz == '+' || *tz == '-')
+    {
+        if (sscanf(tz + 1, "%2d:%2d", &tzHour, &tzMinute) < 1 && sscanf(tz + 1, "%2d%2d", &tzHour, &tzMinute) < 1)
+            return AV_NOPTS_VALUE;
+        if (*tz == '-')
+        {
+            tzHour = -tzHour;
+            tzMinute = -tzMinute;
+        }
+    }
+
+    /* days from 1970-01-01 in proleptic Gregorian calendar, without timegm() of libc */
+    year -= month <= 2;
+    era  = (year >= 0 ? year : year - 399) / 400;
+    yoe  = year - era * 400;
+    doy  = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+
+    seconds = ((days * 24 + hour - tzHour) * 60 + minute - tzMinute) * 60;
+
+    return seconds * AV_TIME_BASE + (int64_t)(second * AV_TIME_BASE);
+}
+
+/*
+ * prev is the last loaded snapshot for live update, its segments are reused when unchanged.
+ * If out is NULL, the parsed snapshot is published to playlist, otherwise it is returned to caller.
+ */
+static int parse_playlist(HLSInfo_t* info, const char* url, Playlist_t* pls, PlaylistSnapshot_t* prev, PlaylistSnapshot_t** out,
+                          const AVIOInterruptCB* int_cb, AVIOContext** io)
+{
+    int ret;
+    char tmp_str[MAX_URL_SIZE];
+    char* data = NULL;
+    int   dataSize = 0;
+    char* cur;
+    char* end;
+    char* line;
+    
+    int is_variant = 0;
+    VariantInfo_t variantInfo;
+
+    KeyType_e eKeyType = KEY_TYPE_NONE;
+    SharedURL_t* curKey = NULL;
+    SharedURL_t* base = NULL;
+    int       has_iv = 0;
+    uint8_t   iv[16] = { 0, };
+    uint8_t   segmentIV[16];
+
+    int is_segment = 0;
+    int is_discontinuity = 0;
+    int64_t segmentDuration = 0;
+    int64_t segmentSize = -1;
+    int64_t segmentOffset = 0;
+
+    Segment_t* curInitSection = NULL;
+    PlaylistSnapshot_t* snap = NULL;
+
+    /* large VOD playlist is only indexed, see LAZY_PLAYLIST_DATA_SIZE */
+    int lazy = 0;
+    int entryCapacity = 0;
+    int curKeyIndex = -1;
+    int curInitIndex = -1;
+
+    /* conditional reload, see save_validators */
+    char headers[2 * MAX_VALIDATOR_LEN + 64];
+    int conditional = 0;
+    uint64_t dataHash = 0;
+    int isMaster = info && !pls;
+
+    /* #EXT-X-PROGRAM-DATE-TIME of next segment. Indexed snapshot carries the timeline while parsing */
+    int64_t programDateTime = AV_NOPTS_VALUE;
+    int64_t nextDateTime = AV_NOPTS_VALUE;
+    int discontinuitySeq = 0;
+
+#ifdef ENABLE_DEBUG_PARSER_PERFORMANCE
+    int64_t parseStart = 0;
+#endif
+
+    AVIOContext* in = NULL;
+    URLContext* h = NULL;
+    uint8_t* redirectURL = NULL;
+
+    /* empty headers also clear the ones of previous request on kept-alive connection */
+    headers[0] = '\0';
+    if (pls && prev)
+    {
+        if (pls->mETag[0])
+            av_strlcatf(headers, sizeof(headers), "If-None-Match: %s\r\n", pls->mETag);
+        if (pls->mLastModified[0])
+            av_strlcatf(headers, sizeof(headers), "If-Modified-Since: %s\r\n", pls->mLastModified);
+        conditional = headers[0] != '\0';
+    }
+    else if (isMaster)
+    {
+        /* validators of cached master, see HLS_M3U8_OpenMaster */
+        if (info->mETag[0])
+            av_strlcatf(headers, sizeof(headers), "If-None-Match: %s\r\n", info->mETag);
+        if (info->mLastModified[0])
+            av_strlcatf(headers, sizeof(headers), "If-Modified-Since: %s\r\n", info->mLastModified);
+        conditional = headers[0] != '\0';
+    }
+
+    if (io && *io) /* KEEP ALIVE OPEN */
+    {
+        in = *io;
+        h = (URLContext*)in->opaque;
+        if(!h)
+        {
+            LOG_ERROR("url context is null \n");
+            return -1;
+        }
+
+        if (is_same_server(h->filename, url))
+        {
+// TBD Check it !!!
+//          avio_reset(in, AVIO_FLAG_READ);
+            AVDictionary* opts = NULL;
+
+            in->eof_reached = 0;
+            av_dict_set(&opts, "headers", headers, 0);
+            ret = ff_http_do_new_request2(h, url, &opts);
+            av_dict_free(&opts);
+            if (ret < 0)
+            {
+                avio_close(in);
+                if (ret == AVERROR_EXIT)
+                {
+                    LOG_ERROR("AVERROR_EXIT !!!\n");
+                    return ret;
+                }
+                LOG_WARN("keepalive open failed, clear connection and retry new connection !\n");
+                in = NULL;
+            }
+        }
+        else
+        {
+            LOG_WARN("It's difference server, new open !\n");
+            avio_close(in);
+            in = NULL;
+        }
+    }
+
+    if (in == NULL)
+    {
+        AVDictionary *opts = NULL;
+        av_dict_set(&opts, "multiple_requests", "1", 0);
+        if (headers[0])
+            av_dict_set(&opts, "headers", headers, 0);
+
+        ret = avio_open2(&in, url, AVIO_FLAG_READ, int_cb, &opts);
+        av_dict_free(&opts);
+        if (ret < 0)
+        {
+            LOG_ERROR("Cannot open url : %s\n", url);
+            in = NULL;
+            return ret;
+        }
+
+        // Save redirect URL, segment URLs are relative to it
+        if (av_opt_get(in, "location", AV_OPT_SEARCH_CHILDREN, &redirectURL) >= 0 && redirectURL)
+            url = (const char*)redirectURL;
+
+    }
+
+    pthread_once(&g_TagHashOnce, init_tag_hash);
+
+    /* segment URLs are kept relative to this, resolved when they are downloaded */
+    if (!(base = new_shared_url(url)))
+    {
+        ret = AVERROR(ENOMEM);
+        goto EXIT;
+    }
+
+    if ((ret = read_playlist_data(in, &data, &dataSize)) < 0)
+    {
+        LOG_ERROR("failed to read playlist : ret %d\n", ret);
+        goto EXIT;
+    }
+
+    /* also kept by media playlist given as master url, it's created while parsing */
+    dataHash = hash_body(data, dataSize);
+
+    if (isMaster)
+    {
+        if (conditional && dataSize == 0)
+        {
+            ret = HLS_M3U8_NOT_MODIFIED;
+            goto EXIT;
+        }
+        info->mMasterHash = hash_data(data, dataSize);
+        info->mMasterTime = time(NULL);
+    }
+
+    /* 304 comes with no body, and the same body as last time needs no parsing either */
+    if (pls && prev && ((conditional && dataSize == 0) || (dataSize > 0 && dataHash == pls->mDataHash)))
+    {
+        pls->mLastLoadTime = get_tick();
+        ret = HLS_M3U8_NOT_MODIFIED;
+        goto EXIT;
+    }
+
+    /* live reload has to compare with previous segments, only the first load is indexed */
+    lazy = !prev && !out && dataSize >= LAZY_PLAYLIST_DATA_SIZE;
+
+#ifdef ENABLE_DEBUG_PARSER_PERFORMANCE
+    parseStart = get_tick();
+#endif
+
+    cur = data;
+    end = data + dataSize;
+
+    line = next_line(&cur, end);
+    if (!line || strcmp(line, "#EXTM3U"))
+    {
+        ret = AVERROR_INVALIDDATA;
+        LOG_ERROR("Invalid Data\n");
+        goto EXIT;
+    }
+
+    while ((line = next_line(&cur, end)))
+    {
+        const char* ptr = NULL;
+
+        switch (get_tag(line, &ptr))
+        {
+        case M3U8_TAG_STREAM_INF:
+        {
+            is_variant = 1;
+            memset(&variantInfo, 0, sizeof(VariantInfo_t));
+            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_variant_args, &variantInfo);
+            break;
+        }
+        case M3U8_TAG_MEDIA:
+        {
+            RenditionInfo_t renditionInfo = {{0}};
+            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_rendition_args, &renditionInfo);
+            new_rendition(info, &renditionInfo, url);
+            break;
+        }
+        case M3U8_TAG_INF:
+        {
+            is_segment = 1;
+            segmentDuration = atof(ptr) * AV_TIME_BASE;        
+            break;
+        }
+        case M3U8_TAG_KEY:
+        {
+            KeyInfo_t keyInfo;
+            memset(&keyInfo, 0x00, sizeof(keyInfo));
+
+            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_key_args, &keyInfo);
+            
+            eKeyType = KEY_TYPE_NONE;
+            if (!strcmp(keyInfo.mMethod, "AES-128"))
+                eKeyType = KEY_TYPE_AES128;
+            
+            has_iv = 0;
+            if (!strncmp(keyInfo.mIV, "0x", 2) || !strncmp(keyInfo.mIV, "0X", 2))
+            {
+                ff_hex_to_data(iv, keyInfo.mIV + 2);
+                has_iv = 1;
+            }
+
+            unref_shared_url(curKey);
+            curKey = NULL;
+            curKeyIndex = -1;
+            if (eKeyType != KEY_TYPE_NONE)
+            {
+                ff_make_absolute_url(tmp_str, sizeof(tmp_str), url, keyInfo.mURI);
+                if (!(curKey = new_shared_url(tmp_str)))
+                {
+                    ret = AVERROR(ENOMEM);
+                    goto EXIT;
+                }
+            }
+            break;
+        }
+        case M3U8_TAG_TARGETDURATION:
+        {
+            ret = ensure_snapshot(info, &pls, &snap, url);
+            if (ret < 0)
+                goto EXIT;
+
+            snap->mTargetDuration = strtoll(ptr, NULL, 10) * AV_TIME_BASE;
+            break;
+        }
+        case M3U8_TAG_MEDIA_SEQUENCE:
+        {
+            ret = ensure_snapshot(info, &pls, &snap, url);
+            if (ret < 0)
+                goto EXIT;
+
+            snap->mStartSeqNo = atoi(ptr);
+            break;
+        }
+        case M3U8_TAG_PLAYLIST_TYPE:
+        {
+            ret = ensure_snapshot(info, &pls, &snap, url);
+            if (ret < 0)
+                goto EXIT;
+
+            if (!strcmp(ptr, "EVENT"))
+                snap->mType = PLS_TYPE_EVENT;
+            else if (!strcmp(ptr, "VOD"))
+                snap->mType = PLS_TYPE_VOD;
+            break;
+        }
+        case M3U8_TAG_SERVER_CONTROL:
+        {
+            ServerControlInfo_t serverControlInfo = {{0}};
+            ret = ensure_snapshot(info, &pls, &snap, url);
+            if (ret < 0)
+                goto EXIT;
+
+            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_server_control_args, &serverControlInfo);
+            if (serverControlInfo.mCanSkipUntil[0])
+                snap->mCanSkipUntil = atof(serverControlInfo.mCanSkipUntil) * AV_TIME_BASE;
+            break;
+        }
+        case M3U8_TAG_SKIP:
+        {
+            SkipInfo_t skipInfo = {{0}};
+            ret = ensure_snapshot(info, &pls, &snap, url);
+            if (ret < 0)
+                goto EXIT;
+
+            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_skip_args, &skipInfo);
+            snap->mSkippedSegmentCnt = atoi(skipInfo.mSkippedSegments);
+            break;
+        }
+        case M3U8_TAG_ENDLIST:
+        {
+            if (snap)
+                snap->mFinished = 1;
+            break;
+        }
+        case M3U8_TAG_MAP:
+        {
+            InitSectionInfo_t initSecInfo = {{0}};
+            ret = ensure_snapshot(info, &pls, &snap, url);
+            if (ret < 0)
+                goto EXIT;
+
+            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_init_section_args, &initSecInfo);
+            curInitSection = new_init_section(snap, &initSecInfo, base);
+            curInitIndex = curInitSection ? snap->mInitSectionCnt - 1 : -1;
+            curInitSection->mKeyType = eKeyType;
+            if (has_iv)
+            {
+                memcpy(curInitSection->mIV, iv, sizeof(iv));
+            }
+            else
+            {
+                int seq = snap->mStartSeqNo + snap->mSkippedSegmentCnt + snap->mSegmentCnt;
+                memset(curInitSection->mIV, 0, sizeof(curInitSection->mIV));
+                AV_WB32(curInitSection->mIV + 12, seq);
+            }
+
+            curInitSection->mKeyURL = ref_shared_url(curKey);
+            break;
+        }
+        case M3U8_TAG_DISCONTINUITY:
+        {
+            is_discontinuity = 1;
+            break;
+        }
+        case M3U8_TAG_DISCONTINUITY_SEQUENCE:
+        {
+            ret = ensure_snapshot(info, &pls, &snap, url);
+            if (ret < 0)
+                goto EXIT;
+
+            snap->mDiscontinuitySeq = atoi(ptr);
+            break;
+        }
+        case M3U8_TAG_PROGRAM_DATE_TIME:
+        {
+            programDateTime = parse_date_time(ptr);
+            if (programDateTime == AV_NOPTS_VALUE)
+                LOG_WARN("Invalid program date time : %s\n", ptr);
+            break;
+        }
+        case M3U8_TAG_BYTERANGE:
+        {
+            segmentSize = strtoll(ptr, NULL, 10);
+            ptr = strchr(ptr, '@');
+            if (ptr)
+                segmentOffset = strtoll(ptr+1, NULL, 10);
+            break;
+        }
+        case M3U8_TAG_NONE:
+        {
+            if (!line[0])
+                break;
+
+            if (is_variant)
+            {
+                if (!new_variant(info, &variantInfo, line, url))
+                {
+                    ret = AVERROR(ENOMEM);
+                    goto EXIT;
+                }
+                is_variant = 0;    
+            }
+            else if (is_segment)
+            {
+                Segment_t* seg;
+                int seq;
+                ret = ensure_snapshot(info, &pls, &snap, url);
+                if (ret < 0)
+                    goto EXIT;
+
+                seq = snap->mStartSeqNo + snap->mSkippedSegmentCnt + snap->mSegmentCnt;
+
+                if (segmentSize < 0)
+                    segmentOffset = 0;
+
+                if (lazy)
+                {
+                    SegmentEntry_t entry;
+
+                    if (eKeyType != KEY_TYPE_NONE && curKeyIndex < 0 &&
+                        (curKeyIndex = add_segment_key(snap, eKeyType, curKey, has_iv, iv)) < 0)
+                    {
+                        ret = curKeyIndex;
+                        goto EXIT;
+                    }
+
+                    entry.mLine          = line - data;
+                    entry.mKey           = eKeyType != KEY_TYPE_NONE ? curKeyIndex : -1;
+                    entry.mInitSection   = curInitIndex;
+                    entry.mDiscontinuity = is_discontinuity;
+                    entry.mUrlOffset     = segmentOffset;
+                    entry.mSize          = segmentSize;
+
+                    /* same as update_start_pts does for allocated segments */
+                    if (snap->mSegmentCnt > 0)
+                        discontinuitySeq += is_discontinuity ? 1 : 0;
+                    else
+                        discontinuitySeq = snap->mDiscontinuitySeq;
+                    if (programDateTime == AV_NOPTS_VALUE && !is_discontinuity)
+                        programDateTime = nextDateTime;
+
+                    entry.mDiscontinuitySeq = discontinuitySeq;
+                    entry.mProgramDateTime  = programDateTime;
+                    nextDateTime = programDateTime != AV_NOPTS_VALUE ? programDateTime + segmentDuration : AV_NOPTS_VALUE;
+
+                    if ((ret = add_segment_entry(snap, &entryCapacity, &entry, segmentDuration)) < 0)
+                        goto EXIT;
+
+                    is_segment = 0;
+                    is_discontinuity = 0;
+                    programDateTime = AV_NOPTS_VALUE;
+
+                    if (segmentSize >= 0) {
+                        segmentOffset += segmentSize;
+                        segmentSize = -1;
+                    }
+                    continue;
+                }
+
+                if (!has_iv)
+                {
+                    memset(segmentIV, 0, sizeof(segmentIV));
+                    AV_WB32(segmentIV + 12, seq);
+                }
+                else
+                    memcpy(segmentIV, iv, sizeof(segmentIV));
+
+                seg = find_reusable_segment(prev, seq, line, base->mURL, segmentOffset, segmentSize, eKeyType,
+                                            curKey ? curKey->mURL : NULL, segmentIV, curInitSection);
+                if (seg)
+                {
+                    dynarray_add(&snap->mSegments, &snap->mSegmentCnt, HLS_M3U8_RefSegment(seg));
+                    is_segment = 0;
+                    is_discontinuity = 0;
+                    programDateTime = AV_NOPTS_VALUE;
+
+                    if (segmentSize >= 0) {
+                        segmentOffset += segmentSize;
+                        segmentSize = -1;
+                    }
+                    continue;
+                }
+
+                seg = alloc_segment(line, base);
+                if (!seg)
+                {
+                    ret = AVERROR(ENOMEM);
+                    goto EXIT;
+                }
+                seg->mDuration = segmentDuration;
+                seg->mDiscontinuity = is_discontinuity;
+                seg->mProgramDateTime = programDateTime;
+                seg->mKeyType = eKeyType;
+                memcpy(seg->mIV, segmentIV, sizeof(seg->mIV));
+
+                seg->mKeyURL = ref_shared_url(curKey);
+
+                dynarray_add(&snap->mSegments, &snap->mSegmentCnt, seg);
+                is_segment = 0;
+                is_discontinuity = 0;
+                programDateTime = AV_NOPTS_VALUE;
+
+                seg->mSize = segmentSize;
+                seg->mUrlOffset = segmentOffset;
+                if (segmentSize >= 0) {
+                    segmentOffset += segmentSize;
+                    segmentSize = -1;
+                }
+
+                seg->mInitSection = HLS_M3U8_RefSegment(curInitSection);
+            }
+            break;
+        }
+        default:
+        {
+            /* comment or tag which is not supported */
+            break;
+        }
+        }
+    }
+
+    if (pls)
+        pls->mLastLoadTime = get_tick();
+
+#ifdef ENABLE_DEBUG_PARSER_PERFORMANCE
+    do {
+        int64_t elapsed = _MAX(get_tick() - parseStart, 1);
+        LOG_TRACE("###### Parser : %d bytes, %d segments in %lld us, %lld MB/s\n", dataSize,
+                  snap ? snap->mSegmentCnt : 0, elapsed, (int64_t)dataSize / elapsed);
+    } while (0);
+#endif
+
+    if (snap && snap->mEntries)
+    {
+        /* data is owned by snapshot regardless of result */
+        ret = finish_segment_index(snap, data, dataSize, base);
+        data = NULL;
+        if (ret < 0)
+            goto EXIT;
+    }
+
+    if (pls)
+    {
+        pls->mDataHash = dataHash;
+        save_validators(pls->mETag, pls->mLastModified, in);
+    }
+    if (isMaster)
+        save_validators(info->mETag, info->mLastModified, in);
+
+    ret = 0;
+    if (snap)
+    {
+        if (out)
+        {
+            *out = snap;
+        }
+        else
+        {
+            update_start_pts(pls, snap, prev);
+            publish_snapshot(pls, snap);
+        }
+        snap = NULL;
+    }
+
+EXIT:
+    free_snapshot(snap);
+    unref_shared_url(curKey);
+    unref_shared_url(base);
+    av_free(data);
+    av_free(redirectURL);
+
+    if (io)
+    {
+        *io = in;
+    }
+    else
+    {
+        if (in)
+            avio_close(in);
+    }
+
+    return ret;
+}
+
+static void add_rendition_to_variant(Variant_t* var, Rendition_t* rend)
+{
+    if (rend->mPlaylist)
+        dynarray_add(&var->mPlaylists, &var->mPlaylistCnt, rend->mPlaylist);
+    else
+    {
+        dynarray_add(&var->mPlaylists[0]->mRenditions, &var->mPlaylists[0]->mRenditionCnt, rend);
+    }
+}
+
+static void add_renditions_to_variant(HLSInfo_t* info, Variant_t* var, enum AVMediaType type, const char* group_id)
+{
+    Rendition_t* rend;
+    int ii;
+
+    if (!info->mLookupDisabled)
+    {
+        rend = info->mGroupTable ? find_group_slot(info->mGroupTable, info->mGroupTableSize, type, group_id)->mHead : NULL;
+        for (; rend; rend = rend->mNextInGroup)
+            add_rendition_to_variant(var, rend);
+        return;
+    }
+
+    for (ii = 0; ii < info->mRenditionCnt; ii++)
+    {
+        rend = info->mRenditions[ii];
+
+        if (rend->mType == type && !strcmp(rend->mGroupId, group_id))
+            add_rendition_to_variant(var, rend);
+    }
+}
+
+/* Register renditions to playlist */
+static void register_renditions(HLSInfo_t* info)
+{
+    int ii;
+
+    for (ii = 0; ii < info->mVariantCnt; ii++)
+    {
+        Variant_t* var = info->mVariants[ii];
+        if(var->mAudioGroup[0])
+        {
+            add_renditions_to_variant(info, var, AVMEDIA_TYPE_AUDIO, var->mAudioGroup);
+        }
+        if(var->mVideoGroup[0])
+        {
+            add_renditions_to_variant(info, var, AVMEDIA_TYPE_VIDEO, var->mVideoGroup);
+        }
+        if(var->mSubtitleGroup[0])
+        {
+            add_renditions_to_variant(info, var, AVMEDIA_TYPE_SUBTITLE, var->mSubtitleGroup);
+        }
+    }
+}
+
+/* Clears info for master of url. It owns mLiveAnchorLock while mURL is set, see HLS_M3U8_Delete */
+static int init_info(HLSInfo_t* info, const char* url)
+{
+    memset(info, 0x00, sizeof(HLSInfo_t));
+
+    if (!(info->mURL = av_strdup(url)))
+        return AVERROR(ENOMEM);
+
+    pthread_mutex_init(&info->mLiveAnchorLock, NULL);
+
+    return 0;
+}
+
+/* Request is conditional if validators of cached master are given, HLS_M3U8_NOT_MODIFIED is returned then */
+static int parse_master(HLSInfo_t* info, const char* url, const char* etag, const char* lastModified,
+                        const AVIOInterruptCB* int_cb, AVIOContext** io)
+{
+    AVIOContext* in = NULL;
+    int ret = 0;
+
+    if ((ret = init_info(info, url)) < 0)
+        return ret;
+
+    if (etag)
+        av_strlcpy(info->mETag, etag, sizeof(info->mETag));
+    if (lastModified)
+        av_strlcpy(info->mLastModified, lastModified, sizeof(info->mLastModified));
+
+    if (io && *io)
         in = *io;
-        h = (URLContext*)in->opaque;
-        if(!h)
+
+    if ((ret = parse_playlist(info, url, NULL, NULL, NULL, int_cb, &in)) != 0)
+        goto ERROR;
+
+    /* url is media playlist itself, it is published already */
+    if (info->mPlaylistCnt == 1 && info->mPlaylists[0]->mSnapshot->mSegmentCnt > 0)
+        info->mPlaylists[0]->mLoaded = 1;
+
+    register_renditions(info);
+
+    goto EXIT;
+ERROR:
+    /* TBD. Free Here */
+
+EXIT:
+    if (io)
+    {
+        *io = in;
+    }
+    else
+    {
+        if (in)
+            avio_close(in);
+    }
+    return ret;
+}
+
+int HLS_M3U8_ParseMaster(HLSInfo_t* info, const char* url, const AVIOInterruptCB* int_cb, AVIOContext** io)
+{
+    return parse_master(info, url, NULL, NULL, int_cb, io);
+}
+
+int HLS_M3U8_Parse(HLSInfo_t* info, const char* url, const AVIOInterruptCB* int_cb, AVIOContext** io)
+{
+    AVIOContext* in = NULL;
+    int ret = 0;
+    int ii;
+
+    if (io && *io)
+        in = *io;
+
+    if ((ret = HLS_M3U8_ParseMaster(info, url, int_cb, &in)) != 0)
+        goto EXIT;
+
+    /* single media playlist is loaded already, nothing to overlap */
+    if (info->mPlaylistCnt > 1)
+    {
+        ret = HLS_M3U8_LoadAll(info, int_cb, MAX_PLAYLIST_CONNECTIONS_PER_HOST);
+        goto EXIT;
+    }
+
+    for (ii = 0; ii < info->mPlaylistCnt; ii++)
+    {
+        if ((ret = HLS_M3U8_Load(info->mPlaylists[ii], int_cb, &in)) != 0)
+            goto EXIT;
+    }
+
+EXIT:
+    if (io)
+    {
+        *io = in;
+    }
+    else
+    {
+        if (in)
+            avio_close(in);
+    }
+    return ret;
+}
+
+int HLS_M3U8_IsLoaded(Playlist_t* pls)
+{
+    return __atomic_load_n(&pls->mLoaded, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Loads a playlist which is known from master only. Receivers and background loader may ask for
+ * the same playlist at once, the later one waits and finds it loaded.
+ */
+int HLS_M3U8_Load(Playlist_t* pls, const AVIOInterruptCB* int_cb, AVIOContext** io)
+{
+    int ret = 0;
+
+    if (HLS_M3U8_IsLoaded(pls))
+        return 0;
+
+    pthread_mutex_lock(&pls->mLoadLock);
+    if (!pls->mLoaded)
+    {
+        ret = parse_playlist(NULL, pls->mURL, pls, NULL, NULL, int_cb, io);
+        if (ret == 0)
+            __atomic_store_n(&pls->mLoaded, 1, __ATOMIC_SEQ_CST);
+        else
+            LOG_ERROR("failed to load playlist %s : ret %d\n", pls->mURL, ret);
+    }
+    pthread_mutex_unlock(&pls->mLoadLock);
+
+    return ret;
+}
+
+typedef struct LoadTask_s {
+    HLSInfo_t*             mInfo;
+    const AVIOInterruptCB* mIntCB;
+    int                    mMaxConnections;
+
+    int*                   mHostIndex;   /* host of each playlist */
+    int*                   mActive;      /* requests in flight to each host */
+    int*                   mResult;      /* result of each playlist */
+    char*                  mTaken;
+    int                    mNext;        /* all playlists before it are taken */
+
+    pthread_mutex_t        mLock;
+    pthread_cond_t         mCond;
+} LoadTask_t;
+
+/* Returns index of playlist to load, -1 if all are taken or -2 if the hosts left are busy. Called with mLock */
+static int take_load_job(LoadTask_t* task)
+{
+    int ii;
+    int busy = 0;
+
+    while (task->mNext < task->mInfo->mPlaylistCnt && task->mTaken[task->mNext])
+        task->mNext++;
+
+    for (ii = task->mNext; ii < task->mInfo->mPlaylistCnt; ii++)
+    {
+        int host = task->mHostIndex[ii];
+
+        if (task->mTaken[ii])
+            continue;
+
+        if (task->mActive[host] >= task->mMaxConnections)
         {
-            LOG_ERROR("url context is null \n");
-            return -1;
+            busy = 1;
+            continue;
+        }
+
+        task->mTaken[ii] = 1;
+        task->mActive[host]++;
+        return ii;
+    }
+
+    return busy ? -2 : -1;
+}
+
+/* Each loader keeps its own keep-alive connection, a playlist is parsed as soon as it arrives */
+static void* load_proc(void* param)
+{
+    LoadTask_t* task = (LoadTask_t*)param;
+    AVIOContext* io = NULL;
+
+    for (;;)
+    {
+        int index;
+        int ret;
+
+        pthread_mutex_lock(&task->mLock);
+        while ((index = take_load_job(task)) == -2)
+            pthread_cond_wait(&task->mCond, &task->mLock);
+        pthread_mutex_unlock(&task->mLock);
+
+        if (index < 0)
+            break;
+
+        ret = HLS_M3U8_Load(task->mInfo->mPlaylists[index], task->mIntCB, &io);
+
+        pthread_mutex_lock(&task->mLock);
+        task->mResult[index] = ret;
+        task->mActive[task->mHostIndex[index]]--;
+        pthread_cond_broadcast(&task->mCond);
+        pthread_mutex_unlock(&task->mLock);
+    }
+
+    if (io)
+        avio_close(io);
+
+    return NULL;
+}
+
+/* Gives the same host index to playlists on the same server, returns number of hosts */
+static int group_by_host(HLSInfo_t* info, int* hostIndex)
+{
+    char (*keys)[MAX_SERVER_KEY_LEN];
+    int hostCnt = 0;
+    int ii, jj;
+
+    keys = av_malloc_array(info->mPlaylistCnt, MAX_SERVER_KEY_LEN);
+    if (!keys)
+        return AVERROR(ENOMEM);
+
+    for (ii = 0; ii < info->mPlaylistCnt; ii++)
+    {
+        get_server_key(keys[hostCnt], MAX_SERVER_KEY_LEN, info->mPlaylists[ii]->mURL);
+
+        for (jj = 0; jj < hostCnt; jj++)
+        {
+            if (!strcmp(keys[jj], keys[hostCnt]))
+                break;
+        }
+
+        hostIndex[ii] = jj;
+        if (jj == hostCnt)
+            hostCnt++;
+    }
+
+    av_free(keys);
+    return hostCnt;
+}
+
+/*
+ * Playlists are loaded in place, so the order of HLSInfo_t doesn't depend on the order of arrival.
+ * Returns the error of the first failed playlist in that order.
+ */
+int HLS_M3U8_LoadAll(HLSInfo_t* info, const AVIOInterruptCB* int_cb, int maxConnections)
+{
+    LoadTask_t task;
+    pthread_t threads[MAX_PLAYLIST_LOADERS];
+    int threadCnt = 0;
+    int loaderCnt;
+    int hostCnt;
+    int ret = 0;
+    int ii;
+
+    if (info->mPlaylistCnt == 0)
+        return 0;
+
+    memset(&task, 0x00, sizeof(task));
+    task.mInfo           = info;
+    task.mIntCB          = int_cb;
+    task.mMaxConnections = _MAX(maxConnections, 1);
+
+    task.mHostIndex = (int*)av_mallocz(info->mPlaylistCnt * sizeof(int));
+    task.mActive    = (int*)av_mallocz(info->mPlaylistCnt * sizeof(int));
+    task.mResult    = (int*)av_mallocz(info->mPlaylistCnt * sizeof(int));
+    task.mTaken     = (char*)av_mallocz(info->mPlaylistCnt);
+    if (!task.mHostIndex || !task.mActive || !task.mResult || !task.mTaken)
+    {
+        ret = AVERROR(ENOMEM);
+        goto EXIT;
+    }
+
+    if ((hostCnt = group_by_host(info, task.mHostIndex)) < 0)
+    {
+        ret = hostCnt;
+        goto EXIT;
+    }
+
+    pthread_mutex_init(&task.mLock, NULL);
+    pthread_cond_init(&task.mCond, NULL);
+
+    loaderCnt = _MIN(info->mPlaylistCnt, task.mMaxConnections * hostCnt);
+    loaderCnt = _MIN(loaderCnt, MAX_PLAYLIST_LOADERS);
+
+    /* this thread is one of loaders */
+    for (ii = 1; ii < loaderCnt; ii++)
+    {
+        if (pthread_create(&threads[threadCnt], NULL, load_proc, &task) != 0)
+            break;
+        threadCnt++;
+    }
+
+    load_proc(&task);
+
+    for (ii = 0; ii < threadCnt; ii++)
+        pthread_join(threads[ii], NULL);
+
+    pthread_cond_destroy(&task.mCond);
+    pthread_mutex_destroy(&task.mLock);
+
+    for (ii = 0; ii < info->mPlaylistCnt; ii++)
+    {
+        if ((ret = task.mResult[ii]) != 0)
+            break;
+    }
+
+EXIT:
+    av_free(task.mHostIndex);
+    av_free(task.mActive);
+    av_free(task.mResult);
+    av_free(task.mTaken);
+    return ret;
+}
+
+/* Loads main playlist and renditions of a variant, which are needed to open its sessions */
+int HLS_M3U8_LoadVariant(Variant_t* var, const AVIOInterruptCB* int_cb, AVIOContext** io)
+{
+    int ret;
+    int ii;
+
+    for (ii = 0; ii < var->mPlaylistCnt; ii++)
+    {
+        if ((ret = HLS_M3U8_Load(var->mPlaylists[ii], int_cb, io)) != 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+static int can_request_delta_update(Playlist_t* pls, PlaylistSnapshot_t* snap)
+{
+    if (snap->mCanSkipUntil <= 0 || snap->mFinished || snap->mSegmentCnt == 0)
+        return 0;
+
+    /* client should not request a delta update unless its playlist is younger than half of the skip boundary */
+    return get_tick() - pls->mLastLoadTime < snap->mCanSkipUntil / 2;
+}
+
+static int find_init_section(PlaylistSnapshot_t* snap, const Segment_t* sec)
+{
+    int ii;
+
+    for (ii = 0; ii < snap->mInitSectionCnt; ii++)
+    {
+        Segment_t* old = snap->mInitSections[ii];
+        if (old->mUrlOffset == sec->mUrlOffset && old->mSize == sec->mSize && is_same_location(old, sec->mURL, sec->mBaseURL))
+            return ii;
+    }
+
+    return -1;
+}
+
+/* only for unpublished snapshot */
+static void replace_init_section(PlaylistSnapshot_t* snap, Segment_t* from, Segment_t* to)
+{
+    int ii;
+
+    for (ii = 0; ii < snap->mSegmentCnt; ii++)
+    {
+        Segment_t* seg = snap->mSegments[ii];
+        if (seg->mInitSection == from)
+        {
+            seg->mInitSection = HLS_M3U8_RefSegment(to);
+            HLS_M3U8_UnrefSegment(from);
         }
+    }
+}
+
+static int has_init_section(PlaylistSnapshot_t* snap, Segment_t* sec)
+{
+    int ii;
+
+    for (ii = 0; ii < snap->mInitSectionCnt; ii++)
+    {
+        if (snap->mInitSections[ii] == sec)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Keeps the init sections of previous load which are still in use, so the receiver keeps its init cache hits */
+static void merge_init_sections(PlaylistSnapshot_t* old, PlaylistSnapshot_t* snap)
+{
+    int ii, index;
+
+    for (ii = 0; ii < snap->mInitSectionCnt; ii++)
+    {
+        Segment_t* sec = snap->mInitSections[ii];
+
+        if ((index = find_init_section(old, sec)) < 0)
+            continue;
+
+        replace_init_section(snap, sec, old->mInitSections[index]);
+        snap->mInitSections[ii] = HLS_M3U8_RefSegment(old->mInitSections[index]);
+        HLS_M3U8_UnrefSegment(sec);
+    }
+
+    /* init sections referenced by the segments reused from previous load */
+    for (ii = 0; ii < snap->mSegmentCnt; ii++)
+    {
+        Segment_t* sec = snap->mSegments[ii]->mInitSection;
+
+        if (sec && !has_init_section(snap, sec))
+            dynarray_add(&snap->mInitSections, &snap->mInitSectionCnt, HLS_M3U8_RefSegment(sec));
+    }
+}
+
+static int merge_skipped_segments(PlaylistSnapshot_t* old, PlaylistSnapshot_t* snap)
+{
+    int ii;
+    int index = snap->mStartSeqNo - old->mStartSeqNo;
+    int skipCnt = snap->mSkippedSegmentCnt;
+    Segment_t** tail = snap->mSegments;
+    int tailCnt = snap->mSegmentCnt;
+    Segment_t* lastInitSection = NULL;
+
+    if (index < 0 || index + skipCnt > old->mSegmentCnt)
+    {
+        LOG_WARN("Skipped segments are not in playlist : old [%d, %d), skipped [%d, %d)\n",
+                 old->mStartSeqNo, old->mStartSeqNo + old->mSegmentCnt, snap->mStartSeqNo, snap->mStartSeqNo + skipCnt);
+        return -1;
+    }
+
+    snap->mSegments = NULL;
+    snap->mSegmentCnt = 0;
+
+    for (ii = 0; ii < skipCnt; ii++)
+    {
+        Segment_t* seg = old->mSegments[index + ii];
+        dynarray_add(&snap->mSegments, &snap->mSegmentCnt, HLS_M3U8_RefSegment(seg));
+
+        lastInitSection = seg->mInitSection;
+    }
+
+    for (ii = 0; ii < tailCnt; ii++)
+    {
+        Segment_t* seg = tail[ii];
+
+        /* EXT-X-MAP may be skipped along with the segments */
+        if (!seg->mInitSection && snap->mInitSectionCnt == 0)
+            seg->mInitSection = HLS_M3U8_RefSegment(lastInitSection);
+
+        dynarray_add(&snap->mSegments, &snap->mSegmentCnt, seg);
+    }
+    av_free(tail);
+
+    snap->mSkippedSegmentCnt = 0;
+
+    return 0;
+}
+
+/*
+ * Reloads live playlist and publishes it as new snapshot. Segments which are still in the window are
+ * shared with the previous snapshot (same object, same start pts), new ones are appended and the
+ * expired ones are released. Since MediaObject holds its own reference of segment, expired segment is
+ * freed when the last MediaObject using it is deleted.
+ */
+int HLS_M3U8_Update(Playlist_t* pls, const AVIOInterruptCB* int_cb, AVIOContext** io)
+{
+    int ret;
+    char url[MAX_URL_SIZE];
+    PlaylistSnapshot_t* old  = HLS_M3U8_AcquireSnapshot(pls);
+    PlaylistSnapshot_t* snap = NULL;
+
+    av_strlcpy(url, pls->mURL, sizeof(url));
+    if (can_request_delta_update(pls, old))
+        av_strlcat(url, strchr(url, '?') ? "&_HLS_skip=YES" : "?_HLS_skip=YES", sizeof(url));
+
+    ret = parse_playlist(NULL, url, pls, old, &snap, int_cb, io);
+    if (ret == HLS_M3U8_NOT_MODIFIED)
+    {
+        HLS_M3U8_ReleaseSnapshot(old);
+        return ret;
+    }
+
+    if (ret == 0 && snap && snap->mSkippedSegmentCnt > 0 && merge_skipped_segments(old, snap) != 0)
+    {
+        /* Cannot apply the delta, reload whole playlist */
+        free_snapshot(snap);
+        snap = NULL;
+
+        /* validators are of the delta, whole playlist has to come back */
+        pls->mETag[0] = '\0';
+        pls->mLastModified[0] = '\0';
+        pls->mDataHash = 0;
+
+        ret = parse_playlist(NULL, pls->mURL, pls, old, &snap, int_cb, io);
+    }
+
+    if (ret == 0 && !snap)
+        ret = AVERROR_INVALIDDATA;
+
+    if (ret)
+    {
+        LOG_ERROR("parse_playlist is failed : ret %d\n", ret);
+        HLS_M3U8_ReleaseSnapshot(old);
+        return ret;
+    }
 
-        if (is_same_server(h->filename, url))
-        {
-// TBD Check it !!!
-//          avio_reset(in, AVIO_FLAG_READ);
-            in->eof_reached = 0;
-            ret = ff_http_do_new_request(h, url);
-            if (ret < 0)
-            {
-                avio_close(in);
-                if (ret == AVERROR_EXIT)
-                {
-                    LOG_ERROR("AVERROR_EXIT !!!\n");
-                    return ret;
-                }
-                LOG_WARN("keepalive open failed, clear connection and retry new connection !\n");
-                in = NULL;
-            }
-        }
-        else
-        {
-            LOG_WARN("It's difference server, new open !\n");
-            avio_close(in);
-            in = NULL;
-        }
+    LOG_INFO("SegmentCnt : %d, StartSeqNo : %d, EndSeqNo : %d\n", snap->mSegmentCnt, snap->mStartSeqNo, snap->mStartSeqNo + snap->mSegmentCnt);
+    if (snap->mStartSeqNo < old->mStartSeqNo)
+        LOG_WARN("Media sequence goes backward : %d -> %d\n", old->mStartSeqNo, snap->mStartSeqNo);
+
+    merge_init_sections(old, snap);
+    update_start_pts(pls, snap, old);
+    HLS_M3U8_ReleaseSnapshot(old);
+
+    publish_snapshot(pls, snap);
+    __atomic_store_n(&pls->mLoaded, 1, __ATOMIC_SEQ_CST);
+
+    return 0;
+}
+
+static int get_playlist_index(HLSInfo_t* info, Playlist_t* pls)
+{
+    int ii;
+
+    if (!info->mLookupDisabled && info->mPlaylistTable)
+        return info->mPlaylistTable[find_playlist_slot(info, info->mPlaylistTable, info->mPlaylistTableSize, pls->mURL)];
+
+    for (ii = 0; ii < info->mPlaylistCnt; ii++)
+    {
+        if (info->mPlaylists[ii] == pls)
+            return ii;
     }
 
-    if (in == NULL)
+    return -1;
+}
+
+#define PLAYLIST_CACHE_MAGIC MKTAG('H', 'L', 'S', 'C')
+
+/*
+ * Cache file is a header, a table of playlists and their blocks. Offsets in the table are from the
+ * start of file and 8 bytes aligned, URL offsets are into the string block mData of the playlist.
+ * Blocks are in memory layout of indexed snapshot, so they are used from the mapping as they are.
+ */
+typedef struct CacheHeader_s {
+    uint32_t mMagic;
+    uint32_t mVersion;
+    uint32_t mEntrySize;    /* sizeof(SegmentEntry_t) of the build which wrote it */
+    uint32_t mPlaylistCnt;
+    uint64_t mMasterHash;
+    uint64_t mFileSize;
+    uint64_t mMaster;       /* offset of CacheMaster_t, 0 if master is not cached */
+    uint64_t mMasterSize;
+} CacheHeader_t;
+
+/*
+ * Variants and renditions of master. Offsets are from the start of this record, so the record is built
+ * once and copied into cache files as it is. Playlists are referred by index of the URL table, -1 for none.
+ */
+typedef struct CacheMaster_s {
+    uint64_t mSize;
+    int64_t  mTime;         /* see HLSInfo_t.mMasterTime */
+    uint64_t mURL;          /* offsets into the string block mData */
+    uint64_t mPlaylists;    /* URL offset of each playlist */
+    uint64_t mVariants;
+    uint64_t mRenditions;
+    uint64_t mData;
+    int32_t  mDataSize;
+    int32_t  mPlaylistCnt;
+    int32_t  mVariantCnt;
+    int32_t  mRenditionCnt;
+    char     mETag[MAX_VALIDATOR_LEN];
+    char     mLastModified[MAX_VALIDATOR_LEN];
+} CacheMaster_t;
+
+typedef struct CacheVariant_s {
+    int32_t  mBandwidth;
+    int32_t  mAverageBandwidth;
+    int32_t  mHdcpLevel;
+    int32_t  mWidth;
+    int32_t  mHeight;
+    int32_t  mPlaylist;
+    double   mFrameRate;
+    char     mCodecs[MAX_CODECS_LEN];
+    char     mAudioGroup[MAX_FIELD_LEN];
+    char     mVideoGroup[MAX_FIELD_LEN];
+    char     mSubtitleGroup[MAX_FIELD_LEN];
+} CacheVariant_t;
+
+typedef struct CacheRendition_s {
+    int32_t  mType;
+    int32_t  mDisposition;
+    int32_t  mPlaylist;
+    char     mGroupId[MAX_FIELD_LEN];
+    char     mLanguage[MAX_FIELD_LEN];
+    char     mName[MAX_FIELD_LEN];
+} CacheRendition_t;
+
+typedef struct CachePlaylist_s {
+    uint64_t mURL;
+    uint64_t mBaseURL;
+    uint64_t mData;
+    uint64_t mEntries;
+    uint64_t mStartPts;
+    uint64_t mEndOffset;
+    uint64_t mKeys;
+    uint64_t mInitSections;
+    int64_t  mTargetDuration;
+    int32_t  mType;
+    int32_t  mStartSeqNo;
+    int32_t  mSegmentCnt;
+    int32_t  mDataSize;
+    int32_t  mKeyCnt;
+    int32_t  mInitSectionCnt;
+} CachePlaylist_t;
+
+typedef struct CacheKey_s {
+    uint64_t mURL;
+    int32_t  mType;
+    int32_t  mHasIV;
+    uint8_t  mIV[16];
+} CacheKey_t;
+
+typedef struct CacheInitSection_s {
+    uint64_t mURL;
+    int64_t  mUrlOffset;
+    int64_t  mSize;
+} CacheInitSection_t;
+
+typedef struct CacheWriter_s {
+    uint8_t*     mBuf;
+    unsigned int mCapacity;
+    int64_t      mSize;
+    int          mError;
+} CacheWriter_t;
+
+static void get_cache_path(char* path, int size, const char* dir, const char* url)
+{
+    snprintf(path, size, "%s/%016llx.m3u8c", dir, (unsigned long long)hash_data(url, strlen(url)));
+}
+
+/* Appends data at the next offset aligned to align and returns the offset, data NULL reserves zeroed space */
+static uint64_t cache_write(CacheWriter_t* w, const void* data, int64_t size, int align)
+{
+    int64_t offset = (w->mSize + align - 1) / align * align;
+    uint8_t* buf;
+
+    if (w->mError)
+        return 0;
+
+    if (offset + size > UINT_MAX || !(buf = av_fast_realloc(w->mBuf, &w->mCapacity, offset + size)))
     {
-        uint8_t *new_url = NULL;
-        AVDictionary *opts = NULL;
-        av_dict_set(&opts, "multiple_requests", "1", 0);
+        w->mError = AVERROR(ENOMEM);
+        return 0;
+    }
+    w->mBuf = buf;
 
-        ret = avio_open2(&in, url, AVIO_FLAG_READ, int_cb, &opts);
-        if (ret < 0)
-        {
-            LOG_ERROR("Cannot open url : %s\n", url);
-            in = NULL;
-            return ret;
-        }
+    memset(buf + w->mSize, 0, offset - w->mSize);
+    if (data)
+        memcpy(buf + offset, data, size);
+    else
+        memset(buf + offset, 0, size);
+    w->mSize = offset + size;
+
+    return offset;
+}
+
+static uint64_t cache_write_string(CacheWriter_t* w, const char* str)
+{
+    return cache_write(w, str, strlen(str) + 1, 1);
+}
+
+/* Returns record of variants and renditions as they are now, NULL if master is not cacheable */
+static uint8_t* build_master_record(HLSInfo_t* info, int64_t* size)
+{
+    CacheWriter_t w = { 0, };
+    CacheWriter_t data = { 0, };
+    CacheMaster_t master;
+    uint64_t* urls = NULL;
+    CacheVariant_t* vars = NULL;
+    CacheRendition_t* rends = NULL;
+    int ii;
+
+    /* master which is a media playlist itself has to be fetched for its segments anyway */
+    if (!info->mURL || info->mVariantCnt == 0 || find_playlist(info, info->mURL))
+        return NULL;
+
+    urls  = (uint64_t*)av_mallocz(_MAX(info->mPlaylistCnt, 1) * sizeof(uint64_t));
+    vars  = (CacheVariant_t*)av_mallocz(info->mVariantCnt * sizeof(CacheVariant_t));
+    rends = (CacheRendition_t*)av_mallocz(_MAX(info->mRenditionCnt, 1) * sizeof(CacheRendition_t));
+    if (!urls || !vars || !rends)
+        goto EXIT;
+
+    memset(&master, 0x00, sizeof(master));
+    master.mURL = cache_write_string(&data, info->mURL);
+
+    for (ii = 0; ii < info->mPlaylistCnt; ii++)
+        urls[ii] = cache_write_string(&data, info->mPlaylists[ii]->mURL);
+
+    for (ii = 0; ii < info->mVariantCnt; ii++)
+    {
+        Variant_t* var = info->mVariants[ii];
 
-        // Save redirect URL 
-        if (av_opt_get(in, "location", AV_OPT_SEARCH_CHILDREN, &new_url) >= 0)
-            url = av_strdup((const char*)new_url); // TBD Free This
+        vars[ii].mBandwidth        = var->mBandwidth;
+        vars[ii].mAverageBandwidth = var->mAverageBandwidth;
+        vars[ii].mHdcpLevel        = var->mHdcpLevel;
+        vars[ii].mWidth            = var->mWidth;
+        vars[ii].mHeight           = var->mHeight;
+        vars[ii].mFrameRate        = var->mFrameRate;
+        /* first one is of the variant, renditions are added again on restore */
+        vars[ii].mPlaylist         = var->mPlaylistCnt > 0 ? get_playlist_index(info, var->mPlaylists[0]) : -1;
+        av_strlcpy(vars[ii].mCodecs,        var->mCodecs,        sizeof(vars[ii].mCodecs));
+        av_strlcpy(vars[ii].mAudioGroup,    var->mAudioGroup,    sizeof(vars[ii].mAudioGroup));
+        av_strlcpy(vars[ii].mVideoGroup,    var->mVideoGroup,    sizeof(vars[ii].mVideoGroup));
+        av_strlcpy(vars[ii].mSubtitleGroup, var->mSubtitleGroup, sizeof(vars[ii].mSubtitleGroup));
+    }
+
+    for (ii = 0; ii < info->mRenditionCnt; ii++)
+    {
+        Rendition_t* rend = info->mRenditions[ii];
 
+        rends[ii].mType        = rend->mType;
+        rends[ii].mDisposition = rend->mDisposition;
+        rends[ii].mPlaylist    = rend->mPlaylist ? get_playlist_index(info, rend->mPlaylist) : -1;
+        av_strlcpy(rends[ii].mGroupId,  rend->mGroupId,  sizeof(rends[ii].mGroupId));
+        av_strlcpy(rends[ii].mLanguage, rend->mLanguage, sizeof(rends[ii].mLanguage));
+        av_strlcpy(rends[ii].mName,     rend->mName,     sizeof(rends[ii].mName));
     }
 
-    if (ff_get_line(in, line, sizeof(line)) == 0 && in->error)
+    cache_write(&w, NULL, sizeof(CacheMaster_t), 8);
+    master.mPlaylists    = cache_write(&w, urls, (int64_t)info->mPlaylistCnt * sizeof(uint64_t), 8);
+    master.mVariants     = cache_write(&w, vars, (int64_t)info->mVariantCnt * sizeof(CacheVariant_t), 8);
+    master.mRenditions   = cache_write(&w, rends, (int64_t)info->mRenditionCnt * sizeof(CacheRendition_t), 8);
+    master.mData         = cache_write(&w, data.mBuf, data.mSize, 8);
+    master.mDataSize     = data.mSize;
+    master.mPlaylistCnt  = info->mPlaylistCnt;
+    master.mVariantCnt   = info->mVariantCnt;
+    master.mRenditionCnt = info->mRenditionCnt;
+    master.mTime         = info->mMasterTime;
+    master.mSize         = w.mSize;
+    av_strlcpy(master.mETag, info->mETag, sizeof(master.mETag));
+    av_strlcpy(master.mLastModified, info->mLastModified, sizeof(master.mLastModified));
+
+    if (w.mError || data.mError)
     {
-        LOG_ERROR("ff_get_line is failed !\n");
-        ret = in->error;
+        av_freep(&w.mBuf);
         goto EXIT;
     }
+    memcpy(w.mBuf, &master, sizeof(master));
+    *size = w.mSize;
+
+EXIT:
+    av_free(data.mBuf);
+    av_free(urls);
+    av_free(vars);
+    av_free(rends);
+    return w.mBuf;
+}
 
-    rtrim(line);
+/* Writes blocks of a finished playlist to w and fills rec. Returns 0 or negative error */
+static int save_playlist(CacheWriter_t* w, Playlist_t* pls, CachePlaylist_t* rec)
+{
+    PlaylistSnapshot_t* snap = HLS_M3U8_AcquireSnapshot(pls);
+    CacheWriter_t data = { 0, };
+    CacheWriter_t keys = { 0, };
+    CacheKey_t lastKey;
+    SegmentEntry_t* entries = NULL;
+    int64_t* startPts = NULL;
+    int64_t* endOffset = NULL;
+    CacheInitSection_t* initSections = NULL;
+    const char* base = NULL;
+    int ret = 0;
+    int ii;
+
+    memset(rec, 0x00, sizeof(CachePlaylist_t));
+    memset(&lastKey, 0x00, sizeof(lastKey));
 
-    if (strcmp(line, "#EXTM3U"))
+    if (!snap->mFinished || snap->mSegmentCnt == 0)
     {
-        ret = AVERROR_INVALIDDATA;
-        LOG_ERROR("Invalid Data\n");
+        ret = AVERROR(EINVAL);
+        goto EXIT;
+    }
+
+    entries      = (SegmentEntry_t*)av_malloc_array(snap->mSegmentCnt, sizeof(SegmentEntry_t));
+    startPts     = (int64_t*)av_malloc_array(snap->mSegmentCnt, sizeof(int64_t));
+    endOffset    = (int64_t*)av_malloc_array(snap->mSegmentCnt, sizeof(int64_t));
+    initSections = (CacheInitSection_t*)av_mallocz(_MAX(snap->mInitSectionCnt, 1) * sizeof(CacheInitSection_t));
+    if (!entries || !startPts || !endOffset || !initSections)
+    {
+        ret = AVERROR(ENOMEM);
         goto EXIT;
     }
 
-    while (!avio_feof(in))
+    rec->mURL = cache_write_string(&data, pls->mURL);
+
+    for (ii = 0; ii < snap->mInitSectionCnt; ii++)
     {
-        const char* ptr;
+        Segment_t* sec = snap->mInitSections[ii];
 
-        if (ff_get_line(in, line, sizeof(line)) == 0 && in->error)
-        {
-            LOG_ERROR("ff_get_line is failed !\n");
-            ret = in->error;
-            goto EXIT;
-        }
-        rtrim(line);
+        initSections[ii].mURL       = cache_write_string(&data, sec->mURL);
+        initSections[ii].mUrlOffset = sec->mUrlOffset;
+        initSections[ii].mSize      = sec->mSize;
+    }
 
-        if (av_strstart(line, "#EXT-X-STREAM-INF:", &ptr))
-        {
-            is_variant = 1;
-            memset(&variantInfo, 0, sizeof(Variant_t));
-            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_variant_args, &variantInfo);
-        }
-        else if (av_strstart(line, "#EXT-X-MEDIA:", &ptr))
-        {
-            RenditionInfo_t renditionInfo = {{0}};
-            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_rendition_args, &renditionInfo);
-            new_rendition(info, &renditionInfo, url);
-        }
-        else if (av_strstart(line, "#EXTINF:", &ptr))
+    for (ii = 0; ii < snap->mSegmentCnt && ret == 0; ii++)
+    {
+        /* not through HLS_M3U8_GetSegment, which would evict segments in use from the cache */
+        Segment_t* seg = snap->mEntries ? materialize_segment(snap, ii) : HLS_M3U8_RefSegment(snap->mSegments[ii]);
+        SegmentEntry_t* entry = &entries[ii];
+
+        if (!seg)
         {
-            is_segment = 1;
-            segmentDuration = atof(ptr) * AV_TIME_BASE;        
+            ret = AVERROR(ENOMEM);
+            break;
         }
-        else if (av_strstart(line, "#EXT-X-KEY:", &ptr))
+
+        /* all segments are restored against one base */
+        if (!base)
+            rec->mBaseURL = cache_write_string(&data, base = seg->mBaseURL);
+        else if (strcmp(base, seg->mBaseURL))
+            ret = AVERROR(EINVAL);
+
+        entry->mLine          = cache_write_string(&data, seg->mURL);
+        entry->mKey           = -1;
+        entry->mInitSection   = seg->mInitSection ? find_init_section(snap, seg->mInitSection) : -1;
+        entry->mDiscontinuity    = seg->mDiscontinuity;
+        entry->mDiscontinuitySeq = seg->mDiscontinuitySeq;
+        entry->mProgramDateTime  = seg->mProgramDateTime;
+        entry->mUrlOffset        = seg->mUrlOffset;
+        entry->mSize             = seg->mSize;
+
+        if (seg->mKeyType != KEY_TYPE_NONE)
         {
-            KeyInfo_t keyInfo;
-            memset(&keyInfo, 0x00, sizeof(keyInfo));
+            uint8_t iv[16] = { 0, };
+            int hasIV;
 
-            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_key_args, &keyInfo);
-            
-            eKeyType = KEY_TYPE_NONE;
-            if (!strcmp(keyInfo.mMethod, "AES-128"))
-                eKeyType = KEY_TYPE_AES128;
-            
-            has_iv = 0;
-            if (!strncmp(keyInfo.mIV, "0x", 2) || !strncmp(keyInfo.mIV, "0X", 2))
+            /* IV derived from sequence number is not written */
+            AV_WB32(iv + 12, snap->mStartSeqNo + ii);
+            hasIV = memcmp(iv, seg->mIV, sizeof(iv)) != 0;
+
+            if (rec->mKeyCnt == 0 || lastKey.mType != seg->mKeyType || lastKey.mHasIV != hasIV ||
+                (hasIV && memcmp(lastKey.mIV, seg->mIV, sizeof(lastKey.mIV))) ||
+                strcmp((const char*)data.mBuf + lastKey.mURL, seg->mKeyURL))
             {
-                ff_hex_to_data(iv, keyInfo.mIV + 2);
-                has_iv = 1;
+                lastKey.mURL   = cache_write_string(&data, seg->mKeyURL);
+                lastKey.mType  = seg->mKeyType;
+                lastKey.mHasIV = hasIV;
+                memcpy(lastKey.mIV, seg->mIV, sizeof(lastKey.mIV));
+
+                cache_write(&keys, &lastKey, sizeof(lastKey), 8);
+                rec->mKeyCnt++;
             }
-            av_strlcpy(keyURI, keyInfo.mURI, sizeof(keyURI));
+            entry->mKey = rec->mKeyCnt - 1;
         }
-        else if (av_strstart(line, "#EXT-X-TARGETDURATION:", &ptr))
-        {
-            ret = ensure_playlist(info, &pls, url);
-            if (ret < 0)
-                goto EXIT;
 
-            pls->mTargetDuration = strtoll(ptr, NULL, 10) * AV_TIME_BASE;
-        }
-        else if (av_strstart(line, "#EXT-X-MEDIA-SEQUENCE:", &ptr))
-        {
-            ret = ensure_playlist(info, &pls, url);
-            if (ret < 0)
-                goto EXIT;
+        startPts[ii]  = HLS_M3U8_GetSegmentStartPts(snap, ii);
+        endOffset[ii] = (ii > 0 ? endOffset[ii - 1] : 0) + HLS_M3U8_GetSegmentDuration(snap, ii);
 
-            pls->mStartSeqNo = atoi(ptr);
-        }
-        else if (av_strstart(line, "#EXT-X-PLAYLIST-TYPE:", &ptr))
-        {
-            ret = ensure_playlist(info, &pls, url);
-            if (ret < 0)
-                goto EXIT;
+        HLS_M3U8_UnrefSegment(seg);
 
-            if (!strcmp(ptr, "EVENT"))
-                pls->mType = PLS_TYPE_EVENT;
-            else if (!strcmp(ptr, "VOD"))
-                pls->mType = PLS_TYPE_VOD;
-        }
-        else if (av_strstart(line, "#EXT-X-ENDLIST", &ptr))
-        {
-            if (pls)
-                pls->mFinished = 1;
-        }
-        else if (av_strstart(line, "#EXT-X-MAP:", &ptr))
-        {
-            InitSectionInfo_t initSecInfo = {{0}};
-printf("---- pls : %p url : %s\n", pls, pls?pls->mURL:"NONE");
-            ret = ensure_playlist(info, &pls, url);
-            if (ret < 0)
-                goto EXIT;
+        if (data.mError)
+            ret = data.mError;
+        else if (keys.mError)
+            ret = keys.mError;
+    }
 
-            ff_parse_key_value(ptr, (ff_parse_key_val_cb) handle_init_section_args, &initSecInfo);
-            curInitSection = new_init_section(pls, &initSecInfo, url);
-            curInitSection->mKeyType = eKeyType;
-            if (has_iv)
-            {
-                memcpy(curInitSection->mIV, iv, sizeof(iv));
-            }
-            else
-            {
-                int seq = pls->mStartSeqNo + pls->mSegmentCnt;
-                memset(curInitSection->mIV, 0, sizeof(curInitSection->mIV));
-                AV_WB32(curInitSection->mIV + 12, seq);
-            }
+    if (ret < 0)
+        goto EXIT;
 
-            if (eKeyType != KEY_TYPE_NONE)
-            {
-                ff_make_absolute_url(tmp_str, sizeof(tmp_str), url, keyURI);
-                curInitSection->mKeyURL = av_strdup(tmp_str);
-                if (!curInitSection->mKeyURL)
-                {
-                    av_free(curInitSection);
-                    ret = AVERROR(ENOMEM);
-                    goto EXIT;
-                }
-            }
-            else
-            {
-                curInitSection->mKeyURL = NULL;
-            }
-        }
-        else if (av_strstart(line, "#EXT-X-BYTERANGE:", &ptr))
-        {
-            segmentSize = strtoll(ptr, NULL, 10);
-            ptr = strchr(ptr, '@');
-            if (ptr)
-                segmentOffset = strtoll(ptr+1, NULL, 10);
-        }
-        else if (av_strstart(line, "#", NULL))
-        {
-            //LOG_WARN("Skip ('%s')\n", line);
-        }
-        else if (line[0])
-        {
-            if (is_variant)
-            {
-                if (!new_variant(info, &variantInfo, line, url))
-                {
-                    ret = AVERROR(ENOMEM);
-                    goto EXIT;
-                }
-                is_variant = 0;    
-            }
-            else if (is_segment)
-            {
-                Segment_t* seg;
-                ret = ensure_playlist(info, &pls, url);
-                if (ret < 0)
-                    goto EXIT;
+    rec->mTargetDuration = snap->mTargetDuration;
+    rec->mType           = snap->mType;
+    rec->mStartSeqNo     = snap->mStartSeqNo;
+    rec->mSegmentCnt     = snap->mSegmentCnt;
+    rec->mDataSize       = data.mSize;
+    rec->mInitSectionCnt = snap->mInitSectionCnt;
+
+    rec->mData         = cache_write(w, data.mBuf, data.mSize, 8);
+    rec->mEntries      = cache_write(w, entries, (int64_t)snap->mSegmentCnt * sizeof(SegmentEntry_t), 8);
+    rec->mStartPts     = cache_write(w, startPts, (int64_t)snap->mSegmentCnt * sizeof(int64_t), 8);
+    rec->mEndOffset    = cache_write(w, endOffset, (int64_t)snap->mSegmentCnt * sizeof(int64_t), 8);
+    rec->mKeys         = cache_write(w, keys.mBuf, keys.mSize, 8);
+    rec->mInitSections = cache_write(w, initSections, (int64_t)snap->mInitSectionCnt * sizeof(CacheInitSection_t), 8);
+    ret = w->mError;
+
+EXIT:
+    HLS_M3U8_ReleaseSnapshot(snap);
+    av_free(data.mBuf);
+    av_free(keys.mBuf);
+    av_free(entries);
+    av_free(startPts);
+    av_free(endOffset);
+    av_free(initSections);
+    return ret;
+}
+
+int HLS_M3U8_SaveCache(HLSInfo_t* info, const char* dir)
+{
+    CacheWriter_t w = { 0, };
+    CacheHeader_t header;
+    CachePlaylist_t* recs = NULL;
+    uint8_t* built = NULL;
+    const uint8_t* master = info->mMasterRecord;
+    int64_t masterSize = info->mMasterRecordSize;
+    uint64_t masterOffset = 0;
+    char path[MAX_URL_SIZE];
+    char tmpPath[MAX_URL_SIZE + 32];
+    FILE* fp = NULL;
+    int cnt = 0;
+    int ret = 0;
+    int ii;
+
+    if (!info->mURL || !info->mMasterHash)
+        return 0;
+
+    recs = (CachePlaylist_t*)av_mallocz(_MAX(info->mPlaylistCnt, 1) * sizeof(CachePlaylist_t));
+    if (!recs)
+        return AVERROR(ENOMEM);
+
+    /* record of pruned master is kept by HLS_M3U8_FilterVariants */
+    if (!master)
+        master = built = build_master_record(info, &masterSize);
+
+    /* table is written in place at the end */
+    cache_write(&w, NULL, sizeof(CacheHeader_t) + info->mPlaylistCnt * sizeof(CachePlaylist_t), 8);
+
+    for (ii = 0; ii < info->mPlaylistCnt; ii++)
+    {
+        Playlist_t* pls = info->mPlaylists[ii];
+
+        /* master which is a media playlist itself is parsed anyway */
+        if (!HLS_M3U8_IsLoaded(pls) || !strcmp(pls->mURL, info->mURL))
+            continue;
+
+        if ((ret = save_playlist(&w, pls, &recs[cnt])) == 0)
+            cnt++;
+        else if (ret != AVERROR(EINVAL))
+            goto EXIT;
+    }
+
+    ret = 0;
+    if (cnt == 0 && !master)
+        goto EXIT;
+
+    if (master)
+    {
+        masterOffset = cache_write(&w, master, masterSize, 8);
+        if ((ret = w.mError) < 0)
+            goto EXIT;
+        ((CacheMaster_t*)(w.mBuf + masterOffset))->mTime = info->mMasterTime;
+    }
+
+    memset(&header, 0x00, sizeof(header));
+    header.mMagic       = PLAYLIST_CACHE_MAGIC;
+    header.mVersion     = PLAYLIST_CACHE_VERSION;
+    header.mEntrySize   = sizeof(SegmentEntry_t);
+    header.mPlaylistCnt = cnt;
+    header.mMasterHash  = info->mMasterHash;
+    header.mFileSize    = w.mSize;
+    header.mMaster      = masterOffset;
+    header.mMasterSize  = master ? masterSize : 0;
+    memcpy(w.mBuf, &header, sizeof(header));
+    memcpy(w.mBuf + sizeof(header), recs, cnt * sizeof(CachePlaylist_t));
+
+    /* readers see either the old file or the complete new one */
+    get_cache_path(path, sizeof(path), dir, info->mURL);
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path, (int)getpid());
+
+    if (!(fp = fopen(tmpPath, "wb")))
+    {
+        LOG_WARN("cannot create playlist cache %s\n", tmpPath);
+        ret = AVERROR(errno);
+        goto EXIT;
+    }
+
+    if (fwrite(w.mBuf, 1, w.mSize, fp) != (size_t)w.mSize)
+        ret = AVERROR(EIO);
+    if (fclose(fp) != 0 && ret == 0)
+        ret = AVERROR(EIO);
+
+    if (ret == 0 && rename(tmpPath, path) != 0)
+        ret = AVERROR(errno);
+
+    if (ret < 0)
+    {
+        LOG_WARN("failed to write playlist cache %s : ret %d\n", path, ret);
+        unlink(tmpPath);
+        goto EXIT;
+    }
+
+    LOG_INFO("playlist cache %s : %d playlists%s, %lld bytes\n", path, cnt, master ? " and master" : "", w.mSize);
+    ret = cnt;
+
+EXIT:
+    av_free(w.mBuf);
+    av_free(recs);
+    av_free(built);
+    return ret;
+}
+
+static int is_cache_range(const CacheMapping_t* map, uint64_t offset, uint64_t size)
+{
+    return offset % 8 == 0 && offset <= map->mSize && size <= map->mSize - offset;
+}
+
+/* Builds indexed snapshot whose tables point into the mapping, NULL if the record is broken */
+static PlaylistSnapshot_t* restore_snapshot(CacheMapping_t* map, const CachePlaylist_t* rec, uint32_t entrySize)
+{
+    const CacheKey_t* keys = (const CacheKey_t*)(map->mAddr + rec->mKeys);
+    const CacheInitSection_t* initSections = (const CacheInitSection_t*)(map->mAddr + rec->mInitSections);
+    PlaylistSnapshot_t* snap = NULL;
+    SharedURL_t* base = NULL;
+    char* data;
+    int ii;
+
+    if (rec->mSegmentCnt <= 0 || rec->mDataSize <= 0 || rec->mKeyCnt < 0 || rec->mInitSectionCnt < 0 ||
+        !is_cache_range(map, rec->mData, rec->mDataSize) ||
+        !is_cache_range(map, rec->mEntries, (uint64_t)rec->mSegmentCnt * entrySize) ||
+        !is_cache_range(map, rec->mStartPts, (uint64_t)rec->mSegmentCnt * sizeof(int64_t)) ||
+        !is_cache_range(map, rec->mEndOffset, (uint64_t)rec->mSegmentCnt * sizeof(int64_t)) ||
+        !is_cache_range(map, rec->mKeys, (uint64_t)rec->mKeyCnt * sizeof(CacheKey_t)) ||
+        !is_cache_range(map, rec->mInitSections, (uint64_t)rec->mInitSectionCnt * sizeof(CacheInitSection_t)))
+        return NULL;
+
+    /* every URL offset below mDataSize is a terminated string */
+    data = (char*)map->mAddr + rec->mData;
+    if (data[rec->mDataSize - 1] != '\0' || rec->mBaseURL >= (uint64_t)rec->mDataSize)
+        return NULL;
+
+    if (!(snap = alloc_snapshot()))
+        return NULL;
+
+    snap->mMapping          = ref_cache_mapping(map);
+    snap->mFinished         = 1;
+    snap->mType             = (PlaylistType_e)rec->mType;
+    snap->mTargetDuration   = rec->mTargetDuration;
+    snap->mStartSeqNo       = rec->mStartSeqNo;
+    snap->mSegmentCnt       = rec->mSegmentCnt;
+    snap->mEntries          = (SegmentEntry_t*)(map->mAddr + rec->mEntries);
+    snap->mSegmentStartPts  = (int64_t*)(map->mAddr + rec->mStartPts);
+    snap->mSegmentEndOffset = (int64_t*)(map->mAddr + rec->mEndOffset);
+    snap->mData             = data;
+    snap->mDataSize         = rec->mDataSize;
+
+    for (ii = 0; ii < snap->mSegmentCnt; ii++)
+    {
+        const SegmentEntry_t* entry = &snap->mEntries[ii];
+
+        if (entry->mLine >= (uint32_t)rec->mDataSize || entry->mKey < -1 || entry->mKey >= rec->mKeyCnt ||
+            entry->mInitSection < -1 || entry->mInitSection >= rec->mInitSectionCnt)
+            goto ERROR;
+    }
 
-                seg = (Segment_t*)av_malloc(sizeof(Segment_t));
-                if (!seg)
-                {
-                    ret = AVERROR(ENOMEM);
-                    goto EXIT;
-                }
-                seg->mDuration = segmentDuration;
-                seg->mKeyType = eKeyType;
-                if (has_iv)
-                    memcpy(seg->mIV, iv, sizeof(iv));
-                else
-                {
-                    int seq = pls->mStartSeqNo + pls->mSegmentCnt;
-                    memset(seg->mIV, 0, sizeof(seg->mIV));
-                    AV_WB32(seg->mIV + 12, seq);
-                }
+    if (!(base = new_shared_url(data + rec->mBaseURL)))
+        goto ERROR;
+    snap->mBaseURL = ref_shared_url(base);
 
-                if (eKeyType != KEY_TYPE_NONE)
-                {
-                    ff_make_absolute_url(tmp_str, sizeof(tmp_str), url, keyURI);
-                    seg->mKeyURL = av_strdup(tmp_str);
-                    if (!seg->mKeyURL)
-                    {
-                        av_free(seg);
-                        ret = AVERROR(ENOMEM);
-                        goto EXIT;
-                    }
-                }
-                else
-                {
-                    seg->mKeyURL = NULL;
-                }
+    for (ii = 0; ii < rec->mKeyCnt; ii++)
+    {
+        SharedURL_t* url;
+        int ret;
 
-                ff_make_absolute_url(tmp_str, sizeof(tmp_str), url, line);
-                seg->mURL = av_strdup(tmp_str);
+        if (keys[ii].mURL >= (uint64_t)rec->mDataSize || !(url = new_shared_url(data + keys[ii].mURL)))
+            goto ERROR;
 
-                if (!seg->mURL)
-                {
-                    av_free(seg->mKeyURL);
-                    av_free(seg);
-                    ret = AVERROR(ENOMEM);
-                    goto EXIT;
-                }
+        ret = add_segment_key(snap, (KeyType_e)keys[ii].mType, url, keys[ii].mHasIV, keys[ii].mIV);
+        unref_shared_url(url);
+        if (ret < 0)
+            goto ERROR;
+    }
 
-                dynarray_add(&pls->mSegments, &pls->mSegmentCnt, seg);
-                is_segment = 0;
+    for (ii = 0; ii < rec->mInitSectionCnt; ii++)
+    {
+        Segment_t* sec;
 
-                seg->mSize = segmentSize;
-                if (segmentSize >= 0) {
-                    seg->mUrlOffset = segmentOffset;
-                    segmentOffset += segmentSize;
-                    segmentSize = -1;
-                } else {
-                    seg->mUrlOffset = 0;
-                    segmentOffset = 0;
-                }
+        if (initSections[ii].mURL >= (uint64_t)rec->mDataSize || !(sec = alloc_segment(data + initSections[ii].mURL, base)))
+            goto ERROR;
 
-                seg->mInitSection = curInitSection;
-            }
-        }
+        sec->mUrlOffset = initSections[ii].mUrlOffset;
+        sec->mSize      = initSections[ii].mSize;
+        dynarray_add(&snap->mInitSections, &snap->mInitSectionCnt, sec);
     }
 
-    if (pls)
-        pls->mLastLoadTime = get_tick();
+    snap->mCache      = (Segment_t**)av_mallocz(LAZY_SEGMENT_CACHE_SIZE * sizeof(Segment_t*));
+    snap->mCacheIndex = (int*)av_mallocz(LAZY_SEGMENT_CACHE_SIZE * sizeof(int));
+    if (!snap->mCache || !snap->mCacheIndex)
+    {
+        av_freep(&snap->mCache);
+        av_freep(&snap->mCacheIndex);
+        goto ERROR;
+    }
+    pthread_mutex_init(&snap->mCacheLock, NULL);
 
-EXIT:
-    if (io)
+    unref_shared_url(base);
+    return snap;
+
+ERROR:
+    unref_shared_url(base);
+    free_snapshot(snap);
+    return NULL;
+}
+
+/* Maps cache file of url under dir into path, NULL if there is none or it is not written by this build */
+static CacheMapping_t* map_cache_file(const char* dir, const char* url, char* path, int size)
+{
+    CacheMapping_t* map = NULL;
+    const CacheHeader_t* header;
+    struct stat st;
+    void* addr;
+    int fd;
+
+    get_cache_path(path, size, dir, url);
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(CacheHeader_t))
     {
-        *io = in;
+        close(fd);
+        return NULL;
     }
-    else
+
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    if (!(map = (CacheMapping_t*)av_mallocz(sizeof(CacheMapping_t))))
     {
-        if (in)
-            avio_close(in);
+        munmap(addr, st.st_size);
+        return NULL;
     }
+    map->mRefCnt = 1;
+    map->mAddr   = (uint8_t*)addr;
+    map->mSize   = st.st_size;
 
-    return ret;
+    header = (const CacheHeader_t*)map->mAddr;
+
+    if (header->mMagic != PLAYLIST_CACHE_MAGIC || header->mVersion != PLAYLIST_CACHE_VERSION ||
+        header->mEntrySize != sizeof(SegmentEntry_t) || header->mFileSize != map->mSize ||
+        !is_cache_range(map, sizeof(CacheHeader_t), (uint64_t)header->mPlaylistCnt * sizeof(CachePlaylist_t)) ||
+        (header->mMaster && !is_cache_range(map, header->mMaster, header->mMasterSize)))
+    {
+        LOG_WARN("playlist cache %s is invalid, ignored\n", path);
+        unref_cache_mapping(map);
+        return NULL;
+    }
+
+    return map;
 }
 
-static void add_renditions_to_variant(HLSInfo_t* info, Variant_t* var, enum AVMediaType type, const char* group_id)
+static int is_terminated(const char* str, int size)
 {
-    int ii;
+    return memchr(str, '\0', size) != NULL;
+}
 
-    for (ii = 0; ii < info->mRenditionCnt; ii++)
+/* Fills info from master record as HLS_M3U8_ParseMaster does, size is the space the record may take */
+static int restore_master(HLSInfo_t* info, const char* url, const uint8_t* rec, uint64_t size)
+{
+    const CacheMaster_t* master = (const CacheMaster_t*)rec;
+    CacheMapping_t view = { 0, (uint8_t*)rec, size };
+    const uint64_t* urls;
+    const CacheVariant_t* vars;
+    const CacheRendition_t* rends;
+    const char* data;
+    int ii, ret;
+
+    if (size < sizeof(CacheMaster_t) || master->mSize > size || master->mDataSize <= 0 ||
+        master->mPlaylistCnt < 0 || master->mVariantCnt <= 0 || master->mRenditionCnt < 0 ||
+        !is_cache_range(&view, master->mData, master->mDataSize) ||
+        !is_cache_range(&view, master->mPlaylists, (uint64_t)master->mPlaylistCnt * sizeof(uint64_t)) ||
+        !is_cache_range(&view, master->mVariants, (uint64_t)master->mVariantCnt * sizeof(CacheVariant_t)) ||
+        !is_cache_range(&view, master->mRenditions, (uint64_t)master->mRenditionCnt * sizeof(CacheRendition_t)) ||
+        !is_terminated(master->mETag, sizeof(master->mETag)) ||
+        !is_terminated(master->mLastModified, sizeof(master->mLastModified)))
+        return AVERROR_INVALIDDATA;
+
+    urls  = (const uint64_t*)(rec + master->mPlaylists);
+    vars  = (const CacheVariant_t*)(rec + master->mVariants);
+    rends = (const CacheRendition_t*)(rec + master->mRenditions);
+    data  = (const char*)rec + master->mData;
+
+    /* every URL offset below mDataSize is a terminated string, file name hash may collide */
+    if (data[master->mDataSize - 1] != '\0' || master->mURL >= (uint64_t)master->mDataSize || strcmp(data + master->mURL, url))
+        return AVERROR_INVALIDDATA;
+
+    if ((ret = init_info(info, url)) < 0)
+        return ret;
+
+    for (ii = 0; ii < master->mPlaylistCnt; ii++)
     {
-        Rendition_t* rend = info->mRenditions[ii];
+        if (urls[ii] >= (uint64_t)master->mDataSize || !new_playlist(info, data + urls[ii], info->mURL) ||
+            info->mPlaylistCnt != ii + 1)
+            goto ERROR;
+    }
 
-        if (rend->mType == type && !strcmp(rend->mGroupId, group_id))
+    for (ii = 0; ii < master->mVariantCnt; ii++)
+    {
+        const CacheVariant_t* rec = &vars[ii];
+        Variant_t* var;
+
+        if (rec->mPlaylist < 0 || rec->mPlaylist >= info->mPlaylistCnt ||
+            !is_terminated(rec->mCodecs, sizeof(rec->mCodecs)) || !is_terminated(rec->mAudioGroup, sizeof(rec->mAudioGroup)) ||
+            !is_terminated(rec->mVideoGroup, sizeof(rec->mVideoGroup)) || !is_terminated(rec->mSubtitleGroup, sizeof(rec->mSubtitleGroup)))
+            goto ERROR;
+
+        if (!(var = (Variant_t*)av_mallocz(sizeof(Variant_t))))
+            goto ERROR;
+
+        var->mBandwidth        = rec->mBandwidth;
+        var->mAverageBandwidth = rec->mAverageBandwidth;
+        var->mHdcpLevel        = (HDCPLevel_e)rec->mHdcpLevel;
+        var->mWidth            = rec->mWidth;
+        var->mHeight           = rec->mHeight;
+        var->mFrameRate        = rec->mFrameRate;
+        strcpy(var->mCodecs,        rec->mCodecs);
+        strcpy(var->mAudioGroup,    rec->mAudioGroup);
+        strcpy(var->mVideoGroup,    rec->mVideoGroup);
+        strcpy(var->mSubtitleGroup, rec->mSubtitleGroup);
+
+        dynarray_add(&info->mVariants, &info->mVariantCnt, var);
+        dynarray_add(&var->mPlaylists, &var->mPlaylistCnt, info->mPlaylists[rec->mPlaylist]);
+    }
+
+    for (ii = 0; ii < master->mRenditionCnt; ii++)
+    {
+        const CacheRendition_t* rec = &rends[ii];
+        Rendition_t* rend;
+
+        if (rec->mPlaylist < -1 || rec->mPlaylist >= info->mPlaylistCnt ||
+            !is_terminated(rec->mGroupId, sizeof(rec->mGroupId)) || !is_terminated(rec->mLanguage, sizeof(rec->mLanguage)) ||
+            !is_terminated(rec->mName, sizeof(rec->mName)))
+            goto ERROR;
+
+        if (!(rend = (Rendition_t*)av_mallocz(sizeof(Rendition_t))))
+            goto ERROR;
+
+        dynarray_add(&info->mRenditions, &info->mRenditionCnt, rend);
+
+        rend->mType        = (enum AVMediaType)rec->mType;
+        rend->mDisposition = rec->mDisposition;
+        strcpy(rend->mGroupId,  rec->mGroupId);
+        strcpy(rend->mLanguage, rec->mLanguage);
+        strcpy(rend->mName,     rec->mName);
+        index_rendition(info, rend);
+
+        if (rec->mPlaylist >= 0)
         {
-            if (rend->mPlaylist)
-                dynarray_add(&var->mPlaylists, &var->mPlaylistCnt, rend->mPlaylist);
-            else
-            {
-                dynarray_add(&var->mPlaylists[0]->mRenditions, &var->mPlaylists[0]->mRenditionCnt, rend);
-            }
+            rend->mPlaylist = info->mPlaylists[rec->mPlaylist];
+            dynarray_add(&rend->mPlaylist->mRenditions, &rend->mPlaylist->mRenditionCnt, rend);
         }
     }
+
+    register_renditions(info);
+
+    av_strlcpy(info->mETag, master->mETag, sizeof(info->mETag));
+    av_strlcpy(info->mLastModified, master->mLastModified, sizeof(info->mLastModified));
+    info->mMasterTime = master->mTime;
+
+    /* kept for the next save, mapping is gone by then */
+    if (!(info->mMasterRecord = (uint8_t*)av_memdup(rec, master->mSize)))
+        goto ERROR;
+    info->mMasterRecordSize = master->mSize;
+
+    return 0;
+
+ERROR:
+    HLS_M3U8_Delete(info);
+    return AVERROR_INVALIDDATA;
 }
 
-int HLS_M3U8_Parse(HLSInfo_t* info, const char* url, const AVIOInterruptCB* int_cb, AVIOContext** io)
+int HLS_M3U8_OpenMaster(HLSInfo_t* info, const char* url, const char* dir, int64_t ttl, const AVIOInterruptCB* int_cb)
 {
-    AVIOContext* in = NULL;
-    int ret = 0;
-    int ii, jj;
+    CacheMapping_t* map = NULL;
+    const CacheHeader_t* header;
+    const CacheMaster_t* master;
+    char path[MAX_URL_SIZE];
+    int64_t now = time(NULL);
+    int64_t age;
+    int revalidated = 0;
+    int ret;
 
-    memset(info, 0x00, sizeof(HLSInfo_t));
+    if (!dir || !dir[0] || !(map = map_cache_file(dir, url, path, sizeof(path))))
+        return HLS_M3U8_ParseMaster(info, url, int_cb, NULL);
 
-    if (io && *io)
-        in = *io;
+    header = (const CacheHeader_t*)map->mAddr;
+    if (!header->mMaster || header->mMasterSize < sizeof(CacheMaster_t))
+    {
+        unref_cache_mapping(map);
+        return HLS_M3U8_ParseMaster(info, url, int_cb, NULL);
+    }
 
-    if ((ret = parse_playlist(info, url, NULL, int_cb, &in)) != 0)
-        goto ERROR;
+    master = (const CacheMaster_t*)(map->mAddr + header->mMaster);
+    age = now - master->mTime;
 
-    /* m3u8 contains other m3u8 for variant */
-    if (info->mPlaylistCnt > 1 || info->mPlaylists[0]->mSegmentCnt == 0)
+    if (age < 0 || age >= ttl)
     {
-        for (ii = 0; ii < info->mPlaylistCnt; ii++)
-        {
-            Playlist_t* pls = info->mPlaylists[ii];
+        const char* etag = is_terminated(master->mETag, sizeof(master->mETag)) ? master->mETag : NULL;
+        const char* lastModified = is_terminated(master->mLastModified, sizeof(master->mLastModified)) ? master->mLastModified : NULL;
 
-            if ((ret = parse_playlist(info, pls->mURL, pls, int_cb, &in)) != 0)
-                goto ERROR;
+        /* plain request if master came without validators */
+        ret = parse_master(info, url, etag, lastModified, int_cb, NULL);
+        if (ret != HLS_M3U8_NOT_MODIFIED)
+        {
+            unref_cache_mapping(map);
+            return ret;
         }
+
+        HLS_M3U8_Delete(info);
+        revalidated = 1;
     }
 
-#if 1 /* Make Start PTS */
-    for (ii = 0; ii < info->mPlaylistCnt; ii++)
+    if ((ret = restore_master(info, url, map->mAddr + header->mMaster, header->mMasterSize)) < 0)
     {
-        int64_t pts = 0;
-        Playlist_t* pls = info->mPlaylists[ii];
+        LOG_WARN("master of playlist cache %s is broken\n", path);
+        unref_cache_mapping(map);
+        return HLS_M3U8_ParseMaster(info, url, int_cb, NULL);
+    }
+    info->mMasterHash = header->mMasterHash;
+
+    if (revalidated)
+    {
+        int fd;
 
-        for (jj = 0; jj < pls->mSegmentCnt; jj++)
+        /* ttl of next open counts from now, rest of the file is still valid */
+        info->mMasterTime = now;
+        if ((fd = open(path, O_WRONLY)) >= 0)
         {
-            Segment_t* seg = pls->mSegments[jj];
-            if (pls->mFinished)
-            {
-                seg->mStartPts = pts;
-                pts += seg->mDuration;
-            }
-            else
-            {
-                seg->mStartPts = AV_NOPTS_VALUE;
-            }
+            if (pwrite(fd, &now, sizeof(now), header->mMaster + offsetof(CacheMaster_t, mTime)) != sizeof(now))
+                LOG_WARN("cannot update time of playlist cache %s\n", path);
+            close(fd);
         }
     }
-#endif
 
-    /* Register renditions to playlist */
-    for (ii = 0; ii < info->mVariantCnt; ii++)
+    LOG_INFO("master %s from playlist cache %s : %d variants, %d renditions, %s\n", url, path, info->mVariantCnt,
+             info->mRenditionCnt, revalidated ? "not modified" : "within ttl");
+
+    unref_cache_mapping(map);
+    return 0;
+}
+
+int HLS_M3U8_LoadCache(HLSInfo_t* info, const char* dir)
+{
+    CacheMapping_t* map = NULL;
+    const CacheHeader_t* header;
+    const CachePlaylist_t* recs;
+    char path[MAX_URL_SIZE];
+    int restored = 0;
+    int ii;
+
+    if (!info->mURL || !info->mMasterHash)
+        return 0;
+
+    if (!(map = map_cache_file(dir, info->mURL, path, sizeof(path))))
+        return 0;
+
+    header = (const CacheHeader_t*)map->mAddr;
+    recs   = (const CachePlaylist_t*)(map->mAddr + sizeof(CacheHeader_t));
+
+    /* master is changed since the cache was written */
+    if (header->mMasterHash != info->mMasterHash)
     {
-        Variant_t* var = info->mVariants[ii];
-        if(var->mAudioGroup[0])
-        {
-            add_renditions_to_variant(info, var, AVMEDIA_TYPE_AUDIO, var->mAudioGroup);
-        }
-        if(var->mVideoGroup[0])
+        LOG_INFO("playlist cache %s is stale\n", path);
+        goto EXIT;
+    }
+
+    for (ii = 0; ii < (int)header->mPlaylistCnt; ii++)
+    {
+        const CachePlaylist_t* rec = &recs[ii];
+        PlaylistSnapshot_t* snap;
+        Playlist_t* pls;
+
+        if (!is_cache_range(map, rec->mData, rec->mDataSize) || rec->mURL >= (uint64_t)rec->mDataSize ||
+            map->mAddr[rec->mData + rec->mDataSize - 1] != '\0')
+            continue;
+
+        pls = find_playlist(info, (const char*)map->mAddr + rec->mData + rec->mURL);
+        if (!pls || HLS_M3U8_IsLoaded(pls))
+            continue;
+
+        if (!(snap = restore_snapshot(map, rec, header->mEntrySize)))
         {
-            add_renditions_to_variant(info, var, AVMEDIA_TYPE_VIDEO, var->mVideoGroup);
+            LOG_WARN("playlist %d of cache %s is broken\n", ii, path);
+            continue;
         }
-        if(var->mSubtitleGroup[0])
+
+        pthread_mutex_lock(&pls->mLoadLock);
+        if (!pls->mLoaded)
         {
-            add_renditions_to_variant(info, var, AVMEDIA_TYPE_SUBTITLE, var->mSubtitleGroup);
+            publish_snapshot(pls, snap);
+            pls->mLastLoadTime = get_tick();
+            __atomic_store_n(&pls->mLoaded, 1, __ATOMIC_SEQ_CST);
+            snap = NULL;
+            restored++;
         }
+        pthread_mutex_unlock(&pls->mLoadLock);
+
+        free_snapshot(snap);
     }
 
-    goto EXIT;
-ERROR:
-    /* TBD. Free Here */
+    LOG_INFO("playlist cache %s : %d of %d playlists restored\n", path, restored, info->mPlaylistCnt);
 
 EXIT:
-    if (io)
+    /* snapshots keep the mapping */
+    unref_cache_mapping(map);
+    return restored;
+}
+
+static void free_playlist(Playlist_t* pls)
+{
+    while (pls->mRetired)
     {
-        *io = in;
+        PlaylistSnapshot_t* snap = pls->mRetired;
+        pls->mRetired = snap->mNextRetired;
+        free_snapshot(snap);
     }
-    else
+    free_snapshot(pls->mSnapshot);
+    av_freep(&pls->mURL);
+    pthread_mutex_destroy(&pls->mLock);
+    pthread_mutex_destroy(&pls->mLoadLock);
+    av_freep(&pls->mRenditions);
+    av_free(pls);
+    /* TBD. IMPLEMENTS HERE .... */
+}
+
+/* Indexes are rebuilt from scratch after playlists or renditions are removed */
+static void rebuild_lookup_tables(HLSInfo_t* info)
+{
+    int ii;
+
+    av_freep(&info->mPlaylistTable);
+    av_freep(&info->mGroupTable);
+    info->mPlaylistTableSize = 0;
+    info->mGroupTableSize = 0;
+    info->mGroupCnt = 0;
+
+    for (ii = 0; ii < info->mPlaylistCnt; ii++)
+        index_playlist(info, ii);
+
+    for (ii = 0; ii < info->mRenditionCnt; ii++)
     {
-        if (in)
-            avio_close(in);
+        info->mRenditions[ii]->mNextInGroup = NULL;
+        index_rendition(info, info->mRenditions[ii]);
     }
-    return ret;
 }
 
-int HLS_M3U8_Update(Playlist_t* pls, const AVIOInterruptCB* int_cb, AVIOContext** io)
+int HLS_M3U8_FilterVariants(HLSInfo_t* info, VariantFilter_fn keep, void* opaque)
 {
-    int ret;
-    int ii, pts;
-    Playlist_t newpls;
-    memset(&newpls, 0x00, sizeof(Playlist_t));
-    strcpy(newpls.mURL, pls->mURL);
+    char* used = NULL;
+    int varCnt = 0;
+    int plsCnt = 0;
+    int rendCnt = 0;
+    int removed;
+    int ii, jj;
 
-    ret = parse_playlist(NULL, newpls.mURL, &newpls, int_cb, io);
-    if (ret)
+    for (ii = 0; ii < info->mVariantCnt; ii++)
     {
-        LOG_ERROR("parse_playlist is failed : ret %d\n", ret);
-        return ret;
+        if (keep(info->mVariants[ii], opaque))
+            varCnt++;
     }
 
-    LOG_INFO("SegmentCnt : %d, StartSeqNo : %d, EndSeqNo : %d\n", newpls.mSegmentCnt, newpls.mStartSeqNo, newpls.mStartSeqNo + newpls.mSegmentCnt);
-#if 0 /* IS NEED TO CHECK */
-    if (newpls.mStartSeqNo > pls->mStartSeqNo)
+    if (varCnt == info->mVariantCnt)
+        return 0;
+
+    if (varCnt == 0)
     {
-        int diff = newpls.mStartSeqNo - pls->mStartSeqNo;
-        
+        LOG_WARN("no variant passes the filter, all of %d variants are kept\n", info->mVariantCnt);
+        return 0;
     }
-#endif 
 
-    free_segment_from_playlist(pls);
-    *pls = newpls;
+    if (!(used = (char*)av_mallocz(info->mPlaylistCnt)))
+        return AVERROR(ENOMEM);
+
+    /* cache keeps the master as parsed, other filter options of next open may keep other variants */
+    if (!info->mMasterRecord)
+        info->mMasterRecord = build_master_record(info, &info->mMasterRecordSize);
 
-    for (ii = 0; ii < pls->mSegmentCnt; ii++)
+    removed = info->mVariantCnt - varCnt;
+    varCnt = 0;
+    for (ii = 0; ii < info->mVariantCnt; ii++)
     {
-        Segment_t* seg = pls->mSegments[ii];
-        if (pls->mFinished)
+        Variant_t* var = info->mVariants[ii];
+
+        if (!keep(var, opaque))
         {
-            seg->mStartPts = pts;
-            pts += seg->mDuration;
+            LOG_INFO("variant %d is pruned : bandwidth %d, %dx%d, %.3f fps, codecs %s\n", ii, var->mBandwidth,
+                     var->mWidth, var->mHeight, var->mFrameRate, var->mCodecs);
+            av_freep(&var->mPlaylists);
+            av_free(var);
+            continue;
         }
-        else
+
+        for (jj = 0; jj < var->mPlaylistCnt; jj++)
         {
-            seg->mStartPts = AV_NOPTS_VALUE;
+            int index = get_playlist_index(info, var->mPlaylists[jj]);
+            if (index >= 0)
+                used[index] = 1;
         }
-
+        info->mVariants[varCnt++] = var;
     }
+    info->mVariantCnt = varCnt;
 
-    return 0;
-}
+    /* renditions of the removed playlists belong to no variant left */
+    for (ii = 0; ii < info->mRenditionCnt; ii++)
+    {
+        Rendition_t* rend = info->mRenditions[ii];
 
-static void free_init_section_list(Playlist_t* pls)
-{
-    int ii;
-    for (ii = 0; ii < pls->mInitSectionCnt; ii++)
+        int index = rend->mPlaylist ? get_playlist_index(info, rend->mPlaylist) : -1;
+
+        if (index >= 0 && !used[index])
+            av_free(rend);
+        else
+            info->mRenditions[rendCnt++] = rend;
+    }
+    info->mRenditionCnt = rendCnt;
+
+    for (ii = 0; ii < info->mPlaylistCnt; ii++)
     {
-        av_freep(&pls->mInitSections[ii]->mURL);
-        av_freep(&pls->mInitSections[ii]);
+        if (!used[ii])
+            free_playlist(info->mPlaylists[ii]);
+        else
+            info->mPlaylists[plsCnt++] = info->mPlaylists[ii];
     }
-    av_freep(&pls->mInitSections);
-    pls->mInitSectionCnt = 0;
+    info->mPlaylistCnt = plsCnt;
+
+    rebuild_lookup_tables(info);
+    av_free(used);
+
+    return removed;
 }
 
 void HLS_M3U8_Delete(HLSInfo_t* info)
@@ -890,15 +3739,7 @@ void HLS_M3U8_Delete(HLSInfo_t* info)
 
     // 1. free playlist 
     for (ii = 0; ii < info->mPlaylistCnt; ii++)
-    {
-        Playlist_t* pls = info->mPlaylists[ii];
-
-        free_segment_from_playlist(pls);
-        free_init_section_list(pls);
-        av_freep(&pls->mRenditions);
-        av_free(pls);
-        /* TBD. IMPLEMENTS HERE .... */
-    }
+        free_playlist(info->mPlaylists[ii]);
     av_freep(&info->mPlaylists);
     info->mPlaylistCnt = 0;
 
@@ -920,8 +3761,79 @@ void HLS_M3U8_Delete(HLSInfo_t* info)
     }
     av_freep(&info->mRenditions);
     info->mRenditionCnt = 0;
+
+    av_freep(&info->mPlaylistTable);
+    av_freep(&info->mGroupTable);
+    info->mPlaylistTableSize = 0;
+    info->mGroupTableSize = 0;
+    info->mGroupCnt = 0;
+    info->mLookupDisabled = 0;
+
+    av_freep(&info->mMasterRecord);
+    info->mMasterRecordSize = 0;
+
+    if (info->mURL)
+        pthread_mutex_destroy(&info->mLiveAnchorLock);
+    av_freep(&info->mURL);
 }
 
+#ifdef ENABLE_DEBUG_MEMORY_FOOTPRINT
+/* Heap bytes held by current snapshot of a playlist, allocator overhead is not counted */
+static int64_t get_playlist_footprint(Playlist_t* pls, int* allocCnt)
+{
+    PlaylistSnapshot_t* snap = HLS_M3U8_AcquireSnapshot(pls);
+    const char* lastKey = NULL;
+    const char* lastBase = NULL;
+    int64_t bytes;
+    int ii;
+
+    bytes = sizeof(Playlist_t) + strlen(pls->mURL) + 1 + sizeof(PlaylistSnapshot_t);
+    *allocCnt = 3;
+
+    if (snap->mEntries)
+    {
+        /* indexed, segments in cache are not counted */
+        bytes += snap->mSegmentCnt * (sizeof(SegmentEntry_t) + 2 * sizeof(int64_t)) + snap->mDataSize + 1;
+        bytes += snap->mKeyCnt * sizeof(SegmentKey_t) + LAZY_SEGMENT_CACHE_SIZE * (sizeof(Segment_t*) + sizeof(int));
+        *allocCnt += 6 + snap->mKeyCnt;
+        HLS_M3U8_ReleaseSnapshot(snap);
+        return bytes;
+    }
+
+    if (snap->mSegmentCnt > 0)
+    {
+        bytes += snap->mSegmentCnt * (sizeof(Segment_t*) + 2 * sizeof(int64_t));
+        *allocCnt += 3;
+    }
+
+    for (ii = 0; ii < snap->mSegmentCnt; ii++)
+    {
+        Segment_t* seg = snap->mSegments[ii];
+
+        bytes += sizeof(Segment_t) + strlen(seg->mURL) + 1;
+        (*allocCnt)++;
+
+        /* segments of the same key share one string */
+        if (seg->mKeyURL && seg->mKeyURL != lastKey)
+        {
+            bytes += sizeof(SharedURL_t) + strlen(seg->mKeyURL);
+            (*allocCnt)++;
+            lastKey = seg->mKeyURL;
+        }
+
+        if (seg->mBaseURL && seg->mBaseURL != lastBase)
+        {
+            bytes += sizeof(SharedURL_t) + strlen(seg->mBaseURL);
+            (*allocCnt)++;
+            lastBase = seg->mBaseURL;
+        }
+    }
+    HLS_M3U8_ReleaseSnapshot(snap);
+
+    return bytes;
+}
+#endif
+
 void HLS_M3U8_Dump(HLSInfo_t* info)
 {
     int ii, jj;
@@ -933,6 +3845,14 @@ void HLS_M3U8_Dump(HLSInfo_t* info)
     {
         Variant_t* var = info->mVariants[ii];
         LOG_INFO("Variant [%d] - Bandwidth : %d\n", ii, var->mBandwidth);
+        if (var->mAverageBandwidth > 0)
+            LOG_INFO("       AverageBandwidth : %d\n", var->mAverageBandwidth);
+        if (var->mHdcpLevel != HDCP_LEVEL_NONE)
+            LOG_INFO("       HDCP : TYPE-%d\n", var->mHdcpLevel - HDCP_LEVEL_TYPE0);
+        if (var->mCodecs[0])
+            LOG_INFO("       Codecs : %s\n", var->mCodecs);
+        if (var->mWidth > 0)
+            LOG_INFO("       Resolution : %dx%d, FrameRate : %.3f\n", var->mWidth, var->mHeight, var->mFrameRate);
         if (var->mAudioGroup[0])
             LOG_INFO("       AudioGroup : %s\n", var->mAudioGroup);
         if (var->mVideoGroup[0])
@@ -943,8 +3863,9 @@ void HLS_M3U8_Dump(HLSInfo_t* info)
         for (jj = 0; jj < var->mPlaylistCnt; jj++)
         {
             Playlist_t* pls = var->mPlaylists[jj];
+            PlaylistSnapshot_t* snap = HLS_M3U8_AcquireSnapshot(pls);
             if (jj == 0)
-                LOG_INFO("       Playlist [%d] - type : MainStream, start : %d, segment : %d\n", jj, pls->mStartSeqNo, pls->mSegmentCnt);
+                LOG_INFO("       Playlist [%d] - type : MainStream, start : %d, segment : %d\n", jj, snap->mStartSeqNo, snap->mSegmentCnt);
             else
             {
                 const char* strType = "Unknown";
@@ -957,8 +3878,9 @@ void HLS_M3U8_Dump(HLSInfo_t* info)
                     default: break;
                 }
 
-                LOG_INFO("       Playlist [%d] - type : Rendition, %s, start : %d, segment : %d\n", jj, strType, pls->mStartSeqNo, pls->mSegmentCnt);
+                LOG_INFO("       Playlist [%d] - type : Rendition, %s, start : %d, segment : %d\n", jj, strType, snap->mStartSeqNo, snap->mSegmentCnt);
             }
+            HLS_M3U8_ReleaseSnapshot(snap);
 
         }
     }
@@ -977,6 +3899,28 @@ void HLS_M3U8_Dump(HLSInfo_t* info)
         }
         LOG_INFO("Rendition [%d] - %s GroupId: %s, Name: %s, LANG: %s\n", ii, strType, rend->mGroupId, rend->mName, rend->mLanguage);
         if (rend->mPlaylist)
-            LOG_INFO("       Playlist - SegmentCnt : %d\n", rend->mPlaylist->mSegmentCnt);
+        {
+            PlaylistSnapshot_t* snap = HLS_M3U8_AcquireSnapshot(rend->mPlaylist);
+            LOG_INFO("       Playlist - SegmentCnt : %d\n", snap->mSegmentCnt);
+            HLS_M3U8_ReleaseSnapshot(snap);
+        }
     }
+
+#ifdef ENABLE_DEBUG_MEMORY_FOOTPRINT
+    do {
+        int64_t total = 0;
+        int totalAllocCnt = 0;
+
+        for (ii = 0; ii < info->mPlaylistCnt; ii++)
+        {
+            int allocCnt;
+            int64_t bytes = get_playlist_footprint(info->mPlaylists[ii], &allocCnt);
+
+            LOG_INFO("Playlist [%d] - %lld bytes in %d allocations\n", ii, bytes, allocCnt);
+            total += bytes;
+            totalAllocCnt += allocCnt;
+        }
+        LOG_INFO("Total - %lld bytes in %d allocations\n", total, totalAllocCnt);
+    } while (0);
+#endif
 }
@@ -4,8 +4,22 @@
 #include "hls_common.h"
 #include "libavformat/avio.h"
 
+#include <pthread.h>
+
 #define MAX_FIELD_LEN    64
+#define MAX_VALIDATOR_LEN 256
 #define MAX_CHARACTERISTICS_LEN 512
+#define MAX_CODECS_LEN   256
+
+/* VOD playlist larger than this is indexed at load, its segments are allocated on demand */
+#define LAZY_PLAYLIST_DATA_SIZE           (1024 * 1024)
+#define LAZY_SEGMENT_CACHE_SIZE           64
+
+/* layout of cache file is native, file of other version or build is ignored */
+#define PLAYLIST_CACHE_VERSION            3
+
+#define MAX_PLAYLIST_CONNECTIONS_PER_HOST 4
+#define MAX_PLAYLIST_LOADERS              16
 
 typedef enum {
     KEY_TYPE_NONE,
@@ -19,7 +33,10 @@ typedef enum {
 } PlaylistType_e;
 
 typedef struct Segment_s {
-    char*             mURL;
+    int               mRefCnt;   /* owned by playlists and media objects, use HLS_M3U8_RefSegment/UnrefSegment */
+
+    char*             mURL;      /* as written in playlist, use HLS_M3U8_GetSegmentURL for absolute one */
+    char*             mBaseURL;  /* URL of playlist which mURL is relative to, shared by its segments */
 
     int64_t           mStartPts;
     int64_t           mDuration;
@@ -30,28 +47,82 @@ typedef struct Segment_s {
     char*             mKeyURL;
     uint8_t           mIV[16];
 
+    int               mDiscontinuity;  /* #EXT-X-DISCONTINUITY before this segment */
+    int               mDiscontinuitySeq; /* discontinuity sequence number, same for segments of one timeline */
+    int64_t           mProgramDateTime;  /* #EXT-X-PROGRAM-DATE-TIME in us since epoch, carried over from
+                                            previous segment if not tagged. AV_NOPTS_VALUE if unknown */
+
     struct Segment_s* mInitSection;
 } Segment_t;
 
-typedef struct Playlist_s {
-    char                mURL[MAX_URL_SIZE];
+/*
+ * Segment list of a playlist at one load. Published snapshot is never modified, live update builds
+ * a new one and swaps it in. Readers take it with HLS_M3U8_AcquireSnapshot() without locking.
+ */
+typedef struct PlaylistSnapshot_s {
+    int                 mRefCnt;
+    int64_t             mVersion;
 
     int                 mFinished;
     PlaylistType_e      mType;
-    
+
     int64_t             mTargetDuration; /* #EXT-X-TARGETDURATION */
     int                 mStartSeqNo;     /* #EXT-X-MEDIA-SEQUENCE */
+    int                 mDiscontinuitySeq; /* #EXT-X-DISCONTINUITY-SEQUENCE, of the first segment */
+
+    int64_t             mCanSkipUntil;      /* #EXT-X-SERVER-CONTROL:CAN-SKIP-UNTIL */
+    int                 mSkippedSegmentCnt; /* #EXT-X-SKIP:SKIPPED-SEGMENTS, delta update only */
 
     Segment_t**         mSegments;
     int                 mSegmentCnt;
 
+    /* packed timing of mSegments for seek, built when the snapshot is published. NULL if allocation failed */
+    int64_t*            mSegmentStartPts;
+    int64_t*            mSegmentEndOffset; /* end of segment from start of the first one */
+
+    /*
+     * Index of large VOD playlist, see LAZY_PLAYLIST_DATA_SIZE. mSegments is NULL and segments are
+     * built from the kept playlist body by HLS_M3U8_GetSegment, recently built ones are cached.
+     */
+    struct SegmentEntry_s* mEntries;
+    struct SegmentKey_s**  mKeys;
+    int                    mKeyCnt;
+    char*                  mData;
+    int                    mDataSize;
+    char*                  mBaseURL;
+    Segment_t**            mCache;
+    int*                   mCacheIndex;
+    pthread_mutex_t        mCacheLock;
+    struct CacheMapping_s* mMapping;  /* set if the index points into mapped cache file, see HLS_M3U8_LoadCache */
+
     Segment_t**         mInitSections;
     int                 mInitSectionCnt;
 
+    struct PlaylistSnapshot_s* mNextRetired;
+} PlaylistSnapshot_t;
+
+typedef struct Playlist_s {
+    char*               mURL;
+    struct HLSInfo_s*   mInfo;       /* owner, live playlists share its timeline */
+
+    PlaylistSnapshot_t* mSnapshot;   /* current version, never NULL */
+    int                 mReaders;    /* readers between loading mSnapshot and taking its reference */
+    PlaylistSnapshot_t* mRetired;    /* replaced versions, freed when no reader holds them */
+    int64_t             mVersion;
+    pthread_mutex_t     mLock;       /* serializes writers only */
+
+    int                 mLoaded;     /* segment list is loaded once, see HLS_M3U8_Load */
+    pthread_mutex_t     mLoadLock;
+
     struct Rendition_s** mRenditions;
     int                  mRenditionCnt;
 
     int64_t             mLastLoadTime;  /* for live update */
+
+    /* validators of the last response, sent back on reload. Written by the loader of the playlist only */
+    char                mETag[MAX_VALIDATOR_LEN];
+    char                mLastModified[MAX_VALIDATOR_LEN];
+    uint64_t            mDataHash;      /* hash of the last body which was parsed */
 } Playlist_t;
 
 typedef struct Rendition_s {
@@ -61,10 +132,25 @@ typedef struct Rendition_s {
     char             mLanguage[MAX_FIELD_LEN];
     char             mName[MAX_FIELD_LEN];
     int              mDisposition; /* TBD. Check it  */
+
+    struct Rendition_s* mNextInGroup; /* next one of the same type and GROUP-ID in playlist order */
 } Rendition_t;
 
+typedef enum {
+    HDCP_LEVEL_NONE,  /* NONE or not given */
+    HDCP_LEVEL_TYPE0,
+    HDCP_LEVEL_TYPE1,
+} HDCPLevel_e;
+
 typedef struct Variant_s {
     int              mBandwidth;
+    int              mAverageBandwidth;       /* AVERAGE-BANDWIDTH, 0 if not given */
+    HDCPLevel_e      mHdcpLevel;              /* HDCP-LEVEL */
+
+    char             mCodecs[MAX_CODECS_LEN]; /* CODECS, RFC 6381 list, empty if not given */
+    int              mWidth;                  /* RESOLUTION, 0 if not given */
+    int              mHeight;
+    double           mFrameRate;              /* FRAME-RATE, 0 if not given */
     
     Playlist_t**     mPlaylists;
     int              mPlaylistCnt;
@@ -75,6 +161,16 @@ typedef struct Variant_s {
 } Variant_t;
 
 typedef struct HLSInfo_s {
+    char*            mURL;         /* master playlist */
+    uint64_t         mMasterHash;  /* hash of master playlist body, validates playlist cache */
+
+    /* validators of master response, see HLS_M3U8_OpenMaster */
+    char             mETag[MAX_VALIDATOR_LEN];
+    char             mLastModified[MAX_VALIDATOR_LEN];
+    int64_t          mMasterTime;          /* wall clock in seconds when master was fetched or revalidated */
+    uint8_t*         mMasterRecord;        /* master as parsed for the cache, kept before variants are pruned */
+    int64_t          mMasterRecordSize;
+
     Playlist_t**     mPlaylists;
     int              mPlaylistCnt;
 
@@ -83,11 +179,84 @@ typedef struct HLSInfo_s {
 
     Rendition_t**    mRenditions;
     int              mRenditionCnt;
+
+    /* lookup indexes built during parse, both are scanned linearly if an allocation failed */
+    int*                     mPlaylistTable;    /* by absolute URL, index of mPlaylists or -1 */
+    int                      mPlaylistTableSize;
+    struct RenditionGroup_s* mGroupTable;       /* by type and GROUP-ID */
+    int                      mGroupTableSize;
+    int                      mGroupCnt;
+    int                      mLookupDisabled;
+
+    /*
+     * Live timeline shared by playlists, first segment of the first live playlist loaded starts at zero.
+     * Others are placed by program date time, or by media sequence if it is not tagged
+     */
+    int              mLiveAnchorSet;
+    int              mLiveAnchorSeqNo;
+    int64_t          mLiveAnchorPts;
+    int64_t          mLiveAnchorDateTime; /* AV_NOPTS_VALUE if the anchor segment has none */
+    pthread_mutex_t  mLiveAnchorLock;     /* playlists of a variant are loaded concurrently */
 } HLSInfo_t;
 
+/* Returns non zero to keep the variant */
+typedef int (*VariantFilter_fn)(const Variant_t* var, void* opaque);
+
+/* Parses master and loads all of its child playlists */
 int HLS_M3U8_Parse(HLSInfo_t* info, const char* url, const AVIOInterruptCB* int_cb, AVIOContext** io);
+
+/* Parses master only, child playlists are left empty until HLS_M3U8_Load */
+int HLS_M3U8_ParseMaster(HLSInfo_t* info, const char* url, const AVIOInterruptCB* int_cb, AVIOContext** io);
+int HLS_M3U8_Load(Playlist_t* pls, const AVIOInterruptCB* int_cb, AVIOContext** io);
+int HLS_M3U8_LoadVariant(Variant_t* var, const AVIOInterruptCB* int_cb, AVIOContext** io);
+int HLS_M3U8_IsLoaded(Playlist_t* pls);
+
+/*
+ * Removes variants rejected by keep, with playlists and renditions which no variant left uses.
+ * Must be called before any child playlist is loaded. All variants are kept if none passes.
+ * Returns number of variants removed.
+ */
+int HLS_M3U8_FilterVariants(HLSInfo_t* info, VariantFilter_fn keep, void* opaque);
+
+/* Loads all child playlists concurrently with up to maxConnections requests per host */
+int HLS_M3U8_LoadAll(HLSInfo_t* info, const AVIOInterruptCB* int_cb, int maxConnections);
+
+/*
+ * Cache of finished playlists, one file under dir per master URL. It is used only while the master
+ * playlist is the same as when it was saved. Restored playlists are mapped from the file, not parsed.
+ * LoadCache returns number of playlists restored, SaveCache the number of playlists written.
+ */
+int HLS_M3U8_LoadCache(HLSInfo_t* info, const char* dir);
+int HLS_M3U8_SaveCache(HLSInfo_t* info, const char* dir);
+
+/*
+ * HLS_M3U8_ParseMaster through the cache under dir. Variants and renditions saved with the playlists are
+ * used without any request while they are younger than ttl seconds. Older ones are revalidated with
+ * ETag/Last-Modified of the master response, and used again if the master is not modified.
+ * It is the same as HLS_M3U8_ParseMaster if dir is NULL or no cache is usable.
+ */
+int HLS_M3U8_OpenMaster(HLSInfo_t* info, const char* url, const char* dir, int64_t ttl, const AVIOInterruptCB* int_cb);
+
+/* Returns 0 if new version is published, HLS_M3U8_NOT_MODIFIED if playlist is unchanged or negative error */
+#define HLS_M3U8_NOT_MODIFIED 1
 int HLS_M3U8_Update(Playlist_t* pls, const AVIOInterruptCB* int_cb, AVIOContext** io);
 void HLS_M3U8_Delete(HLSInfo_t* info);
 void HLS_M3U8_Dump(HLSInfo_t* info);
 
+PlaylistSnapshot_t* HLS_M3U8_AcquireSnapshot(Playlist_t* pls);
+void                HLS_M3U8_ReleaseSnapshot(PlaylistSnapshot_t* snapshot);
+
+/* Segment accessors, work for both of indexed and materialized snapshots. HLS_M3U8_GetSegment returns new reference */
+Segment_t* HLS_M3U8_GetSegment(PlaylistSnapshot_t* snapshot, int index);
+int64_t    HLS_M3U8_GetSegmentDuration(PlaylistSnapshot_t* snapshot, int index);
+int64_t    HLS_M3U8_GetSegmentStartPts(PlaylistSnapshot_t* snapshot, int index);
+int64_t    HLS_M3U8_GetDuration(PlaylistSnapshot_t* snapshot);
+
+/* Returns index of the segment containing offset from start of the first segment, -1 if there is no segment */
+int HLS_M3U8_FindSegment(PlaylistSnapshot_t* snapshot, int64_t offset);
+
+Segment_t* HLS_M3U8_RefSegment(Segment_t* seg);
+int        HLS_M3U8_GetSegmentURL(const Segment_t* seg, char* buf, int size);
+void       HLS_M3U8_UnrefSegment(Segment_t* seg);
+
 #endif /* __M3U8_PARSER_H_ */
@@ -69,7 +69,10 @@ typedef struct MediaObject_s {
     pthread_cond_t   mCond;
 
     int64_t          mStartTime;
+    int64_t          mDownloadTime;
     int              mBandwidth;
+
+    bool             mDiscontinuity; /* demuxer must be reopened before this object */
     
     bool             mWaitForEnd;
 } MediaObject_t;
@@ -266,7 +269,10 @@ LOG_TRACE("[XXX] Download segment : %s\n", RELURL2(obj->mURL));
 
     }while(ret);
 
-    obj->mBandwidth = (int64_t)obj->mDownloadSize * 8 * 1000 * 1000 / (get_tick() - obj->mStartTime);
+    obj->mDownloadTime = get_tick() - obj->mStartTime;
+    if (obj->mDownloadTime <= 0)
+        obj->mDownloadTime = 1;
+    obj->mBandwidth = (int64_t)obj->mDownloadSize * 8 * 1000 * 1000 / obj->mDownloadTime;
 
 EXIT:
     _LOCK(obj);
@@ -294,7 +300,7 @@ MediaObject MediaObject_Create(Segment_t* seg, AVIOInterruptCB* int_cb)
         LOG_ERROR("obj malloc is failed !\n");
         goto ERROR;
     }
-    obj->mSegment        = seg;
+    obj->mSegment        = HLS_M3U8_RefSegment(seg);
     obj->mParentIntCB    = int_cb;
     obj->mIntCB.callback = _abort_interrupt_callback;
     obj->mIntCB.opaque   = obj;
@@ -303,14 +309,16 @@ MediaObject MediaObject_Create(Segment_t* seg, AVIOInterruptCB* int_cb)
     {
         uint8_t key[16];
         char strKey[33], strIV[33];
+        char url[MAX_URL_SIZE];
 
         if (get_key(seg->mKeyURL, key, &obj->mIntCB) != 0)
             goto ERROR;
 
-        if (strstr(seg->mURL, "://"))
-            snprintf(obj->mURL, sizeof(obj->mURL), "crypto+%s", seg->mURL);
+        HLS_M3U8_GetSegmentURL(seg, url, sizeof(url));
+        if (strstr(url, "://"))
+            snprintf(obj->mURL, sizeof(obj->mURL), "crypto+%s", url);
         else
-            snprintf(obj->mURL, sizeof(obj->mURL), "crypto:%s", seg->mURL);
+            snprintf(obj->mURL, sizeof(obj->mURL), "crypto:%s", url);
 
         memset(strKey, 0x00, sizeof(strKey)); 
         memset(strIV, 0x00, sizeof(strIV));
@@ -325,8 +333,7 @@ MediaObject MediaObject_Create(Segment_t* seg, AVIOInterruptCB* int_cb)
     }
     else
     {
-        av_strlcpy(obj->mURL, (const char*)seg->mURL, MAX_URL_SIZE);
-        obj->mURL[MAX_URL_SIZE - 1] = 0;
+        HLS_M3U8_GetSegmentURL(seg, obj->mURL, sizeof(obj->mURL));
     }
 
     if (seg->mSize >= 0)
@@ -360,6 +367,7 @@ ERROR:
         if (obj->mHttpHandle)
             ffurl_close(obj->mHttpHandle);
 
+        HLS_M3U8_UnrefSegment(obj->mSegment);
         av_free(obj);
     }
 
@@ -503,6 +511,7 @@ void MediaObject_Delete(MediaObject obj)
     pthread_cond_destroy(&obj->mCond);
     pthread_mutex_destroy(&obj->mLock);
 
+    HLS_M3U8_UnrefSegment(obj->mSegment);
     free(obj);   
 }
 
@@ -552,6 +561,28 @@ LOG_TRACE("[XXX] Peek from %s, offset : %d, size : %d\n", RELURL2(obj->mURL), of
     return BufferedStream_Peek(obj->mStream, buf, bufLen, offset);
 }
 
+void MediaObject_SetDiscontinuity(MediaObject obj, bool isDiscontinuity)
+{
+    if (!obj )
+    {
+        LOG_ERROR("obj is null !\n");
+        return;
+    }
+
+    obj->mDiscontinuity = isDiscontinuity;
+}
+
+bool MediaObject_IsDiscontinuity(MediaObject obj)
+{
+    if (!obj )
+    {
+        LOG_ERROR("obj is null !\n");
+        return true;
+    }
+
+    return obj->mDiscontinuity;
+}
+
 int MediaObject_GetBandwidth(MediaObject obj)
 {
     if (!obj )
@@ -563,6 +594,28 @@ int MediaObject_GetBandwidth(MediaObject obj)
     return obj->mBandwidth;
 }
 
+int MediaObject_GetDownloadSize(MediaObject obj)
+{
+    if (!obj )
+    {
+        LOG_ERROR("obj is null !\n");
+        return -1;
+    }
+
+    return obj->mDownloadSize;
+}
+
+int64_t MediaObject_GetDownloadTime(MediaObject obj)
+{
+    if (!obj )
+    {
+        LOG_ERROR("obj is null !\n");
+        return -1;
+    }
+
+    return obj->mDownloadTime;
+}
+
 Segment_t* MediaObject_GetSegment(MediaObject obj)
 {
     if (!obj )
@@ -5,6 +5,8 @@
 #include "m3u8_parser.h"
 #include "libavformat/avio.h"
 
+#include <stdbool.h>
+
 typedef struct MediaObject_s* MediaObject;
 
 MediaObject MediaObject_Create(Segment_t* seg, AVIOInterruptCB* int_cb);
@@ -16,7 +18,12 @@ void        MediaObject_Delete(MediaObject obj);
 int  MediaObject_Read(MediaObject obj, unsigned char* buf, int bufLen);
 int  MediaObject_Peek(MediaObject obj, unsigned char* buf, int bufLen, int offset);
 
+void MediaObject_SetDiscontinuity(MediaObject obj, bool isDiscontinuity);
+bool MediaObject_IsDiscontinuity(MediaObject obj);
+
 int MediaObject_GetBandwidth(MediaObject obj);
+int MediaObject_GetDownloadSize(MediaObject obj);
+int64_t MediaObject_GetDownloadTime(MediaObject obj); /* us, from request to end of data */
 Segment_t* MediaObject_GetSegment(MediaObject obj);
 int64_t MediaObject_GetSegmentStartPts(MediaObject obj); /* TBD. Change Name */
 
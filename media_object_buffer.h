@@ -4,13 +4,6 @@
 #include "media_object.h"
 #include <stdbool.h>
 
-#define BUFFER_SUCCESS        (0)
-#define BUFFER_ERROR          (-1)
-#define BUFFER_ERROR_EMPTY    (-2)
-#define BUFFER_ERROR_FULL     (-3)
-#define BUFFER_ERROR_TIMEOUT  (-4)
-#define BUFFER_ERROR_EOS      (-5)
-
 typedef struct MediaObjectBuffer_s* MediaObjectBuffer;
 
 MediaObjectBuffer MediaObjectBuffer_Create(int capacity);
@@ -0,0 +1,239 @@
+#include "packet_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+
+typedef struct PacketBuffer_s
+{
+    int          mCapacity;
+    PacketPool   mPool;
+
+    AVPacket**   mBuffer;
+    int          mFront;
+    int          mRear;
+    int          mCount;
+
+    bool         mEOS;
+    bool         mAbort;
+
+    pthread_mutex_t mLock;
+    pthread_cond_t  mCondVarFull;
+    pthread_cond_t  mCondVarEmpty;
+
+}PacketBuffer_t;
+
+#define IS_EMPTY(buffer)  (buffer->mCount == 0)
+#define IS_FULL(buffer)   (buffer->mCapacity == buffer->mCount)
+
+static void get_target_time(struct timespec* target, int timeout)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    target->tv_nsec = now.tv_usec * 1000 + (timeout%1000)*1000000;
+    target->tv_sec = now.tv_sec + (timeout/1000);
+
+    if (target->tv_nsec >= 1000000000)
+    {
+        target->tv_nsec -=  1000000000;
+        target->tv_sec ++;
+    }
+}
+
+/* Waits on cond with buffer locked, returns BUFFER_ERROR_TIMEOUT if timed out */
+static int wait_cond(PacketBuffer_t* buffer, pthread_cond_t* cond, int timeout, struct timespec* target)
+{
+    if (timeout == -1)
+    {
+        pthread_cond_wait(cond, &buffer->mLock);
+        return BUFFER_SUCCESS;
+    }
+
+    if (pthread_cond_timedwait(cond, &buffer->mLock, target) == ETIMEDOUT)
+        return BUFFER_ERROR_TIMEOUT;
+
+    return BUFFER_SUCCESS;
+}
+
+PacketBuffer PacketBuffer_Create(int capacity, PacketPool pool)
+{
+    PacketBuffer buffer = (PacketBuffer)malloc(sizeof(PacketBuffer_t) + capacity * sizeof(AVPacket*));
+    if (!buffer)
+    {
+        LOG_ERROR("Cannot allocate buffer !!\n");
+        return NULL;
+    }
+
+    memset(buffer, 0x00, sizeof(PacketBuffer_t));
+
+    if (pthread_mutex_init(&buffer->mLock, NULL) != 0)
+    {
+        LOG_ERROR("Cannot init mutext !!\n");
+        free(buffer);
+        return NULL;
+    }
+
+    if (pthread_cond_init(&buffer->mCondVarFull, NULL) != 0 ||
+        pthread_cond_init(&buffer->mCondVarEmpty, NULL) != 0)
+    {
+        LOG_ERROR("Cannot init condvariable !!\n");
+        pthread_mutex_destroy(&buffer->mLock);
+        free(buffer);
+        return NULL;
+    }
+
+    buffer->mBuffer   = (AVPacket**)(buffer + 1);
+    buffer->mCapacity = capacity;
+    buffer->mPool     = pool;
+
+    return buffer;
+}
+
+void PacketBuffer_Delete(PacketBuffer buffer)
+{
+    if (!buffer)
+        return;
+
+    PacketBuffer_Flush(buffer);
+
+    pthread_mutex_destroy(&buffer->mLock);
+    pthread_cond_destroy(&buffer->mCondVarFull);
+    pthread_cond_destroy(&buffer->mCondVarEmpty);
+
+    free(buffer);
+}
+
+int PacketBuffer_Put(PacketBuffer buffer, AVPacket* pkt, int timeout)
+{
+    struct timespec target;
+
+    if (!buffer)
+        return BUFFER_ERROR;
+
+    if (timeout > 0)
+        get_target_time(&target, timeout);
+
+    pthread_mutex_lock(&buffer->mLock);
+
+    while (IS_FULL(buffer) && !buffer->mAbort)
+    {
+        if (timeout == 0 || wait_cond(buffer, &buffer->mCondVarFull, timeout, &target) != BUFFER_SUCCESS)
+        {
+            pthread_mutex_unlock(&buffer->mLock);
+            return timeout == 0 ? BUFFER_ERROR_FULL : BUFFER_ERROR_TIMEOUT;
+        }
+    }
+
+    if (buffer->mAbort)
+    {
+        pthread_mutex_unlock(&buffer->mLock);
+        return BUFFER_ERROR_EOS;
+    }
+
+    buffer->mBuffer[buffer->mRear] = pkt;
+    buffer->mRear = (buffer->mRear + 1) % buffer->mCapacity;
+    buffer->mCount ++;
+
+    pthread_cond_signal(&buffer->mCondVarEmpty);
+    pthread_mutex_unlock(&buffer->mLock);
+
+    return BUFFER_SUCCESS;
+}
+
+int PacketBuffer_Get(PacketBuffer buffer, AVPacket** pkt, int timeout)
+{
+    struct timespec target;
+
+    if (!buffer)
+        return BUFFER_ERROR;
+
+    if (timeout > 0)
+        get_target_time(&target, timeout);
+
+    pthread_mutex_lock(&buffer->mLock);
+
+    while (IS_EMPTY(buffer) && !buffer->mEOS && !buffer->mAbort)
+    {
+        if (timeout == 0 || wait_cond(buffer, &buffer->mCondVarEmpty, timeout, &target) != BUFFER_SUCCESS)
+        {
+            pthread_mutex_unlock(&buffer->mLock);
+            return timeout == 0 ? BUFFER_ERROR_EMPTY : BUFFER_ERROR_TIMEOUT;
+        }
+    }
+
+    if (IS_EMPTY(buffer) || buffer->mAbort)
+    {
+        pthread_mutex_unlock(&buffer->mLock);
+        return BUFFER_ERROR_EOS;
+    }
+
+    *pkt = buffer->mBuffer[buffer->mFront];
+    buffer->mFront = (buffer->mFront + 1) % buffer->mCapacity;
+    buffer->mCount --;
+
+    pthread_cond_signal(&buffer->mCondVarFull);
+    pthread_mutex_unlock(&buffer->mLock);
+
+    return BUFFER_SUCCESS;
+}
+
+void PacketBuffer_SetEOS(PacketBuffer buffer, bool isEOS)
+{
+    if (!buffer)
+        return;
+
+    pthread_mutex_lock(&buffer->mLock);
+    buffer->mEOS = isEOS;
+    pthread_cond_broadcast(&buffer->mCondVarEmpty);
+    pthread_mutex_unlock(&buffer->mLock);
+}
+
+void PacketBuffer_SetAbort(PacketBuffer buffer, bool isAbort)
+{
+    if (!buffer)
+        return;
+
+    pthread_mutex_lock(&buffer->mLock);
+    buffer->mAbort = isAbort;
+    pthread_cond_broadcast(&buffer->mCondVarFull);
+    pthread_cond_broadcast(&buffer->mCondVarEmpty);
+    pthread_mutex_unlock(&buffer->mLock);
+}
+
+int PacketBuffer_GetCount(PacketBuffer buffer)
+{
+    int count;
+
+    if (!buffer)
+        return 0;
+
+    pthread_mutex_lock(&buffer->mLock);
+    count = buffer->mCount;
+    pthread_mutex_unlock(&buffer->mLock);
+
+    return count;
+}
+
+void PacketBuffer_Flush(PacketBuffer buffer)
+{
+    if (!buffer)
+        return;
+
+    pthread_mutex_lock(&buffer->mLock);
+
+    while (!IS_EMPTY(buffer))
+    {
+        PacketPool_Put(buffer->mPool, &buffer->mBuffer[buffer->mFront]);
+        buffer->mFront = (buffer->mFront + 1) % buffer->mCapacity;
+        buffer->mCount --;
+    }
+
+    buffer->mFront = 0;
+    buffer->mRear  = 0;
+
+    pthread_cond_broadcast(&buffer->mCondVarFull);
+    pthread_mutex_unlock(&buffer->mLock);
+}
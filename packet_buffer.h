@@ -0,0 +1,39 @@
+#ifndef __PACKET_BUFFER_H_
+#define __PACKET_BUFFER_H_
+
+#include "hls_common.h"
+#include "packet_pool.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavcodec/avcodec.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Bounded packet queue between session demux thread and hls_read_packet().
+ * EOS lets consumer drain remaining packets, abort wakes up both sides at once.
+ */
+typedef struct PacketBuffer_s* PacketBuffer;
+
+/* Flushed packets are returned to pool, which has to outlive the buffer. pool may be NULL */
+PacketBuffer PacketBuffer_Create(int capacity, PacketPool pool);
+void         PacketBuffer_Delete(PacketBuffer buffer);
+
+/* Takes ownership of pkt on success */
+int PacketBuffer_Put(PacketBuffer buffer, AVPacket* pkt, int timeOut);
+int PacketBuffer_Get(PacketBuffer buffer, AVPacket** pkt, int timeOut);
+
+void PacketBuffer_SetEOS(PacketBuffer buffer, bool isEOS);
+void PacketBuffer_SetAbort(PacketBuffer buffer, bool isAbort);
+
+int  PacketBuffer_GetCount(PacketBuffer buffer);
+void PacketBuffer_Flush(PacketBuffer buffer);
+
+#endif // __PACKET_BUFFER_H_
@@ -0,0 +1,283 @@
+#include "packet_interleaver.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/avutil.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+typedef struct InterleaveStream_s
+{
+    int          mIndex;
+    int64_t      mKey;        /* unwrapped dts of head packet, INT64_MIN if it has no timestamp */
+    int64_t      mWrap;
+    int64_t      mOffset;
+    int64_t      mLastDts;
+    int64_t      mLastKey;    /* unwrapped dts of the last packet with timestamp, AV_NOPTS_VALUE if none */
+}InterleaveStream_t;
+
+typedef struct PacketInterleaver_s
+{
+    int                  mStreamCnt;
+    InterleaveStream_t*  mStreams;
+
+    InterleaveStream_t** mHeap;
+    int                  mHeapCnt;
+    InterleaveStream_t** mPending;   /* streams whose head packet has to be provided, the end goes first */
+    int                  mPendingCnt;
+
+    int64_t              mLastKey;   /* key of last output packet, reference to unwrap newly started stream */
+}PacketInterleaver_t;
+
+/* Unwraps dts, so heap order stays valid over wrap around */
+static int64_t normalize_dts(InterleaveStream_t* stream, int64_t dts, int64_t refKey)
+{
+    int64_t wrap = stream->mWrap;
+
+    if (dts == AV_NOPTS_VALUE)
+        return INT64_MIN; /* no timestamp, output it first */
+
+    if (wrap > 0)
+    {
+        if (stream->mLastDts == AV_NOPTS_VALUE)
+        {
+            /* first packet after start or seek, align to other streams */
+            stream->mOffset = 0;
+            if (refKey != AV_NOPTS_VALUE)
+            {
+                while (dts + stream->mOffset < refKey - wrap / 2)
+                    stream->mOffset += wrap;
+                while (dts + stream->mOffset > refKey + wrap / 2)
+                    stream->mOffset -= wrap;
+            }
+        }
+        else if (dts - stream->mLastDts < -wrap / 2)
+            stream->mOffset += wrap;
+        else if (dts - stream->mLastDts > wrap / 2)
+            stream->mOffset -= wrap;
+    }
+
+    stream->mLastDts = dts;
+    return dts + stream->mOffset;
+}
+
+static bool heap_less(InterleaveStream_t* a, InterleaveStream_t* b)
+{
+    if (a->mKey != b->mKey)
+        return a->mKey < b->mKey;
+
+    return a->mIndex < b->mIndex; /* main stream first on same dts */
+}
+
+static void heap_push(PacketInterleaver_t* il, InterleaveStream_t* stream)
+{
+    int pos = il->mHeapCnt++;
+
+    while (pos > 0)
+    {
+        int parent = (pos - 1) / 2;
+        if (!heap_less(stream, il->mHeap[parent]))
+            break;
+
+        il->mHeap[pos] = il->mHeap[parent];
+        pos = parent;
+    }
+    il->mHeap[pos] = stream;
+}
+
+static InterleaveStream_t* heap_pop(PacketInterleaver_t* il)
+{
+    InterleaveStream_t* top = il->mHeap[0];
+    InterleaveStream_t* last = il->mHeap[--il->mHeapCnt];
+    int pos = 0;
+
+    while (1)
+    {
+        int child = pos * 2 + 1;
+        if (child >= il->mHeapCnt)
+            break;
+
+        if (child + 1 < il->mHeapCnt && heap_less(il->mHeap[child + 1], il->mHeap[child]))
+            child++;
+
+        if (!heap_less(il->mHeap[child], last))
+            break;
+
+        il->mHeap[pos] = il->mHeap[child];
+        pos = child;
+    }
+    il->mHeap[pos] = last;
+
+    return top;
+}
+
+/* Returns the pending stream of index, removed from pending ones. NULL if it is not pending */
+static InterleaveStream_t* take_pending(PacketInterleaver_t* il, int index)
+{
+    InterleaveStream_t* stream;
+    int ii;
+
+    for (ii = il->mPendingCnt - 1; ii >= 0; ii--)
+    {
+        if (il->mPending[ii]->mIndex == index)
+            break;
+    }
+    if (ii < 0)
+        return NULL;
+
+    stream = il->mPending[ii];
+    memmove(&il->mPending[ii], &il->mPending[ii + 1], (il->mPendingCnt - ii - 1) * sizeof(InterleaveStream_t*));
+    il->mPendingCnt--;
+
+    return stream;
+}
+
+PacketInterleaver PacketInterleaver_Create(int streamCnt)
+{
+    PacketInterleaver il;
+    int ii;
+
+    if (streamCnt < 0)
+        return NULL;
+
+    il = (PacketInterleaver)malloc(sizeof(PacketInterleaver_t) + streamCnt * (sizeof(InterleaveStream_t) + 2 * sizeof(InterleaveStream_t*)));
+    if (!il)
+    {
+        LOG_ERROR("Cannot allocate interleaver !!\n");
+        return NULL;
+    }
+
+    memset(il, 0x00, sizeof(PacketInterleaver_t));
+
+    il->mStreamCnt = streamCnt;
+    il->mStreams   = (InterleaveStream_t*)(il + 1);
+    il->mHeap      = (InterleaveStream_t**)(il->mStreams + streamCnt);
+    il->mPending   = il->mHeap + streamCnt;
+
+    for (ii = 0; ii < streamCnt; ii++)
+    {
+        memset(&il->mStreams[ii], 0x00, sizeof(InterleaveStream_t));
+        il->mStreams[ii].mIndex = ii;
+    }
+
+    PacketInterleaver_Reset(il);
+
+    return il;
+}
+
+void PacketInterleaver_Delete(PacketInterleaver interleaver)
+{
+    free(interleaver);
+}
+
+void PacketInterleaver_SetWrap(PacketInterleaver interleaver, int index, int64_t wrap)
+{
+    if (!interleaver || index < 0 || index >= interleaver->mStreamCnt)
+        return;
+
+    interleaver->mStreams[index].mWrap = wrap;
+}
+
+void PacketInterleaver_Reset(PacketInterleaver interleaver)
+{
+    PacketInterleaver_t* il = interleaver;
+    int ii;
+
+    if (!il)
+        return;
+
+    il->mHeapCnt = 0;
+    il->mPendingCnt = 0;
+    il->mLastKey = AV_NOPTS_VALUE;
+
+    /* reversed, so that streams are taken in index order */
+    for (ii = il->mStreamCnt - 1; ii >= 0; ii--)
+    {
+        InterleaveStream_t* stream = &il->mStreams[ii];
+
+        stream->mLastDts = AV_NOPTS_VALUE;
+        stream->mLastKey = AV_NOPTS_VALUE;
+        stream->mOffset = 0;
+        il->mPending[il->mPendingCnt++] = stream;
+    }
+}
+
+int PacketInterleaver_GetPendingCount(PacketInterleaver interleaver)
+{
+    return interleaver ? interleaver->mPendingCnt : 0;
+}
+
+int PacketInterleaver_GetPending(PacketInterleaver interleaver, int n)
+{
+    if (!interleaver || n < 0 || n >= interleaver->mPendingCnt)
+        return -1;
+
+    return interleaver->mPending[interleaver->mPendingCnt - 1 - n]->mIndex;
+}
+
+void PacketInterleaver_Push(PacketInterleaver interleaver, int index, int64_t dts)
+{
+    PacketInterleaver_t* il = interleaver;
+    InterleaveStream_t* stream;
+
+    if (!il || !(stream = take_pending(il, index)))
+        return;
+
+    stream->mKey = normalize_dts(stream, dts, il->mLastKey);
+    if (stream->mKey != INT64_MIN)
+        stream->mLastKey = stream->mKey;
+    heap_push(il, stream);
+}
+
+void PacketInterleaver_End(PacketInterleaver interleaver, int index)
+{
+    if (interleaver)
+        take_pending(interleaver, index);
+}
+
+int PacketInterleaver_Peek(PacketInterleaver interleaver, int64_t* dts)
+{
+    InterleaveStream_t* head;
+
+    if (!interleaver || interleaver->mHeapCnt == 0)
+        return -1;
+
+    head = interleaver->mHeap[0];
+    *dts = head->mKey == INT64_MIN ? AV_NOPTS_VALUE : head->mKey;
+
+    return head->mIndex;
+}
+
+int64_t PacketInterleaver_GetLastDts(PacketInterleaver interleaver, int index)
+{
+    if (!interleaver || index < 0 || index >= interleaver->mStreamCnt)
+        return AV_NOPTS_VALUE;
+
+    return interleaver->mStreams[index].mLastKey;
+}
+
+int PacketInterleaver_Pop(PacketInterleaver interleaver)
+{
+    PacketInterleaver_t* il = interleaver;
+    InterleaveStream_t* stream;
+
+    if (!il || il->mHeapCnt == 0)
+        return -1;
+
+    stream = heap_pop(il);
+    if (stream->mKey != INT64_MIN)
+        il->mLastKey = stream->mKey;
+
+    il->mPending[il->mPendingCnt++] = stream;
+
+    return stream->mIndex;
+}
@@ -0,0 +1,41 @@
+#ifndef __PACKET_INTERLEAVER_H_
+#define __PACKET_INTERLEAVER_H_
+
+#include "hls_common.h"
+
+/*
+ * Orders head packets of sessions by dts for hls_read_packet().
+ * Streams holding a head packet are kept in a min heap, only the stream whose packet was output has to provide
+ * a new one. Ties go to the lower index, so the main stream comes first. dts of streams with a wrap period
+ * is unwrapped, so the order holds over 33 bit MPEG-TS wrap around. Not thread safe, caller locks.
+ */
+typedef struct PacketInterleaver_s* PacketInterleaver;
+
+PacketInterleaver PacketInterleaver_Create(int streamCnt);
+void              PacketInterleaver_Delete(PacketInterleaver interleaver);
+
+/* Wrap period of dts of the stream in the same unit, 0 (default) if its timestamps don't wrap */
+void PacketInterleaver_SetWrap(PacketInterleaver interleaver, int index, int64_t wrap);
+
+/* All streams have to provide head packet again, unwrap state is dropped. Call while producers are stopped */
+void PacketInterleaver_Reset(PacketInterleaver interleaver);
+
+/*
+ * Streams to provide head packet by _Push() or _End(), n from 0 to _GetPendingCount() - 1, -1 if out of range.
+ * Index order after reset. A stream may stay pending while others are popped, e.g. when it is stalled.
+ */
+int  PacketInterleaver_GetPendingCount(PacketInterleaver interleaver);
+int  PacketInterleaver_GetPending(PacketInterleaver interleaver, int n);
+void PacketInterleaver_Push(PacketInterleaver interleaver, int index, int64_t dts);
+void PacketInterleaver_End(PacketInterleaver interleaver, int index);
+
+/* Returns the stream whose head packet goes out next and its unwrapped dts, -1 if no stream holds one */
+int  PacketInterleaver_Peek(PacketInterleaver interleaver, int64_t* dts);
+
+/* Unwrapped dts of the last packet of the stream with timestamp, AV_NOPTS_VALUE if none since reset */
+int64_t PacketInterleaver_GetLastDts(PacketInterleaver interleaver, int index);
+
+/* Returns the stream whose head packet goes out next, -1 if none holds one. The stream becomes pending */
+int  PacketInterleaver_Pop(PacketInterleaver interleaver);
+
+#endif // __PACKET_INTERLEAVER_H_
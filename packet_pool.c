@@ -0,0 +1,235 @@
+#include "packet_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+
+/* Payload memory owned by pool, handed out wrapped in AVBufferRef and taken back by release_buffer() */
+typedef struct PoolBuffer_s
+{
+    struct PacketPool_s* mPool;
+    uint8_t*        mData;
+    int             mSize;
+}PoolBuffer_t;
+
+typedef struct PacketPool_s
+{
+    int             mMaxCount;
+
+    AVPacket**      mPackets;
+    int             mCount;
+
+    PoolBuffer_t**  mBuffers;   /* kept for reuse */
+    int             mBufferCnt;
+    int64_t         mBufferBytes;
+    int             mBufferOut; /* handed out and not released yet */
+    bool            mDeleted;   /* pool is freed when the last buffer comes back */
+
+    pthread_mutex_t mLock;
+}PacketPool_t;
+
+static void free_pool_buffer(PoolBuffer_t* buffer)
+{
+    av_free(buffer->mData);
+    av_free(buffer);
+}
+
+static void free_pool(PacketPool_t* pool)
+{
+    while (pool->mBufferCnt > 0)
+        free_pool_buffer(pool->mBuffers[--pool->mBufferCnt]);
+    av_free(pool->mBuffers);
+
+    pthread_mutex_destroy(&pool->mLock);
+    free(pool);
+}
+
+static void release_buffer(void* opaque, uint8_t* data)
+{
+    PoolBuffer_t* buffer = (PoolBuffer_t*)opaque;
+    PacketPool_t* pool = buffer->mPool;
+    bool freePool;
+
+    pthread_mutex_lock(&pool->mLock);
+    if (!pool->mDeleted && buffer->mSize <= PACKET_POOL_MAX_BUFFER_SIZE &&
+        pool->mBufferBytes + buffer->mSize <= PACKET_POOL_MAX_BUFFER_BYTES && pool->mBufferCnt < pool->mMaxCount)
+    {
+        pool->mBuffers[pool->mBufferCnt++] = buffer;
+        pool->mBufferBytes += buffer->mSize;
+        buffer = NULL;
+    }
+    pool->mBufferOut--;
+    freePool = pool->mDeleted && pool->mBufferOut == 0;
+    pthread_mutex_unlock(&pool->mLock);
+
+    if (buffer)
+        free_pool_buffer(buffer);
+
+    if (freePool)
+        free_pool(pool);
+}
+
+PacketPool PacketPool_Create(int maxCount)
+{
+    PacketPool pool = (PacketPool)malloc(sizeof(PacketPool_t) + maxCount * sizeof(AVPacket*));
+    if (!pool)
+    {
+        LOG_ERROR("Cannot allocate pool !!\n");
+        return NULL;
+    }
+
+    memset(pool, 0x00, sizeof(PacketPool_t));
+
+    if (pthread_mutex_init(&pool->mLock, NULL) != 0)
+    {
+        LOG_ERROR("Cannot init mutext !!\n");
+        free(pool);
+        return NULL;
+    }
+
+    pool->mPackets  = (AVPacket**)(pool + 1);
+    pool->mMaxCount = maxCount;
+
+    /* at most as many payloads as packets are kept */
+    if (!(pool->mBuffers = (PoolBuffer_t**)av_malloc_array(maxCount, sizeof(PoolBuffer_t*))))
+    {
+        LOG_ERROR("Cannot allocate buffer list !!\n");
+        pthread_mutex_destroy(&pool->mLock);
+        free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void PacketPool_Delete(PacketPool pool)
+{
+    bool freePool;
+
+    if (!pool)
+        return;
+
+    while (pool->mCount > 0)
+        av_packet_free(&pool->mPackets[--pool->mCount]);
+
+    /* payloads still held by player free the pool when they come back */
+    pthread_mutex_lock(&pool->mLock);
+    while (pool->mBufferCnt > 0)
+        free_pool_buffer(pool->mBuffers[--pool->mBufferCnt]);
+    pool->mBufferBytes = 0;
+    pool->mDeleted = true;
+    freePool = pool->mBufferOut == 0;
+    pthread_mutex_unlock(&pool->mLock);
+
+    if (freePool)
+        free_pool(pool);
+}
+
+AVPacket* PacketPool_Get(PacketPool pool)
+{
+    AVPacket* pkt = NULL;
+
+    if (!pool)
+        return av_packet_alloc();
+
+    pthread_mutex_lock(&pool->mLock);
+    if (pool->mCount > 0)
+        pkt = pool->mPackets[--pool->mCount];
+    pthread_mutex_unlock(&pool->mLock);
+
+    if (!pkt)
+        pkt = av_packet_alloc();
+
+    return pkt;
+}
+
+void PacketPool_Put(PacketPool pool, AVPacket** pkt)
+{
+    if (!pkt || !*pkt)
+        return;
+
+    if (!pool)
+    {
+        av_packet_free(pkt);
+        return;
+    }
+
+    av_packet_unref(*pkt);
+
+    pthread_mutex_lock(&pool->mLock);
+    if (pool->mCount < pool->mMaxCount)
+    {
+        pool->mPackets[pool->mCount++] = *pkt;
+        *pkt = NULL;
+    }
+    pthread_mutex_unlock(&pool->mLock);
+
+    /* pool is full */
+    av_packet_free(pkt);
+}
+
+AVBufferRef* PacketPool_GetBuffer(PacketPool pool, int size)
+{
+    PoolBuffer_t* buffer = NULL;
+    AVBufferRef* ref = NULL;
+    int ii;
+
+    if (!pool)
+        return av_buffer_alloc(size);
+
+    pthread_mutex_lock(&pool->mLock);
+    /* most recently released first, it is likely still in cache */
+    for (ii = pool->mBufferCnt - 1; ii >= 0; ii--)
+    {
+        if (pool->mBuffers[ii]->mSize >= size)
+        {
+            buffer = pool->mBuffers[ii];
+            pool->mBuffers[ii] = pool->mBuffers[--pool->mBufferCnt];
+            pool->mBufferBytes -= buffer->mSize;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->mLock);
+
+    if (!buffer && (buffer = (PoolBuffer_t*)av_mallocz(sizeof(PoolBuffer_t))))
+    {
+        buffer->mPool = pool;
+        buffer->mSize = FFALIGN(_MAX(size, 1), PACKET_POOL_MIN_BUFFER_SIZE);
+        if (!(buffer->mData = (uint8_t*)av_malloc(buffer->mSize)))
+        {
+            av_freep(&buffer);
+        }
+    }
+
+    if (buffer && !(ref = av_buffer_create(buffer->mData, buffer->mSize, release_buffer, buffer, 0)))
+        free_pool_buffer(buffer);
+
+    if (!ref)
+        return NULL;
+
+    pthread_mutex_lock(&pool->mLock);
+    pool->mBufferOut++;
+    pthread_mutex_unlock(&pool->mLock);
+
+    return ref;
+}
+
+int PacketPool_NewPacket(PacketPool pool, AVPacket* pkt, int size)
+{
+    AVBufferRef* buf;
+
+    if (size < 0 || size >= INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+        return AVERROR(EINVAL);
+
+    if (!(buf = PacketPool_GetBuffer(pool, size + AV_INPUT_BUFFER_PADDING_SIZE)))
+        return AVERROR(ENOMEM);
+
+    memset(buf->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    pkt->buf  = buf;
+    pkt->data = buf->data;
+    pkt->size = size;
+
+    return 0;
+}
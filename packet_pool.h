@@ -0,0 +1,44 @@
+#ifndef __PACKET_POOL_H_
+#define __PACKET_POOL_H_
+
+#include "hls_common.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavcodec/avcodec.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#define PACKET_POOL_MIN_BUFFER_SIZE  (4096)             /* payload buffers are allocated in multiples of this */
+#define PACKET_POOL_MAX_BUFFER_SIZE  (1024 * 1024)      /* larger payload is not kept */
+#define PACKET_POOL_MAX_BUFFER_BYTES (8 * 1024 * 1024)  /* payload kept for reuse in total */
+
+/*
+ * Free list of AVPacket shared by demux threads and hls_read_packet(), and of payload buffers.
+ * Payload from PacketPool_GetBuffer() comes back to the pool when its last reference is dropped,
+ * either by PacketPool_Put() or by the player holding the packet, so the pool lives until then.
+ * Side data is not pooled, it is attached only when extradata changes and freed on unreference.
+ */
+typedef struct PacketPool_s* PacketPool;
+
+PacketPool PacketPool_Create(int maxCount);
+void       PacketPool_Delete(PacketPool pool);
+
+/* Returns a blank packet, allocates a new one if the pool is empty */
+AVPacket* PacketPool_Get(PacketPool pool);
+
+/* Unreferences *pkt and keeps it for reuse, *pkt is set to NULL. Payload from the pool goes back with it, side data is freed */
+void      PacketPool_Put(PacketPool pool, AVPacket** pkt);
+
+/* Returns writable buffer of at least size bytes, reused one if any. Same as av_buffer_alloc() if pool is NULL */
+AVBufferRef* PacketPool_GetBuffer(PacketPool pool, int size);
+
+/* Same as av_new_packet() with payload from PacketPool_GetBuffer(), pkt has to be blank */
+int          PacketPool_NewPacket(PacketPool pool, AVPacket* pkt, int size);
+
+#endif // __PACKET_POOL_H_
@@ -0,0 +1,386 @@
+/*
+ * Offline ABR simulator.
+ *
+ * Replays segment downloads of a variant ladder over a throughput trace in virtual time
+ * and drives HLS_ABR_* exactly as the demuxer does on download completion.
+ * No network and no wall clock, same inputs give same results.
+ *
+ *   abr_sim -t trace.txt [-m master.m3u8 | -l 800000,1500000,3000000] [-p throughput|bola|hybrid|all]
+ *           [-d segment_sec] [-n segments] [-c max_buffer_sec] [-s startup_sec] [-D decoder_buffer_ms]
+ *           [-M margin_percent] [-i min_switch_interval_ms] [-B min_buffer_ms] [-T buffer_target_ms] [-v]
+ *
+ * -D : media the player keeps queued in decoders, reported to the demuxer as codec_buffer_level.
+ *      That part of the buffer is not in the receiver, HLS_ABR_Update adds it back as the demuxer does.
+ *
+ * Trace file : one "<time sec> <Mbit/s>" per line, rate is held until next line, trace repeats.
+ *
+ * Build from the tree root, e.g.
+ *   gcc -O2 -I. tools/abr_sim.c hls_abr.c hls_common.c hls_log.c m3u8_parser.c ... -lavformat -lavutil -lm
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/avutil.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "hls_common.h"
+#include "hls_abr.h"
+#include "m3u8_parser.h"
+
+#define MAX_VARIANTS      (64)
+#define MAX_TRACE_POINTS  (65536)
+
+typedef struct TracePoint_s {
+    double  mTime;  /* sec */
+    double  mRate;  /* bit/s */
+} TracePoint_t;
+
+typedef struct SimConfig_s {
+    ABRConfig_t   mABR;
+
+    int           mBandwidths[MAX_VARIANTS];
+    int           mVariantCnt;
+
+    double*       mDurations;     /* sec of each segment */
+    int           mSegmentCnt;
+
+    double        mMaxBuffer;     /* sec, download waits above this */
+    double        mStartupBuffer; /* sec, playback starts/resumes from this */
+    double        mDecoderBuffer; /* sec, front of buffer which is queued in decoders */
+
+    TracePoint_t* mTrace;
+    int           mTraceCnt;
+    double        mTracePeriod;
+} SimConfig_t;
+
+typedef struct SimResult_s {
+    double  mStartupDelay;
+    double  mRebufferTime;
+    double  mPlayTime;
+    double  mBitrateSum;   /* bandwidth * duration */
+    double  mDurationSum;
+    int     mSwitchCnt;
+} SimResult_t;
+
+static int load_trace(SimConfig_t* cfg, const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    char line[256];
+
+    if (!fp)
+    {
+        LOG_ERROR("cannot open trace %s !\n", path);
+        return -1;
+    }
+
+    cfg->mTrace = (TracePoint_t*)malloc(MAX_TRACE_POINTS * sizeof(TracePoint_t));
+    cfg->mTraceCnt = 0;
+
+    while (cfg->mTrace && cfg->mTraceCnt < MAX_TRACE_POINTS && fgets(line, sizeof(line), fp))
+    {
+        double t, mbps;
+        if (line[0] == '#' || sscanf(line, "%lf %lf", &t, &mbps) != 2)
+            continue;
+
+        cfg->mTrace[cfg->mTraceCnt].mTime = t;
+        cfg->mTrace[cfg->mTraceCnt].mRate = mbps * 1000000;
+        cfg->mTraceCnt++;
+    }
+    fclose(fp);
+
+    if (cfg->mTraceCnt == 0)
+    {
+        LOG_ERROR("trace %s is empty !\n", path);
+        return -1;
+    }
+
+    /* last rate is held for one second before trace repeats */
+    cfg->mTracePeriod = cfg->mTrace[cfg->mTraceCnt - 1].mTime + 1.0;
+    return 0;
+}
+
+/* Virtual time to download size bytes starting at now */
+static double download_time(SimConfig_t* cfg, double now, double size)
+{
+    double bits = size * 8;
+    double elapsed = 0;
+    double pos = now - (int64_t)(now / cfg->mTracePeriod) * cfg->mTracePeriod;
+    int ii = 0;
+
+    while (ii + 1 < cfg->mTraceCnt && cfg->mTrace[ii + 1].mTime <= pos)
+        ii++;
+
+    while (bits > 0)
+    {
+        double end  = ii + 1 < cfg->mTraceCnt ? cfg->mTrace[ii + 1].mTime : cfg->mTracePeriod;
+        double rate = cfg->mTrace[ii].mRate;
+        double span = end - pos;
+
+        if (rate > 0 && rate * span >= bits)
+            return elapsed + bits / rate;
+
+        bits    -= rate * span;
+        elapsed += span;
+        pos      = end;
+
+        if (++ii >= cfg->mTraceCnt)
+        {
+            ii  = 0;
+            pos = 0;
+        }
+
+        if (elapsed > 24 * 3600)
+            return elapsed; /* trace has no throughput */
+    }
+    return elapsed;
+}
+
+/* Plays buffer for dt, accounts stall when it runs out */
+static void drain(SimConfig_t* cfg, SimResult_t* res, double* buffer, int* playing, double dt)
+{
+    if (!*playing)
+    {
+        if (res->mStartupDelay >= 0) /* stalled, startup is counted separately */
+            res->mRebufferTime += dt;
+        return;
+    }
+
+    if (*buffer >= dt)
+    {
+        *buffer -= dt;
+        res->mPlayTime += dt;
+        return;
+    }
+
+    res->mPlayTime     += *buffer;
+    res->mRebufferTime += dt - *buffer;
+    *buffer  = 0;
+    *playing = 0;
+}
+
+static void simulate(SimConfig_t* cfg, ABRPolicy_e policy, SimResult_t* res)
+{
+    ABRConfig_t abrCfg = cfg->mABR;
+    HLSABR abr;
+    double now = 0, buffer = 0;
+    int playing = 0;
+    int variant = 0; /* demuxer starts from the first variant */
+    int ii;
+
+    memset(res, 0, sizeof(SimResult_t));
+    res->mStartupDelay = -1;
+
+    abrCfg.mPolicy = policy;
+    abr = HLS_ABR_Create(&abrCfg, cfg->mBandwidths, cfg->mVariantCnt);
+    if (!abr)
+        return;
+
+    for (ii = 0; ii < cfg->mSegmentCnt; ii++)
+    {
+        double duration = cfg->mDurations[ii];
+        double size = (double)cfg->mBandwidths[variant] * duration / 8;
+        double dt, decoded;
+        ABRSample_t sample;
+        int next;
+
+        /* receiver buffer is full, wait until one segment fits */
+        if (playing && buffer + duration > cfg->mMaxBuffer)
+        {
+            dt = buffer + duration - cfg->mMaxBuffer;
+            drain(cfg, res, &buffer, &playing, dt);
+            now += dt;
+        }
+
+        dt = download_time(cfg, now, size);
+        drain(cfg, res, &buffer, &playing, dt);
+        now += dt;
+
+        buffer += duration;
+        res->mBitrateSum  += (double)cfg->mBandwidths[variant] * duration;
+        res->mDurationSum += duration;
+
+        if (!playing && (buffer >= cfg->mStartupBuffer || ii == cfg->mSegmentCnt - 1))
+        {
+            if (res->mStartupDelay < 0)
+                res->mStartupDelay = now;
+            playing = 1;
+        }
+
+        /* receiver holds what is not yet handed to decoders */
+        decoded = _MIN(buffer, cfg->mDecoderBuffer);
+
+        sample.mTime         = (int64_t)(now * AV_TIME_BASE);
+        sample.mSize         = (int64_t)size;
+        sample.mDownloadTime = (int64_t)(dt * AV_TIME_BASE);
+        sample.mDuration     = (int64_t)(duration * AV_TIME_BASE);
+        sample.mBufferLevel  = (int64_t)((buffer - decoded) * AV_TIME_BASE);
+
+        next = HLS_ABR_Update(abr, &sample, (int64_t)(decoded * AV_TIME_BASE), variant);
+        if (next != variant)
+            res->mSwitchCnt++;
+        variant = next;
+    }
+
+    /* play out remaining buffer */
+    res->mPlayTime += buffer;
+
+    HLS_ABR_Delete(abr);
+}
+
+static int load_master(SimConfig_t* cfg, const char* url)
+{
+    HLSInfo_t info;
+    PlaylistSnapshot_t* snap;
+    int ii;
+
+    memset(&info, 0, sizeof(HLSInfo_t));
+    if (HLS_M3U8_Parse(&info, url, NULL, NULL) < 0 || info.mVariantCnt == 0)
+    {
+        LOG_ERROR("cannot parse %s !\n", url);
+        return -1;
+    }
+
+    cfg->mVariantCnt = _MIN(info.mVariantCnt, MAX_VARIANTS);
+    for (ii = 0; ii < cfg->mVariantCnt; ii++)
+        cfg->mBandwidths[ii] = info.mVariants[ii]->mBandwidth;
+
+    /* segment timeline of first variant, sizes are derived from BANDWIDTH */
+    snap = HLS_M3U8_AcquireSnapshot(info.mVariants[0]->mPlaylists[0]);
+    if (snap && snap->mSegmentCnt > 0)
+    {
+        cfg->mSegmentCnt = snap->mSegmentCnt;
+        cfg->mDurations = (double*)malloc(cfg->mSegmentCnt * sizeof(double));
+        for (ii = 0; cfg->mDurations && ii < cfg->mSegmentCnt; ii++)
+            cfg->mDurations[ii] = (double)HLS_M3U8_GetSegmentDuration(snap, ii) / AV_TIME_BASE;
+    }
+    HLS_M3U8_ReleaseSnapshot(snap);
+
+    HLS_M3U8_Delete(&info);
+    return 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s -t trace [-m master.m3u8 | -l bw,bw,...] [-p throughput|bola|hybrid|all]\n"
+                    "          [-d segment_sec] [-n segments] [-c max_buffer_sec] [-s startup_sec] [-D decoder_buffer_ms]\n"
+                    "          [-M margin] [-i min_switch_interval_ms] [-B min_buffer_ms] [-T buffer_target_ms] [-v]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    static const char* policyNames[] = { "throughput", "bola", "hybrid" };
+    SimConfig_t cfg;
+    SimResult_t res;
+    const char* trace = NULL;
+    const char* master = NULL;
+    const char* ladder = "800000,1500000,3000000,6000000";
+    double segmentDuration = 6;
+    int segmentCnt = 100;
+    int policy = -1; /* all */
+    int opt, ii;
+
+    memset(&cfg, 0, sizeof(SimConfig_t));
+    cfg.mABR.mSafetyMargin      = 20;
+    cfg.mABR.mMinSwitchInterval = 8000 * 1000LL;
+    cfg.mABR.mMinBuffer         = 4000 * 1000LL;
+    cfg.mABR.mBufferTarget      = 12000 * 1000LL;
+    cfg.mMaxBuffer     = 18;
+    cfg.mStartupBuffer = 0; /* first segment */
+
+    HLS_LOG_SetLevel(LOG_LEVEL_WARN);
+
+    while ((opt = getopt(argc, argv, "t:m:l:p:d:n:c:s:D:M:i:B:T:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': trace = optarg; break;
+            case 'm': master = optarg; break;
+            case 'l': ladder = optarg; break;
+            case 'p':
+                for (policy = 2; policy >= 0; policy--)
+                    if (!strcmp(optarg, policyNames[policy]))
+                        break;
+                if (policy < 0 && strcmp(optarg, "all"))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'd': segmentDuration = atof(optarg); break;
+            case 'n': segmentCnt = atoi(optarg); break;
+            case 'c': cfg.mMaxBuffer = atof(optarg); break;
+            case 's': cfg.mStartupBuffer = atof(optarg); break;
+            case 'D': cfg.mDecoderBuffer = atof(optarg) / 1000; break;
+            case 'M': cfg.mABR.mSafetyMargin = atoi(optarg); break;
+            case 'i': cfg.mABR.mMinSwitchInterval = atoll(optarg) * 1000; break;
+            case 'B': cfg.mABR.mMinBuffer = atoll(optarg) * 1000; break;
+            case 'T': cfg.mABR.mBufferTarget = atoll(optarg) * 1000; break;
+            case 'v': HLS_LOG_SetLevel(LOG_LEVEL_TRACE); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (!trace || segmentDuration <= 0 || segmentCnt <= 0 || load_trace(&cfg, trace) < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (master)
+    {
+        if (load_master(&cfg, master) < 0)
+            return 1;
+    }
+    else
+    {
+        char* list = strdup(ladder);
+        char* save = NULL;
+        char* tok;
+
+        for (tok = strtok_r(list, ",", &save); tok && cfg.mVariantCnt < MAX_VARIANTS; tok = strtok_r(NULL, ",", &save))
+            cfg.mBandwidths[cfg.mVariantCnt++] = atoi(tok);
+        free(list);
+    }
+
+    if (!cfg.mDurations)
+    {
+        cfg.mSegmentCnt = segmentCnt;
+        cfg.mDurations = (double*)malloc(segmentCnt * sizeof(double));
+        for (ii = 0; cfg.mDurations && ii < segmentCnt; ii++)
+            cfg.mDurations[ii] = segmentDuration;
+    }
+
+    if (cfg.mVariantCnt == 0 || !cfg.mDurations)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%-10s %10s %10s %12s %8s\n", "policy", "startup_s", "rebuf_%", "avg_kbps", "switches");
+    for (ii = 0; ii < 3; ii++)
+    {
+        if (policy >= 0 && policy != ii)
+            continue;
+
+        simulate(&cfg, (ABRPolicy_e)ii, &res);
+        printf("%-10s %10.3f %10.3f %12.1f %8d\n", policyNames[ii], res.mStartupDelay,
+               res.mPlayTime + res.mRebufferTime > 0 ? res.mRebufferTime * 100 / (res.mPlayTime + res.mRebufferTime) : 0,
+               res.mDurationSum > 0 ? res.mBitrateSum / res.mDurationSum / 1000 : 0, res.mSwitchCnt);
+    }
+
+    free(cfg.mDurations);
+    free(cfg.mTrace);
+    return 0;
+}
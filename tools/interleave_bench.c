@@ -0,0 +1,499 @@
+/*
+ * Interleave throughput of hls_read_packet() with synthetic sessions.
+ *
+ * Each session has a producer thread generating packets into its PacketBuffer like a demux thread, and the main
+ * thread takes them out in dts order like hls_read_packet() and drops them like a player.
+ *   heap : PacketInterleaver, packets and payload from a shared PacketPool
+ *   scan : linear scan of all sessions with av_compare_mod and packets allocated per frame, as before the heap
+ * Reports packets per second and CPU per packet of that run, and packets out of dts order. choose_ns is the
+ * cost of picking the next session alone, measured on the same timestamps without threads and packets.
+ *
+ *   interleave_bench [-m heap|scan|all] [-a audio] [-s subtitle] [-d seconds] [-q queue] [-w]
+ *
+ * -w starts timestamps 5 seconds before 33 bit MPEG-TS wrap around.
+ *
+ * Build from the tree root, e.g.
+ *   gcc -O2 -I. tools/interleave_bench.c packet_interleaver.c packet_buffer.c packet_pool.c hls_common.c hls_log.c -lavcodec -lavutil -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <getopt.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/avutil.h"
+#include "libavutil/mathematics.h"
+#include "libavcodec/avcodec.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "hls_common.h"
+#include "hls_log.h"
+#include "packet_buffer.h"
+#include "packet_pool.h"
+#include "packet_interleaver.h"
+
+#define MAX_SESSIONS      64
+#define PACKET_POOL_SIZE  (1024)
+#define WAIT_TIMEOUT      (100)
+
+typedef enum {
+    BENCH_MODE_HEAP,
+    BENCH_MODE_SCAN,
+    BENCH_MODE_CNT,
+} BenchMode_e;
+
+typedef struct BenchConfig_s {
+    int      mAudioCnt;
+    int      mSubtitleCnt;
+    int      mDuration;    /* seconds */
+    int      mQueueSize;
+    bool     mWrap;
+} BenchConfig_t;
+
+/* synthetic rendition, timestamps in AV_TIME_BASE like session output */
+typedef struct Session_s {
+    int           mIndex;
+    int64_t       mFrameDuration;
+    int           mPayloadSize;
+    int64_t       mPktCnt;
+    int64_t       mStart;
+    int64_t       mWrap;
+    bool          mPooled;
+    PacketPool    mPool;
+    PacketBuffer  mPackets;
+    AVPacket*     mPkt;         /* head packet */
+    bool          mEOF;
+    pthread_t     mThread;
+} Session_t;
+
+typedef struct BenchResult_s {
+    int64_t  mPackets;
+    int64_t  mWallTime;    /* us */
+    int64_t  mCpuTime;     /* us */
+    int64_t  mChooseTime;  /* ns per packet */
+    int64_t  mDisorder;
+} BenchResult_t;
+
+/* head packet of a session in choose only run */
+typedef struct HeadState_s {
+    int64_t  mNext;
+    int64_t  mDts;
+    bool     mHas;
+    bool     mEOF;
+} HeadState_t;
+
+static int64_t get_cpu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t get_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* producer_proc(void* param)
+{
+    Session_t* session = (Session_t*)param;
+    int64_t ii;
+
+    for (ii = 0; ii < session->mPktCnt; ii++)
+    {
+        AVPacket* pkt;
+        int64_t ts = session->mStart + ii * session->mFrameDuration;
+
+        if (session->mPooled)
+        {
+            pkt = PacketPool_Get(session->mPool);
+            if (pkt && PacketPool_NewPacket(session->mPool, pkt, session->mPayloadSize) < 0)
+                PacketPool_Put(session->mPool, &pkt);
+        }
+        else if ((pkt = av_packet_alloc()) && av_new_packet(pkt, session->mPayloadSize) < 0)
+            av_packet_free(&pkt);
+
+        if (!pkt)
+            break;
+
+        pkt->data[0] = (uint8_t)ii;
+        pkt->pos = ts; /* unwrapped time, to check output order */
+        pkt->dts = pkt->pts = session->mWrap > 0 ? ts % session->mWrap : ts;
+        pkt->stream_index = 0;
+
+        if (PacketBuffer_Put(session->mPackets, pkt, -1) != BUFFER_SUCCESS)
+        {
+            if (session->mPooled)
+                PacketPool_Put(session->mPool, &pkt);
+            else
+                av_packet_free(&pkt);
+            break;
+        }
+    }
+
+    PacketBuffer_SetEOS(session->mPackets, true);
+    return NULL;
+}
+
+/* returns false when session is drained */
+static bool take_head_packet(Session_t* session)
+{
+    int ret;
+
+    while ((ret = PacketBuffer_Get(session->mPackets, &session->mPkt, WAIT_TIMEOUT)) == BUFFER_ERROR_TIMEOUT)
+        ;
+
+    return ret == BUFFER_SUCCESS;
+}
+
+static void run_heap(Session_t* sessions, int cnt, PacketInterleaver interleaver, AVPacket* out, BenchResult_t* res)
+{
+    int64_t last = INT64_MIN;
+    int index;
+
+    while (1)
+    {
+        while ((index = PacketInterleaver_GetPending(interleaver, 0)) >= 0)
+        {
+            Session_t* session = &sessions[index];
+
+            if (!take_head_packet(session))
+            {
+                session->mEOF = true;
+                PacketInterleaver_End(interleaver, index);
+                continue;
+            }
+
+            PacketInterleaver_Push(interleaver, index, session->mPkt->dts);
+        }
+
+        if ((index = PacketInterleaver_Pop(interleaver)) < 0)
+            break;
+
+        av_packet_move_ref(out, sessions[index].mPkt);
+        PacketPool_Put(sessions[index].mPool, &sessions[index].mPkt);
+
+        if (out->pos < last)
+            res->mDisorder++;
+        last = out->pos;
+        res->mPackets++;
+        av_packet_unref(out);
+    }
+}
+
+static void run_scan(Session_t* sessions, int cnt, AVPacket* out, BenchResult_t* res)
+{
+    int64_t last = INT64_MIN;
+    int ii;
+
+    while (1)
+    {
+        int minIndex = -1;
+
+        for (ii = 0; ii < cnt; ii++)
+        {
+            if (sessions[ii].mEOF || sessions[ii].mPkt)
+                continue;
+            if (!take_head_packet(&sessions[ii]))
+                sessions[ii].mEOF = true;
+        }
+
+        for (ii = 0; ii < cnt; ii++)
+        {
+            int64_t dts;
+
+            if (sessions[ii].mEOF || !sessions[ii].mPkt)
+                continue;
+
+            if (minIndex == -1)
+            {
+                minIndex = ii;
+                continue;
+            }
+
+            dts = sessions[ii].mPkt->dts;
+            if (dts == AV_NOPTS_VALUE || av_compare_mod(dts, sessions[minIndex].mPkt->dts, 1LL << 33) < 0)
+                minIndex = ii;
+        }
+        if (minIndex < 0)
+            break;
+
+        av_packet_move_ref(out, sessions[minIndex].mPkt);
+        av_packet_free(&sessions[minIndex].mPkt);
+
+        if (out->pos < last)
+            res->mDisorder++;
+        last = out->pos;
+        res->mPackets++;
+        av_packet_unref(out);
+    }
+}
+
+static int64_t head_dts(const Session_t* session, int64_t index)
+{
+    int64_t ts = session->mStart + index * session->mFrameDuration;
+    return session->mWrap > 0 ? ts % session->mWrap : ts;
+}
+
+/* Same decisions as run_heap() and run_scan() on generated timestamps, returns packets chosen */
+static int64_t choose_only(Session_t* sessions, int cnt, PacketInterleaver interleaver, HeadState_t* heads)
+{
+    int64_t packets = 0;
+    int ii, index;
+
+    for (ii = 0; ii < cnt; ii++)
+        memset(&heads[ii], 0, sizeof(HeadState_t));
+
+    if (interleaver)
+    {
+        PacketInterleaver_Reset(interleaver);
+        while (1)
+        {
+            while ((index = PacketInterleaver_GetPending(interleaver, 0)) >= 0)
+            {
+                if (heads[index].mNext < sessions[index].mPktCnt)
+                    PacketInterleaver_Push(interleaver, index, head_dts(&sessions[index], heads[index].mNext++));
+                else
+                    PacketInterleaver_End(interleaver, index);
+            }
+
+            if (PacketInterleaver_Pop(interleaver) < 0)
+                break;
+            packets++;
+        }
+        return packets;
+    }
+
+    while (1)
+    {
+        int minIndex = -1;
+        int64_t minDts = 0;
+
+        for (ii = 0; ii < cnt; ii++)
+        {
+            if (heads[ii].mEOF || heads[ii].mHas)
+                continue;
+            if (heads[ii].mNext < sessions[ii].mPktCnt)
+            {
+                heads[ii].mDts = head_dts(&sessions[ii], heads[ii].mNext);
+                heads[ii].mHas = true;
+            }
+            else
+                heads[ii].mEOF = true;
+        }
+
+        for (ii = 0; ii < cnt; ii++)
+        {
+            int64_t dts;
+
+            if (heads[ii].mEOF || !heads[ii].mHas)
+                continue;
+
+            dts = heads[ii].mDts;
+            if (minIndex == -1 || dts == AV_NOPTS_VALUE || av_compare_mod(dts, minDts, 1LL << 33) < 0)
+            {
+                minIndex = ii;
+                minDts = dts;
+            }
+        }
+        if (minIndex < 0)
+            break;
+
+        heads[minIndex].mHas = false;
+        heads[minIndex].mNext++;
+        packets++;
+    }
+    return packets;
+}
+
+static int run_bench(const BenchConfig_t* cfg, int mode, BenchResult_t* res)
+{
+    Session_t sessions[MAX_SESSIONS];
+    PacketPool pool = NULL;
+    PacketInterleaver interleaver = NULL;
+    HeadState_t heads[MAX_SESSIONS];
+    AVPacket* out = av_packet_alloc();
+    int64_t wrap = av_rescale(1LL << 33, AV_TIME_BASE, 90000);
+    int64_t start = cfg->mWrap ? wrap - 5 * AV_TIME_BASE : 10 * AV_TIME_BASE;
+    int cnt = 1 + cfg->mAudioCnt + cfg->mSubtitleCnt;
+    int ret = AVERROR(ENOMEM);
+    int ii, started = 0;
+    int64_t cpu, wall;
+
+    memset(sessions, 0, sizeof(sessions));
+    memset(res, 0, sizeof(BenchResult_t));
+
+    if (!out)
+        goto EXIT;
+
+    if (mode == BENCH_MODE_HEAP)
+    {
+        if (!(pool = PacketPool_Create(PACKET_POOL_SIZE)) || !(interleaver = PacketInterleaver_Create(cnt)))
+            goto EXIT;
+    }
+
+    for (ii = 0; ii < cnt; ii++)
+    {
+        Session_t* session = &sessions[ii];
+
+        session->mIndex = ii;
+        if (ii == 0)
+        {
+            session->mFrameDuration = AV_TIME_BASE / 30;    /* 30 fps video */
+            session->mPayloadSize   = 8 * 1024;
+        }
+        else if (ii <= cfg->mAudioCnt)
+        {
+            session->mFrameDuration = av_rescale(1024, AV_TIME_BASE, 48000);  /* AAC frame */
+            session->mPayloadSize   = 384;
+        }
+        else
+        {
+            session->mFrameDuration = 2 * AV_TIME_BASE;     /* subtitle cue */
+            session->mPayloadSize   = 64;
+        }
+
+        session->mPktCnt = (int64_t)cfg->mDuration * AV_TIME_BASE / session->mFrameDuration;
+        session->mStart  = start;
+        session->mWrap   = wrap;
+        session->mPooled = mode == BENCH_MODE_HEAP;
+        session->mPool   = pool;
+        if (!(session->mPackets = PacketBuffer_Create(cfg->mQueueSize, pool)))
+            goto EXIT;
+
+        PacketInterleaver_SetWrap(interleaver, ii, wrap);
+    }
+
+    /* repeated to run long enough for the clock */
+    for (ii = 0, wall = get_ns(); ii < 10; ii++)
+        res->mChooseTime += choose_only(sessions, cnt, interleaver, heads);
+    res->mChooseTime = res->mChooseTime > 0 ? (get_ns() - wall) / res->mChooseTime : 0;
+    PacketInterleaver_Reset(interleaver);
+
+    cpu  = get_cpu_time();
+    wall = get_tick();
+
+    for (ii = 0; ii < cnt; ii++, started++)
+    {
+        if (pthread_create(&sessions[ii].mThread, NULL, producer_proc, &sessions[ii]) != 0)
+            break;
+    }
+
+    if (started == cnt)
+    {
+        if (mode == BENCH_MODE_HEAP)
+            run_heap(sessions, cnt, interleaver, out, res);
+        else
+            run_scan(sessions, cnt, out, res);
+        ret = 0;
+    }
+    else
+    {
+        LOG_ERROR("cannot start producer %d !\n", started);
+        for (ii = 0; ii < cnt; ii++)
+            PacketBuffer_SetAbort(sessions[ii].mPackets, true);
+        ret = AVERROR(EAGAIN);
+    }
+
+    for (ii = 0; ii < started; ii++)
+        pthread_join(sessions[ii].mThread, NULL);
+
+    res->mWallTime = get_tick() - wall;
+    res->mCpuTime  = get_cpu_time() - cpu;
+
+EXIT:
+    for (ii = 0; ii < cnt; ii++)
+    {
+        if (sessions[ii].mPkt && mode == BENCH_MODE_HEAP)
+            PacketPool_Put(pool, &sessions[ii].mPkt);
+        av_packet_free(&sessions[ii].mPkt);
+        PacketBuffer_Delete(sessions[ii].mPackets);
+    }
+    PacketInterleaver_Delete(interleaver);
+    PacketPool_Delete(pool);
+    av_packet_free(&out);
+    return ret;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-m heap|scan|all] [-a audio] [-s subtitle] [-d seconds] [-q queue] [-w]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    static const char* modeNames[] = { "heap", "scan" };
+    BenchConfig_t cfg = { 8, 8, 600, 256, false };
+    int mode = -1; /* all */
+    int opt, ii;
+
+    HLS_LOG_SetLevel(LOG_LEVEL_WARN);
+
+    while ((opt = getopt(argc, argv, "m:a:s:d:q:w")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                for (mode = BENCH_MODE_CNT - 1; mode >= 0; mode--)
+                    if (!strcmp(optarg, modeNames[mode]))
+                        break;
+                if (mode < 0 && strcmp(optarg, "all"))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'a': cfg.mAudioCnt    = atoi(optarg); break;
+            case 's': cfg.mSubtitleCnt = atoi(optarg); break;
+            case 'd': cfg.mDuration    = atoi(optarg); break;
+            case 'q': cfg.mQueueSize   = atoi(optarg); break;
+            case 'w': cfg.mWrap        = true; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (cfg.mAudioCnt < 0 || cfg.mSubtitleCnt < 0 || 1 + cfg.mAudioCnt + cfg.mSubtitleCnt > MAX_SESSIONS ||
+        cfg.mDuration <= 0 || cfg.mQueueSize <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("sessions : 1 video, %d audio, %d subtitle, %d s%s\n", cfg.mAudioCnt, cfg.mSubtitleCnt, cfg.mDuration,
+           cfg.mWrap ? ", over 33 bit wrap" : "");
+    printf("%-5s %9s %10s %10s %10s %9s\n", "mode", "packets", "pkt/s", "cpu_ns/pkt", "choose_ns", "disorder");
+    for (ii = 0; ii < BENCH_MODE_CNT; ii++)
+    {
+        BenchResult_t res;
+
+        if (mode >= 0 && mode != ii)
+            continue;
+
+        if (run_bench(&cfg, ii, &res) < 0 || res.mPackets == 0)
+        {
+            LOG_ERROR("%s failed\n", modeNames[ii]);
+            continue;
+        }
+
+        printf("%-5s %9" PRId64 " %10" PRId64 " %10" PRId64 " %10" PRId64 " %9" PRId64 "\n", modeNames[ii], res.mPackets,
+               res.mWallTime > 0 ? res.mPackets * 1000000 / res.mWallTime : 0,
+               res.mCpuTime * 1000 / res.mPackets, res.mChooseTime, res.mDisorder);
+    }
+
+    return 0;
+}
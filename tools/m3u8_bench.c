@@ -0,0 +1,319 @@
+/*
+ * Media playlist parser throughput and allocations on long VOD/DVR playlists.
+ *
+ * Writes playlists of the given segment counts under a directory, then parses each with HLS_M3U8_Parse from
+ * the file and reports MB/s and the heap calls of one parse. Segments are 6 s with a key rotation every 500
+ * segments and a discontinuity with program date time every 1000, like a long DVR window.
+ * kept and kept_bytes are the allocations of the parse still alive until HLS_M3U8_Delete, i.e. the footprint
+ * of the playlist. seek_ns is HLS_M3U8_FindSegment for random offsets of the first playlist.
+ *
+ *   m3u8_bench [-r repeat] [-o dir] [segments ...]       default segments: 10000 50000 100000
+ *
+ * Allocations are counted by wrapping malloc family of glibc in this tool, so it counts libavutil and
+ * libavformat calls made while parsing as well. Bytes kept are malloc_usable_size, allocator overhead included.
+ *
+ * Build from the tree root, e.g.
+ *   gcc -O2 -I. tools/m3u8_bench.c m3u8_parser.c hls_common.c hls_log.c -lavformat -lavcodec -lavutil -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <malloc.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/avutil.h"
+#include "libavutil/log.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "hls_common.h"
+#include "hls_log.h"
+#include "m3u8_parser.h"
+
+#define MAX_SEGMENT_COUNTS   16
+#define KEY_ROTATION         500
+#define DISCONTINUITY_PERIOD 1000
+#define SEEK_CNT             100000
+
+/* heap calls, see malloc wrappers below */
+typedef struct HeapCount_s {
+    int64_t  mAllocs;
+    int64_t  mFrees;
+    int64_t  mBytes;   /* requested by allocs and reallocs */
+    int64_t  mLive;    /* usable bytes allocated and not freed yet */
+} HeapCount_t;
+
+static HeapCount_t g_Heap;
+static int         g_Counting = 0;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t align, size_t size);
+extern void  __libc_free(void* ptr);
+
+static void* count_alloc(void* ptr, size_t size)
+{
+    if (ptr && __atomic_load_n(&g_Counting, __ATOMIC_RELAXED))
+    {
+        __atomic_add_fetch(&g_Heap.mAllocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&g_Heap.mBytes, (int64_t)size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&g_Heap.mLive, (int64_t)malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+static void count_free(void* ptr)
+{
+    if (ptr && __atomic_load_n(&g_Counting, __ATOMIC_RELAXED))
+    {
+        __atomic_add_fetch(&g_Heap.mFrees, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&g_Heap.mLive, (int64_t)malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    }
+}
+
+void* malloc(size_t size)
+{
+    return count_alloc(__libc_malloc(size), size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    return count_alloc(__libc_calloc(n, size), n * size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    void* tmp;
+
+    /* counted as free and alloc, block may move */
+    if (ptr && size)
+    {
+        size_t old = malloc_usable_size(ptr);
+        if (!(tmp = __libc_realloc(ptr, size)))
+            return NULL;
+        if (__atomic_load_n(&g_Counting, __ATOMIC_RELAXED))
+        {
+            __atomic_add_fetch(&g_Heap.mFrees, 1, __ATOMIC_RELAXED);
+            __atomic_sub_fetch(&g_Heap.mLive, (int64_t)old, __ATOMIC_RELAXED);
+        }
+        return count_alloc(tmp, size);
+    }
+
+    count_free(ptr);
+    return count_alloc(__libc_realloc(ptr, size), size);
+}
+
+int posix_memalign(void** ptr, size_t align, size_t size)
+{
+    return count_alloc(*ptr = __libc_memalign(align, size), size) || size == 0 ? 0 : ENOMEM;
+}
+
+void* aligned_alloc(size_t align, size_t size)
+{
+    return count_alloc(__libc_memalign(align, size), size);
+}
+
+void* memalign(size_t align, size_t size)
+{
+    return count_alloc(__libc_memalign(align, size), size);
+}
+
+void free(void* ptr)
+{
+    count_free(ptr);
+    __libc_free(ptr);
+}
+
+static int64_t get_nano_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t get_cpu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Returns size of the playlist written, negative on error */
+static int64_t write_playlist(const char* path, int segments)
+{
+    FILE* fp = fopen(path, "w");
+    int64_t size;
+    int ii;
+
+    if (!fp)
+    {
+        LOG_ERROR("cannot create %s !\n", path);
+        return -1;
+    }
+
+    fprintf(fp, "#EXTM3U\n#EXT-X-VERSION:6\n#EXT-X-TARGETDURATION:6\n#EXT-X-MEDIA-SEQUENCE:0\n"
+                "#EXT-X-PLAYLIST-TYPE:VOD\n#EXT-X-INDEPENDENT-SEGMENTS\n");
+
+    for (ii = 0; ii < segments; ii++)
+    {
+        if (ii % DISCONTINUITY_PERIOD == 0)
+        {
+            time_t t = 1700000000 + ii * 6;
+            struct tm tm;
+            char date[64];
+
+            gmtime_r(&t, &tm);
+            strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S.000Z", &tm);
+            if (ii > 0)
+                fprintf(fp, "#EXT-X-DISCONTINUITY\n");
+            fprintf(fp, "#EXT-X-PROGRAM-DATE-TIME:%s\n", date);
+        }
+
+        if (ii % KEY_ROTATION == 0)
+            fprintf(fp, "#EXT-X-KEY:METHOD=AES-128,URI=\"https://keys.example.com/v1/key/%08d\",IV=0x%032x\n",
+                    ii / KEY_ROTATION, ii);
+
+        fprintf(fp, "#EXTINF:6.006,\nhttps://cdn.example.com/vod/asset/video_1080p/segment_%08d.ts\n", ii);
+    }
+
+    fprintf(fp, "#EXT-X-ENDLIST\n");
+    size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+/* Returns average ns of HLS_M3U8_FindSegment over random offsets, negative on error */
+static int64_t measure_seek(HLSInfo_t* info)
+{
+    PlaylistSnapshot_t* snap;
+    int64_t duration, start;
+    unsigned int seed = 1;
+    int found = 0;
+    int ii;
+
+    if (info->mVariantCnt == 0 || info->mVariants[0]->mPlaylistCnt == 0 ||
+        !(snap = HLS_M3U8_AcquireSnapshot(info->mVariants[0]->mPlaylists[0])))
+        return -1;
+
+    if ((duration = HLS_M3U8_GetDuration(snap)) <= 0)
+    {
+        HLS_M3U8_ReleaseSnapshot(snap);
+        return -1;
+    }
+
+    start = get_nano_time();
+    for (ii = 0; ii < SEEK_CNT; ii++)
+    {
+        int64_t offset = (((int64_t)rand_r(&seed) << 31) | rand_r(&seed)) % duration;
+        found += HLS_M3U8_FindSegment(snap, offset) >= 0;
+    }
+    start = get_nano_time() - start;
+
+    HLS_M3U8_ReleaseSnapshot(snap);
+    return found == SEEK_CNT ? start / SEEK_CNT : -1;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-r repeat] [-o dir] [segments ...]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    int segmentCounts[MAX_SEGMENT_COUNTS] = { 10000, 50000, 100000 };
+    int countCnt = 3;
+    const char* dir = "/tmp";
+    int repeat = 5;
+    int opt, ii, jj;
+
+    HLS_LOG_SetLevel(LOG_LEVEL_WARN);
+    av_log_set_level(AV_LOG_ERROR);
+
+    while ((opt = getopt(argc, argv, "r:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': repeat = atoi(optarg); break;
+            case 'o': dir = optarg; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind < argc)
+    {
+        for (countCnt = 0; optind < argc && countCnt < MAX_SEGMENT_COUNTS; optind++)
+            segmentCounts[countCnt++] = atoi(argv[optind]);
+    }
+
+    if (repeat <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%9s %10s %8s %8s %10s %12s %10s %12s %8s\n", "segments", "bytes", "MB/s", "best", "allocs", "alloc_bytes",
+           "kept", "kept_bytes", "seek_ns");
+    for (ii = 0; ii < countCnt; ii++)
+    {
+        char path[MAX_URL_SIZE];
+        int64_t size, total = 0, best = INT64_MAX, seek = -1;
+        HeapCount_t heap;
+        HLSInfo_t info;
+
+        snprintf(path, sizeof(path), "%s/m3u8_bench_%d.m3u8", dir, segmentCounts[ii]);
+        if (segmentCounts[ii] <= 0 || (size = write_playlist(path, segmentCounts[ii])) < 0)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+
+        for (jj = 0; jj < repeat; jj++)
+        {
+            int64_t start;
+            int ret;
+
+            memset(&g_Heap, 0, sizeof(g_Heap));
+            __atomic_store_n(&g_Counting, 1, __ATOMIC_RELAXED);
+
+            start = get_cpu_time();
+            ret = HLS_M3U8_Parse(&info, path, NULL, NULL);
+            start = get_cpu_time() - start;
+
+            __atomic_store_n(&g_Counting, 0, __ATOMIC_RELAXED);
+            heap = g_Heap;
+
+            if (ret < 0)
+            {
+                LOG_ERROR("cannot parse %s : %d\n", path, ret);
+                return 1;
+            }
+
+            if (jj == 0 && (seek = measure_seek(&info)) < 0)
+                LOG_ERROR("cannot seek %s\n", path);
+            HLS_M3U8_Delete(&info);
+
+            total += start;
+            best = _MIN(best, start);
+        }
+
+        printf("%9d %10" PRId64 " %8.1f %8.1f %10" PRId64 " %12" PRId64 " %10" PRId64 " %12" PRId64 " %8" PRId64 "\n",
+               segmentCounts[ii], size,
+               size * repeat / (double)_MAX(total, 1), size / (double)_MAX(best, 1),
+               heap.mAllocs, heap.mBytes, heap.mAllocs - heap.mFrees, heap.mLive, seek);
+    }
+
+    return 0;
+}
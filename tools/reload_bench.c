@@ -0,0 +1,415 @@
+/*
+ * Live playlist reloads against a stand-in origin answering conditional requests.
+ *
+ * Runs a small HTTP/1.1 origin in a thread serving a live media playlist with ETag and Last-Modified, which
+ * answers 304 with no body when If-None-Match or If-Modified-Since matches. The playlist is loaded with
+ * HLS_M3U8_Parse and reloaded with HLS_M3U8_Update, sliding the window every -c reloads, i.e. most reloads
+ * see an unchanged playlist like a client polling faster than target duration. Modes:
+ *   hash : validators as the linked http gives them, stock http doesn't export them so only the hash of
+ *          the body short-circuits the parse
+ *   etag : validators of the last 200 are set to the playlist by the tool, like an http exporting them,
+ *          so unchanged reloads are 304
+ * Reports origin requests, 304s and body bytes, and CPU of the reloading thread.
+ *
+ *   reload_bench [-m hash|etag|all] [-n reloads] [-c change_every] [-w window] [-k]
+ *
+ * -k reloads over the kept-alive connection like the receiver does with mM3u8IO.
+ *
+ * Build from the tree root, e.g.
+ *   gcc -O2 -I. tools/reload_bench.c m3u8_parser.c hls_common.c hls_log.c -lavformat -lavcodec -lavutil -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/avutil.h"
+#include "libavutil/avstring.h"
+#include "libavutil/log.h"
+#include "libavformat/avformat.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "hls_common.h"
+#include "hls_log.h"
+#include "m3u8_parser.h"
+
+#define REQUEST_SIZE   8192
+#define TARGET_DURATION 6
+
+typedef enum {
+    RELOAD_MODE_HASH,
+    RELOAD_MODE_ETAG,
+    RELOAD_MODE_CNT,
+} ReloadMode_e;
+
+typedef struct Origin_s {
+    int              mSocket;
+    int              mPort;
+    int              mWindow;
+    pthread_t        mThread;
+    pthread_mutex_t  mLock;
+
+    /* under mLock */
+    int              mSequence;      /* #EXT-X-MEDIA-SEQUENCE, playlist changes when it moves */
+    char             mLastETag[64];  /* of the last 200 */
+    char             mLastModified[64];
+    int64_t          mRequests;
+    int64_t          mNotModified;
+    int64_t          mConnections;
+    int64_t          mBodyBytes;
+} Origin_t;
+
+static const char* g_ModeNames[] = { "hash", "etag" };
+
+static int64_t get_cpu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void make_validators(int sequence, char* etag, int etagSize, char* lastModified, int lastModifiedSize)
+{
+    time_t t = 1700000000 + (time_t)sequence * TARGET_DURATION;
+    struct tm tm;
+
+    snprintf(etag, etagSize, "\"live-%d\"", sequence);
+    gmtime_r(&t, &tm);
+    strftime(lastModified, lastModifiedSize, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/* Returns body length, the playlist fits in buf */
+static int make_playlist(int sequence, int window, char* buf, int size)
+{
+    int len, ii;
+
+    len = snprintf(buf, size, "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%d\n#EXT-X-MEDIA-SEQUENCE:%d\n",
+                   TARGET_DURATION, sequence);
+    for (ii = 0; ii < window && len < size; ii++)
+        len += snprintf(buf + len, size - len,
+                        "#EXTINF:6.000,\nhttps://cdn.example.com/live/channel_01/video_1080p/segment_%010d.ts\n",
+                        sequence + ii);
+
+    return _MIN(len, size - 1);
+}
+
+/* Returns value of header in request, NULL if it is not there */
+static const char* find_header(const char* request, const char* name, char* value, int size)
+{
+    const char* line = strstr(request, "\r\n");
+    int nameLen = strlen(name);
+
+    while (line && line[2] != '\r')
+    {
+        line += 2;
+        if (!strncasecmp(line, name, nameLen) && line[nameLen] == ':')
+        {
+            const char* start = line + nameLen + 1;
+            const char* end = strstr(start, "\r\n");
+
+            start += strspn(start, " ");
+            av_strlcpy(value, start, _MIN(size, end - start + 1));
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+
+    return NULL;
+}
+
+static int send_all(int fd, const char* buf, int len)
+{
+    while (len > 0)
+    {
+        ssize_t ret = send(fd, buf, len, MSG_NOSIGNAL);
+        if (ret <= 0)
+            return -1;
+        buf += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/* Serves requests of one connection until the client closes it */
+static void serve_connection(Origin_t* origin, int fd, char* body, int bodySize)
+{
+    char request[REQUEST_SIZE] = "";
+    int len = 0;
+
+    for (;;)
+    {
+        char header[512], value[128], etag[64], lastModified[64];
+        char* end;
+        int sequence, bodyLen = 0, notModified, headerLen;
+        ssize_t ret;
+
+        while (!(end = strstr(request, "\r\n\r\n")))
+        {
+            if (len >= REQUEST_SIZE - 1 || (ret = recv(fd, request + len, REQUEST_SIZE - 1 - len, 0)) <= 0)
+                return;
+            len += ret;
+            request[len] = '\0';
+        }
+        end += 4;
+
+        pthread_mutex_lock(&origin->mLock);
+        sequence = origin->mSequence;
+        pthread_mutex_unlock(&origin->mLock);
+
+        make_validators(sequence, etag, sizeof(etag), lastModified, sizeof(lastModified));
+        notModified = (find_header(request, "If-None-Match", value, sizeof(value)) && !strcmp(value, etag)) ||
+                      (find_header(request, "If-Modified-Since", value, sizeof(value)) && !strcmp(value, lastModified));
+
+        if (notModified)
+        {
+            headerLen = snprintf(header, sizeof(header), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n"
+                                 "Last-Modified: %s\r\nContent-Length: 0\r\n\r\n", etag, lastModified);
+        }
+        else
+        {
+            bodyLen = make_playlist(sequence, origin->mWindow, body, bodySize);
+            headerLen = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+                                 "Content-Type: application/vnd.apple.mpegurl\r\nETag: %s\r\n"
+                                 "Last-Modified: %s\r\nContent-Length: %d\r\n\r\n", etag, lastModified, bodyLen);
+        }
+
+        pthread_mutex_lock(&origin->mLock);
+        origin->mRequests++;
+        origin->mNotModified += notModified;
+        origin->mBodyBytes += bodyLen;
+        if (!notModified)
+        {
+            av_strlcpy(origin->mLastETag, etag, sizeof(origin->mLastETag));
+            av_strlcpy(origin->mLastModified, lastModified, sizeof(origin->mLastModified));
+        }
+        pthread_mutex_unlock(&origin->mLock);
+
+        if (send_all(fd, header, headerLen) < 0 || send_all(fd, body, bodyLen) < 0)
+            return;
+
+        /* keep pipelined bytes of next request */
+        len -= end - request;
+        memmove(request, end, len + 1);
+    }
+}
+
+static void* origin_thread(void* arg)
+{
+    Origin_t* origin = (Origin_t*)arg;
+    int bodySize = 256 + origin->mWindow * 128;
+    char* body = (char*)malloc(bodySize);
+    int fd;
+
+    /* one connection at a time, the client closes the old one before opening new one */
+    while (body && (fd = accept(origin->mSocket, NULL, NULL)) >= 0)
+    {
+        pthread_mutex_lock(&origin->mLock);
+        origin->mConnections++;
+        pthread_mutex_unlock(&origin->mLock);
+
+        serve_connection(origin, fd, body, bodySize);
+        close(fd);
+    }
+
+    free(body);
+    return NULL;
+}
+
+static int start_origin(Origin_t* origin, int window)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int on = 1;
+
+    memset(origin, 0, sizeof(Origin_t));
+    origin->mWindow = window;
+    pthread_mutex_init(&origin->mLock, NULL);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((origin->mSocket = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    setsockopt(origin->mSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if (bind(origin->mSocket, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(origin->mSocket, 4) < 0 ||
+        getsockname(origin->mSocket, (struct sockaddr*)&addr, &addrLen) < 0 ||
+        pthread_create(&origin->mThread, NULL, origin_thread, origin) != 0)
+    {
+        LOG_ERROR("cannot start origin !\n");
+        close(origin->mSocket);
+        return -1;
+    }
+
+    origin->mPort = ntohs(addr.sin_port);
+    return 0;
+}
+
+static void stop_origin(Origin_t* origin)
+{
+    shutdown(origin->mSocket, SHUT_RDWR);
+    close(origin->mSocket);
+    pthread_join(origin->mThread, NULL);
+    pthread_mutex_destroy(&origin->mLock);
+}
+
+static int run_reloads(int mode, int reloads, int changeEvery, int window, bool keepAlive)
+{
+    Origin_t origin;
+    HLSInfo_t info;
+    Playlist_t* pls;
+    AVIOContext* io = NULL;
+    char url[MAX_URL_SIZE];
+    int64_t cpu = 0, requests, notModified, bodyBytes;
+    int parsed = 0, skipped = 0;
+    int ret, ii;
+
+    if (start_origin(&origin, window) < 0)
+        return -1;
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/live.m3u8", origin.mPort);
+    if ((ret = HLS_M3U8_Parse(&info, url, NULL, NULL)) < 0 || info.mVariantCnt == 0 ||
+        info.mVariants[0]->mPlaylistCnt == 0)
+    {
+        LOG_ERROR("cannot parse %s : %d\n", url, ret);
+        stop_origin(&origin);
+        return -1;
+    }
+    pls = info.mVariants[0]->mPlaylists[0];
+
+    /* the first load is not counted */
+    pthread_mutex_lock(&origin.mLock);
+    requests = origin.mRequests;
+    notModified = origin.mNotModified;
+    bodyBytes = origin.mBodyBytes;
+    pthread_mutex_unlock(&origin.mLock);
+
+    for (ii = 1; ii <= reloads; ii++)
+    {
+        int64_t start;
+
+        pthread_mutex_lock(&origin.mLock);
+        if (ii % changeEvery == 0)
+            origin.mSequence++;
+        if (mode == RELOAD_MODE_ETAG)
+        {
+            av_strlcpy(pls->mETag, origin.mLastETag, sizeof(pls->mETag));
+            av_strlcpy(pls->mLastModified, origin.mLastModified, sizeof(pls->mLastModified));
+        }
+        pthread_mutex_unlock(&origin.mLock);
+
+        start = get_cpu_time();
+        ret = HLS_M3U8_Update(pls, NULL, keepAlive ? &io : NULL);
+        cpu += get_cpu_time() - start;
+
+        if (ret == HLS_M3U8_NOT_MODIFIED)
+            skipped++;
+        else if (ret == 0)
+            parsed++;
+        else
+        {
+            LOG_ERROR("reload %d failed : %d\n", ii, ret);
+            break;
+        }
+    }
+
+    if (io)
+        avio_close(io);
+    HLS_M3U8_Delete(&info);
+
+    pthread_mutex_lock(&origin.mLock);
+    requests = origin.mRequests - requests;
+    notModified = origin.mNotModified - notModified;
+    bodyBytes = origin.mBodyBytes - bodyBytes;
+    pthread_mutex_unlock(&origin.mLock);
+
+    printf("%-5s %8d %7d %8d %9" PRId64 " %7" PRId64 " %8" PRId64 " %12" PRId64 " %10" PRId64 "\n",
+           g_ModeNames[mode], reloads, parsed, skipped,
+           requests, notModified, origin.mConnections, bodyBytes, cpu / _MAX(reloads, 1));
+
+    stop_origin(&origin);
+    return ii > reloads ? 0 : -1;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-m hash|etag|all] [-n reloads] [-c change_every] [-w window] [-k]\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    int mode = -1; /* all */
+    int reloads = 1000;
+    int changeEvery = 4;
+    int window = 300;
+    bool keepAlive = false;
+    int opt, ii;
+
+    HLS_LOG_SetLevel(LOG_LEVEL_ERROR);
+    av_log_set_level(AV_LOG_ERROR);
+
+    while ((opt = getopt(argc, argv, "m:n:c:w:k")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                for (mode = RELOAD_MODE_CNT - 1; mode >= 0; mode--)
+                    if (!strcmp(optarg, g_ModeNames[mode]))
+                        break;
+                if (mode < 0 && strcmp(optarg, "all"))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'n': reloads = atoi(optarg); break;
+            case 'c': changeEvery = atoi(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 'k': keepAlive = true; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (reloads <= 0 || changeEvery <= 0 || window <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    avformat_network_init();
+
+    /* cpu_us is per reload, connections include the first load */
+    printf("%-5s %8s %7s %8s %9s %7s %8s %12s %10s\n", "mode", "reloads", "parsed", "skipped", "requests", "304s",
+           "conns", "body_bytes", "cpu_us");
+    for (ii = 0; ii < RELOAD_MODE_CNT; ii++)
+    {
+        if (mode >= 0 && mode != ii)
+            continue;
+
+        if (run_reloads(ii, reloads, changeEvery, window, keepAlive) < 0)
+            LOG_ERROR("%s failed\n", g_ModeNames[ii]);
+    }
+
+    avformat_network_deinit();
+    return 0;
+}
@@ -0,0 +1,292 @@
+/*
+ * CPU cost of segment boundaries in the sub demuxer.
+ *
+ * Demuxes local TS segments the ways a session can, and reports CPU time per segment:
+ *   reopen     : avformat_open_input and avformat_find_stream_info for every segment, as sessions did
+ *                before continuous_demux
+ *   continuous : one libavformat context over all segments, continuous_demux with generic sub demuxer
+ *   native     : in-tree TS demuxer over all segments, continuous_demux with native_ts
+ *
+ *   segment_bench [-m reopen|continuous|native|all] [-r repeat] seg0.ts seg1.ts ...
+ *
+ * Build from the tree root, e.g.
+ *   gcc -O2 -I. tools/segment_bench.c ts_demuxer.c packet_pool.c hls_common.c hls_log.c -lavformat -lavcodec -lavutil -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/avutil.h"
+#include "libavutil/log.h"
+#include "libavformat/avformat.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "hls_common.h"
+#include "hls_log.h"
+#include "ts_demuxer.h"
+#include "packet_pool.h"
+
+#define IO_BUFFER_SIZE  (32 * 1024)
+
+typedef enum {
+    BENCH_MODE_REOPEN,
+    BENCH_MODE_CONTINUOUS,
+    BENCH_MODE_NATIVE,
+    BENCH_MODE_CNT,
+} BenchMode_e;
+
+/* segments read back to back, the way receiver hands them to a session */
+typedef struct SegmentReader_s {
+    char**   mPaths;
+    int      mCnt;
+    int      mIndex;
+    FILE*    mFile;
+    int64_t  mPos;
+    TSDemuxer mDemuxer;  /* told where segments start, NULL for libavformat */
+} SegmentReader_t;
+
+typedef struct BenchResult_s {
+    int64_t  mCpuTime;   /* us */
+    int64_t  mWallTime;  /* us */
+    int64_t  mPackets;
+    int64_t  mBytes;
+} BenchResult_t;
+
+static int64_t get_cpu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int read_segments(void* opaque, uint8_t* buf, int size)
+{
+    SegmentReader_t* reader = (SegmentReader_t*)opaque;
+
+    while (reader->mIndex < reader->mCnt)
+    {
+        int ret;
+
+        if (!reader->mFile)
+        {
+            if (!(reader->mFile = fopen(reader->mPaths[reader->mIndex], "rb")))
+            {
+                LOG_ERROR("cannot open %s !\n", reader->mPaths[reader->mIndex]);
+                return AVERROR(EIO);
+            }
+            if (reader->mDemuxer && reader->mIndex > 0)
+                TSDemuxer_SetSegmentStart(reader->mDemuxer, reader->mPos);
+        }
+
+        if ((ret = fread(buf, 1, size, reader->mFile)) > 0)
+        {
+            reader->mPos += ret;
+            return ret;
+        }
+
+        fclose(reader->mFile);
+        reader->mFile = NULL;
+        reader->mIndex++;
+    }
+
+    return AVERROR_EOF;
+}
+
+static int read_all(AVFormatContext* ic, AVPacket* pkt, BenchResult_t* res)
+{
+    int ret;
+
+    while ((ret = av_read_frame(ic, pkt)) >= 0)
+    {
+        res->mPackets++;
+        res->mBytes += pkt->size;
+        av_packet_unref(pkt);
+    }
+
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+static int bench_reopen(char** paths, int cnt, AVPacket* pkt, BenchResult_t* res)
+{
+    int ret = 0;
+    int ii;
+
+    for (ii = 0; ii < cnt && ret == 0; ii++)
+    {
+        AVFormatContext* ic = NULL;
+
+        if ((ret = avformat_open_input(&ic, paths[ii], NULL, NULL)) < 0)
+        {
+            LOG_ERROR("cannot open %s : %d\n", paths[ii], ret);
+            break;
+        }
+
+        if ((ret = avformat_find_stream_info(ic, NULL)) >= 0)
+            ret = read_all(ic, pkt, res);
+
+        avformat_close_input(&ic);
+    }
+
+    return ret;
+}
+
+static int bench_continuous(char** paths, int cnt, AVPacket* pkt, BenchResult_t* res)
+{
+    SegmentReader_t reader = { paths, cnt, 0, NULL, 0, NULL };
+    AVFormatContext* ic = avformat_alloc_context();
+    AVIOContext* io = NULL;
+    unsigned char* buf = (unsigned char*)av_malloc(IO_BUFFER_SIZE);
+    int ret = AVERROR(ENOMEM);
+
+    if (!ic || !buf || !(io = avio_alloc_context(buf, IO_BUFFER_SIZE, 0, &reader, read_segments, NULL, NULL)))
+        goto EXIT;
+    buf = NULL;
+    ic->pb = io;
+
+    if ((ret = avformat_open_input(&ic, NULL, av_find_input_format("mpegts"), NULL)) < 0)
+    {
+        LOG_ERROR("cannot open sub demuxer : %d\n", ret);
+        goto EXIT;
+    }
+
+    if ((ret = avformat_find_stream_info(ic, NULL)) >= 0)
+        ret = read_all(ic, pkt, res);
+
+EXIT:
+    avformat_close_input(&ic);
+    if (io)
+        av_freep(&io->buffer);
+    avio_context_free(&io);
+    av_free(buf);
+    if (reader.mFile)
+        fclose(reader.mFile);
+    return ret;
+}
+
+static int bench_native(char** paths, int cnt, AVPacket* pkt, BenchResult_t* res)
+{
+    SegmentReader_t reader = { paths, cnt, 0, NULL, 0, NULL };
+    PacketPool pool = PacketPool_Create(16);
+    int ret;
+
+    if (!pool || !(reader.mDemuxer = TSDemuxer_Create(read_segments, &reader)))
+    {
+        PacketPool_Delete(pool);
+        return AVERROR(ENOMEM);
+    }
+    TSDemuxer_SetPacketPool(reader.mDemuxer, pool);
+
+    if ((ret = TSDemuxer_ReadHeader(reader.mDemuxer)) >= 0)
+    {
+        while ((ret = TSDemuxer_ReadPacket(reader.mDemuxer, pkt)) == 0)
+        {
+            res->mPackets++;
+            res->mBytes += pkt->size;
+            av_packet_unref(pkt);
+        }
+        ret = ret == AVERROR_EOF ? 0 : ret;
+    }
+
+    TSDemuxer_Delete(reader.mDemuxer);
+    PacketPool_Delete(pool);
+    if (reader.mFile)
+        fclose(reader.mFile);
+    return ret;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-m reopen|continuous|native|all] [-r repeat] seg0.ts seg1.ts ...\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    static const char* modeNames[] = { "reopen", "continuous", "native" };
+    AVPacket* pkt;
+    int mode = -1; /* all */
+    int repeat = 5;
+    int opt, ii, jj;
+
+    HLS_LOG_SetLevel(LOG_LEVEL_WARN);
+    av_log_set_level(AV_LOG_ERROR);
+
+    while ((opt = getopt(argc, argv, "m:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                for (mode = BENCH_MODE_CNT - 1; mode >= 0; mode--)
+                    if (!strcmp(optarg, modeNames[mode]))
+                        break;
+                if (mode < 0 && strcmp(optarg, "all"))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'r': repeat = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc || repeat <= 0 || !(pkt = av_packet_alloc()))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%-11s %8s %8s %10s %12s %12s %12s\n", "mode", "segments", "packets", "bytes", "cpu_us", "cpu_us/seg", "wall_us/seg");
+    for (ii = 0; ii < BENCH_MODE_CNT; ii++)
+    {
+        BenchResult_t res;
+        int64_t cpu, wall;
+        int ret = 0;
+
+        if (mode >= 0 && mode != ii)
+            continue;
+
+        memset(&res, 0, sizeof(res));
+        cpu  = get_cpu_time();
+        wall = get_tick();
+
+        for (jj = 0; jj < repeat && ret == 0; jj++)
+        {
+            if (ii == BENCH_MODE_REOPEN)
+                ret = bench_reopen(argv + optind, argc - optind, pkt, &res);
+            else if (ii == BENCH_MODE_CONTINUOUS)
+                ret = bench_continuous(argv + optind, argc - optind, pkt, &res);
+            else
+                ret = bench_native(argv + optind, argc - optind, pkt, &res);
+        }
+
+        res.mCpuTime  = get_cpu_time() - cpu;
+        res.mWallTime = get_tick() - wall;
+
+        if (ret < 0)
+        {
+            LOG_ERROR("%s failed : %d\n", modeNames[ii], ret);
+            continue;
+        }
+
+        jj = (argc - optind) * repeat;
+        printf("%-11s %8d %8" PRId64 " %10" PRId64 " %12" PRId64 " %12" PRId64 " %12" PRId64 "\n",
+               modeNames[ii], argc - optind, res.mPackets / repeat, res.mBytes / repeat, res.mCpuTime / repeat,
+               res.mCpuTime / jj, res.mWallTime / jj);
+    }
+
+    av_packet_free(&pkt);
+    return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ * Startup time to first packet against an origin.
+ *
+ * Replays what hls_read_header() does for the main session until its first packet, the way each startup
+ * mode opens it, and reports the time of every step from the start:
+ *   probe  : av_probe_input_buffer with 4 KB, avformat_open_input and avformat_find_stream_info up to 4 s
+ *   fast   : fast_start, container from segment extension and stream analysis up to 0.5 s
+ *   native : native_ts, in-tree TS demuxer without probing and analysis
+ * Playlists are loaded with HLS_M3U8_Parse and the first segment of the first variant is read over avio, so
+ * a local origin (e.g. python3 -m http.server) gives real request round trips.
+ *
+ *   startup_bench [-m probe|fast|native|all] [-r repeat] [-v] http://127.0.0.1:8000/master.m3u8
+ *
+ * Build from the tree root, e.g.
+ *   gcc -O2 -I. tools/startup_bench.c m3u8_parser.c ts_demuxer.c packet_pool.c hls_common.c hls_log.c -lavformat -lavcodec -lavutil -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <getopt.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/avutil.h"
+#include "libavutil/avstring.h"
+#include "libavutil/log.h"
+#include "libavformat/avformat.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "hls_common.h"
+#include "hls_log.h"
+#include "m3u8_parser.h"
+#include "ts_demuxer.h"
+#include "packet_pool.h"
+
+#define IO_BUFFER_SIZE               (32 * 1024)
+#define PROBE_SIZE                   "4096"
+#define ANALYZE_DURATION             "4000000"  /* us, default max_analyze_duration of sessions */
+#define FAST_START_ANALYZE_DURATION  "500000"   /* us */
+
+typedef enum {
+    STARTUP_MODE_PROBE,
+    STARTUP_MODE_FAST,
+    STARTUP_MODE_NATIVE,
+    STARTUP_MODE_CNT,
+} StartupMode_e;
+
+/* us from the start of a run */
+typedef struct StartupTime_s {
+    int64_t  mPlaylist;
+    int64_t  mOpen;
+    int64_t  mAnalyze;
+    int64_t  mFirstPacket;
+} StartupTime_t;
+
+static const struct {
+    const char* mExt;
+    const char* mFormat;
+} g_SegmentFormats[] = {
+    { "ts",   "mpegts" },
+    { "aac",  "aac"    },
+    { "mp4",  "mov"    },
+    { "m4s",  "mov"    },
+    { "cmfv", "mov"    },
+    { "cmfa", "mov"    },
+};
+
+static int read_segment(void* opaque, uint8_t* buf, int size)
+{
+    int ret = avio_read((AVIOContext*)opaque, buf, size);
+    return ret == 0 ? AVERROR_EOF : ret;
+}
+
+static ff_const59 AVInputFormat* guess_input_format(const Segment_t* seg)
+{
+    char path[MAX_URL_SIZE];
+    char* ext;
+    int ii;
+
+    if (seg->mInitSection)
+        return av_find_input_format("mov");
+
+    av_strlcpy(path, seg->mURL, sizeof(path));
+    path[strcspn(path, "?#")] = '\0';
+
+    if (!(ext = strrchr(path, '.')) || strchr(ext, '/'))
+        return NULL;
+
+    for (ii = 0; ii < sizeof(g_SegmentFormats) / sizeof(g_SegmentFormats[0]); ii++)
+    {
+        if (!av_strcasecmp(ext + 1, g_SegmentFormats[ii].mExt))
+            return av_find_input_format(g_SegmentFormats[ii].mFormat);
+    }
+
+    return NULL;
+}
+
+static int open_first_segment(HLSInfo_t* info, Segment_t** seg, AVIOContext** in)
+{
+    PlaylistSnapshot_t* snap;
+    char url[MAX_URL_SIZE];
+    int ret;
+
+    if (info->mVariantCnt == 0 || info->mVariants[0]->mPlaylistCnt == 0)
+        return AVERROR_INVALIDDATA;
+
+    if (!(snap = HLS_M3U8_AcquireSnapshot(info->mVariants[0]->mPlaylists[0])))
+        return AVERROR_INVALIDDATA;
+
+    *seg = HLS_M3U8_GetSegment(snap, 0);
+    HLS_M3U8_ReleaseSnapshot(snap);
+    if (!*seg)
+        return AVERROR_INVALIDDATA;
+
+    if ((ret = HLS_M3U8_GetSegmentURL(*seg, url, sizeof(url))) < 0)
+        return ret;
+
+    if ((ret = avio_open2(in, url, AVIO_FLAG_READ, NULL, NULL)) < 0)
+        LOG_ERROR("cannot open %s : %d\n", url, ret);
+
+    return ret;
+}
+
+static int first_packet_lavf(AVIOContext* in, const Segment_t* seg, bool fastStart, int64_t start, StartupTime_t* t)
+{
+    AVFormatContext* ic = avformat_alloc_context();
+    ff_const59 AVInputFormat* fmt = NULL;
+    AVDictionary* opts = NULL;
+    AVIOContext* io = NULL;
+    AVPacket* pkt = av_packet_alloc();
+    unsigned char* buf = (unsigned char*)av_malloc(IO_BUFFER_SIZE);
+    int ret = AVERROR(ENOMEM);
+
+    if (!ic || !pkt || !buf || !(io = avio_alloc_context(buf, IO_BUFFER_SIZE, 0, in, read_segment, NULL, NULL)))
+        goto EXIT;
+    buf = NULL;
+
+    av_dict_set(&opts, "probesize", PROBE_SIZE, 0);
+    av_dict_set(&opts, "analyzeduration", ANALYZE_DURATION, 0);
+
+    /* stream parameters come from CODECS, analysis only has to find extradata */
+    if (fastStart && (fmt = guess_input_format(seg)))
+    {
+        av_dict_set(&opts, "analyzeduration", FAST_START_ANALYZE_DURATION, 0);
+        av_dict_set(&opts, "fpsprobesize", "0", 0);
+    }
+    else if ((ret = av_probe_input_buffer(io, &fmt, "", NULL, 0, 0)) < 0)
+    {
+        LOG_ERROR("failed to probe input buffer !\n");
+        goto EXIT;
+    }
+
+    ic->pb = io;
+    if ((ret = avformat_open_input(&ic, "", fmt, &opts)) < 0)
+    {
+        LOG_ERROR("Open avformat input failed : %d\n", ret);
+        goto EXIT;
+    }
+    t->mOpen = get_tick() - start;
+
+    if ((ret = avformat_find_stream_info(ic, NULL)) < 0)
+        goto EXIT;
+    t->mAnalyze = get_tick() - start;
+
+    if ((ret = av_read_frame(ic, pkt)) >= 0)
+        t->mFirstPacket = get_tick() - start;
+
+EXIT:
+    av_dict_free(&opts);
+    avformat_close_input(&ic);
+    if (io)
+        av_freep(&io->buffer);
+    avio_context_free(&io);
+    av_free(buf);
+    av_packet_free(&pkt);
+    return ret;
+}
+
+static int first_packet_native(AVIOContext* in, int64_t start, StartupTime_t* t)
+{
+    PacketPool pool = PacketPool_Create(16);
+    TSDemuxer demuxer = NULL;
+    AVPacket* pkt = av_packet_alloc();
+    int ret = AVERROR(ENOMEM);
+
+    if (!pool || !pkt || !(demuxer = TSDemuxer_Create(read_segment, in)))
+        goto EXIT;
+    TSDemuxer_SetPacketPool(demuxer, pool);
+
+    if ((ret = TSDemuxer_ReadHeader(demuxer)) < 0)
+        goto EXIT;
+    t->mOpen = t->mAnalyze = get_tick() - start;
+
+    if ((ret = TSDemuxer_ReadPacket(demuxer, pkt)) == 0)
+        t->mFirstPacket = get_tick() - start;
+
+EXIT:
+    av_packet_free(&pkt);
+    TSDemuxer_Delete(demuxer);
+    PacketPool_Delete(pool);
+    return ret;
+}
+
+static int run_startup(const char* url, int mode, StartupTime_t* t)
+{
+    HLSInfo_t info;
+    Segment_t* seg = NULL;
+    AVIOContext* in = NULL;
+    int64_t start = get_tick();
+    int ret;
+
+    memset(t, 0, sizeof(StartupTime_t));
+
+    if ((ret = HLS_M3U8_Parse(&info, url, NULL, NULL)) < 0)
+    {
+        LOG_ERROR("cannot parse %s : %d\n", url, ret);
+        return ret;
+    }
+    t->mPlaylist = get_tick() - start;
+
+    if ((ret = open_first_segment(&info, &seg, &in)) >= 0)
+    {
+        if (mode == STARTUP_MODE_NATIVE)
+            ret = first_packet_native(in, start, t);
+        else
+            ret = first_packet_lavf(in, seg, mode == STARTUP_MODE_FAST, start, t);
+    }
+
+    avio_closep(&in);
+    HLS_M3U8_UnrefSegment(seg);
+    HLS_M3U8_Delete(&info);
+    return ret;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-m probe|fast|native|all] [-r repeat] [-v] master_url\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    static const char* modeNames[] = { "probe", "fast", "native" };
+    int mode = -1; /* all */
+    int repeat = 10;
+    int opt, ii, jj;
+
+    HLS_LOG_SetLevel(LOG_LEVEL_WARN);
+    av_log_set_level(AV_LOG_ERROR);
+
+    while ((opt = getopt(argc, argv, "m:r:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                for (mode = STARTUP_MODE_CNT - 1; mode >= 0; mode--)
+                    if (!strcmp(optarg, modeNames[mode]))
+                        break;
+                if (mode < 0 && strcmp(optarg, "all"))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'r': repeat = atoi(optarg); break;
+            case 'v': HLS_LOG_SetLevel(LOG_LEVEL_TRACE); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc || repeat <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    avformat_network_init();
+
+    /* averages in us, the first run of each mode is a warm up */
+    printf("%-7s %10s %10s %10s %12s %12s\n", "mode", "playlist", "open", "analyze", "first_pkt", "min_first");
+    for (ii = 0; ii < STARTUP_MODE_CNT; ii++)
+    {
+        StartupTime_t sum, t;
+        int64_t minFirst = INT64_MAX;
+        int runs = 0;
+
+        if (mode >= 0 && mode != ii)
+            continue;
+
+        memset(&sum, 0, sizeof(sum));
+        for (jj = 0; jj <= repeat; jj++)
+        {
+            if (run_startup(argv[optind], ii, &t) < 0 || t.mFirstPacket == 0)
+            {
+                LOG_ERROR("%s failed\n", modeNames[ii]);
+                break;
+            }
+            if (jj == 0)
+                continue;
+
+            sum.mPlaylist    += t.mPlaylist;
+            sum.mOpen        += t.mOpen;
+            sum.mAnalyze     += t.mAnalyze;
+            sum.mFirstPacket += t.mFirstPacket;
+            minFirst = _MIN(minFirst, t.mFirstPacket);
+            runs++;
+        }
+
+        if (runs == 0)
+            continue;
+
+        printf("%-7s %10" PRId64 " %10" PRId64 " %10" PRId64 " %12" PRId64 " %12" PRId64 "\n", modeNames[ii],
+               sum.mPlaylist / runs, sum.mOpen / runs, sum.mAnalyze / runs, sum.mFirstPacket / runs, minFirst);
+    }
+
+    avformat_network_deinit();
+    return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * Bit-exact check of the in-tree TS demuxer against libavformat.
+ *
+ * Segments are read back to back the way a session sees them, once by the native TS demuxer and once by
+ * libavformat mpegts with parsers off (fflags +noparse), so both deliver whole PES packets. Packets are paired
+ * per PID in order and pts, dts, pos, size and payload bytes are compared.
+ * libavformat leaves key flags to its parsers, so a third pass with parsers on checks the key flag of every
+ * native packet against the parsed frame starting at the same pts.
+ *
+ *   ts_compare [-v] seg0.ts seg1.ts ...
+ *
+ * Build from the tree root, e.g.
+ *   gcc -O2 -I. tools/ts_compare.c ts_demuxer.c packet_pool.c hls_common.c hls_log.c -lavformat -lavcodec -lavutil -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/avutil.h"
+#include "libavutil/log.h"
+#include "libavformat/avformat.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "hls_common.h"
+#include "hls_log.h"
+#include "ts_demuxer.h"
+#include "packet_pool.h"
+
+#define IO_BUFFER_SIZE  (32 * 1024)
+#define MAX_PIDS        32
+
+typedef struct SegmentReader_s {
+    char**    mPaths;
+    int       mCnt;
+    int       mIndex;
+    FILE*     mFile;
+    int64_t   mPos;
+    TSDemuxer mDemuxer;
+} SegmentReader_t;
+
+/* native packets of one PID, consumed in order by libavformat packets */
+typedef struct PidTrack_s {
+    int       mPid;
+    AVPacket** mPackets;
+    int       mCnt;
+    int       mAlloc;
+    int       mNext;
+    int       mLavfCnt;
+    int       mMatch;
+    int       mMismatch;
+    int64_t*  mKeyPts;    /* pts of parsed frames, key frames negated */
+    int       mKeyCnt;
+    int       mKeyAlloc;
+    int       mKeyMismatch;
+} PidTrack_t;
+
+static int          gVerbose = 0;
+static PidTrack_t   gTracks[MAX_PIDS];
+static int          gTrackCnt = 0;
+
+static int read_segments(void* opaque, uint8_t* buf, int size)
+{
+    SegmentReader_t* reader = (SegmentReader_t*)opaque;
+
+    while (reader->mIndex < reader->mCnt)
+    {
+        int ret;
+
+        if (!reader->mFile)
+        {
+            if (!(reader->mFile = fopen(reader->mPaths[reader->mIndex], "rb")))
+            {
+                LOG_ERROR("cannot open %s !\n", reader->mPaths[reader->mIndex]);
+                return AVERROR(EIO);
+            }
+            if (reader->mDemuxer && reader->mIndex > 0)
+                TSDemuxer_SetSegmentStart(reader->mDemuxer, reader->mPos);
+        }
+
+        if ((ret = fread(buf, 1, size, reader->mFile)) > 0)
+        {
+            reader->mPos += ret;
+            return ret;
+        }
+
+        fclose(reader->mFile);
+        reader->mFile = NULL;
+        reader->mIndex++;
+    }
+
+    return AVERROR_EOF;
+}
+
+static PidTrack_t* get_track(int pid)
+{
+    int ii;
+
+    for (ii = 0; ii < gTrackCnt; ii++)
+    {
+        if (gTracks[ii].mPid == pid)
+            return &gTracks[ii];
+    }
+
+    if (gTrackCnt >= MAX_PIDS)
+        return NULL;
+
+    memset(&gTracks[gTrackCnt], 0, sizeof(PidTrack_t));
+    gTracks[gTrackCnt].mPid = pid;
+    return &gTracks[gTrackCnt++];
+}
+
+static int add_native_packet(PidTrack_t* track, const AVPacket* pkt)
+{
+    AVPacket* ref;
+
+    if (track->mCnt == track->mAlloc)
+    {
+        int alloc = _MAX(track->mAlloc * 2, 256);
+        AVPacket** packets = (AVPacket**)realloc(track->mPackets, alloc * sizeof(AVPacket*));
+        if (!packets)
+            return AVERROR(ENOMEM);
+        track->mPackets = packets;
+        track->mAlloc   = alloc;
+    }
+
+    if (!(ref = av_packet_alloc()) || av_packet_ref(ref, pkt) < 0)
+    {
+        av_packet_free(&ref);
+        return AVERROR(ENOMEM);
+    }
+
+    track->mPackets[track->mCnt++] = ref;
+    return 0;
+}
+
+static int read_native(char** paths, int cnt, AVPacket* pkt)
+{
+    SegmentReader_t reader = { paths, cnt, 0, NULL, 0, NULL };
+    PacketPool pool = PacketPool_Create(16);
+    int ret;
+
+    if (!pool || !(reader.mDemuxer = TSDemuxer_Create(read_segments, &reader)))
+    {
+        PacketPool_Delete(pool);
+        return AVERROR(ENOMEM);
+    }
+    TSDemuxer_SetPacketPool(reader.mDemuxer, pool);
+
+    if ((ret = TSDemuxer_ReadHeader(reader.mDemuxer)) >= 0)
+    {
+        while ((ret = TSDemuxer_ReadPacket(reader.mDemuxer, pkt)) == 0)
+        {
+            const TSStreamInfo_t* info = TSDemuxer_GetStreamInfo(reader.mDemuxer, pkt->stream_index);
+            PidTrack_t* track = info ? get_track(info->mPid) : NULL;
+
+            ret = track ? add_native_packet(track, pkt) : AVERROR(EINVAL);
+            av_packet_unref(pkt);
+            if (ret < 0)
+                break;
+        }
+        ret = ret == AVERROR_EOF ? 0 : ret;
+    }
+
+    TSDemuxer_Delete(reader.mDemuxer);
+    PacketPool_Delete(pool);
+    if (reader.mFile)
+        fclose(reader.mFile);
+    return ret;
+}
+
+static void compare_packet(PidTrack_t* track, const AVPacket* pkt)
+{
+    const AVPacket* ref;
+    const char* diff = NULL;
+
+    track->mLavfCnt++;
+    if (track->mNext >= track->mCnt)
+    {
+        track->mMismatch++;
+        if (gVerbose)
+            printf("pid %d #%d : missing in native, lavf pts %lld size %d\n", track->mPid, track->mLavfCnt - 1,
+                   (long long)pkt->pts, pkt->size);
+        return;
+    }
+
+    ref = track->mPackets[track->mNext++];
+    if (ref->pts != pkt->pts)
+        diff = "pts";
+    else if (ref->dts != pkt->dts)
+        diff = "dts";
+    else if (ref->pos != pkt->pos)
+        diff = "pos";
+    else if (ref->size != pkt->size)
+        diff = "size";
+    else if (memcmp(ref->data, pkt->data, pkt->size))
+        diff = "payload";
+
+    if (!diff)
+    {
+        track->mMatch++;
+        return;
+    }
+
+    track->mMismatch++;
+    if (gVerbose)
+        printf("pid %d #%d : %s differs, native pts %lld dts %lld pos %lld size %d flags %x, "
+               "lavf pts %lld dts %lld pos %lld size %d flags %x\n", track->mPid, track->mNext - 1, diff,
+               (long long)ref->pts, (long long)ref->dts, (long long)ref->pos, ref->size, ref->flags,
+               (long long)pkt->pts, (long long)pkt->dts, (long long)pkt->pos, pkt->size, pkt->flags);
+}
+
+static int add_parsed_frame(PidTrack_t* track, const AVPacket* pkt)
+{
+    if (pkt->pts == AV_NOPTS_VALUE)
+        return 0;
+
+    if (track->mKeyCnt == track->mKeyAlloc)
+    {
+        int alloc = _MAX(track->mKeyAlloc * 2, 256);
+        int64_t* pts = (int64_t*)realloc(track->mKeyPts, alloc * sizeof(int64_t));
+        if (!pts)
+            return AVERROR(ENOMEM);
+        track->mKeyPts   = pts;
+        track->mKeyAlloc = alloc;
+    }
+
+    /* pts is 33 bits, so the sign is free to mark key frames */
+    track->mKeyPts[track->mKeyCnt++] = (pkt->flags & AV_PKT_FLAG_KEY) ? -pkt->pts - 1 : pkt->pts;
+    return 0;
+}
+
+static void compare_key_flags(PidTrack_t* track)
+{
+    int ii, jj = 0;
+
+    for (ii = 0; ii < track->mCnt; ii++)
+    {
+        const AVPacket* ref = track->mPackets[ii];
+        int key = -1;
+
+        /* parsed frames come in the same order, the first one at PES pts carries its key flag */
+        for (; jj < track->mKeyCnt && key < 0; jj++)
+        {
+            int64_t pts = track->mKeyPts[jj] < 0 ? -track->mKeyPts[jj] - 1 : track->mKeyPts[jj];
+            if (pts == ref->pts)
+                key = track->mKeyPts[jj] < 0;
+        }
+
+        if (key < 0 || key != !!(ref->flags & AV_PKT_FLAG_KEY))
+        {
+            track->mKeyMismatch++;
+            if (gVerbose)
+                printf("pid %d #%d : key %d, parsed %s\n", track->mPid, ii, !!(ref->flags & AV_PKT_FLAG_KEY),
+                       key < 0 ? "frame not found" : (key ? "key" : "non key"));
+            if (key < 0)
+                jj = 0;
+        }
+    }
+}
+
+static int read_lavf(char** paths, int cnt, AVPacket* pkt, bool parse)
+{
+    SegmentReader_t reader = { paths, cnt, 0, NULL, 0, NULL };
+    AVFormatContext* ic = avformat_alloc_context();
+    AVDictionary* opts = NULL;
+    AVIOContext* io = NULL;
+    unsigned char* buf = (unsigned char*)av_malloc(IO_BUFFER_SIZE);
+    int ret = AVERROR(ENOMEM);
+
+    if (!ic || !buf || !(io = avio_alloc_context(buf, IO_BUFFER_SIZE, 0, &reader, read_segments, NULL, NULL)))
+        goto EXIT;
+    buf = NULL;
+    ic->pb = io;
+
+    if (!parse)
+        av_dict_set(&opts, "fflags", "+noparse", 0);
+    if ((ret = avformat_open_input(&ic, NULL, av_find_input_format("mpegts"), &opts)) < 0)
+    {
+        LOG_ERROR("cannot open libavformat mpegts : %d\n", ret);
+        goto EXIT;
+    }
+
+    while ((ret = av_read_frame(ic, pkt)) >= 0)
+    {
+        PidTrack_t* track = get_track(ic->streams[pkt->stream_index]->id);
+        int err = 0;
+
+        if (track && !parse)
+            compare_packet(track, pkt);
+        else if (track)
+            err = add_parsed_frame(track, pkt);
+        av_packet_unref(pkt);
+        if (err < 0)
+            break;
+    }
+    ret = ret == AVERROR_EOF ? 0 : ret;
+
+EXIT:
+    av_dict_free(&opts);
+    avformat_close_input(&ic);
+    if (io)
+        av_freep(&io->buffer);
+    avio_context_free(&io);
+    av_free(buf);
+    if (reader.mFile)
+        fclose(reader.mFile);
+    return ret;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-v] seg0.ts seg1.ts ...\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    AVPacket* pkt;
+    int mismatch = 0;
+    int opt, ii, jj;
+
+    HLS_LOG_SetLevel(LOG_LEVEL_WARN);
+    av_log_set_level(AV_LOG_ERROR);
+
+    while ((opt = getopt(argc, argv, "v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'v': gVerbose = 1; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc || !(pkt = av_packet_alloc()))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (read_native(argv + optind, argc - optind, pkt) < 0 || read_lavf(argv + optind, argc - optind, pkt, false) < 0 ||
+        read_lavf(argv + optind, argc - optind, pkt, true) < 0)
+    {
+        av_packet_free(&pkt);
+        return 1;
+    }
+
+    printf("%6s %8s %8s %8s %8s %8s\n", "pid", "native", "lavf", "match", "mismatch", "key_diff");
+    for (ii = 0; ii < gTrackCnt; ii++)
+    {
+        PidTrack_t* track = &gTracks[ii];
+
+        /* native packets libavformat never delivered */
+        track->mMismatch += track->mCnt - track->mNext;
+        compare_key_flags(track);
+        mismatch += track->mMismatch + track->mKeyMismatch;
+        printf("%6d %8d %8d %8d %8d %8d\n", track->mPid, track->mCnt, track->mLavfCnt, track->mMatch, track->mMismatch,
+               track->mKeyMismatch);
+
+        for (jj = 0; jj < track->mCnt; jj++)
+            av_packet_free(&track->mPackets[jj]);
+        free(track->mPackets);
+        free(track->mKeyPts);
+    }
+
+    av_packet_free(&pkt);
+    return mismatch ? 2 : 0;
+}
@@ -0,0 +1,898 @@
+#include "ts_demuxer.h"
+
+#include "hls_common.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavutil/crc.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mem.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#define TS_SYNC_BYTE         0x47
+#define TS_MAX_PID           0x2000
+#define TS_PAT_PID           0x0000
+#define TS_READ_SIZE         (TS_PACKET_SIZE * 64)
+#define TS_MAX_HEADER_SIZE   (TS_PACKET_SIZE * 4096) /* give up if PAT/PMT are not found */
+#define TS_MAX_STREAMS       16
+#define TS_MAX_SECTION_SIZE  1024
+
+#define PES_MAX_HEADER_SIZE  (9 + 255)
+#define PES_MIN_BUFFER_SIZE  4096
+
+typedef struct Section_s {
+    uint8_t     mBuf[TS_MAX_SECTION_SIZE];
+    int         mSize;
+    bool        mStarted;
+
+    /* last parsed section, PAT/PMT repeat every ~100ms and are skipped when unchanged */
+    int         mCachedLen;
+    uint32_t    mCachedCrc;
+} Section_t;
+
+typedef struct TSStream_s {
+    TSStreamInfo_t mInfo;
+    int            mIndex;
+    int            mCC;          /* last continuity counter, -1 if unknown */
+    int64_t        mPos;         /* stream position of TS packet starting the PES */
+
+    /* PES reassembly */
+    bool           mStarted;
+    uint8_t        mHeader[PES_MAX_HEADER_SIZE];
+    int            mHeaderSize;  /* collected header bytes */
+    int            mHeaderLen;   /* full header length, 0 until known */
+    int            mPayloadLen;  /* from PES_packet_length, 0 means unbounded */
+
+    PacketPool     mPool;        /* payload buffers, NULL to allocate each */
+    AVBufferRef*   mBuf;         /* handed over to packet as it is */
+    int            mSize;
+
+    int64_t        mPts;
+    int64_t        mDts;
+    int            mFlags;
+} TSStream_t;
+
+typedef struct TSDemuxer_s {
+    TSDemuxerRead_fn mRead;
+    void*            mOpaque;
+
+    uint8_t          mBuf[TS_READ_SIZE];
+    int64_t          mBufOffset;   /* stream position of mBuf[0], bytes read since create or reset */
+    int              mPos;
+    int              mEnd;
+    int              mEndResult;   /* result of read callback once data is ended */
+    bool             mResync;      /* sync is lost, next sync byte must be confirmed */
+    int64_t          mSegmentStart; /* continuity counters restart from this position, -1 if none */
+    int              mFlushIndex;  /* next stream to flush at the end of data */
+
+    int              mPmtPid;
+    Section_t        mPat;
+    Section_t        mPmt;
+    bool             mHasPmt;
+    bool             mHeaderDone;
+
+    TSStream_t       mStreams[TS_MAX_STREAMS];
+    int              mStreamCnt;
+    int8_t           mPidToStream[TS_MAX_PID];
+
+    PacketPool       mPool;
+} TSDemuxer_t;
+
+static const struct {
+    int              mStreamType;
+    enum AVMediaType mCodecType;
+    enum AVCodecID   mCodecId;
+} g_StreamTypes[] = {
+    { 0x01, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_MPEG2VIDEO },
+    { 0x02, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_MPEG2VIDEO },
+    { 0x03, AVMEDIA_TYPE_AUDIO, AV_CODEC_ID_MP3 },
+    { 0x04, AVMEDIA_TYPE_AUDIO, AV_CODEC_ID_MP3 },
+    { 0x0f, AVMEDIA_TYPE_AUDIO, AV_CODEC_ID_AAC },
+    { 0x10, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_MPEG4 },
+    { 0x11, AVMEDIA_TYPE_AUDIO, AV_CODEC_ID_AAC_LATM },
+    { 0x15, AVMEDIA_TYPE_DATA,  AV_CODEC_ID_TIMED_ID3 },
+    { 0x1b, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_H264 },
+    { 0x24, AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_HEVC },
+    { 0x81, AVMEDIA_TYPE_AUDIO, AV_CODEC_ID_AC3 },
+    { 0x87, AVMEDIA_TYPE_AUDIO, AV_CODEC_ID_EAC3 },
+};
+
+/* Returns index of the first sync byte at or after 'from', or -1 */
+static int find_sync_byte(const uint8_t* buf, int from, int size)
+{
+    const uint8_t* p;
+    int ii = from;
+
+#if defined(__SSE2__)
+    const __m128i sync = _mm_set1_epi8(TS_SYNC_BYTE);
+    for (; ii + 16 <= size; ii += 16)
+    {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + ii)), sync));
+        if (mask)
+            return ii + __builtin_ctz(mask);
+    }
+#elif defined(__aarch64__)
+    const uint8x16_t sync = vdupq_n_u8(TS_SYNC_BYTE);
+    for (; ii + 16 <= size; ii += 16)
+    {
+        if (vmaxvq_u8(vceqq_u8(vld1q_u8(buf + ii), sync)))
+            break;
+    }
+#endif
+
+    if (ii >= size)
+        return -1;
+
+    p = (const uint8_t*)memchr(buf + ii, TS_SYNC_BYTE, size - ii);
+    return p ? (int)(p - buf) : -1;
+}
+
+/*
+ * Returns offset of sync byte confirmed by the next packet, or -1 with
+ * *candidate set to the first one which can not be confirmed with given data.
+ */
+static int find_sync(const uint8_t* buf, int size, int* candidate)
+{
+    int off = 0;
+
+    *candidate = -1;
+    while ((off = find_sync_byte(buf, off, size)) >= 0)
+    {
+        if (off + TS_PACKET_SIZE >= size)
+        {
+            *candidate = off;
+            break;
+        }
+
+        if (buf[off + TS_PACKET_SIZE] == TS_SYNC_BYTE)
+            return off;
+        off++;
+    }
+
+    return -1;
+}
+
+static int64_t read_timestamp(const uint8_t* p)
+{
+    return ((int64_t)(p[0] & 0x0e) << 29) | ((AV_RB16(p + 1) >> 1) << 15) | (AV_RB16(p + 3) >> 1);
+}
+
+static bool has_pes_optional_header(int streamId)
+{
+    return streamId != 0xbc && streamId != 0xbe && streamId != 0xbf &&
+           streamId != 0xf0 && streamId != 0xf1 && streamId != 0xff &&
+           streamId != 0xf2 && streamId != 0xf8;
+}
+
+static void reset_pes(TSStream_t* st)
+{
+    st->mStarted    = false;
+    st->mHeaderSize = 0;
+    st->mHeaderLen  = 0;
+    st->mPayloadLen = 0;
+    st->mSize       = 0;
+    st->mPts        = AV_NOPTS_VALUE;
+    st->mDts        = AV_NOPTS_VALUE;
+    st->mFlags      = 0;
+}
+
+static void release_pes(TSStream_t* st)
+{
+    reset_pes(st);
+    av_buffer_unref(&st->mBuf);
+}
+
+static int reserve_pes(TSStream_t* st, int size)
+{
+    AVBufferRef* buf;
+    int capacity = st->mBuf ? st->mBuf->size : 0;
+
+    if (size + AV_INPUT_BUFFER_PADDING_SIZE <= capacity)
+        return 0;
+
+    capacity = _MAX(capacity * 2, PES_MIN_BUFFER_SIZE);
+    if (capacity < size + AV_INPUT_BUFFER_PADDING_SIZE)
+        capacity = size + AV_INPUT_BUFFER_PADDING_SIZE;
+
+    /* buffer from pool may be larger than asked, which saves growing it again */
+    if (!(buf = PacketPool_GetBuffer(st->mPool, capacity)))
+        return AVERROR(ENOMEM);
+
+    if (st->mSize > 0)
+        memcpy(buf->data, st->mBuf->data, st->mSize);
+    av_buffer_unref(&st->mBuf);
+    st->mBuf = buf;
+    return 0;
+}
+
+/* Hands over reassembled PES payload to packet without copying */
+static int emit_pes(TSStream_t* st, AVPacket* pkt)
+{
+    int ret = -1;
+
+    if (st->mHeaderLen == 0 || st->mHeaderSize < st->mHeaderLen || st->mSize == 0)
+        goto EXIT;
+
+    if ((ret = reserve_pes(st, st->mSize)) < 0)
+        goto EXIT;
+
+    memset(st->mBuf->data + st->mSize, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    pkt->buf          = st->mBuf;
+    pkt->data         = st->mBuf->data;
+    pkt->size         = st->mSize;
+    pkt->stream_index = st->mIndex;
+    pkt->pts          = st->mPts;
+    pkt->dts          = st->mDts;
+    pkt->flags        = st->mFlags;
+    pkt->pos          = st->mPos;
+
+    st->mBuf = NULL;
+
+EXIT:
+    reset_pes(st);
+    return ret;
+}
+
+static void finish_pes_header(TSStream_t* st)
+{
+    const uint8_t* h = st->mHeader;
+    int pesLen = AV_RB16(h + 4);
+
+    if (st->mHeaderLen >= 9)
+    {
+        int flags = h[7];
+
+        if ((flags & 0x80) && st->mHeaderLen >= 14)
+            st->mPts = st->mDts = read_timestamp(h + 9);
+        if ((flags & 0x40) && st->mHeaderLen >= 19)
+            st->mDts = read_timestamp(h + 14);
+    }
+
+    st->mPayloadLen = pesLen ? _MAX(pesLen - (st->mHeaderLen - 6), 0) : 0;
+    if (st->mPayloadLen > 0)
+        reserve_pes(st, st->mPayloadLen);
+}
+
+/* Collects PES header which may span TS packets, returns consumed bytes or -1 */
+static int consume_pes_header(TSStream_t* st, const uint8_t* buf, int len)
+{
+    int used = 0;
+
+    while (used < len)
+    {
+        int need = st->mHeaderLen ? st->mHeaderLen : (st->mHeaderSize < 6 ? 6 : 9);
+        int n = _MIN(need - st->mHeaderSize, len - used);
+
+        memcpy(st->mHeader + st->mHeaderSize, buf + used, n);
+        st->mHeaderSize += n;
+        used += n;
+
+        if (st->mHeaderSize < need)
+            break;
+
+        if (st->mHeaderLen)
+        {
+            finish_pes_header(st);
+            break;
+        }
+
+        if (st->mHeaderSize == 6)
+        {
+            if (AV_RB24(st->mHeader) != 0x000001)
+                return -1;
+
+            if (!has_pes_optional_header(st->mHeader[3]))
+            {
+                st->mHeaderLen = 6;
+                finish_pes_header(st);
+                break;
+            }
+        }
+        else
+            st->mHeaderLen = 9 + st->mHeader[8];
+    }
+
+    return used;
+}
+
+/* Returns 1 if pkt is filled */
+static int handle_pes_payload(TSStream_t* st, bool pusi, int flags, int64_t pos, const uint8_t* buf, int len, AVPacket* pkt)
+{
+    int emitted = 0;
+    int used;
+
+    if (pusi)
+    {
+        if (st->mStarted)
+            emitted = emit_pes(st, pkt) == 0;
+
+        reset_pes(st);
+        st->mStarted = true;
+        st->mPos = pos;
+    }
+    else if (!st->mStarted)
+        return 0;
+
+    st->mFlags |= flags;
+
+    if (st->mHeaderLen == 0 || st->mHeaderSize < st->mHeaderLen)
+    {
+        if ((used = consume_pes_header(st, buf, len)) < 0)
+        {
+            LOG_WARN("invalid PES header, pid : %d\n", st->mInfo.mPid);
+            reset_pes(st);
+            return emitted;
+        }
+
+        buf += used;
+        len -= used;
+        if (st->mHeaderLen == 0 || st->mHeaderSize < st->mHeaderLen)
+            return emitted;
+    }
+
+    if (len > 0)
+    {
+        if (reserve_pes(st, st->mSize + len) < 0)
+        {
+            reset_pes(st);
+            return emitted;
+        }
+        memcpy(st->mBuf->data + st->mSize, buf, len);
+        st->mSize += len;
+    }
+
+    /* PES with known length can be delivered without waiting for the next one */
+    if (!emitted && st->mPayloadLen > 0 && st->mSize >= st->mPayloadLen)
+        emitted = emit_pes(st, pkt) == 0;
+
+    return emitted;
+}
+
+static const TSStreamInfo_t* find_stream_type(int streamType, const uint8_t* desc, int descLen, TSStreamInfo_t* info)
+{
+    int ii;
+
+    info->mStreamType = streamType;
+    info->mCodecType  = AVMEDIA_TYPE_UNKNOWN;
+    info->mCodecId    = AV_CODEC_ID_NONE;
+
+    for (ii = 0; ii < sizeof(g_StreamTypes) / sizeof(g_StreamTypes[0]); ii++)
+    {
+        if (g_StreamTypes[ii].mStreamType == streamType)
+        {
+            info->mCodecType = g_StreamTypes[ii].mCodecType;
+            info->mCodecId   = g_StreamTypes[ii].mCodecId;
+            return info;
+        }
+    }
+
+    /* private data, codec is signalled by descriptor */
+    if (streamType == 0x06)
+    {
+        while (descLen >= 2 && desc[1] + 2 <= descLen)
+        {
+            int tag = desc[0];
+
+            if (tag == 0x6a || (tag == 0x05 && desc[1] >= 4 && AV_RB32(desc + 2) == MKBETAG('A', 'C', '-', '3')))
+                info->mCodecId = AV_CODEC_ID_AC3;
+            else if (tag == 0x7a || (tag == 0x05 && desc[1] >= 4 && AV_RB32(desc + 2) == MKBETAG('E', 'A', 'C', '3')))
+                info->mCodecId = AV_CODEC_ID_EAC3;
+
+            if (info->mCodecId != AV_CODEC_ID_NONE)
+            {
+                info->mCodecType = AVMEDIA_TYPE_AUDIO;
+                return info;
+            }
+
+            descLen -= desc[1] + 2;
+            desc    += desc[1] + 2;
+        }
+    }
+
+    return NULL;
+}
+
+static int parse_pat(TSDemuxer_t* d, const uint8_t* buf, int len)
+{
+    int ii;
+
+    if (buf[0] != 0x00)
+        return -1;
+
+    for (ii = 8; ii + 4 <= len - 4; ii += 4)
+    {
+        int program = AV_RB16(buf + ii);
+        int pid     = AV_RB16(buf + ii + 2) & 0x1fff;
+
+        if (program == 0) /* network PID */
+            continue;
+
+        if (pid != d->mPmtPid)
+        {
+            LOG_INFO("PMT pid : %d -> %d\n", d->mPmtPid, pid);
+            d->mPmtPid = pid;
+            d->mPmt.mSize = 0;
+            d->mPmt.mStarted = false;
+            d->mPmt.mCachedLen = 0;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+/* Streams are fixed once header is read, later PMT only remaps PIDs to them */
+static void apply_pmt_streams(TSDemuxer_t* d, TSStreamInfo_t* infos, int cnt)
+{
+    bool used[TS_MAX_STREAMS] = { false, };
+    int ii, jj;
+
+    memset(d->mPidToStream, -1, sizeof(d->mPidToStream));
+
+    if (!d->mHeaderDone)
+    {
+        for (ii = 0; ii < d->mStreamCnt; ii++)
+            release_pes(&d->mStreams[ii]);
+
+        for (ii = 0; ii < cnt; ii++)
+        {
+            TSStream_t* st = &d->mStreams[ii];
+
+            memset(st, 0, sizeof(TSStream_t));
+            st->mPool  = d->mPool;
+            st->mInfo  = infos[ii];
+            st->mIndex = ii;
+            st->mCC    = -1;
+            reset_pes(st);
+            d->mPidToStream[infos[ii].mPid] = ii;
+        }
+        d->mStreamCnt = cnt;
+        return;
+    }
+
+    for (ii = 0; ii < cnt; ii++)
+    {
+        int found = -1;
+
+        for (jj = 0; jj < d->mStreamCnt && found < 0; jj++)
+            if (!used[jj] && d->mStreams[jj].mInfo.mCodecId == infos[ii].mCodecId)
+                found = jj;
+
+        for (jj = 0; jj < d->mStreamCnt && found < 0; jj++)
+            if (!used[jj] && d->mStreams[jj].mInfo.mCodecType == infos[ii].mCodecType)
+                found = jj;
+
+        if (found < 0)
+        {
+            LOG_WARN("new stream in PMT is ignored, pid : %d, type : 0x%x\n", infos[ii].mPid, infos[ii].mStreamType);
+            continue;
+        }
+
+        if (d->mStreams[found].mInfo.mCodecId != infos[ii].mCodecId)
+            LOG_WARN("codec of stream %d is changed, type : 0x%x -> 0x%x\n", found, d->mStreams[found].mInfo.mStreamType, infos[ii].mStreamType);
+
+        used[found] = true;
+        if (d->mStreams[found].mInfo.mPid != infos[ii].mPid)
+        {
+            reset_pes(&d->mStreams[found]);
+            d->mStreams[found].mCC = -1;
+        }
+        d->mStreams[found].mInfo = infos[ii];
+        d->mPidToStream[infos[ii].mPid] = found;
+    }
+}
+
+static int parse_pmt(TSDemuxer_t* d, const uint8_t* buf, int len)
+{
+    TSStreamInfo_t infos[TS_MAX_STREAMS];
+    int cnt = 0;
+    const uint8_t* p;
+    const uint8_t* end = buf + len - 4;
+
+    if (buf[0] != 0x02 || len < 16)
+        return -1;
+
+    p = buf + 12 + (AV_RB16(buf + 10) & 0x0fff);
+    while (p + 5 <= end)
+    {
+        int streamType = p[0];
+        int pid        = AV_RB16(p + 1) & 0x1fff;
+        int descLen    = AV_RB16(p + 3) & 0x0fff;
+
+        if (p + 5 + descLen > end)
+            break;
+
+        if (cnt < TS_MAX_STREAMS && find_stream_type(streamType, p + 5, descLen, &infos[cnt]))
+        {
+            infos[cnt].mPid = pid;
+            cnt++;
+        }
+
+        p += 5 + descLen;
+    }
+
+    if (cnt == 0)
+        return -1;
+
+    apply_pmt_streams(d, infos, cnt);
+    d->mHasPmt = true;
+    return 0;
+}
+
+static void complete_section(TSDemuxer_t* d, Section_t* sec)
+{
+    int len;
+    uint32_t crc;
+
+    if (sec->mSize < 3)
+        return;
+
+    len = 3 + (AV_RB16(sec->mBuf + 1) & 0x0fff);
+    if (len < 12 || len > TS_MAX_SECTION_SIZE)
+    {
+        sec->mSize = 0;
+        sec->mStarted = false;
+        return;
+    }
+
+    if (sec->mSize < len)
+        return;
+
+    sec->mSize = 0;
+    sec->mStarted = false;
+
+    crc = AV_RB32(sec->mBuf + len - 4);
+    if (sec->mCachedLen == len && sec->mCachedCrc == crc)
+        return;
+
+    /* CRC over the whole section including CRC_32 is 0 */
+    if (av_crc(av_crc_get_table(AV_CRC_32_IEEE), -1, sec->mBuf, len) != 0)
+    {
+        LOG_WARN("%s section with bad CRC is dropped\n", sec == &d->mPat ? "PAT" : "PMT");
+        return;
+    }
+
+    if ((sec == &d->mPat ? parse_pat(d, sec->mBuf, len) : parse_pmt(d, sec->mBuf, len)) == 0)
+    {
+        sec->mCachedLen = len;
+        sec->mCachedCrc = crc;
+    }
+}
+
+static void append_section(TSDemuxer_t* d, Section_t* sec, const uint8_t* buf, int len)
+{
+    if (sec->mSize + len > TS_MAX_SECTION_SIZE)
+        len = TS_MAX_SECTION_SIZE - sec->mSize;
+
+    memcpy(sec->mBuf + sec->mSize, buf, len);
+    sec->mSize += len;
+    complete_section(d, sec);
+}
+
+static void handle_section(TSDemuxer_t* d, Section_t* sec, bool pusi, const uint8_t* buf, int len)
+{
+    if (pusi)
+    {
+        int pointer = buf[0];
+
+        buf++;
+        len--;
+        if (pointer >= len)
+            return;
+
+        if (sec->mStarted)
+            append_section(d, sec, buf, pointer);
+
+        buf += pointer;
+        len -= pointer;
+        sec->mSize = 0;
+        sec->mStarted = true;
+    }
+    else if (!sec->mStarted)
+        return;
+
+    append_section(d, sec, buf, len);
+}
+
+/* Returns 1 if pkt is filled */
+static int handle_ts_packet(TSDemuxer_t* d, const uint8_t* p, AVPacket* pkt)
+{
+    int pid  = AV_RB16(p + 1) & 0x1fff;
+    bool pusi = p[1] & 0x40;
+    int afc  = (p[3] >> 4) & 0x3;
+    int cc   = p[3] & 0xf;
+    int flags = 0;
+    bool discontinuity = false;
+    const uint8_t* payload = p + 4;
+    const uint8_t* end = p + TS_PACKET_SIZE;
+    int64_t pos = d->mBufOffset + (p - d->mBuf);
+    TSStream_t* st;
+    int ii;
+
+    /* counters of next segment are not continued from previous one */
+    if (d->mSegmentStart >= 0 && pos >= d->mSegmentStart)
+    {
+        for (ii = 0; ii < d->mStreamCnt; ii++)
+            d->mStreams[ii].mCC = -1;
+        d->mSegmentStart = -1;
+    }
+
+    if (p[1] & 0x80) /* transport error */
+        return 0;
+
+    if (afc & 0x2)
+    {
+        if (p[4] > 183)
+            return 0;
+
+        if (p[4] > 0)
+        {
+            discontinuity = p[5] & 0x80;
+            if (p[5] & 0x40)
+                flags |= AV_PKT_FLAG_KEY;
+        }
+        payload += 1 + p[4];
+    }
+
+    if (!(afc & 0x1) || payload >= end)
+        return 0;
+
+    if (pid == TS_PAT_PID)
+    {
+        handle_section(d, &d->mPat, pusi, payload, end - payload);
+        return 0;
+    }
+
+    if (pid == d->mPmtPid)
+    {
+        handle_section(d, &d->mPmt, pusi, payload, end - payload);
+        return 0;
+    }
+
+    if (d->mPidToStream[pid] < 0)
+        return 0;
+
+    st = &d->mStreams[(int)d->mPidToStream[pid]];
+    if (st->mCC >= 0 && !discontinuity)
+    {
+        if (cc == st->mCC) /* duplicated packet */
+            return 0;
+        if (cc != ((st->mCC + 1) & 0xf))
+            flags |= AV_PKT_FLAG_CORRUPT;
+    }
+    st->mCC = cc;
+
+    return handle_pes_payload(st, pusi, flags, pos, payload, end - payload, pkt);
+}
+
+static int fill_buffer(TSDemuxer_t* d)
+{
+    int ret;
+
+    if (d->mPos > 0)
+    {
+        memmove(d->mBuf, d->mBuf + d->mPos, d->mEnd - d->mPos);
+        d->mBufOffset += d->mPos;
+        d->mEnd -= d->mPos;
+        d->mPos = 0;
+    }
+
+    ret = d->mRead(d->mOpaque, d->mBuf + d->mEnd, TS_READ_SIZE - d->mEnd);
+    if (ret > 0)
+        d->mEnd += ret;
+
+    return ret;
+}
+
+static const uint8_t* next_ts_packet(TSDemuxer_t* d)
+{
+    int ret;
+
+    while (1)
+    {
+        const uint8_t* p = d->mBuf + d->mPos;
+        int avail = d->mEnd - d->mPos;
+
+        if (avail >= TS_PACKET_SIZE)
+        {
+            int off, candidate;
+
+            if (p[0] == TS_SYNC_BYTE && !d->mResync)
+            {
+                d->mPos += TS_PACKET_SIZE;
+                return p;
+            }
+
+            if (!d->mResync)
+            {
+                LOG_WARN("lost sync !\n");
+                d->mResync = true;
+            }
+
+            if ((off = find_sync(p, avail, &candidate)) >= 0)
+            {
+                d->mPos += off;
+                d->mResync = false;
+                continue;
+            }
+
+            /* keep unconfirmed candidate until more data arrives */
+            d->mPos += candidate >= 0 ? candidate : avail;
+        }
+
+        if ((ret = fill_buffer(d)) <= 0)
+        {
+            d->mEndResult = ret < 0 ? ret : AVERROR_EOF;
+            return NULL;
+        }
+    }
+}
+
+TSDemuxer TSDemuxer_Create(TSDemuxerRead_fn read, void* opaque)
+{
+    TSDemuxer_t* d = (TSDemuxer_t*)av_mallocz(sizeof(TSDemuxer_t));
+    if (!d)
+    {
+        LOG_ERROR("failed to alloc ts demuxer !\n");
+        return NULL;
+    }
+
+    d->mRead   = read;
+    d->mOpaque = opaque;
+    d->mPmtPid = -1;
+    d->mSegmentStart = -1;
+    memset(d->mPidToStream, -1, sizeof(d->mPidToStream));
+
+    return d;
+}
+
+void TSDemuxer_Delete(TSDemuxer demuxer)
+{
+    int ii;
+
+    if (!demuxer)
+        return;
+
+    for (ii = 0; ii < demuxer->mStreamCnt; ii++)
+        release_pes(&demuxer->mStreams[ii]);
+
+    av_free(demuxer);
+}
+
+bool TSDemuxer_Probe(const uint8_t* buf, int size)
+{
+    int ii;
+
+    if (size < TS_PACKET_SIZE * 2)
+        return false;
+
+    for (ii = 0; ii + TS_PACKET_SIZE <= size; ii += TS_PACKET_SIZE)
+    {
+        if (buf[ii] != TS_SYNC_BYTE)
+            return false;
+    }
+
+    return true;
+}
+
+int TSDemuxer_ReadHeader(TSDemuxer demuxer)
+{
+    TSDemuxer_t* d = demuxer;
+    int readSize = 0;
+
+    if (!d)
+        return AVERROR(EINVAL);
+
+    while (!d->mHasPmt)
+    {
+        const uint8_t* p = next_ts_packet(d);
+        if (!p)
+            return d->mEndResult;
+
+        handle_ts_packet(d, p, NULL);
+
+        if ((readSize += TS_PACKET_SIZE) > TS_MAX_HEADER_SIZE)
+        {
+            LOG_ERROR("PAT/PMT is not found !\n");
+            return AVERROR_INVALIDDATA;
+        }
+    }
+
+    d->mHeaderDone = true;
+    return 0;
+}
+
+int TSDemuxer_ReadPacket(TSDemuxer demuxer, AVPacket* pkt)
+{
+    TSDemuxer_t* d = demuxer;
+
+    if (!d)
+        return AVERROR(EINVAL);
+
+    while (!d->mEndResult)
+    {
+        const uint8_t* p = next_ts_packet(d);
+        if (!p)
+            break;
+
+        if (handle_ts_packet(d, p, pkt))
+            return 0;
+    }
+
+    /* deliver pending PES of each stream at the end of data */
+    while (d->mFlushIndex < d->mStreamCnt)
+    {
+        TSStream_t* st = &d->mStreams[d->mFlushIndex++];
+        if (st->mStarted && emit_pes(st, pkt) == 0)
+            return 0;
+    }
+
+    return d->mEndResult;
+}
+
+void TSDemuxer_Reset(TSDemuxer demuxer)
+{
+    int ii;
+
+    if (!demuxer)
+        return;
+
+    demuxer->mPos = demuxer->mEnd = 0;
+    demuxer->mBufOffset  = 0;
+    demuxer->mSegmentStart = -1;
+    demuxer->mEndResult  = 0;
+    demuxer->mFlushIndex = 0;
+    demuxer->mResync     = false;
+
+    demuxer->mPat.mSize = demuxer->mPmt.mSize = 0;
+    demuxer->mPat.mStarted = demuxer->mPmt.mStarted = false;
+
+    for (ii = 0; ii < demuxer->mStreamCnt; ii++)
+    {
+        reset_pes(&demuxer->mStreams[ii]);
+        demuxer->mStreams[ii].mCC = -1;
+    }
+}
+
+void TSDemuxer_SetPacketPool(TSDemuxer demuxer, PacketPool pool)
+{
+    if (!demuxer)
+        return;
+
+    demuxer->mPool = pool;
+}
+
+void TSDemuxer_SetSegmentStart(TSDemuxer demuxer, int64_t pos)
+{
+    if (!demuxer)
+        return;
+
+    demuxer->mSegmentStart = pos;
+}
+
+int TSDemuxer_GetStreamCount(TSDemuxer demuxer)
+{
+    return demuxer ? demuxer->mStreamCnt : 0;
+}
+
+const TSStreamInfo_t* TSDemuxer_GetStreamInfo(TSDemuxer demuxer, int index)
+{
+    if (!demuxer || index < 0 || index >= demuxer->mStreamCnt)
+        return NULL;
+
+    return &demuxer->mStreams[index].mInfo;
+}
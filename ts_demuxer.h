@@ -0,0 +1,61 @@
+#ifndef __TS_DEMUXER_H_
+#define __TS_DEMUXER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet_pool.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "libavcodec/avcodec.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#define TS_PACKET_SIZE    188
+#define TS_PTS_TIMEBASE   90000
+
+typedef struct TSDemuxer_s* TSDemuxer;
+
+/* Same contract as AVIOContext read_packet, returns <= 0 at the end of data */
+typedef int (*TSDemuxerRead_fn)(void* opaque, uint8_t* buf, int size);
+
+typedef struct TSStreamInfo_s {
+    int              mPid;
+    int              mStreamType;
+    enum AVMediaType mCodecType;
+    enum AVCodecID   mCodecId;
+} TSStreamInfo_t;
+
+TSDemuxer TSDemuxer_Create(TSDemuxerRead_fn read, void* opaque);
+void      TSDemuxer_Delete(TSDemuxer demuxer);
+
+bool TSDemuxer_Probe(const uint8_t* buf, int size);
+
+/* PES payload is taken from pool, which has to outlive the demuxer. Set before TSDemuxer_ReadHeader() */
+void TSDemuxer_SetPacketPool(TSDemuxer demuxer, PacketPool pool);
+
+/* Reads until PAT/PMT are found, stream table is fixed after this */
+int  TSDemuxer_ReadHeader(TSDemuxer demuxer);
+
+/*
+ * Returns 0, AVERROR_EOF at the end of data or the error from read callback.
+ * pkt->pos is the position of TS packet starting the PES in bytes read since create or reset.
+ */
+int  TSDemuxer_ReadPacket(TSDemuxer demuxer, AVPacket* pkt);
+
+/* Drops partial PES and read buffer, keeps PAT/PMT cache */
+void TSDemuxer_Reset(TSDemuxer demuxer);
+
+/* Next segment starts at pos of the bytes read, continuity counters are not checked over it */
+void TSDemuxer_SetSegmentStart(TSDemuxer demuxer, int64_t pos);
+
+int                   TSDemuxer_GetStreamCount(TSDemuxer demuxer);
+const TSStreamInfo_t* TSDemuxer_GetStreamInfo(TSDemuxer demuxer, int index);
+
+#endif /* __TS_DEMUXER_H_ */